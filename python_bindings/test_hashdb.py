@@ -169,7 +169,7 @@ def temp_out_equals(a):
 
 # Settings
 settings.block_size = 1
-str_equals(settings.settings_string(), '{"settings_version":4, "block_size":1}')
+str_equals(settings.settings_string(), '{"settings_version":5, "block_size":1, "layout_version":3, "hash_prefix_bytes":7, "hash_count_bytes":1, "bloom_false_positive_rate":0, "bloom_capacity":100000000, "source_index":false}')
 
 # Timestamp
 ts = hashdb.timestamp_t()
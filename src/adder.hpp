@@ -179,6 +179,49 @@ class adder_t {
     delete names;
   }
 
+  // add the hashes of one source using the source index of A, false if
+  // the source has no hashes
+  bool add_source_hashes(const std::string& file_hash) {
+
+    // hash data
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+
+    // the hashes of the source
+    std::vector<std::string> block_hashes;
+    manager_a->find_source_hashes(file_hash, block_hashes);
+
+    for (std::vector<std::string>::const_iterator it = block_hashes.begin();
+         it != block_hashes.end(); ++it) {
+
+      // get hash data from A
+      bool found_hash = manager_a->find_hash(*it, k_entropy, block_label,
+                                             count, source_sub_counts);
+      // hash required
+      if (!found_hash) {
+        // program error
+        assert(0);
+      }
+
+      // the sub_count of this source
+      hashdb::source_sub_counts_t::const_iterator sub_count_it =
+                                   source_sub_counts.find(
+                                   hashdb::source_sub_count_t(file_hash, 0));
+      if (sub_count_it == source_sub_counts.end()) {
+        // program error
+        assert(0);
+      }
+
+      // add hash for source
+      manager_b->merge_hash(*it, k_entropy, block_label,
+                            file_hash, sub_count_it->sub_count);
+    }
+
+    return block_hashes.size() != 0;
+  }
+
   public:
   // add A into B
   adder_t(const hashdb::scan_manager_t* const p_manager_a,
@@ -212,7 +255,7 @@ class adder_t {
   }
 
   // add hash and source information and do not re-add sources
-  void add(const std::string& block_hash) {
+  void add(const hashdb::hash_iterator_t& hash_it) {
 
     // hash data
     uint64_t k_entropy;
@@ -222,13 +265,8 @@ class adder_t {
                                    new hashdb::source_sub_counts_t;
 
     // get hash data from A
-    bool found_hash = manager_a->find_hash(block_hash, k_entropy, block_label,
-                                           count, *source_sub_counts);
-    // hash required
-    if (!found_hash) {
-      // program error
-      assert(0);
-    }
+    const std::string& block_hash = hash_it.block_hash();
+    hash_it.read(k_entropy, block_label, count, *source_sub_counts);
 
     // process each source in source_sub_counts
     for (hashdb::source_sub_counts_t::const_iterator it =
@@ -260,7 +298,7 @@ class adder_t {
   }
 
   // add hash and source information in count range and do not re-add sources
-  void add_range(const std::string& block_hash,
+  void add_range(const hashdb::hash_iterator_t& hash_it,
                  size_t m, size_t n) {
 
     // hash data
@@ -271,13 +309,8 @@ class adder_t {
                                      new hashdb::source_sub_counts_t;
 
     // get hash data from A
-    bool found_hash = manager_a->find_hash(block_hash, k_entropy, block_label,
-                                           count, *source_sub_counts);
-    // hash required
-    if (!found_hash) {
-      // program error
-      assert(0);
-    }
+    const std::string& block_hash = hash_it.block_hash();
+    hash_it.read(k_entropy, block_label, count, *source_sub_counts);
 
     // add if in range
     if (count >= m && (n==0 || count <= n)) {
@@ -313,7 +346,7 @@ class adder_t {
   }
 
   // add hashes and source references when the repository name matches
-  void add_repository(const std::string& block_hash) {
+  void add_repository(const hashdb::hash_iterator_t& hash_it) {
 
     // hash data
     uint64_t k_entropy;
@@ -323,13 +356,8 @@ class adder_t {
                                  new hashdb::source_sub_counts_t;
 
     // get hash data from A
-    bool found_hash = manager_a->find_hash(block_hash, k_entropy, block_label,
-                                           count, *source_sub_counts);
-    // hash required
-    if (!found_hash) {
-      // program error
-      assert(0);
-    }
+    const std::string& block_hash = hash_it.block_hash();
+    hash_it.read(k_entropy, block_label, count, *source_sub_counts);
 
     // process each source in source_sub_counts
     for (hashdb::source_sub_counts_t::const_iterator it =
@@ -374,7 +402,7 @@ class adder_t {
   }
 
   // add hashes and source references when the repository name does not match
-  void add_non_repository(const std::string& block_hash) {
+  void add_non_repository(const hashdb::hash_iterator_t& hash_it) {
 
     // hash data
     uint64_t k_entropy;
@@ -384,13 +412,8 @@ class adder_t {
                                       new hashdb::source_sub_counts_t;
 
     // get hash data from A
-    bool found_hash = manager_a->find_hash(block_hash, k_entropy, block_label,
-                                           count, *source_sub_counts);
-    // hash required
-    if (!found_hash) {
-      // program error
-      assert(0);
-    }
+    const std::string& block_hash = hash_it.block_hash();
+    hash_it.read(k_entropy, block_label, count, *source_sub_counts);
 
     // process each source in source_sub_counts
     for (hashdb::source_sub_counts_t::const_iterator it =
@@ -433,6 +456,53 @@ class adder_t {
 
     delete source_sub_counts;
   }
+
+  // add the hashes and source information of a source when the repository
+  // name matches, reading only the hashes of the source
+  void add_repository_source(const std::string& file_hash) {
+
+    // skip preexisting sources
+    if (!is_preexisting_source(file_hash)) {
+      classify_repository_source(file_hash);
+
+      // only process sources matching repository_name
+      if (repository_sources.find(file_hash) != repository_sources.end() &&
+          add_source_hashes(file_hash)) {
+
+        // add source information
+        add_source_data(file_hash);
+        add_repository_source_names(file_hash);
+        processed_sources.insert(file_hash);
+      }
+    }
+
+    // track this source
+    tracker->track();
+  }
+
+  // add the hashes and source information of a source when a repository
+  // name does not match, reading only the hashes of the source
+  void add_non_repository_source(const std::string& file_hash) {
+
+    // skip preexisting sources
+    if (!is_preexisting_source(file_hash)) {
+      classify_repository_source(file_hash);
+
+      // process sources that have at least one non-matching repository_name
+      if (non_repository_sources.find(file_hash) !=
+                              non_repository_sources.end() &&
+          add_source_hashes(file_hash)) {
+
+        // add source information
+        add_source_data(file_hash);
+        add_non_repository_source_names(file_hash);
+        processed_sources.insert(file_hash);
+      }
+    }
+
+    // track this source
+    tracker->track();
+  }
 };
 
 #endif
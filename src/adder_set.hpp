@@ -124,20 +124,15 @@ class adder_set_t {
   }
 
   // add A and B into C where A and B hash sources are common
-  void intersect(const std::string& binary_hash) {
+  void intersect(const hashdb::hash_iterator_t& hash_it_a) {
+    const std::string& binary_hash = hash_it_a.block_hash();
 
     // read hash data from A
     uint64_t k_entropy_a;
     std::string block_label_a;
     uint64_t count_a;
     hashdb::source_sub_counts_t source_sub_counts_a;
-    bool found_hash_a = manager_a->find_hash(binary_hash, k_entropy_a,
-                                 block_label_a, count_a, source_sub_counts_a);
-    // hash required
-    if (!found_hash_a) {
-      // program error
-      assert(0);
-    }
+    hash_it_a.read(k_entropy_a, block_label_a, count_a, source_sub_counts_a);
 
     // read hash data from B
     uint64_t k_entropy_b;
@@ -180,20 +175,15 @@ class adder_set_t {
   }
 
   // add A and B into C when A and B hash is common
-  void intersect_hash(const std::string& binary_hash) {
+  void intersect_hash(const hashdb::hash_iterator_t& hash_it_a) {
+    const std::string& binary_hash = hash_it_a.block_hash();
 
     // read hash data from A
     uint64_t k_entropy_a;
     std::string block_label_a;
     uint64_t count_a;
     hashdb::source_sub_counts_t source_sub_counts_a;
-    bool found_hash_a = manager_a->find_hash(binary_hash, k_entropy_a,
-                                 block_label_a, count_a, source_sub_counts_a);
-    // hash required
-    if (!found_hash_a) {
-      // program error
-      assert(0);
-    }
+    hash_it_a.read(k_entropy_a, block_label_a, count_a, source_sub_counts_a);
 
     // read hash data from B
     uint64_t k_entropy_b;
@@ -247,20 +237,15 @@ class adder_set_t {
   }
 
   // add A into C when A hash and source is not in B
-  void subtract(const std::string& binary_hash) {
+  void subtract(const hashdb::hash_iterator_t& hash_it_a) {
+    const std::string& binary_hash = hash_it_a.block_hash();
 
     // read hash data from A
     uint64_t k_entropy_a;
     std::string block_label_a;
     uint64_t count_a;
     hashdb::source_sub_counts_t source_sub_counts_a;
-    bool found_hash_a = manager_a->find_hash(binary_hash, k_entropy_a,
-                                 block_label_a, count_a, source_sub_counts_a);
-    // hash required
-    if (!found_hash_a) {
-      // program error
-      assert(0);
-    }
+    hash_it_a.read(k_entropy_a, block_label_a, count_a, source_sub_counts_a);
 
     // read hash data from B
     uint64_t k_entropy_b;
@@ -309,20 +294,15 @@ class adder_set_t {
   }
 
   // add A into C when A hash is not in B
-  void subtract_hash(const std::string& binary_hash) {
+  void subtract_hash(const hashdb::hash_iterator_t& hash_it_a) {
+    const std::string& binary_hash = hash_it_a.block_hash();
 
     // read hash data from A
     uint64_t k_entropy_a;
     std::string block_label_a;
     uint64_t count_a;
     hashdb::source_sub_counts_t source_sub_counts_a;
-    bool found_hash_a = manager_a->find_hash(binary_hash, k_entropy_a,
-                                 block_label_a, count_a, source_sub_counts_a);
-    // hash required
-    if (!found_hash_a) {
-      // program error
-      assert(0);
-    }
+    hash_it_a.read(k_entropy_a, block_label_a, count_a, source_sub_counts_a);
 
     // read hash count from B
     size_t count = manager_b->find_hash_count(binary_hash);
@@ -31,16 +31,19 @@
 #include "scan_list.hpp"
 #include "adder.hpp"
 #include "adder_set.hpp"
+#include "range_scan.hpp"
 
 // Standard includes
 #include <cerrno>
 #include <cstdlib>
+#include <sys/stat.h>
 #include <cstdio>
 #include <string>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
 #include <vector>
+#include <map>
 
 // leave alone else create using existing settings if new
 void create_if_new(const std::string& hashdb_dir,
@@ -65,7 +68,8 @@ void create_if_new(const std::string& hashdb_dir,
     exit(1);
   }
 
-  // create hashdb_dir using from_hashdb_dir settings
+  // create hashdb_dir using from_hashdb_dir settings in the current layout
+  settings.layout_version = hashdb::settings_t::CURRENT_LAYOUT_VERSION;
   error_message = hashdb::create_hashdb(hashdb_dir, settings, command_string);
   if (error_message.size() != 0) {
     // bad since from_hashdb_dir is not valid
@@ -85,6 +89,16 @@ static void require_hashdb_dir(const std::string& hashdb_dir) {
   }
 }
 
+// enable bulk loading else fail
+static void require_bulk_load(hashdb::import_manager_t& manager) {
+  std::string error_message = manager.enable_bulk_load(
+                      hashdb::import_manager_t::DEFAULT_BULK_RUN_SIZE);
+  if (error_message.size() != 0) {
+    std::cerr << "Error: " << error_message << "\n";
+    exit(1);
+  }
+}
+
 static void print_header(const std::string& cmd) {
   std::cout << "# command: " << cmd << "\n"
             << "# hashdb-Version: " << PACKAGE_VERSION << "\n";
@@ -103,6 +117,100 @@ std::string random_binary_hash() {
   return std::string(hash, 16);
 }
 
+// histogram counts for one range of hashes
+class histogram_scanner_t : public range_scanner_t {
+  public:
+  uint64_t total_hashes;
+  uint64_t total_distinct_hashes;
+  // <count, number of hashes with count>
+  std::map<uint32_t, uint64_t> hash_histogram;
+
+  histogram_scanner_t() :
+          total_hashes(0), total_distinct_hashes(0), hash_histogram() {
+  }
+
+  uint64_t visit(const hashdb::hash_iterator_t& it) {
+    const uint64_t count = it.count();
+    total_hashes += count;
+    if (count == 1) {
+      ++total_distinct_hashes;
+    }
+    ++hash_histogram[count];
+    return it.source_count();
+  }
+};
+
+// hashes with a given count in one range of hashes
+class duplicates_scanner_t : public range_scanner_t {
+  private:
+  const uint64_t number;
+
+  public:
+  std::vector<std::string> block_hashes;
+
+  duplicates_scanner_t(const uint64_t p_number) :
+          number(p_number), block_hashes() {
+  }
+
+  uint64_t visit(const hashdb::hash_iterator_t& it) {
+    if (it.count() == number) {
+      block_hashes.push_back(it.block_hash());
+    }
+    return it.source_count();
+  }
+};
+
+// hashes of one source in one range of hashes
+class hash_table_scanner_t : public range_scanner_t {
+  private:
+  const std::string file_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_sub_counts_t source_sub_counts;
+
+  public:
+  std::vector<std::string> block_hashes;
+
+  hash_table_scanner_t(const std::string& p_file_hash) :
+          file_hash(p_file_hash), k_entropy(0), block_label(""), count(0),
+          source_sub_counts(), block_hashes() {
+  }
+
+  uint64_t visit(const hashdb::hash_iterator_t& it) {
+    it.read(k_entropy, block_label, count, source_sub_counts);
+    for (hashdb::source_sub_counts_t::const_iterator sub_it =
+                     source_sub_counts.begin();
+                     sub_it != source_sub_counts.end(); ++sub_it) {
+      if (sub_it->file_hash == file_hash) {
+        block_hashes.push_back(it.block_hash());
+        break;
+      }
+    }
+    return source_sub_counts.size();
+  }
+};
+
+// print the hashes found by scanners, in range order, with their JSON text
+template <typename T>
+static bool print_found_hashes(hashdb::scan_manager_t& manager,
+                               const hashdb::scan_mode_t scan_mode,
+                               const std::vector<T*>& scanners) {
+  std::vector<std::string> block_hashes;
+  for (size_t i = 0; i < scanners.size(); ++i) {
+    block_hashes.insert(block_hashes.end(),
+                        scanners[i]->block_hashes.begin(),
+                        scanners[i]->block_hashes.end());
+  }
+  std::vector<std::string> json_texts;
+  manager.find_hashes_json(scan_mode, block_hashes, json_texts);
+  for (size_t i = 0; i < block_hashes.size(); ++i) {
+    std::cout << hashdb::bin_to_hex(block_hashes[i]) << "\t"
+              << json_texts[i] << "\n";
+  }
+  return block_hashes.size() != 0;
+}
+
 namespace commands {
 
 // ************************************************************
@@ -117,11 +225,13 @@ class in_ptr_t {
   in_ptr_t& operator=(const in_ptr_t&);
 
   public:
-  in_ptr_t(const std::string& in_filename) : in(NULL) {
+  in_ptr_t(const std::string& in_filename, const bool binary = false) :
+                                                               in(NULL) {
     if (in_filename == "-") {
       in = &std::cin;
     } else {
-      std::ifstream* inf = new std::ifstream(in_filename.c_str());
+      std::ifstream* inf = new std::ifstream(in_filename.c_str(),
+                  binary ? std::ios::in | std::ios::binary : std::ios::in);
       if (!inf->is_open()) {
         std::cerr << "Error: Cannot open " << in_filename
                   << ": " << strerror(errno) << "\n";
@@ -140,6 +250,15 @@ class in_ptr_t {
   std::istream* operator()() {
     return in;
   }
+
+  // file size, or 0 for stdin
+  static uint64_t size(const std::string& in_filename) {
+    struct stat s;
+    if (in_filename == "-" || stat(in_filename.c_str(), &s) != 0) {
+      return 0;
+    }
+    return s.st_size;
+  }
 };
 
 class out_ptr_t {
@@ -151,11 +270,13 @@ class out_ptr_t {
   out_ptr_t& operator=(const out_ptr_t&);
 
   public:
-  out_ptr_t(const std::string& out_filename) : out(NULL) {
+  out_ptr_t(const std::string& out_filename, const bool binary = false) :
+                                                               out(NULL) {
     if (out_filename == "-") {
       out = &std::cout;
     } else {
-      std::ofstream* outf = new std::ofstream(out_filename.c_str());
+      std::ofstream* outf = new std::ofstream(out_filename.c_str(),
+                  binary ? std::ios::out | std::ios::binary : std::ios::out);
       if (!outf->is_open()) {
         std::cerr << "Error: Cannot open " << out_filename
                   << ": " << strerror(errno) << "\n";
@@ -194,6 +315,121 @@ class out_ptr_t {
     }
   }
 
+  // ************************************************************
+  // maintenance
+  // ************************************************************
+  static void migrate(const std::string& hashdb_dir,
+                      const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    std::string error_message = hashdb::migrate_hashdb(hashdb_dir, cmd);
+    if (error_message.size() == 0) {
+      std::cout << "Database migrated.\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // rebuild the hash store with the given widths else the widths in
+  // settings and show the prefix collision rate
+  static void rebuild_hash_store(const std::string& hashdb_dir,
+                                 const bool has_hash_prefix_bytes,
+                                 const uint32_t hash_prefix_bytes,
+                                 const bool has_hash_count_bytes,
+                                 const uint32_t hash_count_bytes,
+                                 const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // use the settings widths unless widths are given
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+    const uint32_t prefix_bytes = (has_hash_prefix_bytes) ?
+                             hash_prefix_bytes : settings.hash_prefix_bytes;
+    const uint32_t count_bytes = (has_hash_count_bytes) ?
+                             hash_count_bytes : settings.hash_count_bytes;
+
+    uint64_t hash_count;
+    uint64_t prefix_count;
+    error_message = hashdb::rebuild_hash_store(hashdb_dir, prefix_bytes,
+                               count_bytes, cmd, hash_count, prefix_count);
+    if (error_message.size() == 0) {
+      const double collision_rate = (hash_count == 0) ? 0.0 :
+                 1.0 - static_cast<double>(prefix_count) / hash_count;
+      std::cout << "{\"hash_count\":" << hash_count
+                << ", \"prefix_count\":" << prefix_count
+                << ", \"prefix_collision_rate\":" << collision_rate
+                << "}\n";
+      std::cout << "Hash store rebuilt.\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // build the source index and keep it from then on
+  static void rebuild_source_index(const std::string& hashdb_dir,
+                                   const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    std::string error_message = hashdb::rebuild_source_index(hashdb_dir, cmd);
+    if (error_message.size() == 0) {
+      std::cout << "Source index rebuilt.\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // rebuild the Bloom filter at the given rate else at the rate in settings
+  static void rebuild_bloom(const std::string& hashdb_dir,
+                            const bool has_bloom_false_positive_rate,
+                            const double bloom_false_positive_rate,
+                            const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // use the settings rate unless a rate is given
+    double rate = bloom_false_positive_rate;
+    if (!has_bloom_false_positive_rate) {
+      hashdb::settings_t settings;
+      std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+      if (error_message.size() != 0) {
+        std::cerr << "Error: " << error_message << "\n";
+        exit(1);
+      }
+      rate = settings.bloom_false_positive_rate;
+      if (!(rate > 0.0)) {
+        std::cerr << "Error: The hashdb has no Bloom filter.  Please provide"
+                  << " a false positive rate using -f.\n";
+        exit(1);
+      }
+    }
+
+    std::string error_message = hashdb::rebuild_bloom(hashdb_dir, rate, cmd);
+    if (error_message.size() == 0) {
+      if (rate > 0.0) {
+        std::cout << "Bloom filter rebuilt.\n";
+      } else {
+        std::cout << "Bloom filter removed.\n";
+      }
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
   // ************************************************************
   // import/export
   // ************************************************************
@@ -206,6 +442,7 @@ class out_ptr_t {
                      const bool disable_recursive_processing,
                      const bool disable_calculate_entropy,
                      const bool disable_calculate_labels,
+                     const bool bulk_load,
                      const std::string& cmd) {
 
     // ingest
@@ -215,7 +452,8 @@ class out_ptr_t {
                     disable_recursive_processing,
                     disable_calculate_entropy,
                     disable_calculate_labels,
-                    cmd);
+                    cmd,
+                    bulk_load);
     if (error_message.size() != 0) {
       std::cerr << "Error: " << error_message << "\n";
       exit(1);
@@ -227,22 +465,30 @@ class out_ptr_t {
                      const std::string& tab_file,
                      const std::string& repository_name,
                          const std::string& whitelist_dir,
+                     const bool bulk_load,
                      const std::string& cmd) {
 
     // validate hashdb_dir path
     require_hashdb_dir(hashdb_dir);
 
     // resources
-    hashdb::import_manager_t manager(hashdb_dir, cmd);
+    hashdb::import_manager_t manager(hashdb_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
+    if (bulk_load) {
+      require_bulk_load(manager);
+    }
     hashdb::scan_manager_t* whitelist_manager = NULL;
     if (whitelist_dir != "") {
       require_hashdb_dir(whitelist_dir);
-      whitelist_manager = new hashdb::scan_manager_t(whitelist_dir);
+      whitelist_manager = new hashdb::scan_manager_t(whitelist_dir,
+                        hashdb::scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
     }
     progress_tracker_t progress_tracker(hashdb_dir, 0, cmd);
 
     // open the tab file for reading
     in_ptr_t in_ptr(tab_file);
+    manager.preallocate(in_ptr_t::size(tab_file));
     ::import_tab(manager, repository_name, tab_file, whitelist_manager,
                  progress_tracker, *in_ptr());
 
@@ -254,19 +500,40 @@ class out_ptr_t {
 
   // import json
   static void import_json(const std::string& hashdb_dir,
-                          const std::string& json_file,
+                          const std::vector<std::string>& json_files,
+                          const bool bulk_load,
                           const std::string& cmd) {
 
     // validate hashdb_dir path
     require_hashdb_dir(hashdb_dir);
 
     // resources
-    hashdb::import_manager_t manager(hashdb_dir, cmd);
+    hashdb::import_manager_t manager(hashdb_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
+    if (bulk_load) {
+      require_bulk_load(manager);
+    }
     progress_tracker_t progress_tracker(hashdb_dir, 0, cmd);
 
-    // open the JSON file for reading
-    in_ptr_t in_ptr(json_file);
-    ::import_json(manager, progress_tracker, *in_ptr());
+    // open the JSON files for reading
+    std::vector<in_ptr_t*> in_ptrs;
+    std::vector<std::istream*> ins;
+    uint64_t total_size = 0;
+    for (std::vector<std::string>::const_iterator it = json_files.begin();
+         it != json_files.end(); ++it) {
+      in_ptrs.push_back(new in_ptr_t(*it));
+      ins.push_back((*in_ptrs.back())());
+      total_size += in_ptr_t::size(*it);
+    }
+    manager.preallocate(total_size);
+    ::import_json(manager, progress_tracker, json_files, ins);
+
+    // done
+    for (std::vector<in_ptr_t*>::iterator it = in_ptrs.begin();
+         it != in_ptrs.end(); ++it) {
+      delete *it;
+    }
   }
 
   // export json
@@ -294,6 +561,47 @@ class out_ptr_t {
   }
 
   // export json range
+  // dump
+  static void dump(const std::string& hashdb_dir,
+                   const std::string& dump_file,
+                   const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // resources
+    hashdb::scan_manager_t manager(hashdb_dir);
+
+    // write the binary dump
+    out_ptr_t out_ptr(dump_file, true);
+    std::string error_message = manager.dump(*out_ptr());
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // load
+  static void load(const std::string& hashdb_dir,
+                   const std::string& dump_file,
+                   const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // resources
+    hashdb::import_manager_t manager(hashdb_dir, cmd);
+
+    // read the binary dump
+    in_ptr_t in_ptr(dump_file, true);
+    manager.preallocate(in_ptr_t::size(dump_file) * 4);
+    std::string error_message = manager.load(*in_ptr());
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
   static void export_json_range(const std::string& hashdb_dir,
                                 const std::string& json_file,
                                 const std::string& begin_block_hash,
@@ -333,17 +641,16 @@ class out_ptr_t {
 
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir);
-    hashdb::import_manager_t manager_b(dest_dir, cmd);
+    hashdb::import_manager_t manager_b(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
     progress_tracker_t progress_tracker(
                                 dest_dir, manager_a.size_hashes(), cmd);
     adder_t adder(&manager_a, &manager_b, &progress_tracker);
 
-    // add data for binary_hash from A to B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      // add the hash
-      adder.add(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    // add data for each hash from A to B
+    for (hashdb::hash_iterator_t it(manager_a); !it.at_end(); it.next()) {
+      adder.add(it);
     }
   }
 
@@ -371,7 +678,9 @@ class out_ptr_t {
     create_if_new(dest_dir, hashdb_dirs[0], cmd);
 
     // open the consumer at dest_dir
-    hashdb::import_manager_t consumer(dest_dir, cmd);
+    hashdb::import_manager_t consumer(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
 
     // calculate the total hash records for the tracker
     size_t total_hash_records = 0;
@@ -385,7 +694,9 @@ class out_ptr_t {
     progress_tracker_t progress_tracker(dest_dir, total_hash_records, cmd);
 
     // define the ordered multimap of key=hash, value=producer_t
-    typedef std::pair<hashdb::scan_manager_t*, adder_t*> producer_t;
+    typedef std::pair<hashdb::scan_manager_t*, adder_t*> producer_manager_t;
+    typedef std::pair<hashdb::hash_iterator_t*, producer_manager_t>
+                                                              producer_t;
     typedef std::pair<std::string, producer_t> ordered_producers_value_t;
     typedef std::multimap<std::string, producer_t> ordered_producers_t;
 
@@ -397,19 +708,21 @@ class out_ptr_t {
                     it != hashdb_dirs.end(); ++it) {
       std::string hashdb_dir = *it;
       hashdb::scan_manager_t* producer = new hashdb::scan_manager_t(hashdb_dir);
-      std::string binary_hash = producer->first_hash();
-      if (binary_hash.size() != 0) {
+      hashdb::hash_iterator_t* hash_it = new hashdb::hash_iterator_t(*producer);
+      if (!hash_it->at_end()) {
         // the producer is not empty, so enqueue it
         // create the adder
         adder_t* adder = new adder_t(producer, &consumer, &progress_tracker);
-        ordered_producers.insert(ordered_producers_value_t(binary_hash,
-                                      producer_t(producer, adder)));
+        ordered_producers.insert(ordered_producers_value_t(
+                     hash_it->block_hash(),
+                     producer_t(hash_it, producer_manager_t(producer, adder))));
 
       // also track total hashes to be processed
       total_hash_records += producer->size_hashes();
 
       } else {
         // no hashes for this producer so close it
+        delete hash_it;
         delete producer;
       }
     }
@@ -418,26 +731,27 @@ class out_ptr_t {
     while (ordered_producers.size() != 0) {
       // get the hash, producer, and adder for the first hash
       ordered_producers_t::iterator it = ordered_producers.begin();
-      hashdb::scan_manager_t* producer = it->second.first;
-      adder_t* adder = it->second.second;
+      const producer_t producer = it->second;
+      hashdb::hash_iterator_t* hash_it = producer.first;
 
       // add the hash to the consumer
-      adder->add(it->first);
+      producer.second.second->add(*hash_it);
 
       // get the next hash from this producer
-      std::string binary_hash = producer->next_hash(it->first);
+      hash_it->next();
 
       // remove this hash, producer_t entry
       ordered_producers.erase(it);
 
-      if (binary_hash.size() != 0) {
+      if (!hash_it->at_end()) {
         // hash exists so add the hash, producer, and adder
-        ordered_producers.insert(ordered_producers_value_t(binary_hash,
-                                      producer_t(producer, adder)));
+        ordered_producers.insert(ordered_producers_value_t(
+                                 hash_it->block_hash(), producer));
       } else {
         // no hashes for this producer so close it
-        delete producer;
-        delete adder;
+        delete hash_it;
+        delete producer.second.second;
+        delete producer.second.first;
       }
     }
   }
@@ -454,17 +768,30 @@ class out_ptr_t {
 
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir);
-    hashdb::import_manager_t manager_b(dest_dir, cmd);
+    hashdb::import_manager_t manager_b(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
+
+    // with a source index, visit only the hashes of matching sources
+    if (manager_a.has_source_index()) {
+      progress_tracker_t progress_tracker(dest_dir,
+                                          manager_a.size_sources(), cmd);
+      adder_t adder(&manager_a, &manager_b, repository_name,
+                    &progress_tracker);
+      for (hashdb::source_iterator_t it(manager_a); !it.at_end();
+           it.next()) {
+        adder.add_repository_source(it.file_hash());
+      }
+      return;
+    }
+
     progress_tracker_t progress_tracker(dest_dir,
                                         manager_a.size_hashes(), cmd);
     adder_t adder(&manager_a, &manager_b, repository_name, &progress_tracker);
 
-    // add data for binary_hash from A to B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      // add the hash
-      adder.add_repository(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    // add data for each hash from A to B
+    for (hashdb::hash_iterator_t it(manager_a); !it.at_end(); it.next()) {
+      adder.add_repository(it);
     }
   }
 
@@ -481,17 +808,16 @@ class out_ptr_t {
 
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir);
-    hashdb::import_manager_t manager_b(dest_dir, cmd);
+    hashdb::import_manager_t manager_b(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
     progress_tracker_t progress_tracker(dest_dir,
                                         manager_a.size_hashes(), cmd);
     adder_t adder(&manager_a, &manager_b, &progress_tracker);
 
-    // add data for binary_hash from A to B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      // add the hash
-      adder.add_range(binary_hash, m, n);
-      binary_hash = manager_a.next_hash(binary_hash);
+    // add data for each hash from A to B
+    for (hashdb::hash_iterator_t it(manager_a); !it.at_end(); it.next()) {
+      adder.add_range(it, m, n);
     }
   }
 
@@ -509,16 +835,16 @@ class out_ptr_t {
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir1);
     hashdb::scan_manager_t manager_b(hashdb_dir2);
-    hashdb::import_manager_t manager_c(dest_dir, cmd);
+    hashdb::import_manager_t manager_c(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
     progress_tracker_t progress_tracker(dest_dir, manager_a.size_hashes(), cmd);
     adder_set_t adder_set(&manager_a, &manager_b, &manager_c,
                                                            &progress_tracker);
 
     // iterate A to intersect A and B into C
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      adder_set.intersect(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    for (hashdb::hash_iterator_t it(manager_a); !it.at_end(); it.next()) {
+      adder_set.intersect(it);
     }
   }
 
@@ -536,16 +862,16 @@ class out_ptr_t {
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir1);
     hashdb::scan_manager_t manager_b(hashdb_dir2);
-    hashdb::import_manager_t manager_c(dest_dir, cmd);
+    hashdb::import_manager_t manager_c(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
     progress_tracker_t progress_tracker(dest_dir, manager_a.size_hashes(), cmd);
     adder_set_t adder_set(&manager_a, &manager_b, &manager_c,
                                                           & progress_tracker);
 
     // iterate A to intersect_hash A and B into C
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      adder_set.intersect_hash(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    for (hashdb::hash_iterator_t it(manager_a); !it.at_end(); it.next()) {
+      adder_set.intersect_hash(it);
     }
   }
 
@@ -563,18 +889,16 @@ class out_ptr_t {
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir1);
     hashdb::scan_manager_t manager_b(hashdb_dir2);
-    hashdb::import_manager_t manager_c(dest_dir, cmd);
+    hashdb::import_manager_t manager_c(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
     progress_tracker_t progress_tracker(dest_dir, manager_a.size_hashes(), cmd);
     adder_set_t adder_set(&manager_a, &manager_b, &manager_c,
                                                           &progress_tracker);
 
     // iterate A to add A to C if A hash and source not in B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-
-      // add A to C if A hash and source not in B
-      adder_set.subtract(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    for (hashdb::hash_iterator_t it(manager_a); !it.at_end(); it.next()) {
+      adder_set.subtract(it);
     }
   }
 
@@ -592,18 +916,16 @@ class out_ptr_t {
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir1);
     hashdb::scan_manager_t manager_b(hashdb_dir2);
-    hashdb::import_manager_t manager_c(dest_dir, cmd);
+    hashdb::import_manager_t manager_c(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
     progress_tracker_t progress_tracker(dest_dir, manager_a.size_hashes(), cmd);
     adder_set_t adder_set(&manager_a, &manager_b, &manager_c,
                                                           &progress_tracker);
 
     // iterate A to add A to C if A hash not in B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-
-      // add A to C if A hash not in B
-      adder_set.subtract_hash(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    for (hashdb::hash_iterator_t it(manager_a); !it.at_end(); it.next()) {
+      adder_set.subtract_hash(it);
     }
   }
 
@@ -619,17 +941,30 @@ class out_ptr_t {
 
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir);
-    hashdb::import_manager_t manager_b(dest_dir, cmd);
+    hashdb::import_manager_t manager_b(dest_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
+
+    // with a source index, visit only the hashes of matching sources
+    if (manager_a.has_source_index()) {
+      progress_tracker_t progress_tracker(dest_dir,
+                                          manager_a.size_sources(), cmd);
+      adder_t adder(&manager_a, &manager_b, repository_name,
+                    &progress_tracker);
+      for (hashdb::source_iterator_t it(manager_a); !it.at_end();
+           it.next()) {
+        adder.add_non_repository_source(it.file_hash());
+      }
+      return;
+    }
+
     progress_tracker_t progress_tracker(dest_dir,
                                         manager_a.size_hashes(), cmd);
     adder_t adder(&manager_a, &manager_b, repository_name, &progress_tracker);
 
-    // add data for binary_hash from A to B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      // add the hash
-      adder.add_non_repository(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    // add data for each hash from A to B
+    for (hashdb::hash_iterator_t it(manager_a); !it.at_end(); it.next()) {
+      adder.add_non_repository(it);
     }
   }
 
@@ -640,22 +975,24 @@ class out_ptr_t {
   static void scan_list(const std::string& hashdb_dir,
                         const std::string& hashes_file,
                         const hashdb::scan_mode_t scan_mode,
+                        const size_t binary_hash_size,
                         const std::string& cmd) {
 
     // validate hashdb_dir path
     require_hashdb_dir(hashdb_dir);
 
     // resources
-    hashdb::scan_manager_t manager(hashdb_dir);
+    hashdb::scan_manager_t manager(hashdb_dir,
+                      hashdb::scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
 
     // open the hashes list file for reading
-    in_ptr_t in_ptr(hashes_file);
+    in_ptr_t in_ptr(hashes_file, binary_hash_size != 0);
 
     // print header information
     print_header(cmd);
 
     // scan the list
-    ::scan_list(manager, *in_ptr(), scan_mode);
+    ::scan_list(manager, *in_ptr(), scan_mode, binary_hash_size);
 
     // done
     std::cout << "# scan_list completed.\n";
@@ -680,7 +1017,8 @@ class out_ptr_t {
     }
 
     // open DB
-    hashdb::scan_manager_t scan_manager(hashdb_dir);
+    hashdb::scan_manager_t scan_manager(hashdb_dir,
+                      hashdb::scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
 
     // scan
     std::string expanded_text = scan_manager.find_hash_json(
@@ -762,61 +1100,33 @@ class out_ptr_t {
     // start progress tracker
     progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
 
-    // total number of hashes in the database
-    uint64_t total_hashes = 0;
-
-    // total number of distinct hashes
-    uint64_t total_distinct_hashes = 0;
-
-    // hash histogram as <count, number of hashes with count>
-    std::map<uint32_t, uint64_t> hash_histogram;
-
-    // space for variables
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t source_sub_counts;
-
-    // iterate over hashdb and set variables for calculating the histogram
-    std::string binary_hash = manager.first_hash();
-
     // note if the DB is empty
-    if (binary_hash.size() == 0) {
+    if (manager.size_hashes() == 0) {
       std::cout << "The map is empty.\n";
     }
 
-    while (binary_hash.size() != 0) {
-      manager.find_hash(binary_hash, k_entropy, block_label, count,
-                        source_sub_counts);
-      // update total hashes observed
-      total_hashes += count;
-      // update total distinct hashes
-      if (count == 1) {
-        ++total_distinct_hashes;
-      }
-
-      // update hash_histogram information
-      // look for existing entry
-      std::map<uint32_t, uint64_t>::iterator hash_histogram_it =
-                                              hash_histogram.find(count);
-      if (hash_histogram_it == hash_histogram.end()) {
-
-        // this is the first hash found with this count value
-        // so start a new element for it
-        hash_histogram.insert(std::pair<uint32_t, uint64_t>(count, 1));
-
-      } else {
+    // scan ranges of the hashes in parallel
+    std::vector<histogram_scanner_t*> scanners;
+    std::vector<range_scanner_t*> range_scanners;
+    for (size_t i = 0; i < range_scan_threads(); ++i) {
+      scanners.push_back(new histogram_scanner_t);
+      range_scanners.push_back(scanners.back());
+    }
+    range_scan(manager, range_scanners, progress_tracker);
 
-        // increment existing value for number of hashes with this count
-        uint64_t old_number = hash_histogram_it->second;
-        hash_histogram.erase(count);
-        hash_histogram.insert(std::pair<uint32_t, uint64_t>(
-                                           count, old_number + 1));
+    // merge the range counts
+    uint64_t total_hashes = 0;
+    uint64_t total_distinct_hashes = 0;
+    std::map<uint32_t, uint64_t> hash_histogram;
+    for (size_t i = 0; i < scanners.size(); ++i) {
+      total_hashes += scanners[i]->total_hashes;
+      total_distinct_hashes += scanners[i]->total_distinct_hashes;
+      for (std::map<uint32_t, uint64_t>::const_iterator it =
+           scanners[i]->hash_histogram.begin();
+           it != scanners[i]->hash_histogram.end(); ++it) {
+        hash_histogram[it->first] += it->second;
       }
-
-      // move forward
-      progress_tracker.track_hash_data(source_sub_counts.size());
-      binary_hash = manager.next_hash(binary_hash);
+      delete scanners[i];
     }
 
     // show totals
@@ -861,32 +1171,19 @@ class out_ptr_t {
     // start progress tracker
     progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
 
-    bool any_found = false;
-
-    // space for variables
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t source_sub_counts;
-
-    // iterate over hashdb and set variables for finding duplicates
-    std::string binary_hash = manager.first_hash();
-
-    while (binary_hash.size() != 0) {
-      manager.find_hash(binary_hash, k_entropy, block_label, count,
-                                  source_sub_counts);
-      if (count == number) {
-        // show hash with requested duplicates number
-        std::string expanded_text = manager.find_hash_json(
-                                                    scan_mode, binary_hash);
-        std::cout << hashdb::bin_to_hex(binary_hash) << "\t"
-                  << expanded_text << "\n";
-        any_found = true;
-      }
+    // scan ranges of the hashes in parallel
+    std::vector<duplicates_scanner_t*> scanners;
+    std::vector<range_scanner_t*> range_scanners;
+    for (size_t i = 0; i < range_scan_threads(); ++i) {
+      scanners.push_back(new duplicates_scanner_t(number));
+      range_scanners.push_back(scanners.back());
+    }
+    range_scan(manager, range_scanners, progress_tracker);
 
-      // move forward
-      progress_tracker.track_hash_data(source_sub_counts.size());
-      binary_hash = manager.next_hash(binary_hash);
+    // show hashes with requested duplicates number, in hash order
+    const bool any_found = print_found_hashes(manager, scan_mode, scanners);
+    for (size_t i = 0; i < scanners.size(); ++i) {
+      delete scanners[i];
     }
 
     // say so if nothing was found
@@ -927,42 +1224,38 @@ class out_ptr_t {
     // print header information
     print_header(cmd);
 
+    // with a source index, read only the hashes of the source
+    if (manager.has_source_index()) {
+      std::vector<std::string> block_hashes;
+      manager.find_source_hashes(file_binary_hash, block_hashes);
+      progress_tracker_t progress_tracker(hashdb_dir, block_hashes.size(),
+                                          cmd);
+      for (std::vector<std::string>::const_iterator it =
+           block_hashes.begin(); it != block_hashes.end(); ++it) {
+        std::string expanded_text = manager.find_hash_json(scan_mode, *it);
+        std::cout << hashdb::bin_to_hex(*it) << "\t" << expanded_text
+                  << "\n";
+        progress_tracker.track();
+      }
+      return;
+    }
+
     // start progress tracker
     progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
 
-    // space for variables
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t source_sub_counts;
-
-    // look for hashes that belong to this source
-    // get the first hash
-    std::string binary_hash = manager.first_hash();
-    while (binary_hash.size() != 0) {
-
-      // read hash data for the hash
-      manager.find_hash(binary_hash, k_entropy, block_label, count,
-                                                    source_sub_counts);
-
-      // find sources that match the source we are looking for
-      for (hashdb::source_sub_counts_t::const_iterator it =
-                       source_sub_counts.begin();
-                       it!= source_sub_counts.end(); ++it) {
-        if (it->file_hash == file_binary_hash) {
-
-          // the source matches so print the hash and move on
-          std::string expanded_text = manager.find_hash_json(
-                                                    scan_mode, binary_hash);
-          std::cout << hashdb::bin_to_hex(binary_hash) << "\t" << expanded_text
-                    << "\n";
-          break;
-        }
-      }
+    // scan ranges of the hashes in parallel for hashes of this source
+    std::vector<hash_table_scanner_t*> scanners;
+    std::vector<range_scanner_t*> range_scanners;
+    for (size_t i = 0; i < range_scan_threads(); ++i) {
+      scanners.push_back(new hash_table_scanner_t(file_binary_hash));
+      range_scanners.push_back(scanners.back());
+    }
+    range_scan(manager, range_scanners, progress_tracker);
 
-      // move forward
-      progress_tracker.track_hash_data(source_sub_counts.size());
-      binary_hash = manager.next_hash(binary_hash);
+    // show the hashes in hash order
+    print_found_hashes(manager, scan_mode, scanners);
+    for (size_t i = 0; i < scanners.size(); ++i) {
+      delete scanners[i];
     }
   }
 
@@ -1077,7 +1370,8 @@ class out_ptr_t {
     srand (time(NULL)+1); // ensure seed is different by advancing 1 second
 
     // open manager
-    hashdb::scan_manager_t manager(hashdb_dir);
+    hashdb::scan_manager_t manager(hashdb_dir,
+                      hashdb::scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
 
     // start progress tracker
     progress_tracker_t progress_tracker(hashdb_dir, count, cmd);
@@ -1166,7 +1460,8 @@ class out_ptr_t {
     const uint64_t count = s_to_uint64(count_string);
 
     // open manager
-    hashdb::scan_manager_t manager(hashdb_dir);
+    hashdb::scan_manager_t manager(hashdb_dir,
+                      hashdb::scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
 
     // start progress tracker
     progress_tracker_t progress_tracker(hashdb_dir, count, cmd);
@@ -1206,7 +1501,8 @@ class out_ptr_t {
     const uint64_t count = s_to_uint64(count_string);
 
     // open manager
-    hashdb::scan_manager_t manager(hashdb_dir);
+    hashdb::scan_manager_t manager(hashdb_dir,
+                      hashdb::scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
 
     // open scan_stream
     hashdb::scan_stream_t scan_stream(&manager, 16, scan_mode);
@@ -1228,13 +1524,15 @@ class out_ptr_t {
     }
     const std::string unscanned(ss.str());
 
-    // put/get data
+    // put/get data, taking every ready result first so put never waits
+    // on get
     for (uint64_t i=1; i<=count; ++i) {
-      scan_stream.put(unscanned);
-      const std::string scanned = scan_stream.get();
-      if (scanned.size() > 0) {
+      std::string scanned = scan_stream.get();
+      while (scanned.size() > 0) {
         progress_tracker.track_count(list_size);
+        scanned = scan_stream.get();
       }
+      scan_stream.put(unscanned);
     }
 
     // get data until processing is done
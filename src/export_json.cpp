@@ -40,63 +40,212 @@
 
 #include <iostream>
 #include <cassert>
+#include <set>
+#include <vector>
+#include <pthread.h>
 #include "../src_libhashdb/hashdb.hpp"
 #include "progress_tracker.hpp"
+#include "range_scan.hpp"
 
-void export_json_sources(const hashdb::scan_manager_t& manager,
-                         std::ostream& os) {
+// Hashes are exported in chunks of about this many hashes.  Chunks are
+// formatted on worker threads and written in order by the calling thread.
+static const size_t EXPORT_CHUNK_HASHES = 16384;
 
-  std::string file_hash = manager.first_source();
-  while (file_hash.size() != 0) {
+// Workers may run this many chunks per thread ahead of the writer.
+static const size_t EXPORT_CHUNKS_AHEAD = 4;
 
-    // get source data
-    std::string json_source_string = manager.export_source_json(file_hash);
+// one formatted range of hashes
+struct export_chunk_t {
+  std::string json_text;
+  uint64_t hash_data_count;               // for the progress tracker
+  std::set<std::string> source_hashes;    // sources cited, if wanted
+  export_chunk_t() : json_text(), hash_data_count(0), source_hashes() {
+  }
+};
+
+// state shared by the export workers and the writer
+class export_pipeline_t {
+  private:
+  // do not allow copy or assignment
+  export_pipeline_t(const export_pipeline_t&);
+  export_pipeline_t& operator=(const export_pipeline_t&);
+
+  public:
+  const hashdb::scan_manager_t& manager;
+  const std::vector<std::pair<std::string, std::string> >& ranges;
+  const bool want_sources;
+  const size_t chunks_ahead;
+  size_t next_range;                      // next range for a worker
+  size_t next_write;                      // next range for the writer
+  std::vector<export_chunk_t*> chunks;    // formatted, not yet written
+  pthread_mutex_t M;
+  pthread_cond_t chunk_done;
+  pthread_cond_t chunk_written;
+
+  export_pipeline_t(const hashdb::scan_manager_t& p_manager,
+                    const std::vector<std::pair<std::string, std::string> >&
+                                                             p_ranges,
+                    const bool p_want_sources,
+                    const size_t p_chunks_ahead) :
+          manager(p_manager), ranges(p_ranges),
+          want_sources(p_want_sources), chunks_ahead(p_chunks_ahead),
+          next_range(0), next_write(0), chunks(p_ranges.size(), NULL),
+          M(), chunk_done(), chunk_written() {
+    pthread_mutex_init(&M, NULL);
+    pthread_cond_init(&chunk_done, NULL);
+    pthread_cond_init(&chunk_written, NULL);
+  }
 
-    // program error
-    if (json_source_string.size() == 0) {
-      assert(0);
+  ~export_pipeline_t() {
+    pthread_cond_destroy(&chunk_written);
+    pthread_cond_destroy(&chunk_done);
+    pthread_mutex_destroy(&M);
+  }
+};
+
+// format ranges until none are left
+static void* run_export_worker(void* const arg) {
+  export_pipeline_t& pipeline = *static_cast<export_pipeline_t*>(arg);
+  hashdb::source_sub_counts_t source_sub_counts;
+
+  while (true) {
+
+    // take the next range, staying at most chunks_ahead ahead of the writer
+    pthread_mutex_lock(&pipeline.M);
+    while (pipeline.next_range < pipeline.ranges.size() &&
+           pipeline.next_range >= pipeline.next_write +
+                                  pipeline.chunks_ahead) {
+      pthread_cond_wait(&pipeline.chunk_written, &pipeline.M);
+    }
+    if (pipeline.next_range == pipeline.ranges.size()) {
+      pthread_mutex_unlock(&pipeline.M);
+      break;
     }
+    const size_t i = pipeline.next_range++;
+    pthread_mutex_unlock(&pipeline.M);
 
-    os << json_source_string << "\n";
+    // format the range, decoding each hash once
+    export_chunk_t* chunk = new export_chunk_t;
+    for (hashdb::hash_iterator_t it(pipeline.manager,
+                                    pipeline.ranges[i].first,
+                                    pipeline.ranges[i].second);
+         !it.at_end(); it.next()) {
+
+      const std::string json_hash_string = it.export_json(source_sub_counts);
+
+      // program error
+      if (json_hash_string.size() == 0) {
+        assert(0);
+      }
+
+      chunk->json_text.append(json_hash_string);
+      chunk->json_text.push_back('\n');
+
+      // the amount of hash data is 1 or source count + 1, see
+      // progress_tracker_t::track_hash_data
+      const size_t source_count = source_sub_counts.size();
+      chunk->hash_data_count += (source_count == 1) ? 1 : source_count + 1;
+
+      // note the sources involved
+      if (pipeline.want_sources) {
+        for (hashdb::source_sub_counts_t::const_iterator it2 =
+             source_sub_counts.begin(); it2 != source_sub_counts.end();
+             ++it2) {
+          chunk->source_hashes.insert(it2->file_hash);
+        }
+      }
+    }
 
-    // next
-    file_hash = manager.next_source(file_hash);
+    // hand the chunk to the writer
+    pthread_mutex_lock(&pipeline.M);
+    pipeline.chunks[i] = chunk;
+    pthread_cond_broadcast(&pipeline.chunk_done);
+    pthread_mutex_unlock(&pipeline.M);
   }
+
+  return NULL;
 }
 
-void export_json_hashes(const hashdb::scan_manager_t& manager,
-                        progress_tracker_t& progress_tracker,
-                        std::ostream& os) {
+// Export the hashes from begin_block_hash through end_block_hash in
+// order, formatting on worker threads and writing from this thread.
+// Collect the cited sources into source_hashes if not NULL.
+static void export_hash_ranges(const hashdb::scan_manager_t& manager,
+                               const std::string& begin_block_hash,
+                               const std::string& end_block_hash,
+                               progress_tracker_t& progress_tracker,
+                               std::ostream& os,
+                               std::set<std::string>* source_hashes) {
+
+  // split into about EXPORT_CHUNK_HASHES hashes per range, with enough
+  // ranges to keep every thread busy
+  const size_t num_threads = range_scan_threads();
+  size_t num_ranges = manager.size_hashes() / EXPORT_CHUNK_HASHES;
+  if (num_ranges < num_threads * EXPORT_CHUNKS_AHEAD) {
+    num_ranges = num_threads * EXPORT_CHUNKS_AHEAD;
+  }
+  std::vector<std::pair<std::string, std::string> > ranges;
+  manager.hash_ranges(num_ranges, ranges, begin_block_hash, end_block_hash);
+
+  // start the workers
+  export_pipeline_t pipeline(manager, ranges, source_hashes != NULL,
+                             num_threads * EXPORT_CHUNKS_AHEAD);
+  std::vector<pthread_t> threads(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    if (pthread_create(&threads[i], NULL, run_export_worker, &pipeline)
+                                                                   != 0) {
+      std::cerr << "Error: unable to start export thread.\n";
+      exit(1);
+    }
+  }
 
-  // space for variables in order to use the tracker
-  std::string block_hash;
-  uint64_t k_entropy;
-  std::string block_label;
-  uint64_t count;
-  hashdb::source_sub_counts_t source_sub_counts;
+  // write the chunks in range order
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    pthread_mutex_lock(&pipeline.M);
+    while (pipeline.chunks[i] == NULL) {
+      pthread_cond_wait(&pipeline.chunk_done, &pipeline.M);
+    }
+    export_chunk_t* chunk = pipeline.chunks[i];
+    pipeline.chunks[i] = NULL;
+    pipeline.next_write = i + 1;
+    pthread_cond_broadcast(&pipeline.chunk_written);
+    pthread_mutex_unlock(&pipeline.M);
+
+    os.write(chunk->json_text.c_str(), chunk->json_text.size());
+    progress_tracker.track_count(chunk->hash_data_count);
+    if (source_hashes != NULL) {
+      source_hashes->insert(chunk->source_hashes.begin(),
+                            chunk->source_hashes.end());
+    }
+    delete chunk;
+  }
 
-  block_hash = manager.first_hash();
-  while (block_hash.size() != 0) {
+  for (size_t i = 0; i < num_threads; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+}
 
-    // get hash data
-    std::string json_hash_string = manager.export_hash_json(block_hash);
+void export_json_sources(const hashdb::scan_manager_t& manager,
+                         std::ostream& os) {
+
+  for (hashdb::source_iterator_t it(manager); !it.at_end(); it.next()) {
+
+    // get source data
+    std::string json_source_string = it.export_json();
 
     // program error
-    if (json_hash_string.size() == 0) {
+    if (json_source_string.size() == 0) {
       assert(0);
     }
 
-    // emit the JSON
-    os << json_hash_string << "\n";
+    os << json_source_string << "\n";
+  }
+}
 
-    // update the progress tracker, this accurate approach is expensive
-    manager.find_hash(block_hash, k_entropy, block_label,
-                      count, source_sub_counts);
-    progress_tracker.track_hash_data(source_sub_counts.size());
+void export_json_hashes(const hashdb::scan_manager_t& manager,
+                        progress_tracker_t& progress_tracker,
+                        std::ostream& os) {
 
-    // next
-    block_hash = manager.next_hash(block_hash);
-  }
+  export_hash_ranges(manager, "", "", progress_tracker, os, NULL);
 }
 
 void export_json_range(const hashdb::scan_manager_t& manager,
@@ -105,50 +254,10 @@ void export_json_range(const hashdb::scan_manager_t& manager,
                        progress_tracker_t& progress_tracker,
                        std::ostream& os) {
 
-  // the subset of cited sources to export
+  // export the block hashes that are in range, noting the sources involved
   std::set<std::string> source_hashes;
-
-  // space for variables in order to use the tracker
-  std::string block_hash;
-  uint64_t k_entropy;
-  std::string block_label;
-  uint64_t count;
-  hashdb::source_sub_counts_t source_sub_counts;
-
-  // export the block hashes that are in range
-  block_hash = manager.first_hash();
-  while (block_hash.size() != 0) {
-
-    manager.find_hash(block_hash, k_entropy, block_label,
-                      count, source_sub_counts);
-
-    if (block_hash >= begin_block_hash && block_hash <= end_block_hash) {
-      // process the block hash since it is in range
-
-      // get JSON hash data
-      std::string json_hash_string = manager.export_hash_json(block_hash);
-
-      // program error
-      if (json_hash_string.size() == 0) {
-        assert(0);
-      }
-
-      // emit the JSON
-      os << json_hash_string << "\n";
-
-      // note the sources involved
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
-        source_hashes.insert(it->file_hash);
-      }
-    }
-
-    // update the progress tracker
-    progress_tracker.track_hash_data(source_sub_counts.size());
-
-    // next
-    block_hash = manager.next_hash(block_hash);
-  }
+  export_hash_ranges(manager, begin_block_hash, end_block_hash,
+                     progress_tracker, os, &source_hashes);
 
   // export the cited sources
   for (std::set<std::string>::const_iterator it2 = source_hashes.begin();
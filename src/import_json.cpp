@@ -20,7 +20,8 @@
 /**
  * \file
  * Import from data in JSON format.  Lines are one of source data,
- * block hash data, or comment.
+ * block hash data, or comment.  Lines are decoded in parallel and
+ * imported in input order.
  */
 
 #include <config.h>
@@ -38,38 +39,93 @@
   #include <winsock2.h>
 #endif
 
-#include <sstream>
+#include <iostream>
+#include <string>
+#include <vector>
 #include "../src_libhashdb/hashdb.hpp"
 #include "progress_tracker.hpp"
-#include <fstream>
+#include "line_pipeline.hpp"
+#include "import_json.hpp"
 
-void import_json(hashdb::import_manager_t& manager,
-                 progress_tracker_t& progress_tracker,
-                 std::istream& in) {
-  std::string line;
-  size_t line_number = 0;
-  while(getline(in, line)) {
-    ++line_number;
+// lines and what they decode to
+struct json_chunk_t : public line_chunk_t {
+  std::vector<hashdb::json_record_t> records;
+  std::vector<std::string> error_messages;
+  std::vector<bool> is_skipped;               // comment or empty line
+  json_chunk_t() : line_chunk_t(), records(), error_messages(),
+                   is_skipped() {
+  }
+};
 
-    // skip comment lines
-    if (line[0] == '#') {
-      continue;
-    }
+class json_pipeline_t : public line_pipeline_t {
+  private:
+  hashdb::import_manager_t& manager;
+  progress_tracker_t& progress_tracker;
+  const std::vector<std::string>& filenames;
+
+  // do not allow copy or assignment
+  json_pipeline_t(const json_pipeline_t&);
+  json_pipeline_t& operator=(const json_pipeline_t&);
+
+  protected:
+  line_chunk_t* new_chunk() {
+    return new json_chunk_t;
+  }
+
+  void parse(line_chunk_t& p_chunk) {
+    json_chunk_t& chunk = static_cast<json_chunk_t&>(p_chunk);
+    const size_t count = chunk.size();
+    chunk.records.resize(count);
+    chunk.error_messages.resize(count);
+    chunk.is_skipped.resize(count, false);
+    for (size_t i = 0; i < count; ++i) {
 
-    // skip empty lines
-    if (line.size() == 0) {
-      continue;
+      // skip comment lines and empty lines
+      if (chunk.line_size(i) == 0 || chunk.line(i)[0] == '#') {
+        chunk.is_skipped[i] = true;
+        continue;
+      }
+
+      chunk.error_messages[i] = hashdb::import_manager_t::parse_json(
+                    std::string(chunk.line(i), chunk.line_size(i)),
+                    chunk.records[i]);
     }
+  }
 
-    // import JSON
-    std::string error_message = manager.import_json(line);
-    if (error_message.size() != 0) {
-      std::cerr << "Invalid line " << line_number
-                << " error: " << error_message
-                << ": '" << line << "'\n";
-    } else {
-      progress_tracker.track();
+  void import(line_chunk_t& p_chunk) {
+    json_chunk_t& chunk = static_cast<json_chunk_t&>(p_chunk);
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      if (chunk.is_skipped[i]) {
+        continue;
+      }
+      if (chunk.error_messages[i].size() != 0) {
+        std::cerr << "Invalid line " << chunk.first_line_number + i;
+        if (filenames.size() > 1) {
+          std::cerr << " of " << filenames[chunk.file_index];
+        }
+        std::cerr << " error: " << chunk.error_messages[i] << ": '"
+                  << std::string(chunk.line(i), chunk.line_size(i))
+                  << "'\n";
+      } else {
+        manager.import_record(chunk.records[i]);
+        progress_tracker.track();
+      }
     }
   }
-}
 
+  public:
+  json_pipeline_t(hashdb::import_manager_t& p_manager,
+                  progress_tracker_t& p_progress_tracker,
+                  const std::vector<std::string>& p_filenames) :
+          line_pipeline_t(0), manager(p_manager),
+          progress_tracker(p_progress_tracker), filenames(p_filenames) {
+  }
+};
+
+void import_json(hashdb::import_manager_t& manager,
+                 progress_tracker_t& progress_tracker,
+                 const std::vector<std::string>& filenames,
+                 const std::vector<std::istream*>& ins) {
+  json_pipeline_t pipeline(manager, progress_tracker, filenames);
+  pipeline.run(ins);
+}
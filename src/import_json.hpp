@@ -28,11 +28,20 @@
 
 #include "../src_libhashdb/hashdb.hpp"
 #include "progress_tracker.hpp"
-#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
 
+/**
+ * Import the lines of each input stream in order.  A reader thread reads
+ * the lines in chunks, parser threads decode them, and the calling thread
+ * imports them in input order.  Invalid lines are reported by line number
+ * and, when there is more than one input, by filename.
+ */
 void import_json(hashdb::import_manager_t& manager,
                  progress_tracker_t& progress_tracker,
-                 std::istream& in);
+                 const std::vector<std::string>& filenames,
+                 const std::vector<std::istream*>& ins);
 
 #endif
 
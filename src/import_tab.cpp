@@ -26,6 +26,10 @@
  * Note that block offset is not used.  All block hashes for new file
  * hashes are imported.  All block hashes for pre-existing file hashes
  * are ignored.
+ *
+ * Lines are decoded and checked against the whitelist in parallel, see
+ * line_pipeline.hpp, and imported in input order.  Source data and the
+ * source name are imported once per file hash.
  */
 
 #include <config.h>
@@ -44,106 +48,190 @@
 #endif
 
 #include <iostream>
-#include <sstream>
+#include <string>
+#include <vector>
 #include "../src_libhashdb/hashdb.hpp"
-#include "s_to_uint64.hpp"
 #include "progress_tracker.hpp"
+#include "line_pipeline.hpp"
+#include "import_tab.hpp"
+
+// lines and what they decode to
+struct tab_chunk_t : public line_chunk_t {
+  enum line_status_t {SKIPPED, VALID, NO_TAB, NO_SECOND_TAB,
+                      INVALID_FILE_HASH, INVALID_BLOCK_HASH};
+  std::vector<line_status_t> statuses;
+  std::vector<std::string> file_hashes;
+  std::vector<std::string> block_hashes;
+  std::vector<bool> is_whitelisted;
+  tab_chunk_t() : line_chunk_t(), statuses(), file_hashes(),
+                  block_hashes(), is_whitelisted() {
+  }
+};
 
-void import_tab(hashdb::import_manager_t& manager,
-                const std::string& repository_name,
-                const std::string& filename,
-                const hashdb::scan_manager_t* const whitelist_manager,
-                progress_tracker_t& progress_tracker,
-                std::istream& in) {
-
-  // only import file hashes that are new to the session
-  std::set<std::string> importable_sources;
+// decode hex digits into bin, return false if empty or invalid
+static bool decode_hash(const char* const hex, const size_t size,
+                        std::string& bin) {
+  if (size == 0 || size%2 != 0) {
+    return false;
+  }
+  bin.resize(size / 2);
+  return hashdb::hex_to_bin(hex, size, &bin[0]);
+}
 
-  std::string line;
-  size_t line_number = 0;
-  while(getline(in, line)) {
-    ++line_number;
+class tab_pipeline_t : public line_pipeline_t {
+  private:
+  hashdb::import_manager_t& manager;
+  const std::string& repository_name;
+  const std::string& filename;
+  const hashdb::scan_manager_t* const whitelist_manager;
+  progress_tracker_t& progress_tracker;
+
+  // do not allow copy or assignment
+  tab_pipeline_t(const tab_pipeline_t&);
+  tab_pipeline_t& operator=(const tab_pipeline_t&);
+
+  protected:
+  line_chunk_t* new_chunk() {
+    return new tab_chunk_t;
+  }
 
-    // skip comment lines
-    if (line[0] == '#') {
-      continue;
-    }
+  void parse(line_chunk_t& p_chunk) {
+    tab_chunk_t& chunk = static_cast<tab_chunk_t&>(p_chunk);
+    const size_t count = chunk.size();
+    chunk.statuses.resize(count, tab_chunk_t::SKIPPED);
+    chunk.file_hashes.resize(count);
+    chunk.block_hashes.resize(count);
+    chunk.is_whitelisted.resize(count, false);
 
-    // skip empty lines
-    if (line.size() == 0) {
-      continue;
-    }
+    for (size_t i = 0; i < count; ++i) {
+      const char* const line = chunk.line(i);
+      const size_t line_size = chunk.line_size(i);
 
-    // find tabs
-    size_t tab_index1 = line.find('\t');
-    if (tab_index1 == std::string::npos) {
-      std::cerr << "Tab not found on line " << line_number << ": '" << line << "'\n";
-      continue;
-    }
-    size_t tab_index2 = line.find('\t', tab_index1 + 1);
-    if (tab_index2 == std::string::npos) {
-      std::cerr << "Second tab not found on line " << line_number << ": '" << line << "'\n";
-      continue;
-    }
+      // skip comment lines and empty lines
+      if (line_size == 0 || line[0] == '#') {
+        continue;
+      }
 
-    // get file hash
-    std::string file_hash_string = line.substr(0, tab_index1);
-    std::string file_binary_hash = hashdb::hex_to_bin(file_hash_string);
-    if (file_binary_hash.size() == 0) {
-      std::cerr << "file hexdigest is invalid on line " << line_number
-                << ": '" << line << "', '" << file_hash_string << "'\n";
-      continue;
-    }
+      // find tabs
+      const char* const tab1 = static_cast<const char*>(
+                                        memchr(line, '\t', line_size));
+      if (tab1 == NULL) {
+        chunk.statuses[i] = tab_chunk_t::NO_TAB;
+        continue;
+      }
+      const char* const tab2 = static_cast<const char*>(
+                  memchr(tab1 + 1, '\t', line + line_size - tab1 - 1));
+      if (tab2 == NULL) {
+        chunk.statuses[i] = tab_chunk_t::NO_SECOND_TAB;
+        continue;
+      }
 
-    // skip the file hash if it was preexisting else identify it as importable
-    if (importable_sources.find(file_binary_hash) == importable_sources.end()) {
-      // the file hash has not been seen yet so see if it is preexisting
-      if (manager.has_source(file_binary_hash)) {
-        // the file is preexisting so skip it
+      // file hash, then block hash
+      if (!decode_hash(line, tab1 - line, chunk.file_hashes[i])) {
+        chunk.statuses[i] = tab_chunk_t::INVALID_FILE_HASH;
         continue;
-      } else {
-        // the file hash is new so identify it as importable
-        importable_sources.insert(file_binary_hash);
       }
+      if (!decode_hash(tab1 + 1, tab2 - tab1 - 1, chunk.block_hashes[i])) {
+        chunk.statuses[i] = tab_chunk_t::INVALID_BLOCK_HASH;
+        continue;
+      }
+      chunk.statuses[i] = tab_chunk_t::VALID;
     }
 
-    // skip the file hash if it has not been identified as importable
-    if (importable_sources.find(file_binary_hash) == importable_sources.end()) {
-      continue;
+    // check the block hashes against the whitelist in one sorted batch
+    if (whitelist_manager != NULL) {
+      std::vector<size_t> indexes;
+      std::vector<std::string> block_hashes;
+      for (size_t i = 0; i < count; ++i) {
+        if (chunk.statuses[i] == tab_chunk_t::VALID) {
+          indexes.push_back(i);
+          block_hashes.push_back(chunk.block_hashes[i]);
+        }
+      }
+      std::vector<size_t> counts;
+      whitelist_manager->find_hash_counts(block_hashes, counts);
+      for (size_t j = 0; j < indexes.size(); ++j) {
+        chunk.is_whitelisted[indexes[j]] = (counts[j] > 0);
+      }
     }
+  }
 
-    // get block hash
-    std::string block_hashdigest_string = line.substr(
-                                  tab_index1+1, tab_index2 - tab_index1 - 1);
-    std::string block_binary_hash = hashdb::hex_to_bin(block_hashdigest_string);
-    if (block_binary_hash == "") {
-      std::cerr << "Invalid block hash on line " << line_number
-                << ": '" << line << "', '" << block_hashdigest_string << "'\n";
-      continue;
-    }
+  void import(line_chunk_t& p_chunk) {
+    tab_chunk_t& chunk = static_cast<tab_chunk_t&>(p_chunk);
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      const tab_chunk_t::line_status_t status = chunk.statuses[i];
+      if (status == tab_chunk_t::SKIPPED) {
+        continue;
+      }
 
-    // skip the file offset
+      // the text of the line, for reporting errors
+      const size_t line_number = chunk.first_line_number + i;
+      std::string line;
+      size_t tab_index1 = 0;
+      size_t tab_index2 = 0;
+      if (status != tab_chunk_t::VALID) {
+        line.assign(chunk.line(i), chunk.line_size(i));
+        tab_index1 = line.find('\t');
+        tab_index2 = line.find('\t', tab_index1 + 1);
+      }
 
-    // mark with "w" if in whitelist
-    std::string whitelist_flag = "";
-    if (whitelist_manager != NULL) {
-      if (whitelist_manager->find_hash_count(block_binary_hash) > 0) {
-        whitelist_flag = "w";
+      if (status == tab_chunk_t::NO_TAB) {
+        std::cerr << "Tab not found on line " << line_number << ": '" << line << "'\n";
+        continue;
+      }
+      if (status == tab_chunk_t::NO_SECOND_TAB) {
+        std::cerr << "Second tab not found on line " << line_number << ": '" << line << "'\n";
+        continue;
+      }
+      if (status == tab_chunk_t::INVALID_FILE_HASH) {
+        std::cerr << "file hexdigest is invalid on line " << line_number
+                  << ": '" << line << "', '" << line.substr(0, tab_index1)
+                  << "'\n";
+        continue;
       }
-    }
 
-    // add source data
-    manager.insert_source_data(file_binary_hash, 0, "", 0, 0);
+      // block hash
+      if (status == tab_chunk_t::INVALID_BLOCK_HASH) {
+        std::cerr << "Invalid block hash on line " << line_number
+                  << ": '" << line << "', '"
+                  << line.substr(tab_index1 + 1, tab_index2 - tab_index1 - 1)
+                  << "'\n";
+        continue;
+      }
 
-    // add name pair
-    manager.insert_source_name(file_binary_hash, repository_name, filename);
+      // add block hash, marked with "w" if in whitelist, unless the
+      // file hash was preexisting.  The import manager adds the source
+      // data and name pair once and decides as it applies the change,
+      // so this thread does not read the database while it is written.
+      manager.insert_new_source_hash(chunk.block_hashes[i], 0,
+                          chunk.is_whitelisted[i] ? "w" : "",
+                          chunk.file_hashes[i], repository_name, filename);
 
-    // add block hash
-    manager.insert_hash(block_binary_hash, 0.0, whitelist_flag,
-                        file_binary_hash);
+      // update progress tracker
+      progress_tracker.track();
+    }
+  }
 
-    // update progress tracker
-    progress_tracker.track();
+  public:
+  tab_pipeline_t(hashdb::import_manager_t& p_manager,
+                 const std::string& p_repository_name,
+                 const std::string& p_filename,
+                 const hashdb::scan_manager_t* const p_whitelist_manager,
+                 progress_tracker_t& p_progress_tracker) :
+          line_pipeline_t(0), manager(p_manager),
+          repository_name(p_repository_name), filename(p_filename),
+          whitelist_manager(p_whitelist_manager),
+          progress_tracker(p_progress_tracker) {
   }
-}
+};
 
+void import_tab(hashdb::import_manager_t& manager,
+                const std::string& repository_name,
+                const std::string& filename,
+                const hashdb::scan_manager_t* const whitelist_manager,
+                progress_tracker_t& progress_tracker,
+                std::istream& in) {
+  tab_pipeline_t pipeline(manager, repository_name, filename,
+                          whitelist_manager, progress_tracker);
+  pipeline.run(std::vector<std::istream*>(1, &in));
+}
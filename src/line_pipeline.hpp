@@ -0,0 +1,357 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Read lines of text input on a reader thread, decode them on parser
+ * threads, and import them in input order on the calling thread.
+ *
+ * Input is read in chunks of whole lines, about LINE_CHUNK_BYTES each.
+ * Input may instead be fixed-size binary records, which are then the
+ * lines of the chunks.  Derive from line_chunk_t to hold what the lines
+ * decode to and from line_pipeline_t to decode and import them.  The
+ * reader stays a few chunks per parser ahead of the import so memory
+ * stays bounded.
+ */
+
+#ifndef LINE_PIPELINE_HPP
+#define LINE_PIPELINE_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+#include <cassert>
+#include <pthread.h>
+#include "../src_libhashdb/num_cpus.hpp"
+
+// Input is read in chunks of about this many bytes.
+static const size_t LINE_CHUNK_BYTES = 1 << 20;
+
+// The reader may run this many chunks per parser ahead of the import.
+static const size_t LINE_CHUNKS_AHEAD = 4;
+
+// whole lines, or whole binary records, of one input
+class line_chunk_t {
+  private:
+  std::vector<size_t> line_starts;
+  size_t record_size;                 // 0 for lines
+
+  public:
+  size_t file_index;                  // index of the input
+  size_t first_line_number;           // set just before import
+  std::string text;                   // lines, each ending in '\n'
+  bool is_parsed;
+
+  line_chunk_t() : line_starts(), record_size(0), file_index(0),
+                   first_line_number(0), text(), is_parsed(false) {
+  }
+
+  virtual ~line_chunk_t() {
+  }
+
+  // find the lines, making each a C string, else find the records.
+  // The last record may be short.
+  void split(const size_t p_record_size) {
+    record_size = p_record_size;
+    line_starts.clear();
+    size_t start = 0;
+    while (start < text.size()) {
+      line_starts.push_back(start);
+      if (record_size != 0) {
+        start += record_size;
+      } else {
+        const size_t end = text.find('\n', start);
+        text[end] = '\0';
+        start = end + 1;
+      }
+    }
+  }
+
+  size_t size() const {
+    return line_starts.size();
+  }
+
+  const char* line(const size_t i) const {
+    return text.c_str() + line_starts[i];
+  }
+
+  size_t line_size(const size_t i) const {
+    const size_t end = (i + 1 < line_starts.size()) ?
+                                      line_starts[i + 1] : text.size();
+    return end - line_starts[i] - ((record_size == 0) ? 1 : 0);
+  }
+};
+
+class line_pipeline_t {
+
+  private:
+  std::vector<std::istream*> ins;
+  const size_t record_size;               // 0 for lines
+  size_t chunks_ahead;
+  std::deque<line_chunk_t*> chunks;       // read, not yet imported
+  size_t first_chunk;                     // number of chunks[0]
+  size_t next_parse;                      // next chunk for a parser
+  bool is_done_reading;
+  pthread_mutex_t M;
+  pthread_cond_t chunk_read;
+  pthread_cond_t chunk_parsed;
+  pthread_cond_t chunk_imported;
+
+  // do not allow copy or assignment
+  line_pipeline_t(const line_pipeline_t&);
+  line_pipeline_t& operator=(const line_pipeline_t&);
+
+  // queue a chunk, waiting while the reader is too far ahead
+  void push(line_chunk_t* const chunk) {
+    pthread_mutex_lock(&M);
+    while (chunks.size() >= chunks_ahead) {
+      pthread_cond_wait(&chunk_imported, &M);
+    }
+    chunks.push_back(chunk);
+    pthread_cond_signal(&chunk_read);
+    pthread_mutex_unlock(&M);
+  }
+
+  // read the inputs in order into chunks of whole records
+  void read_records() {
+    const size_t read_size = (LINE_CHUNK_BYTES / record_size + 1) *
+                             record_size;
+    for (size_t i = 0; i < ins.size(); ++i) {
+      std::istream& in = *ins[i];
+      while (true) {
+        line_chunk_t* const chunk = new_chunk();
+        chunk->file_index = i;
+        chunk->text.resize(read_size);
+        in.read(&chunk->text[0], read_size);
+        const size_t count = in.gcount();
+        chunk->text.resize(count);
+        if (count == 0) {
+          delete chunk;
+        } else {
+          push(chunk);
+        }
+        if (count < read_size) {
+          break;
+        }
+      }
+    }
+  }
+
+  // read the inputs in order into chunks of whole lines
+  void read_lines() {
+    for (size_t i = 0; i < ins.size(); ++i) {
+      std::istream& in = *ins[i];
+      std::string partial_line;
+      while (true) {
+        line_chunk_t* const chunk = new_chunk();
+        chunk->file_index = i;
+        chunk->text.swap(partial_line);
+        partial_line.clear();
+
+        const size_t offset = chunk->text.size();
+        chunk->text.resize(offset + LINE_CHUNK_BYTES);
+        in.read(&chunk->text[offset], LINE_CHUNK_BYTES);
+        const size_t count = in.gcount();
+        chunk->text.resize(offset + count);
+
+        // the last chunk of the input
+        if (count < LINE_CHUNK_BYTES) {
+          if (chunk->text.size() == 0) {
+            delete chunk;
+          } else {
+            if (chunk->text[chunk->text.size() - 1] != '\n') {
+              chunk->text.push_back('\n');
+            }
+            push(chunk);
+          }
+          break;
+        }
+
+        // keep the partial last line for the next chunk
+        const size_t last_newline = chunk->text.rfind('\n');
+        if (last_newline == std::string::npos) {
+          // a line longer than the chunk
+          partial_line.swap(chunk->text);
+          delete chunk;
+          continue;
+        }
+        partial_line.assign(chunk->text, last_newline + 1,
+                            std::string::npos);
+        chunk->text.resize(last_newline + 1);
+        push(chunk);
+      }
+    }
+  }
+
+  void read() {
+    if (record_size != 0) {
+      read_records();
+    } else {
+      read_lines();
+    }
+
+    // wake the parsers and the import so they can finish
+    pthread_mutex_lock(&M);
+    is_done_reading = true;
+    pthread_cond_broadcast(&chunk_read);
+    pthread_cond_broadcast(&chunk_parsed);
+    pthread_mutex_unlock(&M);
+  }
+
+  // decode chunks until none are left
+  void parse_chunks() {
+    while (true) {
+
+      // take the next chunk read
+      pthread_mutex_lock(&M);
+      while (next_parse == first_chunk + chunks.size() && !is_done_reading) {
+        pthread_cond_wait(&chunk_read, &M);
+      }
+      if (next_parse == first_chunk + chunks.size()) {
+        pthread_mutex_unlock(&M);
+        break;
+      }
+      line_chunk_t* const chunk = chunks[next_parse - first_chunk];
+      ++next_parse;
+      pthread_mutex_unlock(&M);
+
+      chunk->split(record_size);
+      parse(*chunk);
+
+      pthread_mutex_lock(&M);
+      chunk->is_parsed = true;
+      pthread_cond_broadcast(&chunk_parsed);
+      pthread_mutex_unlock(&M);
+    }
+  }
+
+  static void* run_reader(void* const arg) {
+    static_cast<line_pipeline_t*>(arg)->read();
+    return NULL;
+  }
+
+  static void* run_parser(void* const arg) {
+    static_cast<line_pipeline_t*>(arg)->parse_chunks();
+    return NULL;
+  }
+
+  protected:
+  /**
+   * A new, empty chunk of the derived type.  Called on the reader thread.
+   */
+  virtual line_chunk_t* new_chunk() = 0;
+
+  /**
+   * Decode the lines of chunk.  Called on many parser threads at once.
+   */
+  virtual void parse(line_chunk_t& chunk) = 0;
+
+  /**
+   * Import the decoded lines of chunk.  Called on the calling thread of
+   * run, one chunk at a time in input order.
+   */
+  virtual void import(line_chunk_t& chunk) = 0;
+
+  public:
+  /**
+   * Read lines, else binary records of record_size bytes.
+   */
+  line_pipeline_t(const size_t p_record_size) :
+          ins(), record_size(p_record_size), chunks_ahead(0), chunks(),
+          first_chunk(0), next_parse(0), is_done_reading(false),
+          M(), chunk_read(), chunk_parsed(), chunk_imported() {
+    pthread_mutex_init(&M, NULL);
+    pthread_cond_init(&chunk_read, NULL);
+    pthread_cond_init(&chunk_parsed, NULL);
+    pthread_cond_init(&chunk_imported, NULL);
+  }
+
+  virtual ~line_pipeline_t() {
+    pthread_cond_destroy(&chunk_imported);
+    pthread_cond_destroy(&chunk_parsed);
+    pthread_cond_destroy(&chunk_read);
+    pthread_mutex_destroy(&M);
+  }
+
+  /**
+   * Read, decode and import the lines of each input in order.  Run once.
+   */
+  void run(const std::vector<std::istream*>& p_ins) {
+
+    // one reader and a parser per CPU
+    const int num_cpus = hashdb::numCPU();
+    const size_t num_parsers = (num_cpus > 1) ? num_cpus : 1;
+    ins = p_ins;
+    chunks_ahead = num_parsers * LINE_CHUNKS_AHEAD;
+
+    pthread_t reader_thread;
+    if (pthread_create(&reader_thread, NULL, run_reader,
+                       static_cast<void*>(this)) != 0) {
+      std::cerr << "Unable to start line reader thread.\n";
+      assert(0);
+    }
+    std::vector<pthread_t> parser_threads(num_parsers);
+    for (size_t i = 0; i < num_parsers; ++i) {
+      if (pthread_create(&parser_threads[i], NULL, run_parser,
+                         static_cast<void*>(this)) != 0) {
+        std::cerr << "Unable to start line parser thread.\n";
+        assert(0);
+      }
+    }
+
+    // import the chunks in input order, numbering their lines
+    size_t file_index = 0;
+    size_t line_number = 1;
+    while (true) {
+      pthread_mutex_lock(&M);
+      while ((chunks.size() == 0 && !is_done_reading) ||
+             (chunks.size() != 0 && !chunks.front()->is_parsed)) {
+        pthread_cond_wait(&chunk_parsed, &M);
+      }
+      if (chunks.size() == 0) {
+        pthread_mutex_unlock(&M);
+        break;
+      }
+      line_chunk_t* const chunk = chunks.front();
+      chunks.pop_front();
+      ++first_chunk;
+      pthread_cond_signal(&chunk_imported);
+      pthread_mutex_unlock(&M);
+
+      if (chunk->file_index != file_index) {
+        file_index = chunk->file_index;
+        line_number = 1;
+      }
+      chunk->first_line_number = line_number;
+      line_number += chunk->size();
+      import(*chunk);
+      delete chunk;
+    }
+
+    pthread_join(reader_thread, NULL);
+    for (size_t i = 0; i < num_parsers; ++i) {
+      pthread_join(parser_threads[i], NULL);
+    }
+  }
+};
+
+#endif
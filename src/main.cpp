@@ -86,6 +86,13 @@ static bool has_disable_calculate_labels = false;
 static bool has_json_scan_mode = false;
 static bool has_tuning = false;
 static bool has_part_range = false;
+static bool has_bulk_load = false;
+static bool has_bloom_false_positive_rate = false;
+static bool has_bloom_capacity = false;
+static bool has_hash_prefix_bytes = false;
+static bool has_hash_count_bytes = false;
+static bool has_source_index = false;
+static bool has_binary_hash_list = false;
 
 // option values
 hashdb::settings_t settings;
@@ -95,6 +102,7 @@ static size_t step_size = settings.block_size;
 static hashdb::scan_mode_t scan_mode = hashdb::scan_mode_t::EXPANDED_OPTIMIZED;
 static std::string begin_block_hash = "";
 static std::string end_block_hash = "";
+static size_t binary_hash_size = 0;
 
 // arguments
 static std::string cmd= "";         // the command line invocation text
@@ -199,12 +207,19 @@ int main(int argc,char **argv) {
       {"disable_processing",      required_argument, 0, 'x'},
       {"json_scan_mode",          required_argument, 0, 'j'},
       {"part_range",              required_argument, 0, 'p'},
+      {"bulk_load",                     no_argument, 0, 'B'},
+      {"bloom_false_positive_rate", required_argument, 0, 'f'},
+      {"bloom_capacity",          required_argument, 0, 'c'},
+      {"hash_prefix_bytes",       required_argument, 0, 'P'},
+      {"hash_count_bytes",        required_argument, 0, 'C'},
+      {"source_index",                  no_argument, 0, 'i'},
+      {"binary_hash_list",        required_argument, 0, 'l'},
 
       // end
       {0,0,0,0}
     };
 
-    int ch = getopt_long(argc, argv, "hHvVb:s:r:w:x:j:m:p:",
+    int ch = getopt_long(argc, argv, "hHvVb:s:r:w:x:j:m:p:Bf:c:P:C:il:",
                          long_options, &option_index);
     if (ch == -1) {
       // no more arguments
@@ -300,6 +315,77 @@ int main(int argc,char **argv) {
         break;
       }
 
+      case 'B': {	// bulk load a new hashdb
+        has_bulk_load = true;
+        break;
+      }
+
+      case 'f': {	// Bloom filter false positive rate
+        has_bloom_false_positive_rate = true;
+        char* end;
+        settings.bloom_false_positive_rate = std::strtod(optarg, &end);
+        if (*end != '\0' || settings.bloom_false_positive_rate < 0.0 ||
+            settings.bloom_false_positive_rate >= 1.0) {
+          std::cerr << "Error: Invalid Bloom filter false positive rate: '"
+                    << optarg << "'.  " << see_usage << "\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'c': {	// Bloom filter capacity
+        has_bloom_capacity = true;
+        char* end;
+        settings.bloom_capacity = std::strtoull(optarg, &end, 10);
+        if (*end != '\0' || *optarg == '-' || settings.bloom_capacity == 0) {
+          std::cerr << "Error: Invalid Bloom filter capacity: '"
+                    << optarg << "'.  " << see_usage << "\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'P': {	// hash store prefix width
+        has_hash_prefix_bytes = true;
+        settings.hash_prefix_bytes = std::atoi(optarg);
+        if (!hashdb::settings_t::valid_hash_prefix_bytes(
+                                           settings.hash_prefix_bytes)) {
+          std::cerr << "Error: Invalid hash prefix bytes: '"
+                    << optarg << "'.  " << see_usage << "\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'C': {	// hash store count width
+        has_hash_count_bytes = true;
+        settings.hash_count_bytes = std::atoi(optarg);
+        if (!hashdb::settings_t::valid_hash_count_bytes(
+                                           settings.hash_count_bytes)) {
+          std::cerr << "Error: Invalid hash count bytes: '"
+                    << optarg << "'.  " << see_usage << "\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'i': {	// keep the source index
+        has_source_index = true;
+        settings.source_index = true;
+        break;
+      }
+
+      case 'l': {	// binary hash list input with this block hash size
+        has_binary_hash_list = true;
+        binary_hash_size = std::atoi(optarg);
+        if (binary_hash_size == 0) {
+          std::cerr << "Error: Invalid binary hash list block hash size: '"
+                    << optarg << "'.  " << see_usage << "\n";
+          exit(1);
+        }
+        break;
+      }
+
       default:
 //        std::cerr << "unexpected command character " << ch << "\n";
         exit(1);
@@ -391,6 +477,41 @@ void check_options(const std::string& options) {
     std::cerr << "The -p part range option is not allowed for this command.\n";
     exit(1);
   }
+  if (has_bulk_load && options.find("B") ==
+      std::string::npos) {
+    std::cerr << "The -B bulk load option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_bloom_false_positive_rate && options.find("f") ==
+      std::string::npos) {
+    std::cerr << "The -f Bloom filter false positive rate option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_bloom_capacity && options.find("c") ==
+      std::string::npos) {
+    std::cerr << "The -c Bloom filter capacity option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_hash_prefix_bytes && options.find("P") ==
+      std::string::npos) {
+    std::cerr << "The -P hash prefix bytes option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_hash_count_bytes && options.find("C") ==
+      std::string::npos) {
+    std::cerr << "The -C hash count bytes option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_source_index && options.find("i") ==
+      std::string::npos) {
+    std::cerr << "The -i source index option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_binary_hash_list && options.find("l") ==
+      std::string::npos) {
+    std::cerr << "The -l binary hash list option is not allowed for this command.\n";
+    exit(1);
+  }
 }
 
 void check_params(const std::string& options, size_t param_count) {
@@ -407,12 +528,29 @@ void run_command() {
 
   // new database
   if (command == "create") {
-    check_params("bamt", 1);
+    check_params("bfcPCiamt", 1);
     commands::create(args[0], settings, cmd);
 
+  // maintenance
+  } else if (command == "migrate") {
+    check_params("", 1);
+    commands::migrate(args[0], cmd);
+  } else if (command == "rebuild_hash_store") {
+    check_params("PC", 1);
+    commands::rebuild_hash_store(args[0],
+                     has_hash_prefix_bytes, settings.hash_prefix_bytes,
+                     has_hash_count_bytes, settings.hash_count_bytes, cmd);
+  } else if (command == "rebuild_source_index") {
+    check_params("", 1);
+    commands::rebuild_source_index(args[0], cmd);
+  } else if (command == "rebuild_bloom") {
+    check_params("f", 1);
+    commands::rebuild_bloom(args[0], has_bloom_false_positive_rate,
+                            settings.bloom_false_positive_rate, cmd);
+
   // import
   } else if (command == "ingest") {
-    check_params("srwREL", 2);
+    check_params("srwRELB", 2);
     if (repository_name == "") {
       repository_name = args[1];
     }
@@ -421,18 +559,27 @@ void run_command() {
              has_disable_recursive_processing,
              has_disable_calculate_entropy,
              has_disable_calculate_labels,
+             has_bulk_load,
              cmd);
 
   } else if (command == "import_tab") {
-    check_params("rw", 2);
+    check_params("rwB", 2);
     if (repository_name == "") {
       repository_name = args[1];
     }
-    commands::import_tab(args[0], args[1], repository_name, whitelist_dir, cmd);
+    commands::import_tab(args[0], args[1], repository_name, whitelist_dir,
+                         has_bulk_load, cmd);
 
   } else if (command == "import") {
-    check_params("", 2);
-    commands::import_json(args[0], args[1], cmd);
+    check_options("B");
+    // check param count
+    if (args.size() < 2) {
+      std::cerr << "The number of paramters provided is not valid for this command.\n";
+      exit(1);
+    }
+    commands::import_json(args[0],
+                   std::vector<std::string>(args.begin() + 1, args.end()),
+                   has_bulk_load, cmd);
 
   } else if (command == "export") {
     check_params("p", 2);
@@ -443,6 +590,14 @@ void run_command() {
       commands::export_json(args[0], args[1], cmd);
     }
 
+  } else if (command == "dump") {
+    check_params("", 2);
+    commands::dump(args[0], args[1], cmd);
+
+  } else if (command == "load") {
+    check_params("", 2);
+    commands::load(args[0], args[1], cmd);
+
   // database manipulation
   } else if (command == "add") {
     check_params("", 2);
@@ -501,8 +656,8 @@ void run_command() {
 
   // scan
   } else if (command == "scan_list") {
-    check_params("j", 2);
-    commands::scan_list(args[0], args[1], scan_mode, cmd);
+    check_params("jl", 2);
+    commands::scan_list(args[0], args[1], scan_mode, binary_hash_size, cmd);
 
   } else if (command == "scan_hash") {
     check_params("j", 2);
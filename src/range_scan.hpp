@@ -0,0 +1,152 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Scan the block hashes of a database in parallel.  The hashes are split
+ * into one range per scanner, see scan_manager_t::hash_ranges, and each
+ * range is walked on its own thread with its own hash_iterator_t, so each
+ * walk has its own read transaction.  Scanners keep partial results for
+ * their range.  Since the ranges are in ascending order, the caller merges
+ * the scanners in order to get results in block hash order.
+ */
+
+#ifndef RANGE_SCAN_HPP
+#define RANGE_SCAN_HPP
+
+#include "../src_libhashdb/hashdb.hpp"
+#include "../src_libhashdb/num_cpus.hpp"
+#include "progress_tracker.hpp"
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+
+/**
+ * Scan one range of hashes.  Each scanner is used by one thread.
+ */
+class range_scanner_t {
+  public:
+  virtual ~range_scanner_t() {
+  }
+
+  /**
+   * Visit the hash at it and return its source count, which is the
+   * amount of hash data visited, for tracking progress.
+   */
+  virtual uint64_t visit(const hashdb::hash_iterator_t& it) = 0;
+};
+
+/**
+ * The number of scanners to use for a range scan.
+ */
+inline size_t range_scan_threads() {
+  const int n = hashdb::numCPU();
+  return (n > 1) ? n : 1;
+}
+
+// per-thread work
+struct range_scan_job_t {
+  const hashdb::scan_manager_t* manager;
+  std::string begin_block_hash;
+  std::string end_block_hash;
+  range_scanner_t* scanner;
+  progress_tracker_t* progress_tracker;
+  pthread_mutex_t* M;
+  range_scan_job_t() : manager(NULL), begin_block_hash(), end_block_hash(),
+                       scanner(NULL), progress_tracker(NULL), M(NULL) {
+  }
+
+  private:
+  // do not allow copy or assignment
+  range_scan_job_t(const range_scan_job_t&);
+  range_scan_job_t& operator=(const range_scan_job_t&);
+};
+
+// show progress in batches to keep threads off of the progress lock
+static const uint64_t RANGE_SCAN_TRACK_BATCH = 10000;
+
+static void* run_range_scan(void* const arg) {
+  range_scan_job_t* job = static_cast<range_scan_job_t*>(arg);
+  uint64_t untracked = 0;
+  uint64_t hashes = 0;
+  for (hashdb::hash_iterator_t it(*job->manager, job->begin_block_hash,
+                                  job->end_block_hash);
+       !it.at_end(); it.next()) {
+
+    // the amount of hash data is 1 or source count + 1, see
+    // progress_tracker_t::track_hash_data
+    const uint64_t count = job->scanner->visit(it);
+    untracked += (count == 1) ? 1 : count + 1;
+
+    if (++hashes % RANGE_SCAN_TRACK_BATCH == 0) {
+      pthread_mutex_lock(job->M);
+      job->progress_tracker->track_count(untracked);
+      pthread_mutex_unlock(job->M);
+      untracked = 0;
+    }
+  }
+  pthread_mutex_lock(job->M);
+  job->progress_tracker->track_count(untracked);
+  pthread_mutex_unlock(job->M);
+  return NULL;
+}
+
+/**
+ * Scan the hashes in manager with scanners, one range per scanner, and
+ * return when all ranges are scanned.  Scanners past the last range,
+ * when there are fewer hashes than scanners, visit nothing.
+ */
+inline void range_scan(const hashdb::scan_manager_t& manager,
+                       const std::vector<range_scanner_t*>& scanners,
+                       progress_tracker_t& progress_tracker) {
+
+  std::vector<std::pair<std::string, std::string> > ranges;
+  manager.hash_ranges(scanners.size(), ranges);
+
+  pthread_mutex_t M;
+  pthread_mutex_init(&M, NULL);
+
+  std::vector<range_scan_job_t*> jobs;
+  std::vector<pthread_t> threads(ranges.size());
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    range_scan_job_t* job = new range_scan_job_t;
+    job->manager = &manager;
+    job->begin_block_hash = ranges[i].first;
+    job->end_block_hash = ranges[i].second;
+    job->scanner = scanners[i];
+    job->progress_tracker = &progress_tracker;
+    job->M = &M;
+    jobs.push_back(job);
+    if (pthread_create(&threads[i], NULL, run_range_scan, job) != 0) {
+      std::cerr << "Error: unable to start range scan thread.\n";
+      exit(1);
+    }
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    pthread_join(threads[i], NULL);
+    delete jobs[i];
+  }
+
+  pthread_mutex_destroy(&M);
+}
+
+#endif
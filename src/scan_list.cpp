@@ -20,7 +20,16 @@
 /**
  * \file
  * Scan for hashes in file where lines are "<label><tab><hex hash>".
- * Comment lines are forwarded to output.
+ * Comment lines are forwarded to output.  Alternatively, scan a binary
+ * hash list where each record is an 8-byte big-endian label followed by
+ * the binary block hash.
+ *
+ * Chunks of the list are decoded on worker threads, see
+ * line_pipeline.hpp.  The hashes of each chunk are then looked up in
+ * one sorted batch and the output of the chunk is written whole, one
+ * chunk at a time in input order, so the output is the same as for a
+ * serial scan, including which match EXPANDED_OPTIMIZED reports in
+ * full.
  */
 
 #include <config.h>
@@ -39,55 +48,196 @@
 #endif
 
 #include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
 #include "../src_libhashdb/hashdb.hpp"
+#include "line_pipeline.hpp"
+#include "scan_list.hpp"
 
-void scan_list(hashdb::scan_manager_t& manager, std::istream& in,
-               const hashdb::scan_mode_t scan_mode) {
-
-  size_t line_number = 0;
-  std::string line;
-  while(getline(in, line)) {
-    ++line_number;
-
-    // print comment lines
-    if (line[0] == '#') {
-      // forward to stdout
-      std::cout << line << "\n";
-      continue;
-    }
+// size of the label of a binary hash list record
+static const size_t BINARY_LABEL_SIZE = 8;
 
-    // skip empty lines
-    if (line.size() == 0) {
-      continue;
-    }
+// the decimal digits of the largest label
+static const size_t BINARY_LABEL_DIGITS = 20;
+
+// append the label of a binary hash list record in decimal
+static void append_binary_label(const char* const record,
+                                std::string& output) {
+  uint64_t label = 0;
+  for (size_t j = 0; j < BINARY_LABEL_SIZE; ++j) {
+    label = label << 8 | static_cast<uint8_t>(record[j]);
+  }
+  char digits[BINARY_LABEL_DIGITS];
+  char* p = digits + BINARY_LABEL_DIGITS;
+  do {
+    *--p = static_cast<char>('0' + label % 10);
+    label /= 10;
+  } while (label != 0);
+  output.append(p, digits + BINARY_LABEL_DIGITS - p);
+}
+
+// lines and the hashes they decode to
+struct scan_list_chunk_t : public line_chunk_t {
+  enum line_status_t {VALID, NO_TAB, INVALID_BLOCK_HASH, SHORT_RECORD};
+  // the block hash and line index of each line to scan
+  std::vector<std::string> block_hashes;
+  std::vector<size_t> indexes;
+  // pair(line index, status) of each invalid line
+  std::vector<std::pair<size_t, line_status_t> > invalid_lines;
+  scan_list_chunk_t() : line_chunk_t(), block_hashes(), indexes(),
+                        invalid_lines() {
+  }
+};
+
+class scan_list_pipeline_t : public line_pipeline_t {
+  private:
+  hashdb::scan_manager_t& manager;
+  const hashdb::scan_mode_t scan_mode;
+  const size_t binary_hash_size;            // 0 for text
+
+  // do not allow copy or assignment
+  scan_list_pipeline_t(const scan_list_pipeline_t&);
+  scan_list_pipeline_t& operator=(const scan_list_pipeline_t&);
+
+  protected:
+  line_chunk_t* new_chunk() {
+    return new scan_list_chunk_t;
+  }
+
+  void parse(line_chunk_t& p_chunk) {
+    scan_list_chunk_t& chunk = static_cast<scan_list_chunk_t&>(p_chunk);
+    const size_t count = chunk.size();
+
+    // labels are formatted from the line as the output is composed
+    std::vector<std::string>& block_hashes = chunk.block_hashes;
+    std::vector<size_t>& indexes = chunk.indexes;
+    block_hashes.reserve(count);
+    indexes.reserve(count);
 
-    // find tabs
-    size_t tab_index1 = line.find('\t');
-    if (tab_index1 == std::string::npos) {
-      std::cerr << "Tab not found on line " << line_number << ": '" << line << "'\n";
-      continue;
+    for (size_t i = 0; i < count; ++i) {
+      const char* const line = chunk.line(i);
+      const size_t line_size = chunk.line_size(i);
+      std::string block_hash;
+
+      if (binary_hash_size != 0) {
+        // label then block hash
+        if (line_size != BINARY_LABEL_SIZE + binary_hash_size) {
+          chunk.invalid_lines.push_back(std::pair<size_t,
+                  scan_list_chunk_t::line_status_t>(
+                  i, scan_list_chunk_t::SHORT_RECORD));
+          continue;
+        }
+        block_hash.assign(line + BINARY_LABEL_SIZE, binary_hash_size);
+
+      } else {
+
+        // comment and empty lines are not scanned
+        if (line_size == 0 || line[0] == '#') {
+          continue;
+        }
+
+        // find tab
+        const char* const tab = static_cast<const char*>(
+                                        memchr(line, '\t', line_size));
+        if (tab == NULL) {
+          chunk.invalid_lines.push_back(std::pair<size_t,
+                  scan_list_chunk_t::line_status_t>(
+                  i, scan_list_chunk_t::NO_TAB));
+          continue;
+        }
+
+        // get block hash
+        const size_t hex_size = line + line_size - tab - 1;
+        block_hash.resize(hex_size / 2);
+        if (hex_size == 0 ||
+            !hashdb::hex_to_bin(tab + 1, hex_size, &block_hash[0])) {
+          chunk.invalid_lines.push_back(std::pair<size_t,
+                  scan_list_chunk_t::line_status_t>(
+                  i, scan_list_chunk_t::INVALID_BLOCK_HASH));
+          continue;
+        }
+      }
+      block_hashes.push_back(block_hash);
+      indexes.push_back(i);
     }
+  }
 
-    // get label
-    std::string label = line.substr(0, tab_index1);
+  void import(line_chunk_t& p_chunk) {
+    scan_list_chunk_t& chunk = static_cast<scan_list_chunk_t&>(p_chunk);
 
-    // get block hash
-    std::string block_hashdigest_string = line.substr(tab_index1+1);
-    std::string block_binary_hash = hashdb::hex_to_bin(block_hashdigest_string);
-    if (block_binary_hash == "") {
-      std::cerr << "Invalid block hash on line " << line_number
-                << ": '" << line << "'\n";
-      continue;
+    // report invalid lines
+    for (size_t j = 0; j < chunk.invalid_lines.size(); ++j) {
+      const size_t i = chunk.invalid_lines[j].first;
+      const size_t line_number = chunk.first_line_number + i;
+      const std::string line(chunk.line(i), chunk.line_size(i));
+      switch(chunk.invalid_lines[j].second) {
+        case scan_list_chunk_t::NO_TAB:
+          std::cerr << "Tab not found on line " << line_number << ": '" << line << "'\n";
+          break;
+        case scan_list_chunk_t::INVALID_BLOCK_HASH:
+          std::cerr << "Invalid block hash on line " << line_number
+                    << ": '" << line << "'\n";
+          break;
+        case scan_list_chunk_t::SHORT_RECORD:
+          std::cerr << "Incomplete record " << line_number
+                    << " at the end of the binary hash list\n";
+          break;
+        default: assert(0);
+      }
     }
 
-    // scan
-    const std::string expanded_text = manager.find_hash_json(
-                                              scan_mode, block_binary_hash);
-    if (expanded_text.size() != 0) {
-      std::cout << label << "\t"
-                << block_hashdigest_string << "\t"
-                << expanded_text << std::endl;
+    // scan here rather than on the workers so that EXPANDED_OPTIMIZED
+    // reports each match in full where a serial scan would
+    std::vector<std::string> json_texts;
+    manager.find_hashes_json(scan_mode, chunk.block_hashes, json_texts);
+
+    // compose the output in input order
+    std::string output;
+    size_t next = 0;
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      if (next < chunk.indexes.size() && chunk.indexes[next] == i) {
+        const std::string& expanded_text = json_texts[next];
+        if (expanded_text.size() != 0) {
+          if (binary_hash_size != 0) {
+            append_binary_label(chunk.line(i), output);
+            output += "\t";
+            output += hashdb::bin_to_hex(chunk.block_hashes[next]);
+          } else {
+            // the line is the label and the hash separated by a tab
+            output.append(chunk.line(i), chunk.line_size(i));
+          }
+          output += "\t";
+          output += expanded_text;
+          output += "\n";
+        }
+        ++next;
+
+      } else if (binary_hash_size == 0 && chunk.line(i)[0] == '#') {
+        // forward comment lines
+        output.append(chunk.line(i), chunk.line_size(i));
+        output += "\n";
+      }
     }
+
+    // write the output of the chunk
+    std::cout.write(output.c_str(), output.size());
   }
-}
 
+  public:
+  scan_list_pipeline_t(hashdb::scan_manager_t& p_manager,
+                       const hashdb::scan_mode_t p_scan_mode,
+                       const size_t p_binary_hash_size) :
+          line_pipeline_t((p_binary_hash_size == 0) ? 0 :
+                          BINARY_LABEL_SIZE + p_binary_hash_size),
+          manager(p_manager), scan_mode(p_scan_mode),
+          binary_hash_size(p_binary_hash_size) {
+  }
+};
+
+void scan_list(hashdb::scan_manager_t& manager, std::istream& in,
+               const hashdb::scan_mode_t scan_mode,
+               const size_t binary_hash_size) {
+  scan_list_pipeline_t pipeline(manager, scan_mode, binary_hash_size);
+  pipeline.run(std::vector<std::istream*>(1, &in));
+}
@@ -20,7 +20,9 @@
 /**
  * \file
  * Scan for hashes in file where lines are "<label><tab><hex hash>".
- * Comment lines are forwarded to output.
+ * Comment lines are forwarded to output.  Alternatively, scan a binary
+ * hash list where each record is an 8-byte big-endian label followed by
+ * the binary block hash.
  */
 
 #ifndef SCAN_LIST_HPP
@@ -29,7 +31,13 @@
 #include <iostream>
 #include "../src_libhashdb/hashdb.hpp"
 
+/**
+ * Scan the list on worker threads, writing matches in input order.
+ * Read a binary hash list of binary_hash_size block hashes, else text
+ * when binary_hash_size is 0.
+ */
 void scan_list(hashdb::scan_manager_t& manager, std::istream& in,
-               const hashdb::scan_mode_t scan_mode);
+               const hashdb::scan_mode_t scan_mode,
+               const size_t binary_hash_size);
 
 #endif
@@ -43,14 +43,24 @@ void overview() {
   << "       hashdb [options] <command> [<args>]\n"
   << "\n"
   << "New Database:\n"
-  << "  create [-b <block size>] <hashdb>\n"
+  << "  create [-b <block size>] [-f <rate>] [-P <prefix bytes>]\n"
+  << "         [-C <count bytes>] [-i] <hashdb>\n"
+  << "\n"
+  << "Maintenance:\n"
+  << "  migrate <hashdb>\n"
+  << "  rebuild_bloom [-f <rate>] <hashdb>\n"
+  << "  rebuild_hash_store [-P <prefix bytes>] [-C <count bytes>] <hashdb>\n"
+  << "  rebuild_source_index <hashdb>\n"
   << "\n"
   << "Import/Export:\n"
   << "  ingest [-r <repository name>] [-w <whitelist.hdb>] [-s <step size>]\n"
-  << "         [-x <rel>] <hashdb.hdb> <import directory>\n"
-  << "  import_tab [-r <repository name>] [-w <whitelist.hdb>] <hashdb> <tab file>\n"
-  << "  import <hashdb> <json file>\n"
+  << "         [-x <rel>] [-B] <hashdb.hdb> <import directory>\n"
+  << "  import_tab [-r <repository name>] [-w <whitelist.hdb>] [-B] <hashdb>\n"
+  << "             <tab file>\n"
+  << "  import [-B] <hashdb> <json file> [<json file> ...]\n"
   << "  export [-p <begin:end>] <hashdb> <json file>\n"
+  << "  dump <hashdb> <dump file>\n"
+  << "  load <hashdb> <dump file>\n"
   << "\n"
   << "Database Manipulation:\n"
   << "  add <source hashdb> <destination hashdb>\n"
@@ -64,7 +74,7 @@ void overview() {
   << "  subtract_repository <source hashdb> <destination hashdb> <repository name>\n"
   << "\n"
   << "Scan:\n"
-  << "  scan_list [-j e|o|c|a] <hashdb> <hash list file>\n"
+  << "  scan_list [-j e|o|c|a] [-l <hash size>] <hashdb> <hash list file>\n"
   << "  scan_hash [-j e|o|c|a] <hashdb> <hex block hash>\n"
   << "  scan_media [-s <step size>] [-j e|o|c|a] [-x <r>] <hashdb> <media image>\n"
   << "\n"
@@ -91,24 +101,108 @@ static void create() {
   const hashdb::settings_t settings;
 
   std::cout
-  << "create [-b <block size>] <hashdb>\n"
+  << "create [-b <block size>] [-f <rate>] [-c <hashes>]\n"
+  << "       [-P <prefix bytes>] [-C <count bytes>] [-i] <hashdb>\n"
   << "  Create a new <hashdb> hash database.\n"
   << "\n"
   << "  Options:\n"
   << "  -b, --block_size=<block size>\n"
   << "    <block size>, in bytes, or use 0 for no restriction\n"
   << "    (default " << settings.block_size << ")\n"
+  << "  -f, --bloom_false_positive_rate=<rate>\n"
+  << "    Keep a Bloom filter that screens out absent hashes during scans,\n"
+  << "    with false positive <rate>, for example 0.01, or use 0 for none\n"
+  << "    (default " << settings.bloom_false_positive_rate << ")\n"
+  << "  -c, --bloom_capacity=<hashes>\n"
+  << "    The number of <hashes> to size the Bloom filter for.  The file is\n"
+  << "    sparse and fills as hashes are imported\n"
+  << "    (default " << settings.bloom_capacity << ")\n"
+  << "  -P, --hash_prefix_bytes=<prefix bytes>\n"
+  << "    The number of leading hash bytes kept in the hash store, from 1\n"
+  << "    to " << hashdb::settings_t::MAX_HASH_PREFIX_BYTES
+  << ".  Wider prefixes collide less and take more space\n"
+  << "    (default " << settings.hash_prefix_bytes << ")\n"
+  << "  -C, --hash_count_bytes=<count bytes>\n"
+  << "    The width of the approximate hash counts in the hash store: 0 for\n"
+  << "    presence only, 1 for a logarithmic count, or 2 or 4 for clipped\n"
+  << "    counts (default " << settings.hash_count_bytes << ")\n"
+  << "  -i, --source_index\n"
+  << "    Keep the block hashes of each source so hash_table, add_repository\n"
+  << "    and subtract_repository read only the hashes of the sources they\n"
+  << "    need rather than every hash\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>   the file path to the new hash database to create\n"
   ;
 }
 
+// Maintenance
+static void migrate() {
+  std::cout
+  << "migrate <hashdb>\n"
+  << "  Move the stores of a <hashdb> hash database made by an earlier\n"
+  << "  version into the current layout: one LMDB environment so that one\n"
+  << "  transaction updates all stores, with the per-source records of\n"
+  << "  hashes with several sources in their own fixed-width store.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>   the hash database to migrate\n"
+  ;
+}
+
+static void rebuild_hash_store() {
+  std::cout
+  << "rebuild_hash_store [-P <prefix bytes>] [-C <count bytes>] <hashdb>\n"
+  << "  Rebuild the hash store of a <hashdb> hash database from its hash\n"
+  << "  data store and show the fraction of hashes that share a prefix with\n"
+  << "  another hash.  Do not use the database while rebuilding.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -P, --hash_prefix_bytes=<prefix bytes>\n"
+  << "    The new prefix width (default is the width in the hashdb settings)\n"
+  << "  -C, --hash_count_bytes=<count bytes>\n"
+  << "    The new count width (default is the width in the hashdb settings)\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>   the hash database to rebuild the hash store of\n"
+  ;
+}
+
+static void rebuild_source_index() {
+  std::cout
+  << "rebuild_source_index <hashdb>\n"
+  << "  Build the source index of a <hashdb> hash database from its hash\n"
+  << "  data store and keep it from then on, see create -i.  Do not use the\n"
+  << "  database while building.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>   the hash database to build the source index of\n"
+  ;
+}
+
+static void rebuild_bloom() {
+  std::cout
+  << "rebuild_bloom [-f <rate>] <hashdb>\n"
+  << "  Rebuild the Bloom filter of a <hashdb> hash database, sized for the\n"
+  << "  hashes in the database.  Rebuild after importing many more hashes\n"
+  << "  than the filter was sized for, or after an operating system crash\n"
+  << "  during an import.  Do not import while rebuilding.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -f, --bloom_false_positive_rate=<rate>\n"
+  << "    The false positive <rate>, or use 0 to remove the Bloom filter\n"
+  << "    (default is the rate in the hashdb settings)\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>   the hash database to rebuild the Bloom filter of\n"
+  ;
+}
+
 // Import/Export
 static void ingest() {
   std::cout
   << "ingest [-r <repository name>] [-w <whitelist.hdb>] [-s <step size>]\n"
-  << "       [-x <rel>] <hashdb.hdb> <import directory>\n"
+  << "       [-x <rel>] [-B] <hashdb.hdb> <import directory>\n"
   << "  Import hashes recursively from <import directory> into hash database\n"
   << "    <hashdb>.\n"
   << "\n"
@@ -126,6 +220,10 @@ static void ingest() {
   << "      r disables recursively processing embedded data.\n"
   << "      e disables calculating entropy.\n"
   << "      l disables calculating block labels.\n"
+  << "  -B, --bulk_load\n"
+  << "    Build a new, empty hash database in hash order by sorting the hashes\n"
+  << "    on disk and appending them when done.  This is much faster for large\n"
+  << "    imports.  Hashes are not visible until the import completes.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <import dir>   the directory to recursively import from\n"
@@ -135,7 +233,8 @@ static void ingest() {
 
 static void import_tab() {
   std::cout
-  << "import_tab [-r <repository name>] [-w <whitelist.hdb>] <hashdb> <tab file>\n"
+  << "import_tab [-r <repository name>] [-w <whitelist.hdb>] [-B] <hashdb>\n"
+  << "           <tab file>\n"
   << "  Import hashes from file <tab file> into hash database <hashdb>.\n"
   << "\n"
   << "  Options:\n"
@@ -145,6 +244,10 @@ static void import_tab() {
   << "  -w, --whitelist_dir\n"
   << "    The path to a whitelist hash database.  Hashes matching this database\n"
   << "    will be marked with a whitelist entropy flag.\n"
+  << "  -B, --bulk_load\n"
+  << "    Build a new, empty hash database in hash order by sorting the hashes\n"
+  << "    on disk and appending them when done.  This is much faster for large\n"
+  << "    imports.  Hashes are not visible until the import completes.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>       the hash database to insert the imported hashes into\n"
@@ -154,12 +257,19 @@ static void import_tab() {
 
 static void import() {
   std::cout
-  << "import <hashdb> <json file>\n"
-  << "  Import hashes from file <json file> into hash database <hashdb>.\n"
+  << "import [-B] <hashdb> <json file> [<json file> ...]\n"
+  << "  Import hashes from one or more <json file> files into hash database\n"
+  << "  <hashdb>.  Files are imported in the order given.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -B, --bulk_load\n"
+  << "    Build a new, empty hash database in hash order by sorting the hashes\n"
+  << "    on disk and appending them when done.  This is much faster for large\n"
+  << "    imports.  Hashes are not visible until the import completes.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>       the hash database to insert the imported hashes into\n"
-  << "  <json file>    the JSON file to import hashes from\n"
+  << "  <json file>    a JSON file to import hashes from\n"
   ;
 }
 
@@ -179,6 +289,30 @@ static void export_json() {
   ;
 }
 
+static void dump() {
+  std::cout
+  << "dump <hashdb> <dump file>\n"
+  << "  Write hash database <hashdb> into file <dump file> in binary format.\n"
+  << "  Binary dumps are much smaller and faster to load than JSON exports.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the hash database to dump\n"
+  << "  <dump file>    the file to write the binary dump into\n"
+  ;
+}
+
+static void load() {
+  std::cout
+  << "load <hashdb> <dump file>\n"
+  << "  Load the binary dump in file <dump file> into hash database <hashdb>.\n"
+  << "  Loading into a hash database with no hashes appends the hashes in order.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the hash database to load the binary dump into\n"
+  << "  <dump file>    the binary dump file to load\n"
+  ;
+}
+
 // Database Manipulation
 static void add() {
   std::cout
@@ -312,9 +446,10 @@ static void subtract_repository() {
 
 static void scan_list() {
   std::cout
-  << "scan_list [-j e|o|c|a] <hashdb> <hash list file>\n"
+  << "scan_list [-j e|o|c|a] [-l <hash size>] <hashdb> <hash list file>\n"
   << "  Scan hash database <hashdb> for hashes in <hash list file> and print out\n"
-  << "  matches.\n"
+  << "  matches.  The list is scanned on all CPUs and matches are printed in\n"
+  << "  list order.\n"
   << "\n"
   << "  Options:\n"
   << "  -j, --json_scan_mode\n"
@@ -324,6 +459,9 @@ static void scan_list() {
   << "        information.\n"
   << "      c return hash duplicates count\n"
   << "      a return approximate hash duplicates count\n"
+  << "  -l, --binary_hash_list <hash size>\n"
+  << "    Read <hash list file> as binary records, each an 8-byte big-endian\n"
+  << "    label followed by a binary block hash of <hash size> bytes.\n"
   << "  -x, --disable_processing\n"
   << "    Disable further processing:\n"
   << "      r disables recursively processing embedded data.\n"
@@ -588,12 +726,21 @@ static void all() {
   std::cout << "\nNew Database:\n";
   create();
 
+  // Maintenance
+  std::cout << "\nMaintenance:\n";
+  migrate();
+  rebuild_bloom();
+  rebuild_hash_store();
+  rebuild_source_index();
+
   // Import/Export
   std::cout << "\nImport/Export:\n";
   ingest();
   import_tab();
   import();
   export_json();
+  dump();
+  load();
 
   // Database Manipulation
   std::cout << "\nDatabase Manipulation:\n";
@@ -640,11 +787,19 @@ void usage(const std::string& command) {
   // New Database
   else if (command == "create") create();
 
+  // Maintenance
+  else if (command == "migrate") migrate();
+  else if (command == "rebuild_bloom") rebuild_bloom();
+  else if (command == "rebuild_hash_store") rebuild_hash_store();
+  else if (command == "rebuild_source_index") rebuild_source_index();
+
   // Import/Export
   else if (command == "ingest") ingest();
   else if (command == "import_tab") import_tab();
   else if (command == "import") import();
   else if (command == "export") export_json();
+  else if (command == "dump") dump();
+  else if (command == "load") load();
 
   // Database Manipulation
   else if (command == "add") add();
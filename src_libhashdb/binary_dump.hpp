@@ -0,0 +1,278 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Read and write the hashdb binary dump format, a compact alternative to
+ * JSON export and import.  A dump is a header followed by chunks:
+ *
+ *   header: "hashdbbd" magic, 4-byte version, 4-byte block hash size
+ *   chunk:  1-byte type, 4-byte record count, 4-byte payload size,
+ *           payload, 4-byte CRC-32 of the payload
+ *
+ * Fixed-width fields are big-endian.  Chunk types are:
+ *
+ *   'S' sources, in file hash order.  Each record is the file hash,
+ *       filesize, file type, zero count, nonprobative count, and the
+ *       number of repository name, filename pairs followed by the pairs.
+ *   'H' hashes, in block hash order.  Each record is the block hash,
+ *       exactly block hash size bytes, k_entropy, block label, and the
+ *       number of sources followed by source index, sub_count pairs,
+ *       where the source index is the position of the source among all
+ *       source records.
+ *   'E' end, with the number of sources and hashes in the dump.
+ *
+ * All source chunks come before hash chunks.  Numbers in payloads are
+ * encoded as in the LMDB stores, see lmdb_helper::encode_uint64_t, and
+ * strings are a length then their bytes.  Chunks may be read one at a
+ * time from a stream or located in a mapped file by their sizes.
+ */
+
+#ifndef BINARY_DUMP_HPP
+#define BINARY_DUMP_HPP
+
+#include "lmdb_helper.h"
+#include "crc32.h"
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+
+namespace hashdb {
+
+static const char binary_dump_magic[] = "hashdbbd";
+static const uint32_t BINARY_DUMP_VERSION = 1;
+
+// a chunk is written once its payload reaches this size
+static const size_t BINARY_DUMP_CHUNK_SIZE = 1 << 20;
+
+/**
+ * Write a binary dump to a stream.  Add records of one chunk type at a
+ * time.  Not threadsafe.
+ */
+class binary_dump_writer_t {
+
+  private:
+  std::ostream& os;
+  char chunk_type;
+  uint32_t record_count;
+  std::string payload;
+
+  // do not allow copy or assignment
+  binary_dump_writer_t(const binary_dump_writer_t&);
+  binary_dump_writer_t& operator=(const binary_dump_writer_t&);
+
+  static void put_uint32(std::string& s, const uint32_t value) {
+    s.push_back(static_cast<char>(value >> 24));
+    s.push_back(static_cast<char>(value >> 16));
+    s.push_back(static_cast<char>(value >> 8));
+    s.push_back(static_cast<char>(value));
+  }
+
+  public:
+  binary_dump_writer_t(std::ostream& p_os, const uint32_t hash_size) :
+                 os(p_os), chunk_type(0), record_count(0), payload() {
+    std::string header(binary_dump_magic, 8);
+    put_uint32(header, BINARY_DUMP_VERSION);
+    put_uint32(header, hash_size);
+    os.write(header.c_str(), header.size());
+  }
+
+  // write the pending chunk, if any
+  void write_chunk() {
+    if (record_count == 0) {
+      return;
+    }
+    std::string chunk_header(1, chunk_type);
+    put_uint32(chunk_header, record_count);
+    put_uint32(chunk_header, payload.size());
+    std::string crc;
+    put_uint32(crc, hashdb::crc32(0, reinterpret_cast<const uint8_t*>(
+                                    payload.c_str()), payload.size()));
+    os.write(chunk_header.c_str(), chunk_header.size());
+    os.write(payload.c_str(), payload.size());
+    os.write(crc.c_str(), crc.size());
+    record_count = 0;
+    payload.clear();
+  }
+
+  // start a record of type, writing the pending chunk when the type
+  // changes or the chunk is full
+  void begin_record(const char type) {
+    if (type != chunk_type || payload.size() >= BINARY_DUMP_CHUNK_SIZE) {
+      write_chunk();
+      chunk_type = type;
+    }
+    ++record_count;
+  }
+
+  void put_number(const uint64_t value) {
+    uint8_t buffer[10];
+    const uint8_t* const p = lmdb_helper::encode_uint64_t(value, buffer);
+    payload.append(reinterpret_cast<const char*>(buffer), p - buffer);
+  }
+
+  void put_bytes(const std::string& bytes) {
+    payload.append(bytes);
+  }
+
+  void put_string(const std::string& bytes) {
+    put_number(bytes.size());
+    payload.append(bytes);
+  }
+
+  // write the end chunk
+  void finish(const uint64_t source_count, const uint64_t hash_count) {
+    begin_record('E');
+    put_number(source_count);
+    put_number(hash_count);
+    write_chunk();
+    os.flush();
+  }
+};
+
+/**
+ * Read a binary dump from a stream one chunk at a time, checking each
+ * chunk.  Readers return false and set error_message on bad input.  Not
+ * threadsafe.
+ */
+class binary_dump_reader_t {
+
+  private:
+  std::istream& is;
+  std::string payload;
+  const uint8_t* p;
+  const uint8_t* p_stop;
+
+  // do not allow copy or assignment
+  binary_dump_reader_t(const binary_dump_reader_t&);
+  binary_dump_reader_t& operator=(const binary_dump_reader_t&);
+
+  static uint32_t get_uint32(const char* const bytes) {
+    const uint8_t* const b = reinterpret_cast<const uint8_t*>(bytes);
+    return (static_cast<uint32_t>(b[0]) << 24) |
+           (static_cast<uint32_t>(b[1]) << 16) |
+           (static_cast<uint32_t>(b[2]) << 8) |
+           static_cast<uint32_t>(b[3]);
+  }
+
+  public:
+  uint32_t hash_size;
+  char chunk_type;
+  uint32_t record_count;
+  std::string error_message;
+
+  binary_dump_reader_t(std::istream& p_is) :
+                 is(p_is), payload(), p(NULL), p_stop(NULL), hash_size(0),
+                 chunk_type(0), record_count(0), error_message("") {
+  }
+
+  // read and check the header
+  bool read_header() {
+    char header[16];
+    is.read(header, sizeof(header));
+    if (is.gcount() != sizeof(header) ||
+        memcmp(header, binary_dump_magic, 8) != 0) {
+      error_message = "The input is not a hashdb binary dump.";
+      return false;
+    }
+    if (get_uint32(header + 8) != BINARY_DUMP_VERSION) {
+      error_message = "The hashdb binary dump version is not supported.";
+      return false;
+    }
+    hash_size = get_uint32(header + 12);
+    return true;
+  }
+
+  // read and check the next chunk
+  bool read_chunk() {
+    char chunk_header[9];
+    is.read(chunk_header, sizeof(chunk_header));
+    if (is.gcount() != sizeof(chunk_header)) {
+      error_message = "The hashdb binary dump ends before its end chunk.";
+      return false;
+    }
+    chunk_type = chunk_header[0];
+    record_count = get_uint32(chunk_header + 1);
+    const uint32_t payload_size = get_uint32(chunk_header + 5);
+    payload.resize(payload_size);
+    char crc[4];
+    if (payload_size != 0) {
+      is.read(&payload[0], payload_size);
+    }
+    if (static_cast<uint32_t>(is.gcount()) == payload_size) {
+      is.read(crc, sizeof(crc));
+    }
+    if (!is) {
+      error_message = "The hashdb binary dump ends inside a chunk.";
+      return false;
+    }
+    if (get_uint32(crc) != hashdb::crc32(0, reinterpret_cast<const uint8_t*>(
+                                  payload.c_str()), payload.size())) {
+      error_message = "Checksum error in hashdb binary dump chunk.";
+      return false;
+    }
+    p = reinterpret_cast<const uint8_t*>(payload.c_str());
+    p_stop = p + payload.size();
+    return true;
+  }
+
+  // true when the chunk payload is used up
+  bool at_chunk_end() const {
+    return p == p_stop;
+  }
+
+  bool get_number(uint64_t& value) {
+    // a number takes at most 10 bytes
+    if (p_stop - p < 10) {
+      uint8_t buffer[10];
+      memset(buffer, 0, sizeof(buffer));
+      memcpy(buffer, p, p_stop - p);
+      const uint8_t* const q = lmdb_helper::decode_uint64_t(buffer, value);
+      if (q - buffer > p_stop - p) {
+        error_message = "Data error in hashdb binary dump chunk.";
+        return false;
+      }
+      p += q - buffer;
+      return true;
+    }
+    p = lmdb_helper::decode_uint64_t(p, value);
+    return true;
+  }
+
+  bool get_bytes(const size_t size, std::string& bytes) {
+    if (static_cast<size_t>(p_stop - p) < size) {
+      error_message = "Data error in hashdb binary dump chunk.";
+      return false;
+    }
+    bytes.assign(reinterpret_cast<const char*>(p), size);
+    p += size;
+    return true;
+  }
+
+  bool get_string(std::string& bytes) {
+    uint64_t size;
+    return get_number(size) && get_bytes(size, bytes);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,64 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * The bytes of a block hash held in a std::string or in a block_hash_t,
+ * so that the sorted batch lookups take either.
+ */
+
+#ifndef BLOCK_HASH_BYTES_HPP
+#define BLOCK_HASH_BYTES_HPP
+
+#include <cstring>
+#include <string>
+#include "hashdb.hpp"
+
+namespace hashdb {
+
+  inline const char* hash_bytes(const std::string& block_hash) {
+    return block_hash.data();
+  }
+
+  inline size_t hash_size(const std::string& block_hash) {
+    return block_hash.size();
+  }
+
+  inline const char* hash_bytes(const block_hash_t& block_hash) {
+    return block_hash.data;
+  }
+
+  inline size_t hash_size(const block_hash_t& block_hash) {
+    return block_hash.size;
+  }
+
+  // order block hashes as std::string orders their bytes
+  template <typename T>
+  inline bool hash_less(const T& a, const T& b) {
+    const size_t a_size = hash_size(a);
+    const size_t b_size = hash_size(b);
+    const int c = memcmp(hash_bytes(a), hash_bytes(b),
+                         (a_size < b_size) ? a_size : b_size);
+    return (c < 0 || (c == 0 && a_size < b_size));
+  }
+
+} // end namespace hashdb
+
+#endif
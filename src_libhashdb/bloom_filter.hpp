@@ -0,0 +1,347 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Manage the optional hashdb Bloom filter file.  The filter answers
+ * "definitely absent" for most hashes that are not in the hashdb without
+ * touching LMDB.  It is cache-line blocked: each hash maps to one 64-byte
+ * block and all k of its bits are in that block, so a lookup reads one
+ * cache line.  The file is mapped shared so scanners see bits set by an
+ * importer in another process.  Bits are set before the hash is written to
+ * LMDB so the filter never reports a stored hash as absent.
+ *
+ * The file is a 64-byte header followed by the blocks.  Header fields are
+ * in host byte order.  The header counts the adds that set a new bit, which
+ * is about the number of distinct hashes, so a filter that has filled past
+ * the capacity it was sized for can be noticed and rebuilt.  Add is
+ * threadsafe.  Find is threadsafe.
+ *
+ * The file is created sparse, so blocks take disk space as hashes land
+ * in them.  Changes are synced when the filter is closed rather than with
+ * each LMDB commit, so a crash of the operating system can leave LMDB
+ * holding hashes whose bits were lost.  Rebuild the filter after such a
+ * crash.
+ */
+
+#ifndef BLOOM_FILTER_HPP
+#define BLOOM_FILTER_HPP
+
+#include "file_modes.h"
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <cerrno>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+namespace hashdb {
+
+class bloom_filter_t {
+
+  private:
+  static const size_t header_size = 64;
+  static const size_t block_size = 64;          // one cache line
+  static const size_t block_bits = block_size * 8;
+  static const uint32_t file_version = 1;
+  static const uint32_t max_k = 16;
+
+  struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t k;
+    uint64_t num_blocks;
+    uint64_t capacity;
+    uint64_t hash_count;                        // adds that set a new bit
+  };
+
+  const hashdb::file_mode_type_t file_mode;
+  int fd;
+  size_t map_size;
+  uint8_t* map;
+  uint32_t k;
+  uint64_t num_blocks;
+  uint64_t capacity;
+
+  // do not allow copy or assignment
+  bloom_filter_t(const bloom_filter_t&);
+  bloom_filter_t& operator=(const bloom_filter_t&);
+
+  bloom_filter_t(const hashdb::file_mode_type_t p_file_mode) :
+       file_mode(p_file_mode), fd(-1), map_size(0), map(NULL),
+       k(0), num_blocks(0), capacity(0) {
+  }
+
+  static void set_magic(char* magic) {
+    std::memcpy(magic, "hashdbBF", 8);
+  }
+
+  // FNV-1a over the hash bytes then the splitmix64 finalizer.  Block
+  // hashes are usually digests already but any byte string is accepted.
+  static uint64_t hash64(const char* const block_hash, const size_t size,
+                         const uint64_t seed) {
+    uint64_t h = 14695981039346656037ULL ^ seed;
+    for (size_t i = 0; i < size; ++i) {
+      h ^= static_cast<uint8_t>(block_hash[i]);
+      h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+  }
+
+  // the block for the hash and the start and odd step of its bit positions
+  void locate(const char* const block_hash, const size_t size,
+              uint64_t*& block, uint32_t& start, uint32_t& step) const {
+    const uint64_t h1 = hash64(block_hash, size, 0);
+    const uint64_t h2 = hash64(block_hash, size, h1);
+    block = reinterpret_cast<uint64_t*>(
+                  map + header_size + (h1 % num_blocks) * block_size);
+    start = static_cast<uint32_t>(h2);
+    step = static_cast<uint32_t>(h2 >> 32) | 1;
+  }
+
+  public:
+  /**
+   * Create a zeroed filter file sized for capacity hashes at the given
+   * false positive rate.  Return "" or reason for failure.
+   */
+  static std::string create(const std::string& filename,
+                            const uint64_t p_capacity,
+                            const double false_positive_rate) {
+
+    if (!(false_positive_rate > 0.0 && false_positive_rate < 1.0)) {
+      return "Invalid Bloom filter false positive rate.";
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    // bits per hash and number of bit probes for the rate, with blocking
+    // costing a little more than the classic formula
+    const double ln2 = std::log(2.0);
+    const double bits_per_hash = -std::log(false_positive_rate) / (ln2 * ln2);
+    uint32_t new_k = static_cast<uint32_t>(bits_per_hash * ln2 + 0.5);
+    if (new_k < 1) new_k = 1;
+    if (new_k > max_k) new_k = max_k;
+    const uint64_t cap = (p_capacity == 0) ? 1 : p_capacity;
+    const double total_bits = bits_per_hash * 1.1 * static_cast<double>(cap);
+    const uint64_t new_num_blocks =
+                 static_cast<uint64_t>(total_bits / block_bits) + 1;
+
+    // the file must not exist yet
+    const int new_fd = ::open(filename.c_str(),
+                              O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (new_fd < 0) {
+      return "Unable to create Bloom filter file '" + filename + "': " +
+             strerror(errno);
+    }
+
+    header_t header;
+    std::memset(&header, 0, sizeof(header));
+    set_magic(header.magic);
+    header.version = file_version;
+    header.k = new_k;
+    header.num_blocks = new_num_blocks;
+    header.capacity = cap;
+    uint8_t header_block[header_size];
+    std::memset(header_block, 0, header_size);
+    std::memcpy(header_block, &header, sizeof(header));
+
+    // write the header and extend the file with zeroed blocks
+    const off_t file_size = static_cast<off_t>(
+                          header_size + new_num_blocks * block_size);
+    if (::write(new_fd, header_block, header_size) !=
+                           static_cast<ssize_t>(header_size) ||
+        ftruncate(new_fd, file_size) != 0 ||
+        fsync(new_fd) != 0) {
+      const std::string reason = strerror(errno);
+      ::close(new_fd);
+      std::remove(filename.c_str());
+      return "Unable to write Bloom filter file '" + filename + "': " +
+             reason;
+    }
+    ::close(new_fd);
+    return "";
+#else
+    return "The Bloom filter requires mmap support.";
+#endif
+  }
+
+  /**
+   * Map the filter file read-only for READ_ONLY else read-write.  Return
+   * NULL when there is no usable filter file, in which case lookups fall
+   * back to the hash store.
+   */
+  static bloom_filter_t* open(const std::string& filename,
+                              const hashdb::file_mode_type_t p_file_mode) {
+
+    // the filter is optional
+    if (access(filename.c_str(), F_OK) != 0) {
+      return NULL;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    const bool is_read_only = (p_file_mode == hashdb::READ_ONLY);
+    bloom_filter_t* filter = new bloom_filter_t(p_file_mode);
+    filter->fd = ::open(filename.c_str(), (is_read_only) ? O_RDONLY : O_RDWR);
+    struct stat st;
+    if (filter->fd < 0 || fstat(filter->fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < header_size) {
+      std::cerr << "Warning: unable to open Bloom filter file '"
+                << filename << "', not using it.\n";
+      delete filter;
+      return NULL;
+    }
+    filter->map_size = static_cast<size_t>(st.st_size);
+    void* p = mmap(NULL, filter->map_size,
+                   (is_read_only) ? PROT_READ : PROT_READ | PROT_WRITE,
+                   MAP_SHARED, filter->fd, 0);
+    if (p == MAP_FAILED) {
+      std::cerr << "Warning: unable to map Bloom filter file '"
+                << filename << "', not using it.\n";
+      filter->map_size = 0;
+      delete filter;
+      return NULL;
+    }
+    filter->map = static_cast<uint8_t*>(p);
+
+    // validate the header
+    header_t header;
+    std::memcpy(&header, filter->map, sizeof(header));
+    char magic[8];
+    set_magic(magic);
+    if (std::memcmp(header.magic, magic, 8) != 0 ||
+        header.version != file_version ||
+        header.k < 1 || header.k > max_k || header.num_blocks == 0 ||
+        filter->map_size != header_size + header.num_blocks * block_size) {
+      std::cerr << "Warning: invalid Bloom filter file '"
+                << filename << "', not using it.\n";
+      delete filter;
+      return NULL;
+    }
+    filter->k = header.k;
+    filter->num_blocks = header.num_blocks;
+    filter->capacity = header.capacity;
+
+    // lookups hit random blocks
+    madvise(filter->map, filter->map_size, MADV_RANDOM);
+    return filter;
+#else
+    std::cerr << "Warning: Bloom filter file '" << filename
+              << "' requires mmap support, not using it.\n";
+    return NULL;
+#endif
+  }
+
+  ~bloom_filter_t() {
+#ifdef HAVE_SYS_MMAN_H
+    if (map != NULL) {
+      if (file_mode != hashdb::READ_ONLY) {
+        msync(map, map_size, MS_SYNC);
+      }
+      munmap(map, map_size);
+    }
+#endif
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  /**
+   * Add the hash.  The filter must be open read-write.  Return true if
+   * this add takes the filter past its capacity.
+   */
+  bool add(const std::string& block_hash) {
+    uint64_t* block;
+    uint32_t start;
+    uint32_t step;
+    locate(block_hash.c_str(), block_hash.size(), block, start, step);
+    bool is_new = false;
+    for (uint32_t i = 0; i < k; ++i) {
+      const uint32_t bit = (start + i * step) & (block_bits - 1);
+      const uint64_t mask = 1ULL << (bit & 63);
+      if ((block[bit >> 6] & mask) == 0 &&
+          (__sync_fetch_and_or(&block[bit >> 6], mask) & mask) == 0) {
+        is_new = true;
+      }
+    }
+    if (!is_new) {
+      return false;
+    }
+    header_t* const header = reinterpret_cast<header_t*>(map);
+    return (__sync_add_and_fetch(&header->hash_count, 1) == capacity + 1);
+  }
+
+  /**
+   * False if the hash is definitely not in the hashdb, true if it may be.
+   */
+  bool find(const std::string& block_hash) const {
+    return find(block_hash.c_str(), block_hash.size());
+  }
+
+  /**
+   * Find, given the hash as size bytes at block_hash.
+   */
+  bool find(const char* const block_hash, const size_t size) const {
+    uint64_t* block;
+    uint32_t start;
+    uint32_t step;
+    locate(block_hash, size, block, start, step);
+    for (uint32_t i = 0; i < k; ++i) {
+      const uint32_t bit = (start + i * step) & (block_bits - 1);
+      if ((block[bit >> 6] & (1ULL << (bit & 63))) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * The number of hashes the filter was sized for.  The false positive
+   * rate rises once more hashes than this are added.
+   */
+  uint64_t size_capacity() const {
+    return capacity;
+  }
+
+  /**
+   * About the number of distinct hashes added, counting those added by
+   * other processes.
+   */
+  uint64_t size_hashes() const {
+    // the map may be read-only so read the count rather than add zero
+    const header_t* const header = reinterpret_cast<const header_t*>(map);
+    return *static_cast<const volatile uint64_t*>(&header->hash_count);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
@@ -0,0 +1,533 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Build the hash data store and hash store of a new hashdb in hash order.
+ * Inserted and merged hashes are written to sorted runs on disk.  The runs
+ * are then merged and the entries for each hash are aggregated into the
+ * data that inserting them in arrival order would have produced, ready to
+ * be appended to the stores.  Appending keys in order fills LMDB pages
+ * densely and avoids the page splits of inserting in random hash order.
+ * Adding is threadsafe.  Call finish and next from one thread.
+ */
+
+#ifndef HASH_BULK_LOADER_HPP
+#define HASH_BULK_LOADER_HPP
+
+#include "lmdb_helper.h"
+#include "lmdb_changes.hpp"
+#include "lmdb_hash_data_manager.hpp" // for add2, add4, truncate_block_label
+#include "source_id_sub_counts.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <queue>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <cassert>
+#include <unistd.h>
+#include <sys/stat.h>   // for mkdir
+
+// no concurrent adds
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+class hash_bulk_loader_t {
+
+  private:
+  // one inserted or merged hash entry, ordered by hash then by arrival
+  struct record_t {
+    std::string block_hash;
+    uint64_t sequence;
+    uint64_t is_merge;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t source_id;
+    uint64_t sub_count;
+
+    record_t() : block_hash(), sequence(0), is_merge(0), k_entropy(0),
+                 block_label(), source_id(0), sub_count(0) {
+    }
+
+    // std::string orders bytes as unsigned, as LMDB does for keys
+    bool operator<(const record_t& that) const {
+      const int cmp = block_hash.compare(that.block_hash);
+      if (cmp != 0) return cmp < 0;
+      return sequence < that.sequence;
+    }
+  };
+
+  // reads the records of one run file in order
+  class run_reader_t {
+    private:
+    std::ifstream in;
+
+    // do not allow copy or assignment
+    run_reader_t(const run_reader_t&);
+    run_reader_t& operator=(const run_reader_t&);
+
+    public:
+    record_t record;
+
+    run_reader_t(const std::string& filename) :
+              in(filename.c_str(), std::ios::binary), record() {
+      if (!in.is_open()) {
+        std::cerr << "Unable to open bulk load run file '" << filename
+                  << "'.\n";
+        assert(0);
+      }
+    }
+
+    // read the next record, false at end of run
+    bool next() {
+      return read_record(in, record);
+    }
+  };
+
+  // order run readers in the heap by their current record, least first
+  struct reader_greater_t {
+    bool operator()(const run_reader_t* const a,
+                    const run_reader_t* const b) const {
+      return b->record < a->record;
+    }
+  };
+
+  typedef std::priority_queue<run_reader_t*, std::vector<run_reader_t*>,
+                              reader_greater_t> reader_heap_t;
+
+  // limit open run files by merging runs in passes of this many
+  static const size_t max_merge_runs = 64;
+
+  const std::string temp_dir;
+  const size_t run_size;
+  std::vector<record_t> records;              // records for the next run
+  std::vector<std::string> run_filenames;     // runs not yet merged
+  size_t run_number;
+  uint64_t sequence;
+  std::vector<run_reader_t*> readers;         // the final merge
+  reader_heap_t heap;
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  hash_bulk_loader_t(const hash_bulk_loader_t&);
+  hash_bulk_loader_t& operator=(const hash_bulk_loader_t&);
+
+  // record encoding: 4-byte size then the encoded fields
+  static void write_record(std::ostream& out, const record_t& record) {
+
+    // encode the integers, each at most 10 bytes, noting where the hash
+    // and label bytes go between them
+    uint8_t buf[6 * 10];
+    uint8_t* p = buf;
+    p = lmdb_helper::encode_uint64_t(record.block_hash.size(), p);
+    const uint8_t* const hash_at = p;
+    p = lmdb_helper::encode_uint64_t(record.sequence, p);
+    p = lmdb_helper::encode_uint64_t(record.is_merge, p);
+    p = lmdb_helper::encode_uint64_t(record.k_entropy, p);
+    p = lmdb_helper::encode_uint64_t(record.block_label.size(), p);
+    const uint8_t* const label_at = p;
+    p = lmdb_helper::encode_uint64_t(record.source_id, p);
+    p = lmdb_helper::encode_uint64_t(record.sub_count, p);
+
+    const size_t size = (p - buf) + record.block_hash.size() +
+                        record.block_label.size();
+    const char size_bytes[4] = {static_cast<char>(size & 0xff),
+                                static_cast<char>((size >> 8) & 0xff),
+                                static_cast<char>((size >> 16) & 0xff),
+                                static_cast<char>((size >> 24) & 0xff)};
+    out.write(size_bytes, 4);
+    out.write(reinterpret_cast<const char*>(buf), hash_at - buf);
+    out.write(record.block_hash.c_str(), record.block_hash.size());
+    out.write(reinterpret_cast<const char*>(hash_at), label_at - hash_at);
+    out.write(record.block_label.c_str(), record.block_label.size());
+    out.write(reinterpret_cast<const char*>(label_at), p - label_at);
+  }
+
+  // read the next record, false at end of file
+  static bool read_record(std::istream& in, record_t& record) {
+    uint8_t size_bytes[4];
+    in.read(reinterpret_cast<char*>(size_bytes), 4);
+    if (in.gcount() == 0 && in.eof()) {
+      return false;
+    }
+    const size_t size = size_bytes[0] | (size_bytes[1] << 8) |
+                        (size_bytes[2] << 16) | (size_bytes[3] << 24);
+    std::string buf(size, 0);
+    in.read(&buf[0], size);
+    if (!in) {
+      std::cerr << "bulk load run file read error\n";
+      assert(0);
+    }
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(buf.c_str());
+    const uint8_t* const p_stop = p + size;
+    uint64_t field_size;
+    p = lmdb_helper::decode_uint64_t(p, field_size);
+    record.block_hash = std::string(reinterpret_cast<const char*>(p),
+                                    field_size);
+    p += field_size;
+    p = lmdb_helper::decode_uint64_t(p, record.sequence);
+    p = lmdb_helper::decode_uint64_t(p, record.is_merge);
+    p = lmdb_helper::decode_uint64_t(p, record.k_entropy);
+    p = lmdb_helper::decode_uint64_t(p, field_size);
+    record.block_label = std::string(reinterpret_cast<const char*>(p),
+                                     field_size);
+    p += field_size;
+    p = lmdb_helper::decode_uint64_t(p, record.source_id);
+    p = lmdb_helper::decode_uint64_t(p, record.sub_count);
+
+    // validate that the decoding was properly consumed
+    if (p != p_stop) {
+      std::cerr << "data decode error in bulk load run file\n";
+      assert(0);
+    }
+    return true;
+  }
+
+  std::string new_run_filename() {
+    std::stringstream ss;
+    ss << temp_dir << "/run_" << run_number++;
+    return ss.str();
+  }
+
+  // sort the pending records into a new run file
+  void write_run() {
+    std::sort(records.begin(), records.end());
+    const std::string filename = new_run_filename();
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    for (std::vector<record_t>::const_iterator it = records.begin();
+         it != records.end(); ++it) {
+      write_record(out, *it);
+    }
+    out.close();
+    if (!out) {
+      std::cerr << "Unable to write bulk load run file '" << filename
+                << "'.\n";
+      assert(0);
+    }
+    records.clear();
+    run_filenames.push_back(filename);
+  }
+
+  // open readers for the first count runs and start the heap
+  void open_runs(const size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      run_reader_t* reader = new run_reader_t(run_filenames[i]);
+      readers.push_back(reader);
+      if (reader->next()) {
+        heap.push(reader);
+      }
+    }
+  }
+
+  // close the open readers and remove their run files
+  void close_runs() {
+    for (size_t i = 0; i < readers.size(); ++i) {
+      delete readers[i];
+      std::remove(run_filenames[i].c_str());
+    }
+    run_filenames.erase(run_filenames.begin(),
+                        run_filenames.begin() + readers.size());
+    readers.clear();
+    heap = reader_heap_t();
+  }
+
+  // take the least record from the heap into record
+  void pop(record_t& record) {
+    run_reader_t* const reader = heap.top();
+    heap.pop();
+    record = reader->record;
+    if (reader->next()) {
+      heap.push(reader);
+    }
+  }
+
+  // merge the first max_merge_runs runs into one new run
+  void merge_pass() {
+    open_runs(max_merge_runs);
+    const std::string filename = new_run_filename();
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    record_t record;
+    while (!heap.empty()) {
+      pop(record);
+      write_record(out, record);
+    }
+    out.close();
+    if (!out) {
+      std::cerr << "Unable to write bulk load run file '" << filename
+                << "'.\n";
+      assert(0);
+    }
+    close_runs();
+    run_filenames.push_back(filename);
+  }
+
+  // add an inserted or merged entry, starting a new run when full
+  void add(const std::string& block_hash,
+           const uint64_t k_entropy,
+           const std::string& block_label,
+           const uint64_t source_id,
+           const uint64_t is_merge,
+           const uint64_t sub_count) {
+
+    // program error if source ID is 0 since NULL distinguishes between
+    // type 1 and type 2 data.
+    if (source_id == 0) {
+      std::cerr << "program error in source_id\n";
+      assert(0);
+    }
+
+    // require valid block_hash
+    if (block_hash.size() == 0) {
+      std::cerr << "Usage error: the block_hash value provided to the bulk loader is empty.\n";
+      return;
+    }
+
+    record_t record;
+    record.block_hash = block_hash;
+    record.is_merge = is_merge;
+    record.k_entropy = k_entropy;
+    record.block_label = truncate_block_label(block_label);
+    record.source_id = source_id;
+    record.sub_count = sub_count;
+
+    MUTEX_LOCK(&M);
+    record.sequence = sequence++;
+    records.push_back(record);
+    if (records.size() >= run_size) {
+      write_run();
+    }
+    MUTEX_UNLOCK(&M);
+  }
+
+  public:
+  /**
+   * Write runs of up to run_size records into temp_dir, which is created
+   * and then removed when done.
+   */
+  hash_bulk_loader_t(const std::string& p_temp_dir,
+                     const size_t p_run_size) :
+          temp_dir(p_temp_dir),
+          run_size((p_run_size == 0) ? 1 : p_run_size),
+          records(),
+          run_filenames(),
+          run_number(0),
+          sequence(0),
+          readers(),
+          heap(),
+          M() {
+
+    MUTEX_INIT(&M);
+
+    // create the directory for the run files
+    int status;
+#ifdef WIN32
+    status = mkdir(temp_dir.c_str());
+#else
+    status = mkdir(temp_dir.c_str(),0777);
+#endif
+    if (status != 0 && access(temp_dir.c_str(), F_OK) != 0) {
+      std::cerr << "Unable to create bulk load directory '" << temp_dir
+                << "'.\n";
+      assert(0);
+    }
+  }
+
+  ~hash_bulk_loader_t() {
+    close_runs();
+    for (std::vector<std::string>::const_iterator it = run_filenames.begin();
+         it != run_filenames.end(); ++it) {
+      std::remove(it->c_str());
+    }
+    rmdir(temp_dir.c_str());
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Add a hash as import_manager_t::insert_hash would insert it.
+   */
+  void add_insert(const std::string& block_hash,
+                  const uint64_t k_entropy,
+                  const std::string& block_label,
+                  const uint64_t source_id) {
+    add(block_hash, k_entropy, block_label, source_id, 0, 0);
+  }
+
+  /**
+   * Add a hash as import_manager_t::merge_hash would merge it.
+   */
+  void add_merge(const std::string& block_hash,
+                 const uint64_t k_entropy,
+                 const std::string& block_label,
+                 const uint64_t source_id,
+                 const uint64_t sub_count) {
+    add(block_hash, k_entropy, block_label, source_id, 1, sub_count);
+  }
+
+  /**
+   * Write the last run and merge runs until the rest can be merged at once
+   * by next.  Call after all adds are done.
+   */
+  void finish() {
+    MUTEX_LOCK(&M);
+    if (records.size() > 0) {
+      write_run();
+    }
+    while (run_filenames.size() > max_merge_runs) {
+      merge_pass();
+    }
+    open_runs(run_filenames.size());
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Get the next hash in hash order with its data aggregated from all the
+   * entries added for it, false when there are no more hashes.  count is
+   * the count that the last entry would have returned and changes counts
+   * each entry as inserting or merging it would.
+   */
+  bool next(std::string& block_hash,
+            uint64_t& k_entropy,
+            std::string& block_label,
+            uint64_t& count,
+            source_id_sub_counts_t& source_id_sub_counts,
+            hashdb::lmdb_changes_t& changes) {
+
+    source_id_sub_counts.clear();
+    if (heap.empty()) {
+      return false;
+    }
+
+    // the first entry makes a Type 1
+    record_t record;
+    pop(record);
+    block_hash = record.block_hash;
+    k_entropy = record.k_entropy;
+    block_label = record.block_label;
+    const uint64_t type1_source_id = record.source_id;
+    uint64_t type1_sub_count;
+    if (record.is_merge) {
+      type1_sub_count = record.sub_count;
+      count = add2(record.sub_count, 0);
+      ++changes.hash_data_merged;
+    } else {
+      type1_sub_count = 1;
+      count = 1;
+      ++changes.hash_data_inserted;
+    }
+
+    // apply the remaining entries in arrival order
+    bool is_type2 = false;
+    std::map<uint64_t, uint64_t> type3_sub_counts;
+    while (!heap.empty() && heap.top()->record.block_hash == block_hash) {
+      pop(record);
+
+      // check for mismatched data
+      if (mismatched_data(record.k_entropy, k_entropy,
+                          record.block_label, block_label)) {
+        ++changes.hash_data_mismatched_data_detected;
+      }
+
+      if (!is_type2 && record.source_id == type1_source_id) {
+        if (record.is_merge) {
+          // merged before, no change
+          if (mismatched_sub_count(record.sub_count, type1_sub_count)) {
+            ++changes.hash_data_mismatched_sub_count_detected;
+          }
+          count = type1_sub_count;
+          ++changes.hash_data_merged_same;
+        } else {
+          // increment Type 1
+          type1_sub_count = add2(type1_sub_count, 1);
+          count = type1_sub_count;
+          ++changes.hash_data_inserted;
+        }
+
+      } else if (!is_type2) {
+        // split Type 1 into Type 2 and two Type 3
+        const uint64_t sub_count = (record.is_merge) ? record.sub_count : 1;
+        count = add4(type1_sub_count, sub_count);
+        type3_sub_counts[type1_source_id] = type1_sub_count;
+        type3_sub_counts[record.source_id] = sub_count;
+        is_type2 = true;
+        if (record.is_merge) {
+          ++changes.hash_data_merged;
+        } else {
+          ++changes.hash_data_inserted;
+        }
+
+      } else {
+        std::map<uint64_t, uint64_t>::iterator it =
+                                  type3_sub_counts.find(record.source_id);
+        if (record.is_merge && it != type3_sub_counts.end()) {
+          // merged before, no change
+          if (mismatched_sub_count(record.sub_count, it->second)) {
+            ++changes.hash_data_mismatched_sub_count_detected;
+          }
+          ++changes.hash_data_merged_same;
+        } else if (record.is_merge) {
+          // new Type 3
+          count = add4(count, record.sub_count);
+          type3_sub_counts[record.source_id] = record.sub_count;
+          ++changes.hash_data_merged;
+        } else {
+          // new or incremented Type 3
+          count = add4(count, 1);
+          if (it != type3_sub_counts.end()) {
+            it->second = add2(it->second, 1);
+          } else {
+            type3_sub_counts[record.source_id] = 1;
+          }
+          ++changes.hash_data_inserted;
+        }
+      }
+    }
+
+    // report the sources
+    if (is_type2) {
+      for (std::map<uint64_t, uint64_t>::const_iterator it =
+           type3_sub_counts.begin(); it != type3_sub_counts.end(); ++it) {
+        source_id_sub_counts.insert(source_id_sub_count_t(it->first,
+                                                          it->second));
+      }
+    } else {
+      source_id_sub_counts.insert(source_id_sub_count_t(type1_source_id,
+                                                        type1_sub_count));
+    }
+    return true;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
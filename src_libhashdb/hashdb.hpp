@@ -32,6 +32,9 @@
 
 #include <string>
 #include <set>
+#include <map>
+#include <vector>
+#include <iosfwd>       // std::istream&, std::ostream& for load, dump
 #include <stdint.h>
 #include <sys/time.h>   // timeval* for timestamp_t
 #include <pthread.h>    // pthread_t* for scan_stream_t
@@ -45,6 +48,8 @@
 extern "C"
 const char* hashdb_version();
 
+struct MDB_env;
+struct MDB_txn;
 namespace scan_stream {
   class scan_thread_data_t;
 }
@@ -54,9 +59,19 @@ namespace hashdb {
   class lmdb_source_data_manager_t;
   class lmdb_source_id_manager_t;
   class lmdb_source_name_manager_t;
+  class lmdb_source_hash_manager_t;
   class lmdb_changes_t;
   class logger_t;
   class locked_member_t;
+  class lmdb_reader_t;
+  class lmdb_key_iterator_t;
+  class hash_bulk_loader_t;
+  class bloom_filter_t;
+  class import_queue_t;
+  struct import_change_t;
+  struct hash_data_t;
+  struct cached_source_t;
+  class source_cache_t;
 
   // ************************************************************
   // version of the hashdb library
@@ -88,6 +103,76 @@ namespace hashdb {
   // pair(repository_name, filename)
   typedef std::pair<std::string, std::string> source_name_t;
   typedef std::set<source_name_t>             source_names_t;
+
+  /**
+   * A block or file hash held in place rather than in a std::string, so
+   * that lookups with it make no heap allocation.  Holds up to max_size
+   * bytes, enough for SHA-512.
+   */
+  struct block_hash_t {
+    static const size_t max_size = 64;
+    size_t size;
+    char data[max_size];
+
+    block_hash_t();
+
+    /**
+     * The size bytes at p.  Prints a usage error and holds no bytes if
+     * size is over max_size.
+     */
+    block_hash_t(const char* const p, const size_t p_size);
+
+    /**
+     * The bytes of the binary hash in s, see above.
+     */
+    explicit block_hash_t(const std::string& s);
+
+    /**
+     * The hash as a binary string.
+     */
+    std::string str() const;
+  };
+
+  // one source of a hash, see hash_record_t
+  struct hash_source_t {
+    uint64_t source_id;
+    uint64_t sub_count;
+    hash_source_t(const uint64_t p_source_id, const uint64_t p_sub_count);
+  };
+
+  /**
+   * Hash information for one hash with its sources given by source ID,
+   * see scan_manager_t::find_hash and find_hashes.  Reuse hash_record_t
+   * values for many lookups: once their labels and sources have grown to
+   * fit, lookups reuse them rather than allocating.
+   */
+  struct hash_record_t {
+    bool is_found;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    // in store order
+    std::vector<hash_source_t> sources;
+    hash_record_t();
+  };
+
+  // a hash or source decoded from one line of JSON import text, see
+  // import_manager_t::parse_json
+  struct json_record_t {
+    bool is_source;
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    // pair(file_hash, sub_count) in input order
+    std::vector<std::pair<std::string, uint64_t> > source_sub_counts;
+    std::string file_hash;
+    uint64_t filesize;
+    std::string file_type;
+    uint64_t zero_count;
+    uint64_t nonprobative_count;
+    source_names_t names;
+    json_record_t();
+  };
 #endif
 
   // ************************************************************
@@ -97,15 +182,55 @@ namespace hashdb {
    * Provides hashdb settings.
    *
    * Attributes:
-   *   settings_version - The version of the settings record
+   *   settings_version - The version of the settings record,
+   *     SEPARATE_ENV_SETTINGS_VERSION for the SEPARATE_ENV_LAYOUT and
+   *     CURRENT_SETTINGS_VERSION for the layouts in one environment, so
+   *     that readers of one environment per store reject the newer layouts.
    *   block_size - Size, in bytes, of data blocks.
+   *   layout_version - The storage layout of the LMDB stores,
+   *     SEPARATE_ENV_LAYOUT for one LMDB environment per store,
+   *     SINGLE_ENV_LAYOUT for all stores as named DBs in one environment, or
+   *     TYPE3_STORE_LAYOUT for SINGLE_ENV_LAYOUT with the per-source
+   *     records of hashes with several sources in their own fixed-width DB.
+   *   hash_prefix_bytes - The number of leading hash bytes kept as keys in
+   *     the hash store.  Hashes sharing a prefix share one count, so wider
+   *     prefixes lower the collision rate and enlarge the store.
+   *   hash_count_bytes - The width of the approximate counts in the hash
+   *     store: 0 for presence only, 1 for a logarithmic count, or 2 or 4
+   *     for counts clipped to fit.
+   *   bloom_false_positive_rate - The target false positive rate of the
+   *     Bloom filter that screens out absent hashes during scans, or 0 for
+   *     no Bloom filter.
+   *   bloom_capacity - The number of hashes the Bloom filter is sized for.
+   *     The false positive rate rises once more hashes than this are
+   *     imported.  rebuild_bloom sets it from the hashes in the hashdb.
+   *   source_index - Whether the hashdb keeps the source hash store, which
+   *     lists the block hashes of each source for per-source queries.
+   *     Requires a single environment layout.
    */
   struct settings_t {
 #ifndef SWIG
-    static const uint32_t CURRENT_SETTINGS_VERSION = 4;
+    static const uint32_t SEPARATE_ENV_SETTINGS_VERSION = 4;
+    static const uint32_t CURRENT_SETTINGS_VERSION = 5;
+    static const uint32_t SEPARATE_ENV_LAYOUT = 1;
+    static const uint32_t SINGLE_ENV_LAYOUT = 2;
+    static const uint32_t TYPE3_STORE_LAYOUT = 3;
+    static const uint32_t CURRENT_LAYOUT_VERSION = TYPE3_STORE_LAYOUT;
+    static const uint32_t DEFAULT_HASH_PREFIX_BYTES = 7;
+    static const uint32_t MAX_HASH_PREFIX_BYTES = 32;
+    static const uint32_t DEFAULT_HASH_COUNT_BYTES = 1;
+    static const uint64_t DEFAULT_BLOOM_CAPACITY = 100000000;
+    static bool valid_hash_prefix_bytes(const uint64_t hash_prefix_bytes);
+    static bool valid_hash_count_bytes(const uint64_t hash_count_bytes);
 #endif
     uint32_t settings_version;
     uint32_t block_size;
+    uint32_t layout_version;
+    uint32_t hash_prefix_bytes;
+    uint32_t hash_count_bytes;
+    double bloom_false_positive_rate;
+    uint64_t bloom_capacity;
+    bool source_index;
     settings_t();
     std::string settings_string() const;
   };
@@ -163,17 +288,126 @@ namespace hashdb {
 #endif
                            );
 
+  /**
+   * Move the LMDB stores of a hashdb in an older layout into the current
+   * layout.  Stores in their own LMDB environment are moved into one
+   * environment holding each store as a named DB so that one transaction
+   * can update all stores, and the per-source records of hashes with
+   * several sources are moved into their own fixed-width DB.  The settings
+   * are updated and the old store directories are removed.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to migrate.
+   *   command_string - String to put into the hashdb log.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string migrate_hashdb(const std::string& hashdb_dir,
+                             const std::string& command_string);
+
+  /**
+   * Rebuild the Bloom filter of a hashdb from its hash data store, sized
+   * for the hashes present with room to grow but for no fewer than the
+   * capacity in the settings.  The new false positive rate and capacity
+   * are saved in the settings.  A rate of 0 removes the Bloom filter.
+   * Do not rebuild while the hashdb is being imported into.
+   *
+   * The filter is not synced with each LMDB commit, so after a crash of
+   * the operating system during an import it may lack hashes that reached
+   * the hash data store.  Rebuild it before scanning such a hashdb.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database.
+   *   bloom_false_positive_rate - The target false positive rate, or 0.
+   *   command_string - String to put into the hashdb log.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string rebuild_bloom(const std::string& hashdb_dir,
+                            const double bloom_false_positive_rate,
+                            const std::string& command_string);
+
+  /**
+   * Build the source hash store of a hashdb from its hash data store and
+   * keep it from then on.  The store lists the block hashes of each
+   * source so hash_table, add_repository and subtract_repository read
+   * only the hashes of the sources they need.  Do not use the hashdb
+   * while building.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database.
+   *   command_string - String to put into the hashdb log.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string rebuild_source_index(const std::string& hashdb_dir,
+                                   const std::string& command_string);
+
+  /**
+   * Rebuild the hash store of a hashdb from its hash data store in one pass
+   * in hash order, using new prefix and count widths, and measure how many
+   * hashes share a prefix with another hash.  The new widths are saved in
+   * the settings.  Do not use the hashdb while rebuilding.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database.
+   *   hash_prefix_bytes - The new prefix width, see settings_t.
+   *   hash_count_bytes - The new count width, see settings_t.
+   *   command_string - String to put into the hashdb log.
+   *   hash_count - The number of distinct hashes.
+   *   prefix_count - The number of distinct prefixes in the new store.
+   *     The prefix collision rate is 1 - prefix_count / hash_count.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string rebuild_hash_store(const std::string& hashdb_dir,
+                                 const uint32_t hash_prefix_bytes,
+                                 const uint32_t hash_count_bytes,
+                                 const std::string& command_string,
+#ifdef SWIG
+                                 uint64_t& OUTPUT,
+                                 uint64_t& OUTPUT
+#else
+                                 uint64_t& hash_count,
+                                 uint64_t& prefix_count
+#endif
+                                );
+
   /**
    * Return binary string or empty if hexdigest length is not even
    * or has any invalid digits.
    */
   std::string hex_to_bin(const std::string& hex_string);
 
+#ifndef SWIG
+  /**
+   * Decode size hexadecimal digits at hex into size / 2 bytes at bin,
+   * eight digits at a time.  Errors are not reported.  Use for bulk
+   * input.
+   *
+   * Returns:
+   *   False if size is not even or any digit is invalid.
+   */
+  bool hex_to_bin(const char* const hex, const size_t size, char* const bin);
+#endif
+
   /**
    * Return hexadecimal representation of the binary string.
    */
   std::string bin_to_hex(const std::string& binary_string);
 
+#ifndef SWIG
+  /**
+   * Encode size bytes at bin into size * 2 hexadecimal digits at hex,
+   * four bytes at a time.  Use for bulk output.
+   */
+  void bin_to_hex(const char* const bin, const size_t size, char* const hex);
+#endif
+
   /**
    * Calculate and ingest hashes from files recursively from a source
    * path.  Files with EWF extensions (.E01 files) will be ingested as
@@ -193,6 +427,8 @@ namespace hashdb {
    *   disable_calculate_entropy - Disable calculating block entropy values.
    *   disable_calculate_labels - Disable calculating block entropy labels.
    *   command_string - String to put into the new hashdb log.
+   *   bulk_load - Build the hash stores of a new hashdb in hash order,
+   *     see import_manager_t::enable_bulk_load.  Default false.
    *
    * Returns:
    *   "" if successful else reason if not.
@@ -205,7 +441,8 @@ namespace hashdb {
                      const bool disable_recursive_processing,
                      const bool disable_calculate_entropy,
                      const bool disable_calculate_labels,
-                     const std::string& command_string);
+                     const std::string& command_string,
+                     const bool bulk_load = false);
 
   /**
    * Calculate and scan for hashes from the media image file.  Files with
@@ -321,14 +558,92 @@ namespace hashdb {
     lmdb_source_id_manager_t* lmdb_source_id_manager;
     lmdb_source_name_manager_t* lmdb_source_name_manager;
 
+    // the source hash store, NULL when the hashdb has no source index
+    lmdb_source_hash_manager_t* lmdb_source_hash_manager;
+
+    // shared environment, NULL when each store has its own environment
+    MDB_env* env;
+    MDB_txn* batch_txn;
+    pthread_mutex_t M;
+
     logger_t* logger;
     hashdb::lmdb_changes_t* changes;
 
+    // batched writes, queue is NULL when not batching
+    const size_t batch_size;
+    const size_t batch_milliseconds;
+    import_queue_t* queue;
+    pthread_t writer_thread;
+
+    // bulk loading, bulk_loader is NULL when not bulk loading
+    const std::string bulk_load_dir;
+    hash_bulk_loader_t* bulk_loader;
+
+    // Bloom filter, NULL when the hashdb has none
+    bloom_filter_t* bloom_filter;
+
+    // file hashes seen by insert_new_source_hash, used only while
+    // applying changes.  New sources are kept for the life of the manager
+    // since once committed they look preexisting.  Preexisting sources are
+    // forgotten as each batch commits since the stores then answer for
+    // them.
+    std::set<std::string> new_sources;
+    std::set<std::string> preexisting_sources;
+
+    // open the LMDB stores in the layout given in the hashdb settings
+    void open_managers(const std::string& hashdb_dir);
+
+    // apply changes to the LMDB stores
+    void submit(import_change_t& change);
+    void apply(const import_change_t& change);
+    void apply_source_name(const std::string& file_hash,
+                           const std::string& repository_name,
+                           const std::string& filename);
+    void apply_source_data(const std::string& file_hash,
+                           const uint64_t filesize,
+                           const std::string& file_type,
+                           const uint64_t zero_count,
+                           const uint64_t nonprobative_count);
+    void apply_insert_hash(const std::string& block_hash,
+                           const uint64_t k_entropy,
+                           const std::string& block_label,
+                           const std::string& file_hash);
+    void apply_merge_hash(const std::string& block_hash,
+                          const uint64_t k_entropy,
+                          const std::string& block_label,
+                          const std::string& file_hash,
+                          const uint64_t sub_count);
+    void apply_insert_hashes(const import_change_t& change);
+    void apply_new_source_hash(const import_change_t& change);
+
+    // the batch writer thread
+    size_t record_pages() const;
+    void begin_batch(const size_t reserve_pages);
+    void commit_batch();
+    void abort_batch();
+    static void* run_writer(void* const arg);
+    void start_writer();
+
+    // append hashes in hash order to the empty hash stores, in batches
+    void append_hash(const std::string& block_hash,
+                     const hash_data_t& hash_data,
+                     bool& is_open, size_t& pages);
+
+    // append the bulk loaded hashes to the hash stores
+    void load_bulk();
+
     public:
 #ifndef SWIG
     // do not allow copy or assignment
     import_manager_t(const import_manager_t&) = delete;
     import_manager_t& operator=(const import_manager_t&) = delete;
+
+    // suggested batch_size and batch_milliseconds for batched writes
+    static const size_t DEFAULT_BATCH_SIZE = 1000;
+    static const size_t DEFAULT_BATCH_MILLISECONDS = 1000;
+
+    // suggested run_size for bulk loading
+    static const size_t DEFAULT_BULK_RUN_SIZE = 1000000;
 #endif
 
     /**
@@ -342,10 +657,81 @@ namespace hashdb {
                      const std::string& command_string);
 
     /**
-     * The destructor closes the log file and data store resources.
+     * Open hashdb for importing using batched writes.  A writer thread
+     * applies the changes in one LMDB write transaction, or one per store
+     * for a hashdb in the separate environment layout, and commits after
+     * batch_size changes or after batch_milliseconds, whichever comes
+     * first.  Interfaces that read the database commit pending changes
+     * first.
+     *
+     * Parameters:
+     *   hashdb_dir - Path to the hashdb data store to import into.
+     *   command_string - String to put into the new hashdb log.
+     *   batch_size - The maximum number of changes per commit, or 0 to
+     *     commit every change as it is made.
+     *   batch_milliseconds - The maximum time, in milliseconds, that a
+     *     change may wait before it is committed.
+     */
+    import_manager_t(const std::string& hashdb_dir,
+                     const std::string& command_string,
+                     const size_t batch_size,
+                     const size_t batch_milliseconds);
+
+    /**
+     * The destructor commits pending changes and closes the log file
+     * and data store resources.
      */
     ~import_manager_t();
 
+    /**
+     * Commit pending batched changes.  There is nothing to do when
+     * batching is not enabled.
+     */
+    void flush();
+
+    /**
+     * Grow the LMDB map now to hold about expected_bytes more bytes
+     * rather than growing it step by step during the import.  Call
+     * before importing.  This has no effect on a hashdb in the separate
+     * environment layout.
+     *
+     * Parameters:
+     *   expected_bytes - The number of bytes the import is expected to
+     *     add, for example the size of the file being imported.
+     */
+    void preallocate(const uint64_t expected_bytes);
+
+    /**
+     * Set when the background flusher writes committed changes to disk:
+     * after flush_bytes bytes of changes or after flush_milliseconds,
+     * whichever comes first.  The default is 256 MiB or 10 seconds.  This
+     * has no effect on a hashdb in the separate environment layout.
+     *
+     * Parameters:
+     *   flush_bytes - The bytes of changes to let build up before syncing.
+     *   flush_milliseconds - The longest time to wait before syncing
+     *     committed changes.
+     */
+    void set_flush_policy(const uint64_t flush_bytes,
+                          const uint64_t flush_milliseconds);
+
+    /**
+     * Build the hash stores of a new hashdb in hash order rather than
+     * inserting each hash as it arrives.  Hashes inserted or merged after
+     * this are sorted in runs on disk under the hashdb directory and are
+     * appended to the hash stores when the import manager is closed, so
+     * they are not visible to reads until then.  Sources are written as
+     * they arrive.
+     *
+     * Parameters:
+     *   run_size - The number of hashes to sort in memory per run.
+     *
+     * Returns:
+     *   "" if successful else reason if not, for example if the hashdb
+     *   already has hashes.
+     */
+    std::string enable_bulk_load(const size_t run_size);
+
     /**
      * Insert the repository_name, filename pair associated with the
      * source.
@@ -415,6 +801,47 @@ namespace hashdb {
                     const std::string& block_label,
                     const std::string& file_hash,
                     const uint64_t sub_count);
+
+    /**
+     * Insert the hash data of many block hashes of one source, see
+     * insert_hash.  The hashes are queued as one change, so a batch of
+     * fixed-width block hashes makes no heap allocation per hash.
+     *
+     * Parameters:
+     *   block_hashes - The block hashes.
+     *   k_entropies - The entropy value of each block hash.
+     *   block_labels - The block label of each block hash.
+     *   file_hash - The file hash of the source file in binary form.
+     */
+    void insert_hashes(const std::vector<block_hash_t>& block_hashes,
+                       const std::vector<uint64_t>& k_entropies,
+                       const std::vector<std::string>& block_labels,
+                       const std::string& file_hash);
+
+    /**
+     * Insert the hash data associated with the block_hash only if its
+     * source is new, see insert_hash.  The first call for a file hash
+     * adds the source with the repository name and filename pair unless
+     * the source is already in the database, in which case this call and
+     * later calls for the file hash are ignored.  The check is made as
+     * the change is applied, so this does not wait for queued changes.
+     *
+     * Parameters:
+     *   block_hash - The block hash in binary form.
+     *   k_entropy - An entropy value for the associated block, scaled
+     *     up by 1,000 for three decimal place precision.
+     *   block_label - Text indicating the type of the block or "" for
+     *     no label.
+     *   file_hash - The file hash of the source file in binary form.
+     *   repository_name - The repository name of the new source.
+     *   filename - The filename of the new source.
+     */
+    void insert_new_source_hash(const std::string& block_hash,
+                                const uint64_t k_entropy,
+                                const std::string& block_label,
+                                const std::string& file_hash,
+                                const std::string& repository_name,
+                                const std::string& filename);
 #endif
 
     /**
@@ -446,6 +873,46 @@ namespace hashdb {
      */
     std::string import_json(const std::string& json_string);
 
+#ifndef SWIG
+    /**
+     * Decode JSON text as import_json does without importing it, so that
+     * many threads may decode text for one thread to import with
+     * import_record.  Threadsafe.
+     *
+     * Parameters:
+     *   json_string - Hash or source text in JSON format, see import_json.
+     *   record - The decoded hash or source.
+     *
+     * Returns:
+     *   "" else error message if JSON is invalid.
+     */
+    static std::string parse_json(const std::string& json_string,
+                                  json_record_t& record);
+
+    /**
+     * Import a hash or source decoded by parse_json.
+     */
+    void import_record(const json_record_t& record);
+#endif
+
+#ifndef SWIG
+    /**
+     * Import a hashdb binary dump written by scan_manager_t::dump.  When
+     * the hashdb has no hashes, the hashes are appended to the hash stores
+     * in the order they are read, without sorting or per-hash lookups.
+     * Otherwise they are merged as import_json merges them.
+     *
+     * Parameters:
+     *   is - The stream to read the binary dump from.
+     *
+     * Returns:
+     *   "" else error message if the dump is invalid.  Data committed
+     *   before the error remains imported, but the batch holding the bad
+     *   record is discarded.
+     */
+    std::string load(std::istream& is);
+#endif
+
     /**
      * See if the file hash is in the database.
      *
@@ -455,7 +922,9 @@ namespace hashdb {
     bool has_source(const std::string& file_hash) const;
 
     /**
-     * Return the file_hash of the first source in the database.
+     * Return the file_hash of the first source in the database.  See
+     * source_iterator_t, which walks the sources much faster than
+     * first_source and next_source.
      *
      * Returns:
      *   file_hash if a first source is available else "" if DB
@@ -499,6 +968,10 @@ namespace hashdb {
    */
   class scan_manager_t {
 
+    // iterators read the stores directly
+    friend class hash_iterator_t;
+    friend class source_iterator_t;
+
     private:
     lmdb_hash_data_manager_t* lmdb_hash_data_manager;
     lmdb_hash_manager_t* lmdb_hash_manager;
@@ -506,31 +979,90 @@ namespace hashdb {
     lmdb_source_id_manager_t* lmdb_source_id_manager;
     lmdb_source_name_manager_t* lmdb_source_name_manager;
 
+    // the source hash store, NULL when the hashdb has no source index
+    lmdb_source_hash_manager_t* lmdb_source_hash_manager;
+
+    // shared environment, NULL when each store has its own environment
+    MDB_env* env;
+
+    // per-thread read txns and cursors
+    lmdb_reader_t* reader;
+
+    // screens out absent hashes, NULL when the hashdb has no Bloom filter
+    bloom_filter_t* bloom_filter;
+
     // support find_expanded_hash_json when optimizing
     locked_member_t* hashes;
     locked_member_t* sources;
 
+    // recently used sources, kept for up to refresh_milliseconds
+    source_cache_t* source_cache;
+
     // low-level find interfaces
     std::string find_expanded_hash_json(const bool optimizing,
                                      const std::string& block_hash);
+#ifndef SWIG
+    void find_expanded_hash_json(const bool optimizing,
+                                 const std::string& block_hash,
+                                 const hash_data_t& hash_data,
+                                 std::string& json_text);
+    bool find_hash_data(const std::string& block_hash,
+                        hash_data_t& hash_data) const;
+    void find_hash_data(const std::vector<std::string>& block_hashes,
+                        std::vector<hash_data_t>& hash_data) const;
+    template <typename T>
+    void find_present_order(const std::vector<T>& block_hashes,
+                            std::vector<size_t>& order) const;
+    template <typename T>
+    void find_hash_records(const std::vector<T>& block_hashes,
+                           std::vector<hash_record_t>& hash_records) const;
+    void find_source(const uint64_t source_id,
+                     cached_source_t& source,
+                     const bool render) const;
+    void add_source_sub_counts(const hash_data_t& hash_data,
+                               source_sub_counts_t& source_sub_counts) const;
+#endif
     std::string find_hash_count_json(const std::string& block_hash) const;
     std::string find_approximate_hash_count_json(
                                      const std::string& block_hash) const;
+
+    // open the LMDB stores in the layout given in the hashdb settings
+    void open_managers(const std::string& hashdb_dir);
     public:
 #ifndef SWIG
     // do not allow copy or assignment
     scan_manager_t(const scan_manager_t&) = delete;
     scan_manager_t& operator=(const scan_manager_t&) = delete;
+
+    // suggested refresh_milliseconds for scanning a database that is not
+    // being changed
+    static const size_t DEFAULT_REFRESH_MILLISECONDS = 1000;
 #endif
 
     /**
-     * Open hashdb for scanning.
+     * Open hashdb for scanning.  Each lookup reads the newest changes.
      *
      * Parameters:
      *   hashdb_dir - Path to the database to scan against.
      */
     scan_manager_t(const std::string& hashdb_dir);
 
+    /**
+     * Open hashdb for scanning.  Each scanning thread keeps its LMDB read
+     * transactions and cursors open between lookups, reading from one
+     * snapshot of the database for up to refresh_milliseconds before
+     * renewing the snapshot to read newer changes.  Recently used source
+     * information is cached for the same time, so expanded scans do not
+     * read and render the same sources over and over.
+     *
+     * Parameters:
+     *   hashdb_dir - Path to the database to scan against.
+     *   refresh_milliseconds - The maximum age, in milliseconds, of the
+     *     snapshot a lookup reads from, or 0 to read the newest changes.
+     */
+    scan_manager_t(const std::string& hashdb_dir,
+                   const size_t refresh_milliseconds);
+
     /**
      * The destructor closes read-only data store resources.
      */
@@ -558,6 +1090,32 @@ namespace hashdb {
                    std::string& block_label,
                    uint64_t& count,
                    source_sub_counts_t& source_sub_counts) const;
+
+    /**
+     * Find hash, return hash information with each source given by
+     * source ID.  Makes no heap allocation once hash_record has grown to
+     * fit.  Use find_source_json to read a source.
+     *
+     * Parameters:
+     *   block_hash - The block hash.
+     *   hash_record - Receives the hash information, see hash_record_t.
+     *
+     * Returns:
+     *   True if the hash is present, false if not.
+     */
+    bool find_hash(const block_hash_t& block_hash,
+                   hash_record_t& hash_record) const;
+
+    /**
+     * Find hash count, see find_hash_count, without heap allocation.
+     */
+    size_t find_hash_count(const block_hash_t& block_hash) const;
+
+    /**
+     * Find the approximate hash count, see find_approximate_hash_count,
+     * without heap allocation.
+     */
+    size_t find_approximate_hash_count(const block_hash_t& block_hash) const;
 #endif
 
     /**
@@ -601,6 +1159,22 @@ namespace hashdb {
      */
     std::string export_source_json(const std::string& file_hash) const;
 
+#ifndef SWIG
+    /**
+     * Write all sources and hashes as a hashdb binary dump, a compact
+     * format with binary hashes that import_manager_t::load reads much
+     * faster than JSON.  Sources are written in file hash order followed
+     * by hashes in block hash order.
+     *
+     * Parameters:
+     *   os - The stream to write the binary dump to.
+     *
+     * Returns:
+     *   "" else error message if the hashes are not all the same size.
+     */
+    std::string dump(std::ostream& os) const;
+#endif
+
     /**
      * Find hash count.  Faster than find_hash.  Accesses the hash
      * information store.
@@ -613,6 +1187,32 @@ namespace hashdb {
      */
     size_t find_hash_count(const std::string& block_hash) const;
 
+#ifndef SWIG
+    /**
+     * Find the hash counts of many hashes at once, looking them up in
+     * ascending order, see find_hashes.
+     *
+     * Parameters:
+     *   block_hashes - The block hashes in binary form, in any order.
+     *   counts - Receives the count of each hash, or 0 if the hash is
+     *     not there, at the index of the hash in block_hashes.
+     */
+    void find_hash_counts(const std::vector<std::string>& block_hashes,
+                          std::vector<size_t>& counts) const;
+
+    /**
+     * Find the source with a source ID given in a hash_record_t.
+     *
+     * Parameters:
+     *   source_id - The source ID.
+     *
+     * Returns:
+     *   The JSON text of the source, as in the sources of
+     *   find_hash_json, else "" if there is no such source.
+     */
+    std::string find_source_json(const uint64_t source_id) const;
+#endif
+
     /**
      * Find the approximate hash count.  Faster than find_hash, but can
      * be wrong.  Accesses the hash store.
@@ -718,7 +1318,94 @@ namespace hashdb {
                                const std::string& block_hash);
 
     /**
-     * Return the first block hash in the database.
+     * Forget the hashes and sources that EXPANDED_OPTIMIZED has already
+     * reported, for example before scanning the next media image, and
+     * bound the memory used to remember them.
+     *
+     * Parameters:
+     *   memory_limit - The most memory, in bytes, to use to remember
+     *     reported hashes and sources, or 0 for no limit.  Past the
+     *     limit, a probabilistic filter is used, so a hash or source
+     *     may now and then be reported briefly the first time.
+     */
+    void reset_reported(const size_t memory_limit = 0);
+
+#ifndef SWIG
+    /**
+     * Find many hashes at once.  The hashes are looked up in ascending
+     * order with one cursor walking forward through each store, which
+     * touches far fewer pages than looking up each hash on its own when
+     * the database is larger than memory.
+     *
+     * Each source is given by its source ID, so no source is read.  Use
+     * find_source_json to read a source.  Makes no heap allocation for
+     * the results once hash_records has grown to fit.
+     *
+     * Parameters:
+     *   block_hashes - The block hashes in binary form, in any order.
+     *   hash_records - Receives the hash information of each hash, at the
+     *     index of the hash in block_hashes, see hash_record_t.
+     */
+    void find_hashes(const std::vector<std::string>& block_hashes,
+                     std::vector<hash_record_t>& hash_records) const;
+
+    /**
+     * Find many hashes at once, see above, given as block_hash_t values
+     * so that a reused block_hashes makes no heap allocation either.
+     */
+    void find_hashes(const std::vector<block_hash_t>& block_hashes,
+                     std::vector<hash_record_t>& hash_records) const;
+
+    /**
+     * Find many hashes at once, see find_hashes, returning the JSON text
+     * that find_hash_json returns for each hash.  For EXPANDED_OPTIMIZED,
+     * hashes and sources are reported in full the first time they appear
+     * in block_hashes order.
+     *
+     * Parameters:
+     *   scan_mode - The mode to use for performing the scan.
+     *   block_hashes - The block hashes in binary form, in any order.
+     *   json_texts - Receives the JSON text, or "" if the hash is not
+     *     there, at the index of the hash in block_hashes.
+     */
+    void find_hashes_json(const scan_mode_t scan_mode,
+                          const std::vector<std::string>& block_hashes,
+                          std::vector<std::string>& json_texts);
+
+    /**
+     * Find many hashes at once, see above, given as block_hash_t values.
+     * Only the hashes found are copied into strings, for their JSON text.
+     */
+    void find_hashes_json(const scan_mode_t scan_mode,
+                          const std::vector<block_hash_t>& block_hashes,
+                          std::vector<std::string>& json_texts);
+
+    /**
+     * Find the block hashes of a source using the source index, see
+     * settings_t.  Reads only the hashes of the source.
+     *
+     * Parameters:
+     *   file_hash - The file hash of the source in binary form.
+     *   block_hashes - Receives the block hashes of the source in
+     *     ascending order.
+     *
+     * Returns:
+     *   True if the source has block hashes, false if not or if the
+     *   hashdb has no source index.
+     */
+    bool find_source_hashes(const std::string& file_hash,
+                            std::vector<std::string>& block_hashes) const;
+#endif
+
+    /**
+     * Return whether the hashdb keeps the source index used by
+     * find_source_hashes.
+     */
+    bool has_source_index() const;
+
+    /**
+     * Return the first block hash in the database.  See hash_iterator_t,
+     * which walks the hashes much faster than first_hash and next_hash.
      *
      * Returns:
      *   block_hash if a first hash is available else "" if DB is empty.
@@ -737,6 +1424,28 @@ namespace hashdb {
      */
     std::string next_hash(const std::string& block_hash) const;
 
+#ifndef SWIG
+    /**
+     * Split the block hashes into at most n ranges holding about the same
+     * number of hashes, for scanning the ranges in parallel with one
+     * hash_iterator_t per range.
+     *
+     * Parameters:
+     *   n - The number of ranges wanted.
+     *   ranges - The first and last block hash of each range, inclusive
+     *     and in ascending order, or empty if there are no hashes to split.
+     *   begin_block_hash - Split only the hashes at or after this block
+     *     hash, or "" to start at the first hash.
+     *   end_block_hash - Split only the hashes at or before this block
+     *     hash, or "" to end at the last hash.
+     */
+    void hash_ranges(const size_t n,
+                     std::vector<std::pair<std::string, std::string> >&
+                                                          ranges,
+                     const std::string& begin_block_hash = "",
+                     const std::string& end_block_hash = "") const;
+#endif
+
     /**
      * Return the file_hash of the first source in the database.
      *
@@ -774,6 +1483,170 @@ namespace hashdb {
     size_t size_sources() const;
   };
 
+#ifndef SWIG
+  // ************************************************************
+  // hash_iterator_t
+  // ************************************************************
+  /**
+   * Walk the block hashes of a scan_manager_t in ascending order.  The
+   * iterator keeps one LMDB read transaction and cursor for the walk and
+   * reads the data of the current hash where the cursor is, so each step
+   * costs one cursor move rather than a new transaction and a seek back
+   * to the previous hash as with first_hash and next_hash.  Use one
+   * iterator per thread.  Example:
+   *
+   *   for (hashdb::hash_iterator_t it(manager); !it.at_end(); it.next()) {
+   *     std::cout << it.export_json() << "\n";
+   *   }
+   */
+  class hash_iterator_t {
+
+    private:
+    const scan_manager_t& manager;
+    lmdb_key_iterator_t* iterator;
+    std::string current_block_hash;
+
+    // do not allow copy or assignment
+    hash_iterator_t(const hash_iterator_t&);
+    hash_iterator_t& operator=(const hash_iterator_t&);
+
+    // note the current hash
+    void set_current();
+
+    public:
+    /**
+     * Start at the first hash at or after begin_block_hash.
+     *
+     * Parameters:
+     *   manager - The scan manager of the hashdb to walk.
+     *   begin_block_hash - The first block hash in binary form to visit,
+     *     or "" to start at the first hash.
+     *   end_block_hash - The last block hash in binary form to visit, or
+     *     "" to walk to the last hash.
+     *   refresh_count - Renew the snapshot of the database being read
+     *     every refresh_count hashes so that long walks do not hold one
+     *     old snapshot, or 0 to read the whole walk from one snapshot.
+     */
+    hash_iterator_t(const scan_manager_t& manager,
+                    const std::string& begin_block_hash = "",
+                    const std::string& end_block_hash = "",
+                    const size_t refresh_count = 0);
+
+    ~hash_iterator_t();
+
+    /**
+     * Return true when there are no more hashes to visit.
+     */
+    bool at_end() const;
+
+    /**
+     * Move to the next hash.
+     */
+    void next();
+
+    /**
+     * Return the current block hash in binary form.
+     */
+    const std::string& block_hash() const;
+
+    /**
+     * Read the data of the current hash, as scan_manager_t::find_hash.
+     */
+    void read(uint64_t& k_entropy,
+              std::string& block_label,
+              uint64_t& count,
+              source_sub_counts_t& source_sub_counts) const;
+
+    /**
+     * Return the count of the current hash, reading only its first
+     * record.
+     */
+    size_t count() const;
+
+    /**
+     * Return the number of sources of the current hash without reading
+     * them.
+     */
+    size_t source_count() const;
+
+    /**
+     * Return the JSON export text of the current hash, as
+     * scan_manager_t::export_hash_json.
+     */
+    std::string export_json() const;
+
+    /**
+     * Return the JSON export text of the current hash and the source sub
+     * counts it was made from, decoding the hash data once.
+     */
+    std::string export_json(source_sub_counts_t& source_sub_counts) const;
+  };
+
+  // ************************************************************
+  // source_iterator_t
+  // ************************************************************
+  /**
+   * Walk the sources of a scan_manager_t in ascending file hash order
+   * with one LMDB read transaction and cursor, see hash_iterator_t.
+   */
+  class source_iterator_t {
+
+    private:
+    const scan_manager_t& manager;
+    lmdb_key_iterator_t* iterator;
+    std::string current_file_hash;
+
+    // do not allow copy or assignment
+    source_iterator_t(const source_iterator_t&);
+    source_iterator_t& operator=(const source_iterator_t&);
+
+    // note the current source
+    void set_current();
+
+    public:
+    /**
+     * Start at the first source at or after begin_file_hash.
+     *
+     * Parameters:
+     *   manager - The scan manager of the hashdb to walk.
+     *   begin_file_hash - The first file hash in binary form to visit, or
+     *     "" to start at the first source.
+     *   end_file_hash - The last file hash in binary form to visit, or ""
+     *     to walk to the last source.
+     *   refresh_count - Renew the snapshot of the database being read
+     *     every refresh_count sources, or 0 to read the whole walk from
+     *     one snapshot.
+     */
+    source_iterator_t(const scan_manager_t& manager,
+                      const std::string& begin_file_hash = "",
+                      const std::string& end_file_hash = "",
+                      const size_t refresh_count = 0);
+
+    ~source_iterator_t();
+
+    /**
+     * Return true when there are no more sources to visit.
+     */
+    bool at_end() const;
+
+    /**
+     * Move to the next source.
+     */
+    void next();
+
+    /**
+     * Return the file hash of the current source in binary form.
+     */
+    const std::string& file_hash() const;
+
+    /**
+     * Return the JSON export text of the current source, as
+     * scan_manager_t::export_source_json.
+     */
+    std::string export_json() const;
+  };
+#endif
+
   // ************************************************************
   // scan_stream
   // ************************************************************
@@ -781,12 +1654,26 @@ namespace hashdb {
    * Provide a threaded streaming scan interface.  Use put to enqueue
    * arrays of scan input.  Use get to receive arrays of scan output.
    *
+   * The stream holds a bounded number of arrays in flight, from put
+   * until get takes their matches, so memory stays bounded however fast
+   * the caller puts.  put waits while the stream is full and idle scan
+   * threads sleep.  Unlike an unbounded stream, a caller may not put all
+   * of its arrays before getting any: once the stream is full of
+   * matches, put waits for get.  Either get until get returns "" before
+   * each put, or put from one thread and get from another.
+   *
    * If a thread cannot properly parse unscanned data, it will emit a
    * warning to stderr.
    */
   class scan_stream_t {
+    public:
+    /**
+     * The encoding of scanned data, see get.
+     */
+    enum result_format_t {JSON_RESULTS, BINARY_RESULTS};
+
     private:
-    const int num_threads;
+    const size_t num_threads;
     ::pthread_t* threads;
     scan_stream::scan_thread_data_t* scan_thread_data;
     bool done;
@@ -795,6 +1682,8 @@ namespace hashdb {
     // do not allow copy or assignment
     scan_stream_t(const scan_stream_t&);
     scan_stream_t& operator=(const scan_stream_t&);
+
+    void start_threads(const std::vector<int>& cpus);
 #endif
 
     public:
@@ -803,7 +1692,8 @@ namespace hashdb {
      *
      * Parameters:
      *   scan_manger - The hashdb scan manager to use for scanning.
-     *   hash_size - The size, in bytes, of a binary hash, 16 for MD5.
+     *   hash_size - The size, in bytes, of a binary hash, 16 for MD5, at
+     *     most block_hash_t::max_size.
      *   scan_mode - The mode to use for performing the scan.  Controls
      *     scan optimization and returned JSON content.
      */
@@ -811,6 +1701,32 @@ namespace hashdb {
                   const size_t hash_size,
                   const hashdb::scan_mode_t scan_mode);
 
+#ifndef SWIG
+    /**
+     * Create a streaming scan service with a chosen thread pool and
+     * result format.
+     *
+     * Parameters:
+     *   scan_manger - The hashdb scan manager to use for scanning.
+     *   hash_size - The size, in bytes, of a binary hash, 16 for MD5, at
+     *     most block_hash_t::max_size.
+     *   scan_mode - The mode to use for performing the scan.  Controls
+     *     scan optimization and returned JSON content.  Not used for
+     *     BINARY_RESULTS.
+     *   num_threads - The number of scan threads, or 0 for one per CPU.
+     *   cpus - The CPUs to run the scan threads on, in turn, or empty to
+     *     let the system choose.  Each must be from 0 to below CPU_SETSIZE.
+     *     Not supported on every system.
+     *   result_format - JSON_RESULTS or BINARY_RESULTS, see get.
+     */
+    scan_stream_t(hashdb::scan_manager_t* const scan_manager,
+                  const size_t hash_size,
+                  const hashdb::scan_mode_t scan_mode,
+                  const size_t num_threads,
+                  const std::vector<int>& cpus,
+                  const result_format_t result_format);
+#endif
+
     /**
      * Release scan_stream resources.
      */
@@ -828,12 +1744,20 @@ namespace hashdb {
      *       with the scan record.
      *     - A binary label associated with the scan record, of the
      *       length just indicated.
+     *   Waits while the stream is full, until the scan threads take
+     *   arrays to scan or get takes their matches.  Up to five arrays
+     *   per scan thread may be put without getting.  A thread that puts
+     *   more without getting their matches may wait forever, so get
+     *   until get returns "" before each put, or get from another
+     *   thread.
      */
     void put(const std::string& unscanned_data);
 
     /**
      * Receive a string containing an array of records of matched scanned
-     * data or "" if no data is available.
+     * data or "" if no data is available.  Taking matches makes room for
+     * put, which waits for get once the stream is full of matches, see
+     * put.
      *
      * Returns:
      *   An array of records of matched scanned data or "" if no data
@@ -849,14 +1773,24 @@ namespace hashdb {
      *     with the hash that matched.
      *   - JSON text formatted based on the scan mode selected, of the
      *     length just indicated.
+     *
+     *   With BINARY_RESULTS, the JSON length and text are replaced by
+     *   the hash information, with integers in native-Endian format:
+     *   - An 8-byte count of the hash.
+     *   - An 8-byte k_entropy of the hash.
+     *   - A 2-byte length followed by the block_label of the hash.
+     *   - A 4-byte number of sources, followed by an 8-byte source ID
+     *     and an 8-byte sub_count for each source.  Use
+     *     scan_manager_t::find_source_json to read a source.
      */
     std::string get();
 
     /**
      * Returns true if scan_stream is empty, meaning that there is no
      * unscanned data left to scan and there is no scanned data left to
-     * retrieve.  If not empty, a thread yield is issued so that the
-     * caller can busy-wait with less waste.
+     * retrieve.  If not empty, waits until there is scanned data to get
+     * or the stream is empty, so the caller can loop on empty and get
+     * without busy-waiting.
      *
      * Returns:
      *   true if scan_stream is empty.
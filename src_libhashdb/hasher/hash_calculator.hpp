@@ -6,6 +6,9 @@
  * for calculating a hash value: 1) all at once using calculate(), and 2)
  * by calling init(), update(), and final().
  *
+ * Block hashes of whole buffers are faster with md5_blocks in
+ * md5_multi.hpp, which hashes many blocks at once.
+ *
  * This class calculates MD5 hashes by initializing md_context with
  * "EVP_md5()".  Other hash algorithms may be used, instead, by replacing
  * this with, for example, "EVP_sha1()".  Please see openssl/evp.h for
@@ -49,6 +52,16 @@ class hash_calculator_t {
   const EVP_MD* md;
   bool in_progress;
 
+  // hash count zero bytes without allocating them
+  void update_zeros(size_t count) {
+    static const uint8_t zeros[4096] = {0};
+    while (count > 0) {
+      const size_t n = (count < sizeof(zeros)) ? count : sizeof(zeros);
+      EVP_DigestUpdate(md_context, zeros, n);
+      count -= n;
+    }
+  }
+
   public:
   hash_calculator_t() : md_context(EVP_MD_CTX_create()),
                         md(EVP_md5()),
@@ -93,10 +106,7 @@ class hash_calculator_t {
       EVP_DigestUpdate(md_context, buffer + offset, buffer_size - offset);
 
       // hash zeros for part outside buffer
-      size_t extra = count - (buffer_size - offset);
-      uint8_t* b = new uint8_t[extra]();
-      EVP_DigestUpdate(md_context, b, extra);
-      delete[] b;
+      update_zeros(count - (buffer_size - offset));
     }
 
     // put hash into string
@@ -149,10 +159,7 @@ class hash_calculator_t {
       EVP_DigestUpdate(md_context, buffer + offset, buffer_size - offset);
 
       // hash zeros for part outside buffer
-      const size_t extra = count - (buffer_size - offset);
-      const uint8_t* const b = new uint8_t[extra]();
-      EVP_DigestUpdate(md_context, b, extra);
-      delete[] b;
+      update_zeros(count - (buffer_size - offset));
     }
   }
 
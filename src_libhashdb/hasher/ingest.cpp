@@ -280,7 +280,8 @@ namespace hashdb {
                      const bool disable_recursive_processing,
                      const bool disable_calculate_entropy,
                      const bool disable_calculate_labels,
-                     const std::string& cmd) {
+                     const std::string& cmd,
+                     const bool bulk_load) {
 
     bool has_whitelist = false;
     hashdb::scan_manager_t* whitelist_scan_manager = NULL;
@@ -311,8 +312,17 @@ namespace hashdb {
       error_message = "";
     }
 
-    // open import manager
-    hashdb::import_manager_t import_manager(hashdb_dir, cmd);
+    // open import manager, batching writes from the hasher threads
+    hashdb::import_manager_t import_manager(hashdb_dir, cmd,
+                      hashdb::import_manager_t::DEFAULT_BATCH_SIZE,
+                      hashdb::import_manager_t::DEFAULT_BATCH_MILLISECONDS);
+    if (bulk_load) {
+      error_message = import_manager.enable_bulk_load(
+                      hashdb::import_manager_t::DEFAULT_BULK_RUN_SIZE);
+      if (error_message.size() != 0) {
+        return error_message;
+      }
+    }
 
     // get the list of filenames to be processed
     hasher::filenames_t filenames;
@@ -329,7 +339,8 @@ namespace hashdb {
 
     // maybe open whitelist DB
     if (has_whitelist) {
-      whitelist_scan_manager = new scan_manager_t(whitelist_dir);
+      whitelist_scan_manager = new scan_manager_t(whitelist_dir,
+                         scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
     }
 
     // get the number of CPUs
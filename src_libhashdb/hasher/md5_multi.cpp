@@ -0,0 +1,395 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Multi-buffer MD5, following the MD5 algorithm in RFC 1321.
+ *
+ * One template computes the MD5 rounds on a lane type V: uint32_t for
+ * the scalar kernel or a GCC vector of 4, 8 or 16 uint32_t.  Each SIMD
+ * kernel is the template inlined into a function compiled for its
+ * instruction set, so one build runs on any x86 CPU and uses the widest
+ * registers present.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <assert.h>
+#include <iostream>
+#include "md5_multi.hpp"
+
+// SIMD kernels need GCC vector types, target attributes and a runtime
+// CPU check
+#if defined(HAVE_BUILTIN_CPU_SUPPORTS) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define MD5_MULTI_X86
+#endif
+
+// the MD5 rounds must be inlined into each kernel to be compiled for
+// the instruction set of that kernel
+#ifdef __GNUC__
+#define MD5_INLINE static inline __attribute__((always_inline))
+#else
+#define MD5_INLINE static inline
+#endif
+
+namespace hasher {
+
+  // the most lanes of any kernel
+  static const size_t max_lanes = 16;
+
+  // read and write 32-bit little-endian words on any host
+  static inline uint32_t load_le32(const uint8_t* const p) {
+    return static_cast<uint32_t>(p[0]) |
+           static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 |
+           static_cast<uint32_t>(p[3]) << 24;
+  }
+
+  static inline void store_le32(const uint32_t x, uint8_t* const p) {
+    p[0] = static_cast<uint8_t>(x);
+    p[1] = static_cast<uint8_t>(x >> 8);
+    p[2] = static_cast<uint8_t>(x >> 16);
+    p[3] = static_cast<uint8_t>(x >> 24);
+  }
+
+  // Return chunk c of the padded message of one lane: in place when the
+  // chunk is whole in the data, else built in scratch from the data, the
+  // zeros past the available bytes, and the MD5 padding.
+  static inline const uint8_t* lane_chunk(const uint8_t* const data,
+                                          const size_t available,
+                                          const size_t length,
+                                          const size_t c,
+                                          const size_t num_chunks,
+                                          uint8_t* const scratch) {
+    const size_t begin = c * 64;
+    const size_t data_end = (available < length) ? available : length;
+    if (begin + 64 <= data_end) {
+      return data + begin;
+    }
+
+    ::memset(scratch, 0, 64);
+    if (begin < data_end) {
+      ::memcpy(scratch, data + begin, data_end - begin);
+    }
+    if (begin <= length && length < begin + 64) {
+      scratch[length - begin] = 0x80;
+    }
+    if (c == num_chunks - 1) {
+      const uint64_t bits = static_cast<uint64_t>(length) * 8;
+      store_le32(static_cast<uint32_t>(bits), scratch + 56);
+      store_le32(static_cast<uint32_t>(bits >> 32), scratch + 60);
+    }
+    return scratch;
+  }
+
+#define MD5_F(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define MD5_G(b, c, d) ((c) ^ ((d) & ((b) ^ (c))))
+#define MD5_H(b, c, d) ((b) ^ (c) ^ (d))
+#define MD5_I(b, c, d) ((c) ^ ((b) | ~(d)))
+#define MD5_STEP(f, a, b, c, d, w, k, s) \
+  a += f(b, c, d) + w + static_cast<uint32_t>(k); \
+  a = b + ((a << s) | (a >> (32 - s)))
+
+  // compress one 64-byte chunk per lane into state
+  template <typename V>
+  MD5_INLINE void md5_compress(V* const state, const V* const w) {
+    V a = state[0];
+    V b = state[1];
+    V c = state[2];
+    V d = state[3];
+
+    MD5_STEP(MD5_F, a, b, c, d, w[ 0], 0xd76aa478,  7);
+    MD5_STEP(MD5_F, d, a, b, c, w[ 1], 0xe8c7b756, 12);
+    MD5_STEP(MD5_F, c, d, a, b, w[ 2], 0x242070db, 17);
+    MD5_STEP(MD5_F, b, c, d, a, w[ 3], 0xc1bdceee, 22);
+    MD5_STEP(MD5_F, a, b, c, d, w[ 4], 0xf57c0faf,  7);
+    MD5_STEP(MD5_F, d, a, b, c, w[ 5], 0x4787c62a, 12);
+    MD5_STEP(MD5_F, c, d, a, b, w[ 6], 0xa8304613, 17);
+    MD5_STEP(MD5_F, b, c, d, a, w[ 7], 0xfd469501, 22);
+    MD5_STEP(MD5_F, a, b, c, d, w[ 8], 0x698098d8,  7);
+    MD5_STEP(MD5_F, d, a, b, c, w[ 9], 0x8b44f7af, 12);
+    MD5_STEP(MD5_F, c, d, a, b, w[10], 0xffff5bb1, 17);
+    MD5_STEP(MD5_F, b, c, d, a, w[11], 0x895cd7be, 22);
+    MD5_STEP(MD5_F, a, b, c, d, w[12], 0x6b901122,  7);
+    MD5_STEP(MD5_F, d, a, b, c, w[13], 0xfd987193, 12);
+    MD5_STEP(MD5_F, c, d, a, b, w[14], 0xa679438e, 17);
+    MD5_STEP(MD5_F, b, c, d, a, w[15], 0x49b40821, 22);
+
+    MD5_STEP(MD5_G, a, b, c, d, w[ 1], 0xf61e2562,  5);
+    MD5_STEP(MD5_G, d, a, b, c, w[ 6], 0xc040b340,  9);
+    MD5_STEP(MD5_G, c, d, a, b, w[11], 0x265e5a51, 14);
+    MD5_STEP(MD5_G, b, c, d, a, w[ 0], 0xe9b6c7aa, 20);
+    MD5_STEP(MD5_G, a, b, c, d, w[ 5], 0xd62f105d,  5);
+    MD5_STEP(MD5_G, d, a, b, c, w[10], 0x02441453,  9);
+    MD5_STEP(MD5_G, c, d, a, b, w[15], 0xd8a1e681, 14);
+    MD5_STEP(MD5_G, b, c, d, a, w[ 4], 0xe7d3fbc8, 20);
+    MD5_STEP(MD5_G, a, b, c, d, w[ 9], 0x21e1cde6,  5);
+    MD5_STEP(MD5_G, d, a, b, c, w[14], 0xc33707d6,  9);
+    MD5_STEP(MD5_G, c, d, a, b, w[ 3], 0xf4d50d87, 14);
+    MD5_STEP(MD5_G, b, c, d, a, w[ 8], 0x455a14ed, 20);
+    MD5_STEP(MD5_G, a, b, c, d, w[13], 0xa9e3e905,  5);
+    MD5_STEP(MD5_G, d, a, b, c, w[ 2], 0xfcefa3f8,  9);
+    MD5_STEP(MD5_G, c, d, a, b, w[ 7], 0x676f02d9, 14);
+    MD5_STEP(MD5_G, b, c, d, a, w[12], 0x8d2a4c8a, 20);
+
+    MD5_STEP(MD5_H, a, b, c, d, w[ 5], 0xfffa3942,  4);
+    MD5_STEP(MD5_H, d, a, b, c, w[ 8], 0x8771f681, 11);
+    MD5_STEP(MD5_H, c, d, a, b, w[11], 0x6d9d6122, 16);
+    MD5_STEP(MD5_H, b, c, d, a, w[14], 0xfde5380c, 23);
+    MD5_STEP(MD5_H, a, b, c, d, w[ 1], 0xa4beea44,  4);
+    MD5_STEP(MD5_H, d, a, b, c, w[ 4], 0x4bdecfa9, 11);
+    MD5_STEP(MD5_H, c, d, a, b, w[ 7], 0xf6bb4b60, 16);
+    MD5_STEP(MD5_H, b, c, d, a, w[10], 0xbebfbc70, 23);
+    MD5_STEP(MD5_H, a, b, c, d, w[13], 0x289b7ec6,  4);
+    MD5_STEP(MD5_H, d, a, b, c, w[ 0], 0xeaa127fa, 11);
+    MD5_STEP(MD5_H, c, d, a, b, w[ 3], 0xd4ef3085, 16);
+    MD5_STEP(MD5_H, b, c, d, a, w[ 6], 0x04881d05, 23);
+    MD5_STEP(MD5_H, a, b, c, d, w[ 9], 0xd9d4d039,  4);
+    MD5_STEP(MD5_H, d, a, b, c, w[12], 0xe6db99e5, 11);
+    MD5_STEP(MD5_H, c, d, a, b, w[15], 0x1fa27cf8, 16);
+    MD5_STEP(MD5_H, b, c, d, a, w[ 2], 0xc4ac5665, 23);
+
+    MD5_STEP(MD5_I, a, b, c, d, w[ 0], 0xf4292244,  6);
+    MD5_STEP(MD5_I, d, a, b, c, w[ 7], 0x432aff97, 10);
+    MD5_STEP(MD5_I, c, d, a, b, w[14], 0xab9423a7, 15);
+    MD5_STEP(MD5_I, b, c, d, a, w[ 5], 0xfc93a039, 21);
+    MD5_STEP(MD5_I, a, b, c, d, w[12], 0x655b59c3,  6);
+    MD5_STEP(MD5_I, d, a, b, c, w[ 3], 0x8f0ccc92, 10);
+    MD5_STEP(MD5_I, c, d, a, b, w[10], 0xffeff47d, 15);
+    MD5_STEP(MD5_I, b, c, d, a, w[ 1], 0x85845dd1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, w[ 8], 0x6fa87e4f,  6);
+    MD5_STEP(MD5_I, d, a, b, c, w[15], 0xfe2ce6e0, 10);
+    MD5_STEP(MD5_I, c, d, a, b, w[ 6], 0xa3014314, 15);
+    MD5_STEP(MD5_I, b, c, d, a, w[13], 0x4e0811a1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, w[ 4], 0xf7537e82,  6);
+    MD5_STEP(MD5_I, d, a, b, c, w[11], 0xbd3af235, 10);
+    MD5_STEP(MD5_I, c, d, a, b, w[ 2], 0x2ad7d2bb, 15);
+    MD5_STEP(MD5_I, b, c, d, a, w[ 9], 0xeb86d391, 21);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+  }
+
+#undef MD5_F
+#undef MD5_G
+#undef MD5_H
+#undef MD5_I
+#undef MD5_STEP
+
+  // Hash LANES messages of length bytes into out, 16 bytes per lane.
+  // Lane l reads available[l] bytes from data[l] and zeros after that.
+  template <typename V, size_t LANES>
+  MD5_INLINE void md5_lanes(const uint8_t* const* const data,
+                            const size_t* const available,
+                            const size_t length,
+                            uint8_t* const out) {
+
+    V state[4];
+    state[0] = V() + 0x67452301u;
+    state[1] = V() + 0xefcdab89u;
+    state[2] = V() + 0x98badcfeu;
+    state[3] = V() + 0x10325476u;
+
+    // the message, the 0x80 byte, zeros, and the 8-byte bit length
+    const size_t num_chunks = (length + 8) / 64 + 1;
+    uint8_t scratch[LANES][64];
+    uint32_t staged[16][LANES];
+    V w[16];
+    for (size_t c = 0; c < num_chunks; ++c) {
+      // transpose the chunk words of each lane into the lanes of w
+      for (size_t l = 0; l < LANES; ++l) {
+        const uint8_t* const p = lane_chunk(data[l], available[l], length,
+                                            c, num_chunks, scratch[l]);
+        for (size_t j = 0; j < 16; ++j) {
+          staged[j][l] = load_le32(p + 4 * j);
+        }
+      }
+      ::memcpy(w, staged, sizeof(w));
+      md5_compress(state, w);
+    }
+
+    uint32_t words[4][LANES];
+    ::memcpy(words, state, sizeof(words));
+    for (size_t l = 0; l < LANES; ++l) {
+      for (size_t j = 0; j < 4; ++j) {
+        store_le32(words[j][l], out + md5_digest_t::size * l + 4 * j);
+      }
+    }
+  }
+
+  static void md5_lanes_scalar(const uint8_t* const* const data,
+                               const size_t* const available,
+                               const size_t length,
+                               uint8_t* const out) {
+    md5_lanes<uint32_t, 1>(data, available, length, out);
+  }
+
+#ifdef MD5_MULTI_X86
+  typedef uint32_t md5_v4_t __attribute__((vector_size(16)));
+  typedef uint32_t md5_v8_t __attribute__((vector_size(32)));
+  typedef uint32_t md5_v16_t __attribute__((vector_size(64)));
+
+  __attribute__((target("sse2")))
+  static void md5_lanes_sse2(const uint8_t* const* const data,
+                             const size_t* const available,
+                             const size_t length,
+                             uint8_t* const out) {
+    md5_lanes<md5_v4_t, 4>(data, available, length, out);
+  }
+
+  __attribute__((target("avx2")))
+  static void md5_lanes_avx2(const uint8_t* const* const data,
+                             const size_t* const available,
+                             const size_t length,
+                             uint8_t* const out) {
+    md5_lanes<md5_v8_t, 8>(data, available, length, out);
+  }
+
+  __attribute__((target("avx512f")))
+  static void md5_lanes_avx512(const uint8_t* const* const data,
+                               const size_t* const available,
+                               const size_t length,
+                               uint8_t* const out) {
+    md5_lanes<md5_v16_t, 16>(data, available, length, out);
+  }
+#endif
+
+  bool md5_kernel_supported(const md5_kernel_t kernel) {
+    switch(kernel) {
+      case MD5_SCALAR:
+        return true;
+#ifdef MD5_MULTI_X86
+      case MD5_SSE2:
+        return __builtin_cpu_supports("sse2");
+      case MD5_AVX2:
+        return __builtin_cpu_supports("avx2");
+      case MD5_AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+      default:
+        return false;
+    }
+  }
+
+  static md5_kernel_t find_best_kernel() {
+    if (md5_kernel_supported(MD5_AVX512)) {
+      return MD5_AVX512;
+    }
+    if (md5_kernel_supported(MD5_AVX2)) {
+      return MD5_AVX2;
+    }
+    if (md5_kernel_supported(MD5_SSE2)) {
+      return MD5_SSE2;
+    }
+    return MD5_SCALAR;
+  }
+
+  md5_kernel_t md5_best_kernel() {
+    static const md5_kernel_t best_kernel = find_best_kernel();
+    return best_kernel;
+  }
+
+  size_t md5_kernel_lanes(const md5_kernel_t kernel) {
+    switch(kernel) {
+      case MD5_SSE2:
+        return 4;
+      case MD5_AVX2:
+        return 8;
+      case MD5_AVX512:
+        return 16;
+      default:
+        return 1;
+    }
+  }
+
+  void md5_blocks(const uint8_t* const buffer,
+                  const size_t buffer_size,
+                  const size_t* const offsets,
+                  const size_t count,
+                  const size_t block_size,
+                  md5_digest_t* const digests,
+                  const md5_kernel_t p_kernel) {
+
+    const md5_kernel_t kernel =
+                 md5_kernel_supported(p_kernel) ? p_kernel : MD5_SCALAR;
+    const size_t lanes = md5_kernel_lanes(kernel);
+
+    const uint8_t* data[max_lanes];
+    size_t available[max_lanes];
+    uint8_t out[max_lanes * md5_digest_t::size];
+    for (size_t i = 0; i < count; i += lanes) {
+
+      // fill the unused lanes of the last group with its last block
+      const size_t used = (count - i < lanes) ? count - i : lanes;
+      for (size_t l = 0; l < lanes; ++l) {
+        const size_t offset = offsets[i + ((l < used) ? l : used - 1)];
+
+        // program error
+        if (offset > buffer_size) {
+          std::cerr << "md5_blocks offset " << offset
+                    << " is past buffer size " << buffer_size << "\n";
+          assert(0);
+        }
+        data[l] = buffer + offset;
+        available[l] = buffer_size - offset;
+      }
+
+      switch(kernel) {
+#ifdef MD5_MULTI_X86
+        case MD5_SSE2:
+          md5_lanes_sse2(data, available, block_size, out);
+          break;
+        case MD5_AVX2:
+          md5_lanes_avx2(data, available, block_size, out);
+          break;
+        case MD5_AVX512:
+          md5_lanes_avx512(data, available, block_size, out);
+          break;
+#endif
+        default:
+          md5_lanes_scalar(data, available, block_size, out);
+      }
+
+      for (size_t l = 0; l < used; ++l) {
+        ::memcpy(digests[i + l].data, out + md5_digest_t::size * l,
+                 md5_digest_t::size);
+      }
+    }
+  }
+
+} // end namespace hasher
@@ -0,0 +1,89 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Calculate the MD5 block hashes of many equal-size blocks at once.
+ *
+ * Blocks at each step_size offset are independent, so several are hashed
+ * in lockstep, one per 32-bit lane of a SIMD register: 4 lanes with SSE2,
+ * 8 with AVX2 and 16 with AVX-512.  The widest kernel the CPU supports is
+ * chosen at runtime.  Other CPUs use the scalar kernel.
+ */
+
+#ifndef MD5_MULTI_HPP
+#define MD5_MULTI_HPP
+
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+
+namespace hasher {
+
+  /**
+   * The MD5 kernels, from narrowest to widest.
+   */
+  enum md5_kernel_t {MD5_SCALAR, MD5_SSE2, MD5_AVX2, MD5_AVX512};
+
+  /**
+   * One MD5 digest.
+   */
+  struct md5_digest_t {
+    static const size_t size = 16;
+    uint8_t data[size];
+
+    std::string str() const {
+      return std::string(reinterpret_cast<const char*>(data), size);
+    }
+  };
+
+  /**
+   * True if this build and this CPU can run kernel.
+   */
+  bool md5_kernel_supported(const md5_kernel_t kernel);
+
+  /**
+   * The widest kernel this build and this CPU can run.
+   */
+  md5_kernel_t md5_best_kernel();
+
+  /**
+   * The number of blocks kernel hashes at once.
+   */
+  size_t md5_kernel_lanes(const md5_kernel_t kernel);
+
+  /**
+   * Calculate the MD5 hashes of the count blocks of block_size bytes at
+   * offsets in buffer into digests.  Bytes past buffer_size are hashed
+   * as zeros, as in hash_calculator_t::calculate.  Every offset must be
+   * within buffer_size.  An unsupported kernel falls back to the scalar
+   * kernel.
+   */
+  void md5_blocks(const uint8_t* const buffer,
+                  const size_t buffer_size,
+                  const size_t* const offsets,
+                  const size_t count,
+                  const size_t block_size,
+                  md5_digest_t* const digests,
+                  const md5_kernel_t kernel = md5_best_kernel());
+
+} // end namespace hasher
+
+#endif
@@ -38,6 +38,7 @@
 
 #include <cstring>
 #include <sstream>
+#include <vector>
 #include <cstdlib>
 #include <stdint.h>
 #include <assert.h>
@@ -51,12 +52,15 @@
 #include "tprint.hpp"
 #include "process_job.hpp"
 #include "process_recursive.hpp"
-#include "hash_calculator.hpp"
+#include "md5_multi.hpp"
 #include "entropy_calculator.hpp"
 #include "calculate_block_label.hpp"
 
 namespace hasher {
 
+  // block hashes of an ingest job are calculated this many at a time
+  static const size_t hash_batch_size = 256;
+
   // detect if block is all zero
   inline bool all_zero(const uint8_t* const buffer, const size_t buffer_size,
                        const size_t offset, const size_t p_count) {
@@ -114,47 +118,71 @@ namespace hasher {
     print_status(job);
 
     if (!job.disable_ingest_hashes) {
-      // get hash calculator object
-      hasher::hash_calculator_t hash_calculator;
-
       // get entropy calculator object
       hasher::entropy_calculator_t entropy_calculator(job.block_size);
 
-      // iterate over buffer to add block hashes and metadata
+      // iterate over buffer to add block hashes and metadata, hashing a
+      // batch of blocks at a time
       size_t zero_count = 0;
       size_t nonprobative_count = 0;
-      for (size_t i=0; i < job.buffer_data_size; i+= job.step_size) {
-
-        // skip if all the bytes are the same
-        if (all_zero(job.buffer, job.buffer_size, i, job.block_size)) {
-          ++zero_count;
-          continue;
+      size_t offsets[hash_batch_size];
+      hasher::md5_digest_t digests[hash_batch_size];
+      std::vector<hashdb::block_hash_t> block_hashes;
+      std::vector<uint64_t> k_entropies;
+      std::vector<std::string> block_labels;
+      size_t i = 0;
+      while (i < job.buffer_data_size) {
+
+        // gather the offsets of the next batch of blocks
+        size_t count = 0;
+        for (; i < job.buffer_data_size && count < hash_batch_size;
+             i += job.step_size) {
+
+          // skip if all the bytes are the same
+          if (all_zero(job.buffer, job.buffer_size, i, job.block_size)) {
+            ++zero_count;
+            continue;
+          }
+          offsets[count++] = i;
         }
 
-        // calculate block hash
-        const std::string block_hash = hash_calculator.calculate(job.buffer,
-                                    job.buffer_size, i, job.block_size);
-
-        // calculate entropy
-        uint64_t k_entropy = 0;
-        if (!job.disable_calculate_entropy) {
-          k_entropy = entropy_calculator.calculate(job.buffer,
-                                    job.buffer_size, i);
-        }
+        // calculate the block hashes of the batch
+        hasher::md5_blocks(job.buffer, job.buffer_size, offsets, count,
+                           job.block_size, digests);
+        block_hashes.clear();
+        k_entropies.clear();
+        block_labels.clear();
+
+        for (size_t j=0; j < count; ++j) {
+          const size_t offset = offsets[j];
+
+          // calculate entropy
+          uint64_t k_entropy = 0;
+          if (!job.disable_calculate_entropy) {
+            k_entropy = entropy_calculator.calculate(job.buffer,
+                                      job.buffer_size, offset);
+          }
 
-        // calculate block label
-        std::string block_label = "";
-        if (!job.disable_calculate_labels) {
-          block_label = hasher::calculate_block_label(job.buffer,
-                                   job.buffer_size, i, job.block_size);
-          if (block_label.size() != 0) {
-            ++nonprobative_count;
+          // calculate block label
+          std::string block_label = "";
+          if (!job.disable_calculate_labels) {
+            block_label = hasher::calculate_block_label(job.buffer,
+                                     job.buffer_size, offset, job.block_size);
+            if (block_label.size() != 0) {
+              ++nonprobative_count;
+            }
           }
+
+          block_hashes.push_back(hashdb::block_hash_t(
+                     reinterpret_cast<const char*>(digests[j].data),
+                     hasher::md5_digest_t::size));
+          k_entropies.push_back(k_entropy);
+          block_labels.push_back(block_label);
         }
 
-        // add block hash to DB
-        job.import_manager->insert_hash(block_hash, k_entropy, block_label,
-                                        job.file_hash);
+        // add the block hashes of the batch to DB
+        job.import_manager->insert_hashes(block_hashes, k_entropies,
+                                          block_labels, job.file_hash);
       }
 
       // submit tracked source counts to the ingest tracker for final reporting
@@ -186,10 +214,8 @@ namespace hasher {
 
     size_t zero_count = 0;
 
-    // get hash calculator object
-    hasher::hash_calculator_t hash_calculator;
-
-    // iterate over buffer to calculate and scan for block hashes
+    // iterate over buffer to find the blocks to hash
+    std::vector<size_t> offsets;
     for (size_t i=0; i < job.buffer_data_size; i+= job.step_size) {
 
       // skip if all the bytes are the same
@@ -197,14 +223,30 @@ namespace hasher {
         ++zero_count;
         continue;
       }
+      offsets.push_back(i);
+    }
+
+    // calculate their block hashes all at once
+    std::vector<hasher::md5_digest_t> digests(offsets.size());
+    if (offsets.size() != 0) {
+      hasher::md5_blocks(job.buffer, job.buffer_size, &offsets[0],
+                         offsets.size(), job.block_size, &digests[0]);
+    }
+    std::vector<hashdb::block_hash_t> block_hashes;
+    block_hashes.reserve(digests.size());
+    for (size_t j=0; j < digests.size(); ++j) {
+      block_hashes.push_back(hashdb::block_hash_t(
+                     reinterpret_cast<const char*>(digests[j].data),
+                     hasher::md5_digest_t::size));
+    }
 
-      // calculate block hash
-      const std::string block_hash = hash_calculator.calculate(job.buffer,
-                  job.buffer_size, i, job.block_size);
+    // scan the block hashes of the whole buffer at once, in hash order
+    std::vector<std::string> json_strings;
+    job.scan_manager->find_hashes_json(job.scan_mode, block_hashes,
+                                       json_strings);
 
-      // scan
-      const std::string json_string = 
-              job.scan_manager->find_hash_json(job.scan_mode, block_hash);
+    for (size_t j=0; j < block_hashes.size(); ++j) {
+      const std::string& json_string = json_strings[j];
 
       if (json_string.size() > 0) {
         // match so print offset <tab> file <tab> json
@@ -215,10 +257,10 @@ namespace hasher {
         }
 
         // add the offset
-        ss << job.file_offset + i << "\t";
+        ss << job.file_offset + offsets[j] << "\t";
 
         // add the block hash
-        ss << hashdb::bin_to_hex(block_hash) << "\t";
+        ss << hashdb::bin_to_hex(block_hashes[j].str()) << "\t";
 
         // add the json text and a newline
         ss << json_string << "\n";
@@ -176,7 +176,8 @@ namespace hashdb {
     }
 
     // open scan manager
-    hashdb::scan_manager_t scan_manager(hashdb_dir);
+    hashdb::scan_manager_t scan_manager(hashdb_dir,
+                  hashdb::scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
 
     // open the file reader
     const hasher::file_reader_t file_reader(hasher::utf8_to_native(
@@ -24,14 +24,96 @@
 
 #include <config.h>
 #include <string>
+#include <cstring>
+#include <stdint.h>
 #include <cassert>
 #include <iostream>
-#include <sstream>
 #include "hashdb.hpp"
 
 namespace hashdb {
 
 
+// the same byte in every byte of a word
+static inline uint64_t bytes(const uint8_t b) {
+  return 0x0101010101010101ULL * b;
+}
+
+// high bit set in each byte of x, all under 0x80, that is in [lo, hi]
+static inline uint64_t in_range(const uint64_t x,
+                                const uint8_t lo, const uint8_t hi) {
+  const uint64_t at_least_lo = x + bytes(0x80 - lo);
+  const uint64_t above_hi = x + bytes(0x7f - hi);
+  return at_least_lo & ~above_hi & bytes(0x80);
+}
+
+// decode the eight hex digits in word into four bytes at bin
+static inline bool decode_word(const uint64_t word, char* const bin) {
+
+  // every digit must be 0-9, a-f or A-F
+  const uint64_t digits = in_range(word, '0', '9');
+  const uint64_t letters = in_range(word | bytes(0x20), 'a', 'f');
+  if ((word & bytes(0x80)) != 0 || (digits | letters) != bytes(0x80)) {
+    return false;
+  }
+
+  // nibble values, then pairs of nibbles in the low byte of each lane
+  const uint64_t nibbles = (word & bytes(0x0f)) + (letters >> 7) * 9;
+  uint64_t pairs = ((nibbles << 4) | (nibbles >> 8)) & 0x00ff00ff00ff00ffULL;
+  pairs = (pairs | (pairs >> 8)) & 0x0000ffff0000ffffULL;
+  pairs = pairs | (pairs >> 16);
+  bin[0] = static_cast<char>(pairs);
+  bin[1] = static_cast<char>(pairs >> 8);
+  bin[2] = static_cast<char>(pairs >> 16);
+  bin[3] = static_cast<char>(pairs >> 24);
+  return true;
+}
+
+/**
+ * Decode hex into bin eight digits at a time, return false if size is
+ * odd or any digit is invalid.
+ */
+bool hex_to_bin(const char* const hex, const size_t size, char* const bin) {
+
+  // size must be even
+  if (size%2 != 0) {
+    return false;
+  }
+
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    // the first digit goes in the low byte on any host
+    const uint8_t* const h = reinterpret_cast<const uint8_t*>(hex + i);
+    const uint64_t word =
+               static_cast<uint64_t>(h[0])       |
+               static_cast<uint64_t>(h[1]) << 8  |
+               static_cast<uint64_t>(h[2]) << 16 |
+               static_cast<uint64_t>(h[3]) << 24 |
+               static_cast<uint64_t>(h[4]) << 32 |
+               static_cast<uint64_t>(h[5]) << 40 |
+               static_cast<uint64_t>(h[6]) << 48 |
+               static_cast<uint64_t>(h[7]) << 56;
+    if (!decode_word(word, bin + i / 2)) {
+      return false;
+    }
+  }
+
+  // the last few digits, padded with '0'
+  if (i < size) {
+    char tail[8] = {'0', '0', '0', '0', '0', '0', '0', '0'};
+    char tail_bin[4];
+    memcpy(tail, hex + i, size - i);
+    uint64_t word = 0;
+    for (size_t j = 0; j < 8; ++j) {
+      word |= static_cast<uint64_t>(static_cast<uint8_t>(tail[j])) << (8 * j);
+    }
+    if (!decode_word(word, tail_bin)) {
+      return false;
+    }
+    memcpy(bin + i / 2, tail_bin, (size - i) / 2);
+  }
+  return true;
+}
+
 /**
  * Return binary string or empty if hexdigest length is not even
  * or has any invalid digits.
@@ -46,60 +128,49 @@ std::string hex_to_bin(const std::string& hex_string) {
     return "";
   }
 
-  size_t i = 0;
-  size_t j = 0;
-  uint8_t bin[size];
-  for (; i<size; i+=2) {
-    uint8_t c0 = hex_string[i];
-    uint8_t c1 = hex_string[i+1];
-    uint8_t d0;
-    uint8_t d1;
-
-    if(c0>='0' && c0<='9') d0 = c0-'0';
-    else if(c0>='a' && c0<='f') d0 = c0-'a'+10;
-    else if(c0>='A' && c0<='F') d0 = c0-'A'+10;
-    else {
-      std::cerr << "hex_to_bin: unexpected hex character in '"
-                << hex_string << "'\n";
-      return "";
-    }
+  std::string bin(size / 2, 0);
+  if (size != 0 && !hex_to_bin(hex_string.c_str(), size, &bin[0])) {
+    std::cerr << "hex_to_bin: unexpected hex character in '"
+              << hex_string << "'\n";
+    return "";
+  }
+  return bin;
+}
 
-    if(c1>='0' && c1<='9') d1 = c1-'0';
-    else if(c1>='a' && c1<='f') d1 = c1-'a'+10;
-    else if(c1>='A' && c1<='F') d1 = c1-'A'+10;
-    else {
-      std::cerr << "hex_to_bin: unexpected hex character in '"
-                << hex_string << "'\n";
-      return "";
-    }
+// encode the four bytes in the low half of word into eight hex digits
+static inline uint64_t encode_word(const uint64_t word) {
 
-    bin[j++] = d0 << 4 | d1;
-  }
-  return std::string(reinterpret_cast<char*>(bin), j);
+  // byte k in lane 2k
+  uint64_t spread = (word | (word << 16)) & 0x0000ffff0000ffffULL;
+  spread = (spread | (spread << 8)) & 0x00ff00ff00ff00ffULL;
+
+  // the high nibble of byte k in lane 2k, the low nibble in lane 2k + 1
+  const uint64_t nibbles = ((spread >> 4) & bytes(0x0f)) |
+                           ((spread & bytes(0x0f)) << 8);
+
+  // '0' + nibble, moved up to 'a' for nibbles over 9
+  const uint64_t letters = ((nibbles + bytes(6)) >> 4) & bytes(0x01);
+  return nibbles + bytes('0') + letters * ('a' - '0' - 10);
 }
 
-inline uint8_t tohex(uint8_t c) {
-  switch(c) {
-    case 0 : return '0'; break;
-    case 1 : return '1'; break;
-    case 2 : return '2'; break;
-    case 3 : return '3'; break;
-    case 4 : return '4'; break;
-    case 5 : return '5'; break;
-    case 6 : return '6'; break;
-    case 7 : return '7'; break;
-    case 8 : return '8'; break;
-    case 9 : return '9'; break;
-    case 10 : return 'a'; break;
-    case 11 : return 'b'; break;
-    case 12 : return 'c'; break;
-    case 13 : return 'd'; break;
-    case 14 : return 'e'; break;
-    case 15 : return 'f'; break;
-    default:
-      std::cerr << "char " << (uint32_t)c << "\n";
-      assert(0);
-      return 0; // for mingw compiler
+/**
+ * Encode size bytes at bin into size * 2 hex digits at hex, four bytes
+ * at a time.
+ */
+void bin_to_hex(const char* const bin, const size_t size, char* const hex) {
+
+  for (size_t i = 0; i < size; i += 4) {
+    // the first byte goes in the low byte on any host
+    const uint8_t* const b = reinterpret_cast<const uint8_t*>(bin + i);
+    const size_t n = (size - i < 4) ? size - i : 4;
+    uint64_t word = 0;
+    for (size_t j = 0; j < n; ++j) {
+      word |= static_cast<uint64_t>(b[j]) << (8 * j);
+    }
+    const uint64_t digits = encode_word(word);
+    for (size_t j = 0; j < n * 2; ++j) {
+      hex[i * 2 + j] = static_cast<char>(digits >> (8 * j));
+    }
   }
 }
 
@@ -107,12 +178,11 @@ inline uint8_t tohex(uint8_t c) {
  * Return hexadecimal representation of the binary string.
  */
 std::string bin_to_hex(const std::string& binary_string) {
-  std::stringstream ss;
-  for (size_t i=0; i<binary_string.size(); i++) {
-    uint8_t c = binary_string.c_str()[i];
-    ss << tohex(c>>4) << tohex(c&0x0f);
+  std::string hex(binary_string.size() * 2, 0);
+  if (binary_string.size() != 0) {
+    bin_to_hex(binary_string.c_str(), binary_string.size(), &hex[0]);
   }
-  return ss.str();
+  return hex;
 }
 } // end namespace hashdb
 
@@ -0,0 +1,257 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Provides a threadsafe bounded queue of import changes for the batch
+ * writer thread in import_manager_t.
+ *
+ * On push: wait until there is room for the change.
+ * On pop: wait for a change, a flush request, done, or the deadline.
+ *
+ * flush waits until the writer has applied and committed every change
+ * that was queued.
+ */
+
+#ifndef IMPORT_QUEUE_HPP
+#define IMPORT_QUEUE_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>    // std::swap
+#include <iostream>
+#include <cassert>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>       // timespec
+#include "hashdb.hpp"   // block_hash_t
+
+namespace hashdb {
+
+/**
+ * One change requested through import_manager_t.  Fields not used by
+ * the change type are left empty.
+ */
+struct import_change_t {
+  enum import_change_type_t {SOURCE_NAME,
+                             SOURCE_DATA,
+                             INSERT_HASH,
+                             MERGE_HASH,
+                             INSERT_HASHES,
+                             NEW_SOURCE_HASH};
+
+  import_change_type_t type;
+
+  // hash fields
+  std::string block_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t sub_count;
+
+  // hash fields of INSERT_HASHES, one of each per hash
+  std::vector<block_hash_t> block_hashes;
+  std::vector<uint64_t> k_entropies;
+  std::vector<std::string> block_labels;
+
+  // source fields
+  std::string file_hash;
+  uint64_t filesize;
+  std::string file_type;
+  uint64_t zero_count;
+  uint64_t nonprobative_count;
+  std::string repository_name;
+  std::string filename;
+
+  import_change_t() :
+            type(SOURCE_NAME), block_hash(), k_entropy(0), block_label(),
+            sub_count(0), block_hashes(), k_entropies(), block_labels(),
+            file_hash(), filesize(0), file_type(),
+            zero_count(0), nonprobative_count(0), repository_name(),
+            filename() {
+  }
+
+  // exchange contents with other without copying the vectors or strings
+  void swap(import_change_t& other) {
+    std::swap(type, other.type);
+    block_hash.swap(other.block_hash);
+    std::swap(k_entropy, other.k_entropy);
+    block_label.swap(other.block_label);
+    std::swap(sub_count, other.sub_count);
+    block_hashes.swap(other.block_hashes);
+    k_entropies.swap(other.k_entropies);
+    block_labels.swap(other.block_labels);
+    file_hash.swap(other.file_hash);
+    std::swap(filesize, other.filesize);
+    file_type.swap(other.file_type);
+    std::swap(zero_count, other.zero_count);
+    std::swap(nonprobative_count, other.nonprobative_count);
+    repository_name.swap(other.repository_name);
+    filename.swap(other.filename);
+  }
+
+  // the batch writer counts each hash of INSERT_HASHES as a change
+  size_t change_count() const {
+    return (type == INSERT_HASHES) ? block_hashes.size() : 1;
+  }
+};
+
+class import_queue_t {
+
+  private:
+  const size_t max_queue_size;
+  std::deque<import_change_t> changes;
+  bool is_done_adding;
+  uint64_t flush_requested;
+  uint64_t flush_completed;
+
+  mutable pthread_mutex_t M;
+  pthread_cond_t changed;     // a change, flush request, or done
+  pthread_cond_t not_full;    // room for a change
+  pthread_cond_t flushed;     // a flush completed
+
+  // do not allow copy or assignment
+  import_queue_t(const import_queue_t&);
+  import_queue_t& operator=(const import_queue_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  public:
+  import_queue_t(const size_t p_max_queue_size) :
+                max_queue_size(p_max_queue_size), changes(),
+                is_done_adding(false),
+                flush_requested(0), flush_completed(0),
+                M(), changed(), not_full(), flushed() {
+    if(pthread_mutex_init(&M,NULL) ||
+       pthread_cond_init(&changed,NULL) ||
+       pthread_cond_init(&not_full,NULL) ||
+       pthread_cond_init(&flushed,NULL)) {
+      std::cerr << "Error obtaining import queue mutex.\n";
+      assert(0);
+    }
+  }
+
+  ~import_queue_t() {
+    lock();
+    if (changes.size() > 0) {
+      // program error if queue is not empty
+      std::cerr << "Processing error: import ended but import queue is not empty.\n";
+    }
+    unlock();
+    pthread_cond_destroy(&flushed);
+    pthread_cond_destroy(&not_full);
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&M);
+  }
+
+  // move change into the queue, leaving change empty
+  void push(import_change_t& change) {
+    lock();
+    while (changes.size() >= max_queue_size) {
+      pthread_cond_wait(&not_full, &M);
+    }
+    changes.push_back(import_change_t());
+    changes.back().swap(change);
+    pthread_cond_signal(&changed);
+    unlock();
+  }
+
+  /**
+   * Pop a change into change and return true, else return false when
+   * the queue is empty and there is a flush request, done, or the
+   * deadline passes.  Wait without a deadline if deadline is NULL.
+   * flush_generation receives the flush request the writer is serving.
+   */
+  bool pop(import_change_t& change, const timespec* const deadline,
+           uint64_t& flush_generation) {
+    lock();
+    while (changes.size() == 0) {
+      if (flush_requested != flush_completed || is_done_adding) {
+        break;
+      }
+      if (deadline == NULL) {
+        pthread_cond_wait(&changed, &M);
+      } else if (pthread_cond_timedwait(&changed, &M, deadline) != 0) {
+        // timed out
+        break;
+      }
+    }
+
+    flush_generation = flush_requested;
+    if (changes.size() == 0) {
+      unlock();
+      return false;
+    }
+
+    change.swap(changes.front());
+    changes.pop_front();
+    pthread_cond_signal(&not_full);
+    unlock();
+    return true;
+  }
+
+  // the writer has committed everything up to flush_generation
+  void flush_done(const uint64_t flush_generation) {
+    lock();
+    if (flush_generation > flush_completed) {
+      flush_completed = flush_generation;
+      pthread_cond_broadcast(&flushed);
+    }
+    unlock();
+  }
+
+  // wait until everything queued so far is committed
+  void flush() {
+    lock();
+    const uint64_t generation = ++flush_requested;
+    pthread_cond_signal(&changed);
+    while (flush_completed < generation) {
+      pthread_cond_wait(&flushed, &M);
+    }
+    unlock();
+  }
+
+  void done_adding() {
+    lock();
+    is_done_adding = true;
+    pthread_cond_signal(&changed);
+    unlock();
+  }
+
+  bool is_done() const {
+    lock();
+    bool done = is_done_adding && changes.size() == 0;
+    unlock();
+    return done;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
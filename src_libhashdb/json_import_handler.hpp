@@ -0,0 +1,312 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Decode one line of JSON import text with the rapidjson SAX reader,
+ * without building a DOM.  The handler keeps the first value of each
+ * top-level field of interest, with its array elements, and check
+ * validates them in the order and with the messages that
+ * import_manager_t::import_json has always used.  Other fields and
+ * nested values are skipped.  Use one handler per thread.
+ */
+
+#ifndef JSON_IMPORT_HANDLER_HPP
+#define JSON_IMPORT_HANDLER_HPP
+
+#include "hashdb.hpp"
+#include "rapidjson.h"
+#include "reader.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+namespace hashdb {
+
+class json_import_handler_t :
+    public rapidjson::BaseReaderHandler<rapidjson::UTF8<>,
+                                        json_import_handler_t> {
+
+  private:
+  enum value_type_t {OTHER_VALUE, STRING_VALUE, UINT_VALUE, ARRAY_VALUE};
+
+  struct value_t {
+    value_type_t type;
+    std::string s;
+    uint64_t u;
+    value_t() : type(OTHER_VALUE), s(), u(0) {
+    }
+  };
+
+  // one top-level field of interest
+  struct field_t {
+    bool is_present;
+    value_t value;
+    std::vector<value_t> elements;            // when an array
+    field_t() : is_present(false), value(), elements() {
+    }
+  };
+
+  enum field_name_t {BLOCK_HASH, K_ENTROPY, BLOCK_LABEL, SOURCE_SUB_COUNTS,
+                     FILE_HASH, FILESIZE, FILE_TYPE, ZERO_COUNT,
+                     NONPROBATIVE_COUNT, NAME_PAIRS, NUM_FIELDS, NO_FIELD};
+
+  field_t fields[NUM_FIELDS];
+  size_t depth;                               // open objects and arrays
+  field_name_t field;                         // field of the current value
+  bool in_field_array;                        // reading field elements
+
+  // do not allow copy or assignment
+  json_import_handler_t(const json_import_handler_t&);
+  json_import_handler_t& operator=(const json_import_handler_t&);
+
+  static field_name_t field_name(const char* const str,
+                                 const rapidjson::SizeType length) {
+    static const char* const names[NUM_FIELDS] = {
+                  "block_hash", "k_entropy", "block_label",
+                  "source_sub_counts", "file_hash", "filesize", "file_type",
+                  "zero_count", "nonprobative_count", "name_pairs"};
+    for (size_t i = 0; i < NUM_FIELDS; ++i) {
+      if (strlen(names[i]) == length && memcmp(names[i], str, length) == 0) {
+        return static_cast<field_name_t>(i);
+      }
+    }
+    return NO_FIELD;
+  }
+
+  // take a value that opens no container
+  bool value(const value_t& v) {
+    if (depth == 1 && field != NO_FIELD) {
+      fields[field].value = v;
+      field = NO_FIELD;
+    } else if (depth == 2 && in_field_array) {
+      fields[field].elements.push_back(v);
+    }
+    return true;
+  }
+
+  // take the start of an object or array
+  bool start(const bool is_array) {
+    if (depth == 0 && is_array) {
+      // the document must be an object
+      return false;
+    }
+    if (depth == 1 && field != NO_FIELD) {
+      if (is_array) {
+        fields[field].value.type = ARRAY_VALUE;
+        in_field_array = true;
+      } else {
+        field = NO_FIELD;
+      }
+    } else if (depth == 2 && in_field_array) {
+      fields[field].elements.push_back(value_t());
+    }
+    ++depth;
+    return true;
+  }
+
+  bool end() {
+    --depth;
+    if (depth == 1 && in_field_array) {
+      in_field_array = false;
+      field = NO_FIELD;
+    }
+    return true;
+  }
+
+  public:
+  json_import_handler_t() :
+          fields(), depth(0), field(NO_FIELD), in_field_array(false) {
+  }
+
+  // SAX events
+  bool Default() {
+    return value(value_t());
+  }
+  bool Uint(const unsigned u) {
+    return Uint64(u);
+  }
+  bool Uint64(const uint64_t u) {
+    value_t v;
+    v.type = UINT_VALUE;
+    v.u = u;
+    return value(v);
+  }
+  bool String(const char* const str, const rapidjson::SizeType length,
+              const bool) {
+    value_t v;
+    v.type = STRING_VALUE;
+    v.s.assign(str, length);
+    return value(v);
+  }
+  bool Key(const char* const str, const rapidjson::SizeType length,
+           const bool) {
+    if (depth == 1) {
+      // keep the first of repeated fields
+      field = field_name(str, length);
+      if (field != NO_FIELD) {
+        if (fields[field].is_present) {
+          field = NO_FIELD;
+        } else {
+          fields[field].is_present = true;
+        }
+      }
+    }
+    return true;
+  }
+  bool StartObject() {
+    return start(false);
+  }
+  bool EndObject(const rapidjson::SizeType) {
+    return end();
+  }
+  bool StartArray() {
+    return start(true);
+  }
+  bool EndArray(const rapidjson::SizeType) {
+    return end();
+  }
+
+  /**
+   * Validate the fields read and set record, return "" else the reason
+   * the text is not a valid hash or source.
+   */
+  std::string check(json_record_t& record) const {
+
+    if (fields[BLOCK_HASH].is_present) {
+      record.is_source = false;
+
+      // block_hash
+      if (fields[BLOCK_HASH].value.type != STRING_VALUE) {
+        return "Invalid block_hash field";
+      }
+      record.block_hash = hashdb::hex_to_bin(fields[BLOCK_HASH].value.s);
+
+      // entropy (optional)
+      record.k_entropy = 0;
+      if (fields[K_ENTROPY].is_present) {
+        if (fields[K_ENTROPY].value.type != UINT_VALUE) {
+          return "Invalid k_entropy field";
+        }
+        record.k_entropy = fields[K_ENTROPY].value.u;
+      }
+
+      // block_label (optional)
+      record.block_label = "";
+      if (fields[BLOCK_LABEL].is_present) {
+        if (fields[BLOCK_LABEL].value.type != STRING_VALUE) {
+          return "Invalid block_label field";
+        }
+        record.block_label = fields[BLOCK_LABEL].value.s;
+      }
+
+      // source_sub_counts:[]
+      if (!fields[SOURCE_SUB_COUNTS].is_present ||
+          fields[SOURCE_SUB_COUNTS].value.type != ARRAY_VALUE) {
+        return "Invalid source_sub_counts field";
+      }
+      const std::vector<value_t>& elements =
+                                  fields[SOURCE_SUB_COUNTS].elements;
+      record.source_sub_counts.clear();
+      for (size_t i = 0; i + 1 < elements.size(); i += 2) {
+        if (elements[i].type != STRING_VALUE) {
+          return "Invalid source hash in source_sub_counts";
+        }
+        if (elements[i + 1].type != UINT_VALUE) {
+          return "Invalid sub_count in source_sub_counts";
+        }
+        record.source_sub_counts.push_back(std::pair<std::string, uint64_t>(
+                hashdb::hex_to_bin(elements[i].s), elements[i + 1].u));
+      }
+      return "";
+
+    } else if (fields[FILE_HASH].is_present) {
+      record.is_source = true;
+
+      // file_hash
+      if (fields[FILE_HASH].value.type != STRING_VALUE) {
+        return "Invalid file_hash field";
+      }
+      record.file_hash = hashdb::hex_to_bin(fields[FILE_HASH].value.s);
+
+      // filesize
+      if (!fields[FILESIZE].is_present ||
+          fields[FILESIZE].value.type != UINT_VALUE) {
+        return "Invalid filesize field";
+      }
+      record.filesize = fields[FILESIZE].value.u;
+
+      // file_type (optional)
+      record.file_type = "";
+      if (fields[FILE_TYPE].is_present) {
+        if (fields[FILE_TYPE].value.type != STRING_VALUE) {
+          return "Invalid file_type field";
+        }
+        record.file_type = fields[FILE_TYPE].value.s;
+      }
+
+      // zero_count (optional)
+      record.zero_count = 0;
+      if (fields[ZERO_COUNT].is_present) {
+        if (fields[ZERO_COUNT].value.type != UINT_VALUE) {
+          return "Invalid zero_count field";
+        }
+        record.zero_count = fields[ZERO_COUNT].value.u;
+      }
+
+      // nonprobative_count (optional)
+      record.nonprobative_count = 0;
+      if (fields[NONPROBATIVE_COUNT].is_present) {
+        if (fields[NONPROBATIVE_COUNT].value.type != UINT_VALUE) {
+          return "Invalid nonprobative_count field";
+        }
+        record.nonprobative_count = fields[NONPROBATIVE_COUNT].value.u;
+      }
+
+      // name_pairs:[]
+      if (!fields[NAME_PAIRS].is_present ||
+          fields[NAME_PAIRS].value.type != ARRAY_VALUE) {
+        return "Invalid name_pairs field";
+      }
+      const std::vector<value_t>& elements = fields[NAME_PAIRS].elements;
+      record.names.clear();
+      for (size_t i = 0; i < elements.size(); i += 2) {
+        if (elements[i].type != STRING_VALUE) {
+          return "Invalid repository name in name_pairs field";
+        }
+        if (i + 1 == elements.size() ||
+            elements[i + 1].type != STRING_VALUE) {
+          return "Invalid filename in name_pairs field";
+        }
+        record.names.insert(hashdb::source_name_t(elements[i].s,
+                                                  elements[i + 1].s));
+      }
+      return "";
+
+    } else {
+      return "A block_hash or file_hash field is required";
+    }
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,161 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Write JSON text straight into a std::string with a rapidjson Writer
+ * rather than building a rapidjson::Document and copying its text.
+ *
+ * The writer, its level stack and its hex buffer are kept between texts,
+ * and texts are written into strings the caller keeps, so once the
+ * buffers have grown, writing JSON allocates nothing.
+ *
+ * Not threadsafe.  Use thread_json_writer() for this thread's writer.
+ */
+
+#ifndef JSON_WRITER_HPP
+#define JSON_WRITER_HPP
+
+#include <string>
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include "hashdb.hpp"
+#include "rapidjson.h"
+#include "writer.h"
+
+// per-thread writers
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+namespace hashdb {
+
+// rapidjson output stream that appends to a std::string
+class json_string_stream_t {
+  private:
+  std::string* text;
+
+  // do not allow copy or assignment
+  json_string_stream_t(const json_string_stream_t&);
+  json_string_stream_t& operator=(const json_string_stream_t&);
+
+  public:
+  typedef char Ch;
+
+  json_string_stream_t() : text(NULL) {
+  }
+
+  void set(std::string& p_text) {
+    text = &p_text;
+  }
+
+  void Put(const char c) {
+    text->push_back(c);
+  }
+
+  void Flush() {
+  }
+};
+
+class json_writer_t {
+
+  public:
+  typedef rapidjson::Writer<json_string_stream_t> writer_t;
+
+  private:
+  json_string_stream_t stream;
+  writer_t writer;
+  std::string hex;
+
+  // do not allow copy or assignment
+  json_writer_t(const json_writer_t&);
+  json_writer_t& operator=(const json_writer_t&);
+
+  public:
+  json_writer_t() : stream(), writer(stream), hex() {
+  }
+
+  /**
+   * Start a JSON value that replaces the content of text.
+   */
+  writer_t& start(std::string& text) {
+    text.clear();
+    return append(text);
+  }
+
+  /**
+   * Start a JSON value at the end of text.
+   */
+  writer_t& append(std::string& text) {
+    stream.set(text);
+    writer.Reset(stream);
+    return writer;
+  }
+
+  /**
+   * Write binary data as a hexadecimal string value.
+   */
+  void hex_string(const std::string& bin) {
+    hex.resize(bin.size() * 2);
+    if (bin.size() != 0) {
+      hashdb::bin_to_hex(bin.c_str(), bin.size(), &hex[0]);
+    }
+    writer.String(hex.c_str(), static_cast<rapidjson::SizeType>(hex.size()));
+  }
+
+  /**
+   * Write a string value.
+   */
+  void string(const std::string& s) {
+    writer.String(s.c_str(), static_cast<rapidjson::SizeType>(s.size()));
+  }
+};
+
+// this thread's writer, deleted when the thread exits
+static pthread_key_t json_writer_key;
+static pthread_once_t json_writer_once = PTHREAD_ONCE_INIT;
+
+static void delete_json_writer(void* arg) {
+  delete static_cast<json_writer_t*>(arg);
+}
+
+static void create_json_writer_key() {
+  int rc = pthread_key_create(&json_writer_key, delete_json_writer);
+  if (rc != 0) {
+    std::cerr << "JSON writer key error: " << strerror(rc) << "\n";
+    assert(0);
+  }
+}
+
+inline json_writer_t& thread_json_writer() {
+  pthread_once(&json_writer_once, create_json_writer_key);
+  json_writer_t* json_writer =
+             static_cast<json_writer_t*>(pthread_getspecific(json_writer_key));
+  if (json_writer == NULL) {
+    json_writer = new json_writer_t;
+    pthread_setspecific(json_writer_key, json_writer);
+  }
+  return *json_writer;
+}
+
+} // end namespace hashdb
+
+#endif
@@ -41,6 +41,8 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <stdint.h>
 #include <climits>
 #ifndef HAVE_CXX11
@@ -54,14 +56,25 @@
 #include <unistd.h>     // for pipe
 #include "file_modes.h"
 #include "settings_manager.hpp"
+#include "block_hash_bytes.hpp"
 #include "lmdb_hash_data_manager.hpp"
 #include "lmdb_hash_manager.hpp"
 #include "lmdb_source_data_manager.hpp"
 #include "lmdb_source_id_manager.hpp"
 #include "lmdb_source_name_manager.hpp"
+#include "lmdb_source_hash_manager.hpp"
+#include "lmdb_reader.hpp"
+#include "source_cache.hpp"
+#include "hash_bulk_loader.hpp"
+#include "bloom_filter.hpp"
+#include "binary_dump.hpp"
 #include "logger.hpp"
 #include "locked_member.hpp"
+#include "import_queue.hpp"
+#include "json_import_handler.hpp"
+#include "json_writer.hpp"
 #include "lmdb_changes.hpp"
+#include "mutex_lock.hpp"
 #include "rapidjson.h"
 #include "writer.h"
 #include "document.h"
@@ -91,51 +104,258 @@ namespace hashdb {
     return value;
   }
 
-  // helper for producing expanded source for a source ID
-  static void provide_source_information(
-                        const hashdb::scan_manager_t& manager,
-                        const std::string file_hash,
-                        rapidjson::Document::AllocatorType& allocator,
-                        rapidjson::Value& json_source) {
+  // JSON text for a source
+  static void source_json(const std::string& file_hash,
+                          const uint64_t filesize,
+                          const std::string& file_type,
+                          const uint64_t zero_count,
+                          const uint64_t nonprobative_count,
+                          const hashdb::source_names_t& source_names,
+                          std::string& json_text) {
+
+    hashdb::json_writer_t& json_writer = hashdb::thread_json_writer();
+    hashdb::json_writer_t::writer_t& writer = json_writer.start(json_text);
+    writer.StartObject();
+
+    // source data
+    writer.Key("file_hash");
+    json_writer.hex_string(file_hash);
+    writer.Key("filesize");
+    writer.Uint64(filesize);
+    writer.Key("file_type");
+    json_writer.string(file_type);
+    writer.Key("zero_count");
+    writer.Uint64(zero_count);
+    writer.Key("nonprobative_count");
+    writer.Uint64(nonprobative_count);
+
+    // name_pairs as repository name, filename
+    writer.Key("name_pairs");
+    writer.StartArray();
+    for (hashdb::source_names_t::const_iterator it = source_names.begin();
+         it != source_names.end(); ++it) {
+      json_writer.string(it->first);
+      json_writer.string(it->second);
+    }
+    writer.EndArray();
+    writer.EndObject();
+  }
 
-    // fields to hold source information
-    uint64_t filesize;
-    std::string file_type;
-    uint64_t zero_count;
-    uint64_t nonprobative_count;
-    hashdb::source_names_t* source_names(new hashdb::source_names_t);
+  // JSON text for a hash and one count field
+  static void count_json(const char* const name,
+                         const std::string& block_hash,
+                         const uint64_t count,
+                         std::string& json_text) {
+
+    hashdb::json_writer_t& json_writer = hashdb::thread_json_writer();
+    hashdb::json_writer_t::writer_t& writer = json_writer.start(json_text);
+    writer.StartObject();
+    writer.Key("block_hash");
+    json_writer.hex_string(block_hash);
+    writer.Key(name);
+    writer.Uint64(count);
+    writer.EndObject();
+  }
 
-    // read source data
-    manager.find_source_data(file_hash, filesize, file_type,
-                             zero_count, nonprobative_count);
+  // write source_sub_counts as pairs of file hash, sub_count
+  static void write_source_sub_counts(hashdb::json_writer_t& json_writer,
+                            hashdb::json_writer_t::writer_t& writer,
+                            const hashdb::source_sub_counts_t& source_sub_counts) {
+
+    writer.StartArray();
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+      json_writer.hex_string(it->file_hash);
+      writer.Uint64(it->sub_count);
+    }
+    writer.EndArray();
+  }
+
+  // JSON export text for a hash
+  static void hash_json(const std::string& block_hash,
+                        const uint64_t k_entropy,
+                        const std::string& block_label,
+                        const hashdb::source_sub_counts_t& source_sub_counts,
+                        std::string& json_text) {
+
+    hashdb::json_writer_t& json_writer = hashdb::thread_json_writer();
+    hashdb::json_writer_t::writer_t& writer = json_writer.start(json_text);
+    writer.StartObject();
+
+    // hash data
+    writer.Key("block_hash");
+    json_writer.hex_string(block_hash);
+    writer.Key("k_entropy");
+    writer.Uint64(k_entropy);
+    writer.Key("block_label");
+    json_writer.string(block_label);
+
+    // source_sub_counts
+    writer.Key("source_sub_counts");
+    write_source_sub_counts(json_writer, writer, source_sub_counts);
+    writer.EndObject();
+  }
+
+  // compare block hashes, held in std::string or block_hash_t, by index
+  template <typename T>
+  class hash_index_less_t {
+    private:
+    const std::vector<T>& block_hashes;
+    public:
+    hash_index_less_t(const std::vector<T>& p_block_hashes) :
+                      block_hashes(p_block_hashes) {
+    }
+    bool operator()(const size_t a, const size_t b) const {
+      return hash_less(block_hashes[a], block_hashes[b]);
+    }
+  };
+
+  // indexes of the block hashes in ascending hash order, skipping empty
+  // hashes and, when there is a Bloom filter, hashes it rules out
+  template <typename T>
+  static void sorted_order(const std::vector<T>& block_hashes,
+                           const bloom_filter_t* const bloom_filter,
+                           std::vector<size_t>& order) {
+    order.clear();
+    order.reserve(block_hashes.size());
+    for (size_t i = 0; i < block_hashes.size(); ++i) {
+      const T& block_hash = block_hashes[i];
+      if (hash_size(block_hash) == 0) {
+        std::cerr << "Error: find_hashes called with empty block_hash\n";
+        continue;
+      }
+      if (bloom_filter != NULL && !bloom_filter->find(hash_bytes(block_hash),
+                                                     hash_size(block_hash))) {
+        continue;
+      }
+      order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(),
+              hash_index_less_t<T>(block_hashes));
+  }
+
+  // a Bloom filter filled past its capacity screens out fewer absent
+  // hashes as it fills, so say so
+  static void warn_bloom_filter_full(const bloom_filter_t& bloom_filter) {
+    std::cerr << "Warning: the Bloom filter holds about "
+              << bloom_filter.size_hashes()
+              << " hashes but was sized for "
+              << bloom_filter.size_capacity()
+              << " so it screens out fewer absent hashes.  Run rebuild_bloom"
+              << " to resize it.\n";
+  }
+
+  // open the optional Bloom filter, warning if it is past its capacity
+  static bloom_filter_t* open_bloom_filter(const std::string& hashdb_dir,
+                                   const file_mode_type_t file_mode) {
+    bloom_filter_t* bloom_filter = bloom_filter_t::open(
+                                   hashdb_dir + "/bloom_filter", file_mode);
+    if (bloom_filter != NULL &&
+        bloom_filter->size_hashes() > bloom_filter->size_capacity()) {
+      warn_bloom_filter_full(*bloom_filter);
+    }
+    return bloom_filter;
+  }
 
-    // provide source data
-    const std::string hex_file_hash = hashdb::bin_to_hex(file_hash);
+  // the stores, as named DBs in the single environment layout or as
+  // lmdb_<name> environments in the separate environment layout
+  static const size_t num_stores = 5;
+  static const char* const store_names[num_stores] = {
+                 "hash_data_store", "hash_store", "source_data_store",
+                 "source_id_store", "source_name_store"};
+  static const bool store_duplicates[num_stores] = {
+                 true, false, false, false, true};
+
+  // room for the named DBs in the single environment layout
+  static const unsigned int max_dbs = 16;
+
+  // A change writes at most eight records: a source ID record, a blank
+  // source data record, a Type 1 hash data record that becomes a Type 2
+  // and Type 3 records, a hash store record and a source hash record.
+  // Each record reserves the pages lmdb_helper::record_pages gives for
+  // the depth of the stores.
+  static const size_t change_records = 8;
+
+  // the most pages a batch reserves, a batch of changes commits early
+  // rather than reserve more
+  static const size_t max_batch_pages = 65536;
+
+  // pages reserved per appended record, appends fill pages in key order
+  static const size_t append_pages = 2;
+
+  // read the settings of an open hashdb
+  static hashdb::settings_t require_settings(const std::string& hashdb_dir) {
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\nAborting.\n";
+      exit(1);
+    }
+    return settings;
+  }
 
-    // value for strings
-    json_source.AddMember("file_hash", v(hex_file_hash, allocator), allocator);
-    json_source.AddMember("filesize", filesize, allocator);
-    json_source.AddMember("file_type", v(file_type, allocator), allocator);
-    json_source.AddMember("zero_count", zero_count, allocator);
-    json_source.AddMember("nonprobative_count", nonprobative_count, allocator);
+  // open the environment holding all stores for the single environment
+  // layout, else NULL for stores that open their own environment
+  static MDB_env* open_shared_env(const std::string& hashdb_dir,
+                                  const hashdb::settings_t& settings,
+                                  const hashdb::file_mode_type_t file_mode) {
+
+    if (settings.layout_version == settings_t::SEPARATE_ENV_LAYOUT) {
+      return NULL;
+    }
+    return lmdb_helper::open_env(hashdb_dir + "/lmdb_store", file_mode,
+                                 max_dbs);
+  }
 
-    // read source names
-    manager.find_source_names(file_hash, *source_names);
+  // whether Type 3 hash data records are in their own fixed-width DB
+  static bool has_type3_store(const hashdb::settings_t& settings) {
+    return settings.layout_version >= settings_t::TYPE3_STORE_LAYOUT;
+  }
 
-    // name_pairs object
-    rapidjson::Value json_name_pairs(rapidjson::kArrayType);
+  // remove the environment at store_dir, if present
+  static void remove_env_dir(const std::string& store_dir) {
+    std::remove((store_dir + "/data.mdb").c_str());
+    std::remove((store_dir + "/lock.mdb").c_str());
+    rmdir(store_dir.c_str());
+  }
 
-    // provide names
-    hashdb::source_names_t::const_iterator it;
-    for (it = source_names->begin(); it != source_names->end(); ++it) {
-      // repository name
-      json_name_pairs.PushBack(v(it->first, allocator), allocator);
-      // filename
-      json_name_pairs.PushBack(v(it->second, allocator), allocator);
+  // replace the records of the store_name store with the records of the
+  // store_name DB of new_env, built beside the hashdb in new_dir, then
+  // write settings.  The records change in one write txn and settings.json
+  // is replaced whole, so a crash leaves the old or the new store, never a
+  // partly copied one.
+  static std::string replace_store(const std::string& hashdb_dir,
+                                   const hashdb::settings_t& settings,
+                                   const char* const store_name,
+                                   const bool is_duplicates,
+                                   MDB_env* new_env,
+                                   const std::string& new_dir) {
+
+    // stores of the separate environment layout have their own environment
+    MDB_env* to_env = open_shared_env(hashdb_dir, settings, RW_MODIFY);
+    const bool is_separate = (to_env == NULL);
+    if (is_separate) {
+      to_env = lmdb_helper::open_env(
+                     hashdb_dir + "/lmdb_" + store_name, RW_MODIFY);
+    }
+    MDB_dbi to_dbi = lmdb_helper::open_dbi(to_env,
+                     (is_separate) ? NULL : store_name, is_duplicates,
+                     RW_MODIFY);
+    MDB_dbi new_dbi = lmdb_helper::open_dbi(new_env, store_name,
+                     is_duplicates, READ_ONLY);
+
+    // the new records must be on disk before the settings follow them
+    lmdb_helper::replace_dbi(new_env, new_dbi, to_env, to_dbi);
+    int rc = mdb_env_sync(to_env, 1);
+    lmdb_helper::close_env(to_env);
+    lmdb_helper::close_env(new_env);
+    remove_env_dir(new_dir);
+    if (rc != 0) {
+      return std::string("Unable to sync the ") + store_name + ": " +
+             mdb_strerror(rc);
     }
-    json_source.AddMember("name_pairs", json_name_pairs, allocator);
 
-    delete source_names;
+    return hashdb::write_settings(hashdb_dir, settings);
   }
 
   static uint32_t calculate_crc(
@@ -180,6 +400,20 @@ namespace hashdb {
       return "Path '" + hashdb_dir + "' already exists.";
     }
 
+    // hash store widths must be valid
+    if (!settings_t::valid_hash_prefix_bytes(settings.hash_prefix_bytes)) {
+      return "Invalid hash prefix bytes.";
+    }
+    if (!settings_t::valid_hash_count_bytes(settings.hash_count_bytes)) {
+      return "Invalid hash count bytes.";
+    }
+
+    // the source index is a named DB in the shared environment
+    if (settings.source_index &&
+        settings.layout_version == settings_t::SEPARATE_ENV_LAYOUT) {
+      return "The source index requires a single environment layout.";
+    }
+
     // create the new hashdb directory
     int status;
 #ifdef WIN32
@@ -199,11 +433,30 @@ namespace hashdb {
     }
 
     // create new LMDB stores
-    lmdb_hash_data_manager_t(hashdb_dir, RW_NEW);
-    lmdb_hash_manager_t(hashdb_dir, RW_NEW);
-    lmdb_source_data_manager_t(hashdb_dir, RW_NEW);
-    lmdb_source_id_manager_t(hashdb_dir, RW_NEW);
-    lmdb_source_name_manager_t(hashdb_dir, RW_NEW);
+    MDB_env* env = open_shared_env(hashdb_dir, settings, RW_NEW);
+    lmdb_hash_data_manager_t(hashdb_dir, RW_NEW, env,
+                             has_type3_store(settings));
+    lmdb_hash_manager_t(hashdb_dir, RW_NEW, env, settings.hash_prefix_bytes,
+                        settings.hash_count_bytes);
+    lmdb_source_data_manager_t(hashdb_dir, RW_NEW, env);
+    lmdb_source_id_manager_t(hashdb_dir, RW_NEW, env);
+    lmdb_source_name_manager_t(hashdb_dir, RW_NEW, env);
+    if (settings.source_index) {
+      lmdb_source_hash_manager_t(RW_NEW, env);
+    }
+    if (env != NULL) {
+      lmdb_helper::close_env(env);
+    }
+
+    // create the optional Bloom filter
+    if (settings.bloom_false_positive_rate > 0.0) {
+      error_message = bloom_filter_t::create(hashdb_dir + "/bloom_filter",
+                                    settings.bloom_capacity,
+                                    settings.bloom_false_positive_rate);
+      if (error_message.size() != 0) {
+        return error_message;
+      }
+    }
 
     // create the log
     logger_t(hashdb_dir, command_string);
@@ -211,6 +464,334 @@ namespace hashdb {
     return "";
   }
 
+  /**
+   * Return "" if the hashdb is migrated to the current layout else reason
+   * if not.
+   */
+  std::string migrate_hashdb(const std::string& hashdb_dir,
+                             const std::string& command_string) {
+
+    // the hashdb must use an older layout
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (settings.layout_version == settings_t::CURRENT_LAYOUT_VERSION) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' already uses the current layout.";
+    }
+    const bool is_separate =
+               (settings.layout_version == settings_t::SEPARATE_ENV_LAYOUT);
+
+    // the new environment must not exist yet
+    const std::string shared_dir = hashdb_dir + "/lmdb_store";
+    if (is_separate && access(shared_dir.c_str(), F_OK) == 0) {
+      return "Path '" + shared_dir + "' already exists.";
+    }
+
+    // copy each store into its named DB
+    MDB_env* to_env = lmdb_helper::open_env(shared_dir,
+                          (is_separate) ? RW_NEW : RW_MODIFY, max_dbs);
+    if (is_separate) {
+      for (size_t i = 0; i < num_stores; ++i) {
+        const std::string store_dir =
+                       hashdb_dir + "/lmdb_" + store_names[i];
+        MDB_env* from_env = lmdb_helper::open_env(store_dir, READ_ONLY);
+        MDB_dbi from_dbi = lmdb_helper::open_dbi(from_env, NULL,
+                                       store_duplicates[i], READ_ONLY);
+        MDB_dbi to_dbi = lmdb_helper::open_dbi(to_env, store_names[i],
+                                       store_duplicates[i], RW_MODIFY);
+        lmdb_helper::copy_dbi(from_env, from_dbi, to_env, to_dbi);
+        lmdb_helper::close_env(from_env);
+      }
+    }
+
+    // move the Type 3 hash data records into their fixed-width DB
+    MDB_dbi hash_data_dbi = lmdb_helper::open_dbi(to_env, "hash_data_store",
+                          true, RW_MODIFY, 0, lmdb_helper::compare_hash_keys);
+    MDB_dbi type3_dbi = lmdb_helper::open_dbi(to_env, "hash_type3_store",
+                          true, RW_MODIFY, MDB_DUPFIXED,
+                          lmdb_helper::compare_hash_keys);
+    hashdb::move_type3s(to_env, hash_data_dbi, type3_dbi);
+
+    // the changes must be on disk before the settings change and the old
+    // stores go away
+    int rc = mdb_env_sync(to_env, 1);
+    if (rc != 0) {
+      lmdb_helper::close_env(to_env);
+      return std::string("Unable to sync the new store: ") +
+             mdb_strerror(rc);
+    }
+    lmdb_helper::close_env(to_env);
+
+    // use the new layout
+    settings.layout_version = settings_t::CURRENT_LAYOUT_VERSION;
+    error_message = hashdb::write_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // remove the old stores
+    for (size_t i = 0; is_separate && i < num_stores; ++i) {
+      const std::string store_dir =
+                     hashdb_dir + "/lmdb_" + store_names[i];
+      std::remove((store_dir + "/data.mdb").c_str());
+      std::remove((store_dir + "/lock.mdb").c_str());
+      if (rmdir(store_dir.c_str()) != 0) {
+        std::cerr << "Warning: unable to remove old store '" << store_dir
+                  << "'.\n";
+      }
+    }
+
+    // log the migration
+    logger_t(hashdb_dir, command_string);
+
+    return "";
+  }
+
+  /**
+   * Return "" if the Bloom filter is rebuilt else reason if not.
+   */
+  std::string rebuild_bloom(const std::string& hashdb_dir,
+                            const double bloom_false_positive_rate,
+                            const std::string& command_string) {
+
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (bloom_false_positive_rate < 0.0 || bloom_false_positive_rate >= 1.0) {
+      return "Invalid Bloom filter false positive rate.";
+    }
+
+    const std::string filename = hashdb_dir + "/bloom_filter";
+    const std::string new_filename = hashdb_dir + "/bloom_filter.new";
+    std::remove(new_filename.c_str());
+
+    if (bloom_false_positive_rate > 0.0) {
+      hashdb::scan_manager_t manager(hashdb_dir,
+                        scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
+
+      // size for the hashes present with room to grow
+      const uint64_t num_hashes = manager.size_hashes();
+      uint64_t capacity = num_hashes + num_hashes / 2;
+      if (capacity < settings.bloom_capacity) {
+        capacity = settings.bloom_capacity;
+      }
+      settings.bloom_capacity = capacity;
+
+      // build the new filter beside the old one
+      error_message = bloom_filter_t::create(new_filename, capacity,
+                                             bloom_false_positive_rate);
+      if (error_message.size() != 0) {
+        return error_message;
+      }
+      bloom_filter_t* filter = bloom_filter_t::open(new_filename, RW_MODIFY);
+      if (filter == NULL) {
+        std::remove(new_filename.c_str());
+        return "Unable to open new Bloom filter '" + new_filename + "'.";
+      }
+      for (hash_iterator_t it(manager); !it.at_end(); it.next()) {
+        filter->add(it.block_hash());
+      }
+      delete filter;
+
+      // replace the old filter
+      if (std::rename(new_filename.c_str(), filename.c_str()) != 0) {
+        std::remove(new_filename.c_str());
+        return "Unable to replace Bloom filter '" + filename + "': " +
+               strerror(errno);
+      }
+    } else {
+      // no filter
+      std::remove(filename.c_str());
+    }
+
+    // save the rate and capacity
+    settings.bloom_false_positive_rate = bloom_false_positive_rate;
+    error_message = hashdb::write_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // log the rebuild
+    logger_t(hashdb_dir, command_string);
+
+    return "";
+  }
+
+  /**
+   * Return "" if the source index is built else reason if not.
+   */
+  std::string rebuild_source_index(const std::string& hashdb_dir,
+                                   const std::string& command_string) {
+
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (settings.layout_version == settings_t::SEPARATE_ENV_LAYOUT) {
+      return "The source index requires a single environment layout.  "
+             "Please migrate the hashdb.";
+    }
+
+    logger_t logger(hashdb_dir, command_string);
+
+    // build the new store in its own environment beside the hashdb stores
+    const std::string new_dir = hashdb_dir + "/lmdb_source_hash_store.new";
+    remove_env_dir(new_dir);
+    MDB_env* new_env = lmdb_helper::open_env(new_dir, RW_NEW, max_dbs);
+    hashdb::lmdb_changes_t changes;
+    {
+      lmdb_source_hash_manager_t new_manager(RW_NEW, new_env);
+      MDB_env* from_env = open_shared_env(hashdb_dir, settings, READ_ONLY);
+      lmdb_hash_data_manager_t* hash_data_manager =
+                 new lmdb_hash_data_manager_t(hashdb_dir, READ_ONLY,
+                                     from_env, has_type3_store(settings));
+
+      // index the sources of each hash
+      uint64_t k_entropy;
+      std::string block_label;
+      uint64_t count;
+      hashdb::source_id_sub_counts_t source_id_sub_counts;
+      MDB_txn* txn = NULL;
+      size_t pages = 0;
+      lmdb_key_iterator_t* hash_it =
+                            hash_data_manager->new_iterator("", "", 0);
+      for (; !hash_it->at_end(); hash_it->next()) {
+        const std::string block_hash = hash_it->key();
+        hash_data_manager->read_at(hash_it->get_context(), block_hash,
+                         k_entropy, block_label, count, source_id_sub_counts);
+
+        // keep all the records of one hash in one batch, the records are
+        // in source ID order so each is a random insert
+        const size_t hash_pages = source_id_sub_counts.size() *
+                                  lmdb_helper::record_pages(new_env);
+        if (txn != NULL && pages + hash_pages > max_batch_pages) {
+          new_manager.leave_batch();
+          lmdb_helper::commit_batch(txn);
+          txn = NULL;
+        }
+        if (txn == NULL) {
+          txn = lmdb_helper::begin_batch(new_env,
+                              std::max(max_batch_pages, hash_pages) + 10);
+          new_manager.join_batch(txn);
+          pages = 0;
+        }
+        for (hashdb::source_id_sub_counts_t::const_iterator it =
+             source_id_sub_counts.begin();
+             it != source_id_sub_counts.end(); ++it) {
+          new_manager.insert(it->source_id, block_hash, changes);
+        }
+        pages += hash_pages;
+      }
+      if (txn != NULL) {
+        new_manager.leave_batch();
+        lmdb_helper::commit_batch(txn);
+      }
+      delete hash_it;
+      delete hash_data_manager;
+      if (from_env != NULL) {
+        lmdb_helper::close_env(from_env);
+      }
+    }
+
+    // replace the contents of the source hash store and keep the index
+    // from now on
+    settings.source_index = true;
+    error_message = replace_store(hashdb_dir, settings, "source_hash_store",
+                                  true, new_env, new_dir);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // log the build
+    logger.add_hashdb_settings(settings);
+    logger.add_log("\n");
+    logger.add_lmdb_changes(changes);
+
+    return "";
+  }
+
+  /**
+   * Return "" if the hash store is rebuilt else reason if not.
+   */
+  std::string rebuild_hash_store(const std::string& hashdb_dir,
+                                 const uint32_t hash_prefix_bytes,
+                                 const uint32_t hash_count_bytes,
+                                 const std::string& command_string,
+                                 uint64_t& hash_count,
+                                 uint64_t& prefix_count) {
+    hash_count = 0;
+    prefix_count = 0;
+
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (!settings_t::valid_hash_prefix_bytes(hash_prefix_bytes)) {
+      return "Invalid hash prefix bytes.";
+    }
+    if (!settings_t::valid_hash_count_bytes(hash_count_bytes)) {
+      return "Invalid hash count bytes.";
+    }
+
+    logger_t logger(hashdb_dir, command_string);
+
+    // build the new store in its own environment beside the hashdb stores
+    const std::string new_dir = hashdb_dir + "/lmdb_hash_store.new";
+    remove_env_dir(new_dir);
+    MDB_env* new_env = lmdb_helper::open_env(new_dir, RW_NEW, max_dbs);
+    hashdb::lmdb_changes_t changes;
+    {
+      lmdb_hash_manager_t new_manager(hashdb_dir, RW_NEW, new_env,
+                                      hash_prefix_bytes, hash_count_bytes);
+      hashdb::scan_manager_t manager(hashdb_dir,
+                        scan_manager_t::DEFAULT_REFRESH_MILLISECONDS);
+
+      // hashes arrive in order so their prefixes may be appended
+      bool is_open = false;
+      size_t records = 0;
+      for (hash_iterator_t it(manager); !it.at_end(); it.next()) {
+        if (!is_open) {
+          new_manager.begin_batch(max_batch_pages + 10);
+          is_open = true;
+          records = 0;
+        }
+        new_manager.append(it.block_hash(), it.count(), changes);
+        ++hash_count;
+        if (++records == max_batch_pages / append_pages) {
+          new_manager.commit_batch();
+          is_open = false;
+        }
+      }
+      if (is_open) {
+        new_manager.commit_batch();
+      }
+    }
+    prefix_count = changes.hash_inserted;
+
+    // replace the contents of the hash store and use the new widths
+    settings.hash_prefix_bytes = hash_prefix_bytes;
+    settings.hash_count_bytes = hash_count_bytes;
+    error_message = replace_store(hashdb_dir, settings, "hash_store",
+                                  false, new_env, new_dir);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // log the rebuild
+    logger.add_hashdb_settings(settings);
+    logger.add_log("\n");
+    logger.add_lmdb_changes(changes);
+
+    return "";
+  }
+
   // ************************************************************
   // source sub_counts
   // ************************************************************
@@ -223,18 +804,78 @@ namespace hashdb {
     return (file_hash < that.file_hash);
   }
 
+  block_hash_t::block_hash_t() : size(0), data() {
+  }
+
+  block_hash_t::block_hash_t(const char* const p, const size_t p_size) :
+          size(0), data() {
+    if (p_size > max_size) {
+      std::cerr << "Usage error: the hash provided to block_hash_t is "
+                << p_size << " bytes, over " << max_size << ".\n";
+      return;
+    }
+    memcpy(data, p, p_size);
+    size = p_size;
+  }
+
+  block_hash_t::block_hash_t(const std::string& s) :
+          block_hash_t(s.c_str(), s.size()) {
+  }
+
+  std::string block_hash_t::str() const {
+    return std::string(data, size);
+  }
+
+  hash_source_t::hash_source_t(const uint64_t p_source_id,
+                               const uint64_t p_sub_count) :
+          source_id(p_source_id), sub_count(p_sub_count) {
+  }
+
+  hash_record_t::hash_record_t() :
+          is_found(false), k_entropy(0), block_label(), count(0),
+          sources() {
+  }
+
+  json_record_t::json_record_t() :
+          is_source(false), block_hash(), k_entropy(0), block_label(),
+          source_sub_counts(), file_hash(), filesize(0), file_type(),
+          zero_count(0), nonprobative_count(0), names() {
+  }
+
   // ************************************************************
   // settings
   // ************************************************************
   settings_t::settings_t() :
          settings_version(settings_t::CURRENT_SETTINGS_VERSION),
-         block_size(512) {
+         block_size(512),
+         layout_version(settings_t::CURRENT_LAYOUT_VERSION),
+         hash_prefix_bytes(settings_t::DEFAULT_HASH_PREFIX_BYTES),
+         hash_count_bytes(settings_t::DEFAULT_HASH_COUNT_BYTES),
+         bloom_false_positive_rate(0.0),
+         bloom_capacity(settings_t::DEFAULT_BLOOM_CAPACITY),
+         source_index(false) {
+  }
+
+  bool settings_t::valid_hash_prefix_bytes(const uint64_t p_hash_prefix_bytes) {
+    return p_hash_prefix_bytes >= 1 &&
+           p_hash_prefix_bytes <= settings_t::MAX_HASH_PREFIX_BYTES;
+  }
+
+  bool settings_t::valid_hash_count_bytes(const uint64_t p_hash_count_bytes) {
+    return p_hash_count_bytes == 0 || p_hash_count_bytes == 1 ||
+           p_hash_count_bytes == 2 || p_hash_count_bytes == 4;
   }
 
   std::string settings_t::settings_string() const {
     std::stringstream ss;
     ss << "{\"settings_version\":" << settings_version
        << ", \"block_size\":" << block_size
+       << ", \"layout_version\":" << layout_version
+       << ", \"hash_prefix_bytes\":" << hash_prefix_bytes
+       << ", \"hash_count_bytes\":" << hash_count_bytes
+       << ", \"bloom_false_positive_rate\":" << bloom_false_positive_rate
+       << ", \"bloom_capacity\":" << bloom_capacity
+       << ", \"source_index\":" << ((source_index) ? "true" : "false")
        << "}";
     return ss.str();
   }
@@ -250,47 +891,391 @@ namespace hashdb {
           lmdb_source_data_manager(0),
           lmdb_source_id_manager(0),
           lmdb_source_name_manager(0),
+          lmdb_source_hash_manager(0),
+
+          // shared environment
+          env(NULL),
+          batch_txn(NULL),
+          M(),
+
+          // log
+          logger(new logger_t(hashdb_dir, command_string)),
+          changes(new hashdb::lmdb_changes_t),
+
+          // not batching
+          batch_size(0),
+          batch_milliseconds(0),
+          queue(NULL),
+          writer_thread(),
+
+          // not bulk loading
+          bulk_load_dir(hashdb_dir + "/bulk_load_tmp"),
+          bulk_loader(NULL),
+
+          // opened with the managers
+          bloom_filter(NULL),
+          new_sources(),
+          preexisting_sources() {
+
+    MUTEX_INIT(&M);
+
+    // open managers
+    open_managers(hashdb_dir);
+  }
+
+  import_manager_t::import_manager_t(const std::string& hashdb_dir,
+                                     const std::string& command_string,
+                                     const size_t p_batch_size,
+                                     const size_t p_batch_milliseconds) :
+          // LMDB managers
+          lmdb_hash_data_manager(0),
+          lmdb_hash_manager(0),
+          lmdb_source_data_manager(0),
+          lmdb_source_id_manager(0),
+          lmdb_source_name_manager(0),
+          lmdb_source_hash_manager(0),
+
+          // shared environment
+          env(NULL),
+          batch_txn(NULL),
+          M(),
+
+          // log
+          logger(new logger_t(hashdb_dir, command_string)),
+          changes(new hashdb::lmdb_changes_t),
+
+          // batching
+          batch_size(p_batch_size),
+          batch_milliseconds(p_batch_milliseconds),
+          queue(NULL),
+          writer_thread(),
+
+          // not bulk loading
+          bulk_load_dir(hashdb_dir + "/bulk_load_tmp"),
+          bulk_loader(NULL),
+
+          // opened with the managers
+          bloom_filter(NULL),
+          new_sources(),
+          preexisting_sources() {
+
+    MUTEX_INIT(&M);
+
+    // open managers
+    open_managers(hashdb_dir);
+
+    // start the batch writer
+    if (batch_size > 0) {
+      start_writer();
+    }
+  }
+
+  import_manager_t::~import_manager_t() {
+
+    // commit pending changes and stop the batch writer
+    if (queue != NULL) {
+      queue->done_adding();
+      int status = pthread_join(writer_thread, NULL);
+      if (status != 0) {
+        std::cerr << "error in import writer join " << status << "\n";
+      }
+      delete queue;
+    }
+
+    // append the bulk loaded hashes
+    if (bulk_loader != NULL) {
+      load_bulk();
+      delete bulk_loader;
+    }
+
+    // show changes
+    logger->add_lmdb_changes(*changes);
+    std::cout << *changes;
+
+    // close resources
+    delete bloom_filter;
+    delete lmdb_hash_data_manager;
+    delete lmdb_hash_manager;
+    delete lmdb_source_data_manager;
+    delete lmdb_source_id_manager;
+    delete lmdb_source_name_manager;
+    delete lmdb_source_hash_manager;
+    if (env != NULL) {
+      lmdb_helper::close_env(env);
+    }
+    delete logger;
+    delete changes;
+    MUTEX_DESTROY(&M);
+  }
+
+  void import_manager_t::open_managers(const std::string& hashdb_dir) {
+    const hashdb::settings_t settings = require_settings(hashdb_dir);
+    env = open_shared_env(hashdb_dir, settings, RW_MODIFY);
+    lmdb_hash_data_manager = new lmdb_hash_data_manager_t(hashdb_dir,
+                             RW_MODIFY, env, has_type3_store(settings));
+    lmdb_hash_manager = new lmdb_hash_manager_t(hashdb_dir, RW_MODIFY, env,
+                   settings.hash_prefix_bytes, settings.hash_count_bytes);
+    lmdb_source_data_manager = new lmdb_source_data_manager_t(hashdb_dir,
+                                                          RW_MODIFY, env);
+    lmdb_source_id_manager = new lmdb_source_id_manager_t(hashdb_dir,
+                                                          RW_MODIFY, env);
+    lmdb_source_name_manager = new lmdb_source_name_manager_t(hashdb_dir,
+                                                          RW_MODIFY, env);
+    if (settings.source_index) {
+      lmdb_source_hash_manager = new lmdb_source_hash_manager_t(RW_MODIFY,
+                                                                env);
+    }
+    bloom_filter = open_bloom_filter(hashdb_dir, RW_MODIFY);
+  }
+
+  void import_manager_t::flush() {
+    if (queue != NULL) {
+      queue->flush();
+    }
+  }
+
+  // the separate environment layout has no shared env to size or sync
+  void import_manager_t::preallocate(const uint64_t expected_bytes) {
+    flush();
+    if (env != NULL) {
+      MUTEX_LOCK(&M);
+      lmdb_helper::preallocate(env, expected_bytes);
+      MUTEX_UNLOCK(&M);
+    }
+  }
+
+  void import_manager_t::set_flush_policy(const uint64_t flush_bytes,
+                                          const uint64_t flush_milliseconds) {
+    if (env != NULL) {
+      lmdb_helper::set_flush_policy(env, flush_bytes, flush_milliseconds);
+    }
+  }
+
+  std::string import_manager_t::enable_bulk_load(const size_t run_size) {
+    // the hash stores must be empty because hashes are appended
+    flush();
+    if (bulk_loader != NULL) {
+      return "Bulk loading is already enabled.";
+    }
+    if (lmdb_hash_data_manager->size() != 0 ||
+        lmdb_hash_manager->size() != 0) {
+      return "Bulk loading requires a hashdb with no hashes.";
+    }
+    bulk_loader = new hash_bulk_loader_t(bulk_load_dir, run_size);
+    return "";
+  }
+
+  void import_manager_t::insert_source_name(
+                          const std::string& file_hash,
+                          const std::string& repository_name,
+                          const std::string& filename) {
+    if (file_hash.size() == 0) {
+      std::cerr << "Error: insert_source_name called with empty file_hash\n";
+      return;
+    }
+
+    import_change_t change;
+    change.type = import_change_t::SOURCE_NAME;
+    change.file_hash = file_hash;
+    change.repository_name = repository_name;
+    change.filename = filename;
+    submit(change);
+  }
+
+  void import_manager_t::insert_source_data(
+                          const std::string& file_hash,
+                          const uint64_t filesize,
+                          const std::string& file_type,
+                          const uint64_t zero_count,
+                          const uint64_t nonprobative_count) {
+    if (file_hash.size() == 0) {
+      std::cerr << "Error: insert_source_data called with empty file_hash\n";
+      return;
+    }
+
+    import_change_t change;
+    change.type = import_change_t::SOURCE_DATA;
+    change.file_hash = file_hash;
+    change.filesize = filesize;
+    change.file_type = file_type;
+    change.zero_count = zero_count;
+    change.nonprobative_count = nonprobative_count;
+    submit(change);
+  }
+
+  // add whether file hash is present or not, used during ingest
+  void import_manager_t::insert_hash(const std::string& block_hash,
+                          const uint64_t k_entropy,
+                          const std::string& block_label,
+                          const std::string& file_hash) {
+
+    if (block_hash.size() == 0) {
+      std::cerr << "Error: insert_hash called with empty block_hash\n";
+      return;
+    }
+    if (file_hash.size() == 0) {
+      std::cerr << "Error: insert_hash called with empty file_hash\n";
+      return;
+    }
+
+    import_change_t change;
+    change.type = import_change_t::INSERT_HASH;
+    change.block_hash = block_hash;
+    change.k_entropy = k_entropy;
+    change.block_label = block_label;
+    change.file_hash = file_hash;
+    submit(change);
+  }
+
+  // insert many hashes of one source as one change
+  void import_manager_t::insert_hashes(
+                          const std::vector<block_hash_t>& block_hashes,
+                          const std::vector<uint64_t>& k_entropies,
+                          const std::vector<std::string>& block_labels,
+                          const std::string& file_hash) {
+
+    if (k_entropies.size() != block_hashes.size() ||
+        block_labels.size() != block_hashes.size()) {
+      std::cerr << "Usage error: insert_hashes requires one k_entropy and "
+                << "one block_label per block hash.\n";
+      return;
+    }
+    for (size_t i = 0; i < block_hashes.size(); ++i) {
+      if (block_hashes[i].size == 0) {
+        std::cerr << "Error: insert_hashes called with empty block_hash\n";
+        return;
+      }
+    }
+    if (file_hash.size() == 0) {
+      std::cerr << "Error: insert_hashes called with empty file_hash\n";
+      return;
+    }
+    if (block_hashes.size() == 0) {
+      return;
+    }
+
+    import_change_t change;
+    change.type = import_change_t::INSERT_HASHES;
+    change.block_hashes = block_hashes;
+    change.k_entropies = k_entropies;
+    change.block_labels = block_labels;
+    change.file_hash = file_hash;
+    submit(change);
+  }
+
+  // add only if the source is new, used during tab import
+  void import_manager_t::insert_new_source_hash(
+                          const std::string& block_hash,
+                          const uint64_t k_entropy,
+                          const std::string& block_label,
+                          const std::string& file_hash,
+                          const std::string& repository_name,
+                          const std::string& filename) {
+
+    if (block_hash.size() == 0) {
+      std::cerr << "Error: insert_new_source_hash called with empty block_hash\n";
+      return;
+    }
+    if (file_hash.size() == 0) {
+      std::cerr << "Error: insert_new_source_hash called with empty file_hash\n";
+      return;
+    }
+
+    import_change_t change;
+    change.type = import_change_t::NEW_SOURCE_HASH;
+    change.block_hash = block_hash;
+    change.k_entropy = k_entropy;
+    change.block_label = block_label;
+    change.file_hash = file_hash;
+    change.repository_name = repository_name;
+    change.filename = filename;
+    submit(change);
+  }
+
+  // add only if file hash is not present, use during merge
+  void import_manager_t::merge_hash(const std::string& block_hash,
+                                    const uint64_t k_entropy,
+                                    const std::string& block_label,
+                                    const std::string& file_hash,
+                                    const uint64_t sub_count) {
 
-          // log
-          logger(new logger_t(hashdb_dir, command_string)),
-          changes(new hashdb::lmdb_changes_t) {
+    if (block_hash.size() == 0) {
+      std::cerr << "Error: insert_hash called with empty block_hash\n";
+      return;
+    }
+    if (file_hash.size() == 0) {
+      std::cerr << "Error: insert_hash called with empty file_hash\n";
+      return;
+    }
 
-    // open managers
-    lmdb_hash_data_manager = new lmdb_hash_data_manager_t(hashdb_dir,
-                                                          RW_MODIFY);
-    lmdb_hash_manager = new lmdb_hash_manager_t(hashdb_dir, RW_MODIFY);
-    lmdb_source_data_manager = new lmdb_source_data_manager_t(hashdb_dir,
-                                                              RW_MODIFY);
-    lmdb_source_id_manager = new lmdb_source_id_manager_t(hashdb_dir,
-                                                              RW_MODIFY);
-    lmdb_source_name_manager = new lmdb_source_name_manager_t(hashdb_dir,
-                                                              RW_MODIFY);
+    import_change_t change;
+    change.type = import_change_t::MERGE_HASH;
+    change.block_hash = block_hash;
+    change.k_entropy = k_entropy;
+    change.block_label = block_label;
+    change.file_hash = file_hash;
+    change.sub_count = sub_count;
+    submit(change);
   }
 
-  import_manager_t::~import_manager_t() {
+  // queue the change for the batch writer else apply it now
+  void import_manager_t::submit(import_change_t& change) {
+    if (queue != NULL) {
+      queue->push(change);
 
-    // show changes
-    logger->add_lmdb_changes(*changes);
-    std::cout << *changes;
+    } else if (env == NULL) {
+      // each store commits its own part of the change, the lock keeps
+      // new_sources consistent
+      MUTEX_LOCK(&M);
+      apply(change);
+      preexisting_sources.clear();
+      MUTEX_UNLOCK(&M);
 
-    // close resources
-    delete lmdb_hash_data_manager;
-    delete lmdb_hash_manager;
-    delete lmdb_source_data_manager;
-    delete lmdb_source_id_manager;
-    delete lmdb_source_name_manager;
-    delete logger;
-    delete changes;
+    } else {
+      // commit all parts of the change in one txn
+      MUTEX_LOCK(&M);
+      begin_batch(change.change_count() * change_records * record_pages() +
+                  10);
+      apply(change);
+      commit_batch();
+      MUTEX_UNLOCK(&M);
+    }
   }
 
-  void import_manager_t::insert_source_name(
+  void import_manager_t::apply(const import_change_t& change) {
+    switch(change.type) {
+      case import_change_t::SOURCE_NAME:
+        apply_source_name(change.file_hash, change.repository_name,
+                          change.filename);
+        break;
+      case import_change_t::SOURCE_DATA:
+        apply_source_data(change.file_hash, change.filesize,
+                          change.file_type, change.zero_count,
+                          change.nonprobative_count);
+        break;
+      case import_change_t::INSERT_HASH:
+        apply_insert_hash(change.block_hash, change.k_entropy,
+                          change.block_label, change.file_hash);
+        break;
+      case import_change_t::MERGE_HASH:
+        apply_merge_hash(change.block_hash, change.k_entropy,
+                         change.block_label, change.file_hash,
+                         change.sub_count);
+        break;
+      case import_change_t::INSERT_HASHES:
+        apply_insert_hashes(change);
+        break;
+      case import_change_t::NEW_SOURCE_HASH:
+        apply_new_source_hash(change);
+        break;
+      default: assert(0); std::exit(1);
+    }
+  }
+
+  void import_manager_t::apply_source_name(
                           const std::string& file_hash,
                           const std::string& repository_name,
                           const std::string& filename) {
-    if (file_hash.size() == 0) {
-      std::cerr << "Error: insert_source_name called with empty file_hash\n";
-      return;
-    }
     uint64_t source_id;
     bool is_new_id = lmdb_source_id_manager->insert(file_hash, *changes,
                                                     source_id);
@@ -305,46 +1290,46 @@ namespace hashdb {
     }
   }
 
-  void import_manager_t::insert_source_data(
+  void import_manager_t::apply_source_data(
                           const std::string& file_hash,
                           const uint64_t filesize,
                           const std::string& file_type,
                           const uint64_t zero_count,
                           const uint64_t nonprobative_count) {
-    if (file_hash.size() == 0) {
-      std::cerr << "Error: insert_source_data called with empty file_hash\n";
-      return;
-    }
     uint64_t source_id;
     lmdb_source_id_manager->insert(file_hash, *changes, source_id);
     lmdb_source_data_manager->insert(source_id, file_hash,
                filesize, file_type, zero_count, nonprobative_count, *changes);
   }
 
-  // add whether file hash is present or not, used during ingest
-  void import_manager_t::insert_hash(const std::string& block_hash,
+  void import_manager_t::apply_insert_hash(const std::string& block_hash,
                           const uint64_t k_entropy,
                           const std::string& block_label,
                           const std::string& file_hash) {
 
-    if (block_hash.size() == 0) {
-      std::cerr << "Error: insert_hash called with empty block_hash\n";
-      return;
-    }
-    if (file_hash.size() == 0) {
-      std::cerr << "Error: insert_hash called with empty file_hash\n";
-      return;
-    }
-
     uint64_t source_id;
     bool is_new_id = lmdb_source_id_manager->insert(file_hash, *changes,
                                                     source_id);
 
+    // set the Bloom filter bits before the hash is visible in LMDB
+    if (bloom_filter != NULL) {
+      if (bloom_filter->add(block_hash)) {
+        warn_bloom_filter_full(*bloom_filter);
+      }
+    }
+
     // insert hash into hash data manager and hash manager
-    const size_t count = lmdb_hash_data_manager->insert(
-                 block_hash, k_entropy, block_label,
-                 source_id, *changes);
-    lmdb_hash_manager->insert(block_hash, count, *changes);
+    if (bulk_loader != NULL) {
+      bulk_loader->add_insert(block_hash, k_entropy, block_label, source_id);
+    } else {
+      const size_t count = lmdb_hash_data_manager->insert(
+                   block_hash, k_entropy, block_label,
+                   source_id, *changes);
+      lmdb_hash_manager->insert(block_hash, count, *changes);
+      if (lmdb_source_hash_manager != NULL) {
+        lmdb_source_hash_manager->insert(source_id, block_hash, *changes);
+      }
+    }
 
     // If the source ID is new then add a blank source data record just to keep
     // from breaking the reverse look-up done in scan_manager_t.
@@ -354,33 +1339,74 @@ namespace hashdb {
     }
   }
 
-  // add only if file hash is not present, use during merge
-  void import_manager_t::merge_hash(const std::string& block_hash,
+  void import_manager_t::apply_insert_hashes(const import_change_t& change) {
+    // one string for every hash, reusing its buffer
+    std::string block_hash;
+    for (size_t i = 0; i < change.block_hashes.size(); ++i) {
+      block_hash.assign(change.block_hashes[i].data,
+                        change.block_hashes[i].size);
+      apply_insert_hash(block_hash, change.k_entropies[i],
+                        change.block_labels[i], change.file_hash);
+    }
+  }
+
+  void import_manager_t::apply_new_source_hash(
+                          const import_change_t& change) {
+    // decide once per file hash whether its source is new, reading the
+    // source ID store in the txn that adds the source
+    if (new_sources.find(change.file_hash) == new_sources.end()) {
+      if (preexisting_sources.find(change.file_hash) !=
+                                           preexisting_sources.end()) {
+        // skip hashes of a preexisting source
+        return;
+      }
+      uint64_t source_id;
+      const bool is_new_id = lmdb_source_id_manager->insert(
+                                  change.file_hash, *changes, source_id);
+      if (!is_new_id) {
+        preexisting_sources.insert(change.file_hash);
+        return;
+      }
+      new_sources.insert(change.file_hash);
+      lmdb_source_data_manager->insert(source_id, change.file_hash,
+                                       0, "", 0, 0, *changes);
+      lmdb_source_name_manager->insert(source_id, change.repository_name,
+                                       change.filename, *changes);
+    }
+    apply_insert_hash(change.block_hash, change.k_entropy,
+                      change.block_label, change.file_hash);
+  }
+
+  void import_manager_t::apply_merge_hash(const std::string& block_hash,
                                     const uint64_t k_entropy,
                                     const std::string& block_label,
                                     const std::string& file_hash,
                                     const uint64_t sub_count) {
 
-    if (block_hash.size() == 0) {
-      std::cerr << "Error: insert_hash called with empty block_hash\n";
-      return;
-    }
-    if (file_hash.size() == 0) {
-      std::cerr << "Error: insert_hash called with empty file_hash\n";
-      return;
-    }
-
     uint64_t source_id;
     bool is_new_id = lmdb_source_id_manager->insert(file_hash, *changes,
                                                     source_id);
 
-    // merge hash into hash data manager
-    const size_t count = lmdb_hash_data_manager->merge(
-                 block_hash, k_entropy, block_label,
-                 source_id, sub_count, *changes);
+    // set the Bloom filter bits before the hash is visible in LMDB
+    if (bloom_filter != NULL) {
+      if (bloom_filter->add(block_hash)) {
+        warn_bloom_filter_full(*bloom_filter);
+      }
+    }
 
-    // insert hash into hash manager
-    lmdb_hash_manager->insert(block_hash, count, *changes);
+    // merge hash into hash data manager and hash manager
+    if (bulk_loader != NULL) {
+      bulk_loader->add_merge(block_hash, k_entropy, block_label, source_id,
+                             sub_count);
+    } else {
+      const size_t count = lmdb_hash_data_manager->merge(
+                   block_hash, k_entropy, block_label,
+                   source_id, sub_count, *changes);
+      lmdb_hash_manager->insert(block_hash, count, *changes);
+      if (lmdb_source_hash_manager != NULL) {
+        lmdb_source_hash_manager->insert(source_id, block_hash, *changes);
+      }
+    }
 
     // If the source ID is new then add a blank source data record just to keep
     // from breaking the reverse look-up done in scan_manager_t.
@@ -390,185 +1416,493 @@ namespace hashdb {
     }
   }
 
-  // import JSON hash or source, return "" or error
-  std::string import_manager_t::import_json(
-                          const std::string& json_string) {
+  // the most pages writing one record may add to any store
+  size_t import_manager_t::record_pages() const {
+    if (env != NULL) {
+      return lmdb_helper::record_pages(env);
+    }
+    return std::max(std::max(std::max(lmdb_hash_data_manager->record_pages(),
+                                      lmdb_hash_manager->record_pages()),
+                             std::max(lmdb_source_data_manager->record_pages(),
+                                      lmdb_source_id_manager->record_pages())),
+                    lmdb_source_name_manager->record_pages());
+  }
 
-    // open input as a JSON DOM document
-    rapidjson::Document document;
-    if (document.Parse(json_string.c_str()).HasParseError() ||
-        !document.IsObject()) {
-      return "Invalid JSON syntax";
+  // open one write txn for the shared environment else one per store,
+  // reserving reserve_pages pages in each environment.
+  void import_manager_t::begin_batch(const size_t reserve_pages) {
+    if (env != NULL) {
+      batch_txn = lmdb_helper::begin_batch(env, reserve_pages);
+      lmdb_hash_data_manager->join_batch(batch_txn);
+      lmdb_hash_manager->join_batch(batch_txn);
+      lmdb_source_data_manager->join_batch(batch_txn);
+      lmdb_source_id_manager->join_batch(batch_txn);
+      lmdb_source_name_manager->join_batch(batch_txn);
+      if (lmdb_source_hash_manager != NULL) {
+        lmdb_source_hash_manager->join_batch(batch_txn);
+      }
+    } else {
+      lmdb_hash_data_manager->begin_batch(reserve_pages);
+      lmdb_hash_manager->begin_batch(reserve_pages);
+      lmdb_source_data_manager->begin_batch(reserve_pages);
+      lmdb_source_id_manager->begin_batch(reserve_pages);
+      lmdb_source_name_manager->begin_batch(reserve_pages);
+    }
+  }
+
+  void import_manager_t::commit_batch() {
+    if (env != NULL) {
+      lmdb_hash_data_manager->leave_batch();
+      lmdb_hash_manager->leave_batch();
+      lmdb_source_data_manager->leave_batch();
+      lmdb_source_id_manager->leave_batch();
+      lmdb_source_name_manager->leave_batch();
+      if (lmdb_source_hash_manager != NULL) {
+        lmdb_source_hash_manager->leave_batch();
+      }
+      lmdb_helper::commit_batch(batch_txn);
+      batch_txn = NULL;
+    } else {
+      lmdb_hash_data_manager->commit_batch();
+      lmdb_hash_manager->commit_batch();
+      lmdb_source_data_manager->commit_batch();
+      lmdb_source_id_manager->commit_batch();
+      lmdb_source_name_manager->commit_batch();
     }
 
-    // block_hash or file_hash
-    if (document.HasMember("block_hash")) {
+    // the stores now answer for the preexisting sources
+    preexisting_sources.clear();
+  }
 
-      // block_hash
-      if (!document["block_hash"].IsString()) {
-        return "Invalid block_hash field";
+  // discard the changes since begin_batch
+  void import_manager_t::abort_batch() {
+    if (env != NULL) {
+      lmdb_hash_data_manager->leave_batch();
+      lmdb_hash_manager->leave_batch();
+      lmdb_source_data_manager->leave_batch();
+      lmdb_source_id_manager->leave_batch();
+      lmdb_source_name_manager->leave_batch();
+      if (lmdb_source_hash_manager != NULL) {
+        lmdb_source_hash_manager->leave_batch();
       }
-      const std::string block_hash = hashdb::hex_to_bin(
-                                         document["block_hash"].GetString());
-
-      // entropy (optional)
-      uint64_t k_entropy = 0;
-      if (document.HasMember("k_entropy")) {
-        if (document["k_entropy"].IsUint64()) {
-          k_entropy = document["k_entropy"].GetUint64();
-        } else {
-          return "Invalid k_entropy field";
-        }
+      lmdb_helper::abort_batch(batch_txn);
+      batch_txn = NULL;
+    } else {
+      lmdb_hash_data_manager->abort_batch();
+      lmdb_hash_manager->abort_batch();
+      lmdb_source_data_manager->abort_batch();
+      lmdb_source_id_manager->abort_batch();
+      lmdb_source_name_manager->abort_batch();
+    }
+  }
+
+  // Hash records arrive in key order and are appended so they fill pages,
+  // but source hash records are inserted in source ID order, and a hash
+  // can have many Type 3 records, so commit every max_batch_pages pages.
+  void import_manager_t::append_hash(const std::string& block_hash,
+                                     const hash_data_t& hash_data,
+                                     bool& is_open, size_t& pages) {
+
+    // keep all the records of one hash in one batch
+    const size_t source_count = hash_data.source_id_sub_counts.size();
+    size_t hash_pages = (source_count + 2) * append_pages;
+    if (lmdb_source_hash_manager != NULL) {
+      hash_pages += source_count * record_pages();
+    }
+    if (is_open && pages + hash_pages > max_batch_pages) {
+      commit_batch();
+      is_open = false;
+    }
+    if (!is_open) {
+      begin_batch(std::max(max_batch_pages, hash_pages) + 10);
+      is_open = true;
+      pages = 0;
+    }
+
+    lmdb_hash_data_manager->append(block_hash, hash_data.k_entropy,
+                                   hash_data.block_label, hash_data.count,
+                                   hash_data.source_id_sub_counts);
+    lmdb_hash_manager->append(block_hash, hash_data.count, *changes);
+    if (lmdb_source_hash_manager != NULL) {
+      for (hashdb::source_id_sub_counts_t::const_iterator it =
+           hash_data.source_id_sub_counts.begin();
+           it != hash_data.source_id_sub_counts.end(); ++it) {
+        lmdb_source_hash_manager->insert(it->source_id, block_hash,
+                                         *changes);
       }
+    }
+    pages += hash_pages;
+  }
+
+  void import_manager_t::load_bulk() {
+    bulk_loader->finish();
+
+    std::string block_hash;
+    hashdb::hash_data_t hash_data;
+
+    bool is_open = false;
+    size_t pages = 0;
+    while (bulk_loader->next(block_hash, hash_data.k_entropy,
+                             hash_data.block_label, hash_data.count,
+                             hash_data.source_id_sub_counts, *changes)) {
+      append_hash(block_hash, hash_data, is_open, pages);
+    }
+    if (is_open) {
+      commit_batch();
+    }
+  }
 
-      // block_label (optional)
-      std::string block_label = "";
-      if (document.HasMember("block_label")) {
-        if (document["block_label"].IsString()) {
-          block_label = document["block_label"].GetString();
-        } else {
-          return "Invalid block_label field";
+  // LMDB requires a write txn to be used and committed by the thread that
+  // opened it so one writer thread owns the batch txns.
+  void* import_manager_t::run_writer(void* const arg) {
+    import_manager_t& manager = *static_cast<import_manager_t*>(arg);
+    import_queue_t& queue = *manager.queue;
+
+    import_change_t change;
+    bool is_open = false;
+    size_t batch_count = 0;
+    size_t batch_changes = 0;
+    timespec deadline;
+    uint64_t flush_generation;
+
+    while (true) {
+
+      // wait for a change, a flush request, done, or the batch deadline
+      const bool has_change = queue.pop(change,
+                        (is_open) ? &deadline : NULL, flush_generation);
+
+      if (has_change) {
+        // commit first if the change does not fit in the open batch
+        const size_t change_count = change.change_count();
+        if (is_open && batch_count + change_count > batch_changes) {
+          manager.commit_batch();
+          is_open = false;
         }
-      }
 
-      // source_sub_counts:[]
-      if (!document.HasMember("source_sub_counts") ||
-                    !document["source_sub_counts"].IsArray()) {
-        return "Invalid source_sub_counts field";
-      }
-      const rapidjson::Value& json_source_sub_counts =
-                                        document["source_sub_counts"];
-      hashdb::source_sub_counts_t* source_sub_counts =
-                                        new hashdb::source_sub_counts_t;
-      for (rapidjson::SizeType i = 0;
-           i+1 < json_source_sub_counts.Size(); i+=2) {
-
-        // source hash
-        if (!json_source_sub_counts[i+0].IsString()) {
-          delete source_sub_counts;
-          return "Invalid source hash in source_sub_counts";
+        if (!is_open) {
+          // start a batch and its deadline, with fewer changes than
+          // batch_size when the stores are too deep to reserve for all
+          const size_t change_pages = change_records * manager.record_pages();
+          batch_changes = std::max(change_count, std::min(
+                          manager.batch_size, max_batch_pages / change_pages));
+          manager.begin_batch(batch_changes * change_pages + 10);
+          is_open = true;
+          batch_count = 0;
+          timeval now;
+          gettimeofday(&now, 0);
+          const uint64_t usec = now.tv_usec +
+                          (manager.batch_milliseconds % 1000) * 1000;
+          deadline.tv_sec = now.tv_sec + manager.batch_milliseconds / 1000 +
+                          usec / 1000000;
+          deadline.tv_nsec = (usec % 1000000) * 1000;
         }
-        const std::string file_hash = hashdb::hex_to_bin(
-                                        json_source_sub_counts[i].GetString());
 
-        // sub_count
-        if (!json_source_sub_counts[i+1].IsUint64()) {
-          delete source_sub_counts;
-          return "Invalid sub_count in source_sub_counts";
+        manager.apply(change);
+
+        // keep the batch open until it is full or its deadline passes
+        batch_count += change_count;
+        if (batch_count < batch_changes) {
+          timeval now;
+          gettimeofday(&now, 0);
+          if (now.tv_sec < deadline.tv_sec ||
+              (now.tv_sec == deadline.tv_sec &&
+               now.tv_usec * 1000 < deadline.tv_nsec)) {
+            continue;
+          }
         }
-        const uint64_t sub_count = json_source_sub_counts[i+1].GetUint64();
+      }
 
-        // add hash data for this source and source sub_count
-        merge_hash(block_hash, k_entropy, block_label, file_hash, sub_count);
+      // commit
+      if (is_open) {
+        manager.commit_batch();
+        is_open = false;
       }
 
-      delete source_sub_counts;
-      return "";
+      // nothing queued is pending now
+      if (!has_change) {
+        queue.flush_done(flush_generation);
+        if (queue.is_done()) {
+          break;
+        }
+      }
+    }
+    return NULL;
+  }
 
-    } else if (document.HasMember("file_hash")) {
+  void import_manager_t::start_writer() {
+    // queue up to two batches
+    queue = new import_queue_t(batch_size * 2);
+    int rc = pthread_create(&writer_thread, NULL,
+                            import_manager_t::run_writer,
+                            static_cast<void*>(this));
+    if (rc != 0) {
+      std::cerr << "Unable to start import writer thread.\n";
+      assert(0);
+    }
+  }
 
-      // parse file_hash
-      if (!document.HasMember("file_hash") ||
-                    !document["file_hash"].IsString()) {
-        return "Invalid file_hash field";
-      }
-      const std::string file_hash = hashdb::hex_to_bin(
-                                       document["file_hash"].GetString());
+  // import JSON hash or source, return "" or error
+  std::string import_manager_t::import_json(
+                          const std::string& json_string) {
+
+    hashdb::json_record_t record;
+    const std::string error_message = parse_json(json_string, record);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    import_record(record);
+    return "";
+  }
+
+  // decode JSON hash or source, return "" or error
+  std::string import_manager_t::parse_json(
+                          const std::string& json_string,
+                          hashdb::json_record_t& record) {
+
+    // read the fields of interest without building a DOM
+    hashdb::json_import_handler_t handler;
+    rapidjson::Reader reader;
+    rapidjson::StringStream ss(json_string.c_str());
+    if (reader.Parse(ss, handler).IsError()) {
+      return "Invalid JSON syntax";
+    }
+    return handler.check(record);
+  }
 
-      // parse filesize
-      if (!document.HasMember("filesize") ||
-                    !document["filesize"].IsUint64()) {
-        return "Invalid filesize field";
+  void import_manager_t::import_record(const hashdb::json_record_t& record) {
+
+    if (record.is_source) {
+      // source data and source names
+      insert_source_data(record.file_hash, record.filesize, record.file_type,
+                         record.zero_count, record.nonprobative_count);
+      for (hashdb::source_names_t::const_iterator it = record.names.begin();
+           it != record.names.end(); ++it) {
+        insert_source_name(record.file_hash, it->first, it->second);
       }
-      const uint64_t filesize = document["filesize"].GetUint64();
-
-      // parse file_type (optional)
-      std::string file_type = "";
-      if (document.HasMember("file_type")) {
-        if (document["file_type"].IsString()) {
-          file_type = document["file_type"].GetString();
-        } else {
-          return "Invalid file_type field";
-        }
+
+    } else {
+      // hash data for each source and source sub_count
+      for (std::vector<std::pair<std::string, uint64_t> >::const_iterator it =
+                 record.source_sub_counts.begin();
+           it != record.source_sub_counts.end(); ++it) {
+        merge_hash(record.block_hash, record.k_entropy, record.block_label,
+                   it->first, it->second);
       }
+    }
+  }
 
-      // zero_count (optional)
-      uint64_t zero_count = 0;
-      if (document.HasMember("zero_count")) {
-        if (document["zero_count"].IsUint64()) {
-          zero_count = document["zero_count"].GetUint64();
-        } else {
-          return "Invalid zero_count field";
-        }
+  std::string import_manager_t::load(std::istream& is) {
+
+    // write directly rather than through the batch writer or bulk loader
+    flush();
+    binary_dump_reader_t reader(is);
+    if (!reader.read_header()) {
+      return reader.error_message;
+    }
+
+    // append to empty hash stores since the hashes arrive in order
+    const bool is_append = (bulk_loader == NULL &&
+                            lmdb_hash_data_manager->size() == 0 &&
+                            lmdb_hash_manager->size() == 0);
+
+    // the source ID of each source record
+    std::vector<uint64_t> source_ids;
+    std::vector<std::string> file_hashes;
+
+    std::string file_hash;
+    uint64_t filesize;
+    std::string file_type;
+    uint64_t zero_count;
+    uint64_t nonprobative_count;
+    uint64_t name_count;
+    std::string repository_name;
+    std::string filename;
+
+    std::string block_hash;
+    std::string previous_block_hash;
+    uint64_t source_count;
+    uint64_t source_index;
+    uint64_t sub_count;
+    hashdb::hash_data_t hash_data;
+    bool is_open = false;
+    size_t pages = 0;
+    uint64_t hash_count = 0;
+    std::string error_message = "";
+
+    while (error_message.size() == 0) {
+      if (!reader.read_chunk()) {
+        error_message = reader.error_message;
+        break;
       }
 
-      // nonprobative_count (optional)
-      uint64_t nonprobative_count = 0;
-      if (document.HasMember("nonprobative_count")) {
-        if (document["nonprobative_count"].IsUint64()) {
-          nonprobative_count = document["nonprobative_count"].GetUint64();
-        } else {
-          return "Invalid nonprobative_count field";
+      if (reader.chunk_type == 'S') {
+        if (hash_count != 0) {
+          error_message = "Sources follow hashes in hashdb binary dump.";
+          break;
+        }
+        // commit the sources of the chunk in batches rather than once
+        // per store per source, keeping all records of a source together
+        for (uint32_t i = 0; i < reader.record_count; ++i) {
+          if (!(reader.get_string(file_hash) &&
+                reader.get_number(filesize) &&
+                reader.get_string(file_type) &&
+                reader.get_number(zero_count) &&
+                reader.get_number(nonprobative_count) &&
+                reader.get_number(name_count))) {
+            error_message = reader.error_message;
+            break;
+          }
+          const size_t source_pages = (name_count + 2) * record_pages();
+          if (is_open && pages + source_pages > max_batch_pages) {
+            commit_batch();
+            is_open = false;
+          }
+          if (!is_open) {
+            begin_batch(std::max(max_batch_pages, source_pages) + 10);
+            is_open = true;
+            pages = 0;
+          }
+          pages += source_pages;
+          uint64_t source_id;
+          lmdb_source_id_manager->insert(file_hash, *changes, source_id);
+          lmdb_source_data_manager->insert(source_id, file_hash, filesize,
+                  file_type, zero_count, nonprobative_count, *changes);
+          for (uint64_t j = 0; j < name_count; ++j) {
+            if (!(reader.get_string(repository_name) &&
+                  reader.get_string(filename))) {
+              error_message = reader.error_message;
+              break;
+            }
+            lmdb_source_name_manager->insert(source_id, repository_name,
+                                             filename, *changes);
+          }
+          if (error_message.size() != 0) {
+            break;
+          }
+          source_ids.push_back(source_id);
+          file_hashes.push_back(file_hash);
+        }
+        if (error_message.size() != 0) {
+          break;
+        }
+        if (is_open) {
+          commit_batch();
+          is_open = false;
         }
-      }
 
-      // parse name_pairs:[]
-      if (!document.HasMember("name_pairs") ||
-                    !document["name_pairs"].IsArray()) {
-        return "Invalid name_pairs field";
-      }
-      const rapidjson::Value& json_names = document["name_pairs"];
-      hashdb::source_names_t* names = new hashdb::source_names_t;
-      for (rapidjson::SizeType i = 0; i< json_names.Size(); i+=2) {
-
-        // parse repository name
-        if (!json_names[i].IsString()) {
-          delete names;
-          return "Invalid repository name in name_pairs field";
+      } else if (reader.chunk_type == 'H') {
+        for (uint32_t i = 0; i < reader.record_count &&
+                             error_message.size() == 0; ++i) {
+          if (!(reader.get_bytes(reader.hash_size, block_hash) &&
+                reader.get_number(hash_data.k_entropy) &&
+                reader.get_string(hash_data.block_label) &&
+                reader.get_number(source_count))) {
+            error_message = reader.error_message;
+            break;
+          }
+          if (is_append && hash_count != 0 &&
+              block_hash <= previous_block_hash) {
+            error_message = "Hashes are out of order in hashdb binary dump.";
+            break;
+          }
+          hash_data.count = 0;
+          hash_data.source_id_sub_counts.clear();
+          for (uint64_t j = 0; j < source_count; ++j) {
+            if (!(reader.get_number(source_index) &&
+                  reader.get_number(sub_count))) {
+              error_message = reader.error_message;
+              break;
+            }
+            if (source_index >= source_ids.size()) {
+              error_message = "Invalid source in hashdb binary dump.";
+              break;
+            }
+            if (is_append) {
+              hash_data.source_id_sub_counts.insert(
+                  source_id_sub_count_t(source_ids[source_index],
+                                        add2(0, sub_count)));
+              hash_data.count = add4(hash_data.count, sub_count);
+            } else {
+              merge_hash(block_hash, hash_data.k_entropy,
+                         hash_data.block_label, file_hashes[source_index],
+                         sub_count);
+            }
+          }
+          if (error_message.size() != 0) {
+            break;
+          }
+          if (is_append && source_count != 0) {
+            // set the Bloom filter bits before the hash is visible in LMDB
+            if (bloom_filter != NULL) {
+              if (bloom_filter->add(block_hash)) {
+                warn_bloom_filter_full(*bloom_filter);
+              }
+            }
+            append_hash(block_hash, hash_data, is_open, pages);
+            changes->hash_data_inserted += source_count;
+          }
+          previous_block_hash = block_hash;
+          ++hash_count;
         }
-        const std::string repository_name = json_names[i].GetString();
 
-        // parse filename
-        if (!json_names[i+1].IsString()) {
-          delete names;
-          return "Invalid filename in name_pairs field";
+      } else if (reader.chunk_type == 'E') {
+        uint64_t end_source_count;
+        uint64_t end_hash_count;
+        if (!(reader.get_number(end_source_count) &&
+              reader.get_number(end_hash_count))) {
+          error_message = reader.error_message;
+        } else if (end_source_count != source_ids.size() ||
+                   end_hash_count != hash_count) {
+          error_message = "The hashdb binary dump is incomplete.";
         }
-        const std::string filename = json_names[i+1].GetString();
+        break;
 
-        // add repository name, filename pair
-        names->insert(hashdb::source_name_t(repository_name, filename));
+      } else {
+        error_message = "Invalid chunk type in hashdb binary dump.";
       }
 
-      // everything worked so insert the source data and source names
-      insert_source_data(file_hash,
-                         filesize, file_type, zero_count, nonprobative_count);
-      for (hashdb::source_names_t::const_iterator it = names->begin();
-           it != names->end(); ++it) {
-        insert_source_name(file_hash, it->first, it->second);
+      if (error_message.size() == 0 && !reader.at_chunk_end()) {
+        error_message = "Data error in hashdb binary dump chunk.";
       }
+    }
 
-      delete names;
-      return "";
-
-    } else {
-      return "A block_hash or file_hash field is required";
+    // on error discard the open batch, which holds the bad record
+    if (is_open) {
+      if (error_message.size() == 0) {
+        commit_batch();
+      } else {
+        abort_batch();
+      }
     }
+    return error_message;
   }
 
   bool import_manager_t::has_source(const std::string& file_hash) const {
+    if (queue != NULL) {
+      queue->flush();
+    }
     uint64_t source_id;
     return lmdb_source_id_manager->find(file_hash, source_id);
   }
 
   std::string import_manager_t::first_source() const {
+    if (queue != NULL) {
+      queue->flush();
+    }
     return lmdb_source_id_manager->first_source();
   }
 
   std::string import_manager_t::next_source(const std::string& file_hash) const {
+    if (queue != NULL) {
+      queue->flush();
+    }
     return lmdb_source_id_manager->next_source(file_hash);
   }
 
   std::string import_manager_t::size() const {
+    if (queue != NULL) {
+      queue->flush();
+    }
     std::stringstream ss;
     ss << "{\"hash_data_store\":" << lmdb_hash_data_manager->size()
        << ", \"hash_store\":" << lmdb_hash_manager->size()
@@ -580,10 +1914,16 @@ namespace hashdb {
   }
 
   size_t import_manager_t::size_hashes() const {
+    if (queue != NULL) {
+      queue->flush();
+    }
     return lmdb_hash_data_manager->size();
   }
 
   size_t import_manager_t::size_sources() const {
+    if (queue != NULL) {
+      queue->flush();
+    }
     return lmdb_source_id_manager->size();
   }
 
@@ -597,33 +1937,106 @@ namespace hashdb {
           lmdb_source_data_manager(0),
           lmdb_source_id_manager(0),
           lmdb_source_name_manager(0),
+          lmdb_source_hash_manager(0),
+
+          // shared environment
+          env(NULL),
+
+          // read the newest changes
+          reader(new lmdb_reader_t(0)),
+
+          // opened with the managers
+          bloom_filter(NULL),
 
           // for find_expanded_hash_json
           hashes(new locked_member_t),
-          sources(new locked_member_t) {
+          sources(new locked_member_t),
+
+          // sources change, so keep nothing
+          source_cache(new source_cache_t(0, 0)) {
 
     // open managers
-    lmdb_hash_data_manager = new lmdb_hash_data_manager_t(hashdb_dir,
-                                                          READ_ONLY);
-    lmdb_hash_manager = new lmdb_hash_manager_t(hashdb_dir, READ_ONLY);
-    lmdb_source_data_manager = new lmdb_source_data_manager_t(hashdb_dir,
-                                                              READ_ONLY);
-    lmdb_source_id_manager = new lmdb_source_id_manager_t(hashdb_dir,
-                                                              READ_ONLY);
-    lmdb_source_name_manager = new lmdb_source_name_manager_t(hashdb_dir,
-                                                              READ_ONLY);
+    open_managers(hashdb_dir);
+  }
+
+  scan_manager_t::scan_manager_t(const std::string& hashdb_dir,
+                                 const size_t refresh_milliseconds) :
+          // LMDB managers
+          lmdb_hash_data_manager(0),
+          lmdb_hash_manager(0),
+          lmdb_source_data_manager(0),
+          lmdb_source_id_manager(0),
+          lmdb_source_name_manager(0),
+          lmdb_source_hash_manager(0),
+
+          // shared environment
+          env(NULL),
+
+          // keep snapshots for refresh_milliseconds
+          reader(new lmdb_reader_t(refresh_milliseconds)),
+
+          // opened with the managers
+          bloom_filter(NULL),
+
+          // for find_expanded_hash_json
+          hashes(new locked_member_t),
+          sources(new locked_member_t),
+
+          // keep sources as long as snapshots
+          source_cache(new source_cache_t(source_cache_t::DEFAULT_CAPACITY,
+                                          refresh_milliseconds)) {
+
+    // open managers
+    open_managers(hashdb_dir);
   }
 
   scan_manager_t::~scan_manager_t() {
+    // close reader txns before their environments
+    delete reader;
+    delete bloom_filter;
+
     delete lmdb_hash_data_manager;
     delete lmdb_hash_manager;
     delete lmdb_source_data_manager;
     delete lmdb_source_id_manager;
     delete lmdb_source_name_manager;
+    delete lmdb_source_hash_manager;
+    if (env != NULL) {
+      lmdb_helper::close_env(env);
+    }
 
     // for find_expanded_hash_json
     delete hashes;
     delete sources;
+    delete source_cache;
+  }
+
+  // all stores read through one reader, which keeps one txn per thread
+  // per environment
+  void scan_manager_t::open_managers(const std::string& hashdb_dir) {
+    const hashdb::settings_t settings = require_settings(hashdb_dir);
+    env = open_shared_env(hashdb_dir, settings, READ_ONLY);
+    lmdb_hash_data_manager = new lmdb_hash_data_manager_t(hashdb_dir,
+                             READ_ONLY, env, has_type3_store(settings));
+    lmdb_hash_manager = new lmdb_hash_manager_t(hashdb_dir, READ_ONLY, env,
+                   settings.hash_prefix_bytes, settings.hash_count_bytes);
+    lmdb_source_data_manager = new lmdb_source_data_manager_t(hashdb_dir,
+                                                          READ_ONLY, env);
+    lmdb_source_id_manager = new lmdb_source_id_manager_t(hashdb_dir,
+                                                          READ_ONLY, env);
+    lmdb_source_name_manager = new lmdb_source_name_manager_t(hashdb_dir,
+                                                          READ_ONLY, env);
+    if (settings.source_index) {
+      lmdb_source_hash_manager = new lmdb_source_hash_manager_t(READ_ONLY,
+                                                                env);
+      lmdb_source_hash_manager->set_reader(reader);
+    }
+    bloom_filter = open_bloom_filter(hashdb_dir, READ_ONLY);
+    lmdb_hash_data_manager->set_reader(reader);
+    lmdb_hash_manager->set_reader(reader);
+    lmdb_source_data_manager->set_reader(reader);
+    lmdb_source_id_manager->set_reader(reader);
+    lmdb_source_name_manager->set_reader(reader);
   }
 
   std::string scan_manager_t::find_hash_json(
@@ -653,97 +2066,228 @@ namespace hashdb {
     }
   }
 
+  // forget reported hashes and sources, splitting the limit between them
+  void scan_manager_t::reset_reported(const size_t memory_limit) {
+    hashes->clear(memory_limit / 2);
+    sources->clear(memory_limit / 2);
+  }
+
   // Find expanded hash, optimized with caching, return JSON.
   // If optimizing, cache hashes and sources.
   std::string scan_manager_t::find_expanded_hash_json(
                     const bool optimizing, const std::string& block_hash) {
 
-    // fields to hold the scan
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t* source_sub_counts =
-                                           new hashdb::source_sub_counts_t;
-
     // scan
-    bool matched = scan_manager_t::find_hash(block_hash,
-                           k_entropy, block_label, count, *source_sub_counts);
+    hashdb::hash_data_t hash_data;
+    find_hash_data(block_hash, hash_data);
+
+    std::string json_text;
+    find_expanded_hash_json(optimizing, block_hash, hash_data, json_text);
+    return json_text;
+  }
+
+  // expanded hash JSON for found hash data, written into json_text.
+  // Source objects come pre-rendered from the source cache, so they are
+  // copied into the JSON text rather than written field by field.
+  void scan_manager_t::find_expanded_hash_json(
+                    const bool optimizing, const std::string& block_hash,
+                    const hashdb::hash_data_t& hash_data,
+                    std::string& json_text) {
 
     // done if no match
-    if (matched == false) {
-      delete source_sub_counts;
-      return "";
+    if (hash_data.is_found == false) {
+      json_text.clear();
+      return;
     }
 
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
+    hashdb::json_writer_t& json_writer = hashdb::thread_json_writer();
+    hashdb::json_writer_t::writer_t& writer = json_writer.start(json_text);
+    writer.StartObject();
 
     // block_hash
-    std::string hex_block_hash = hashdb::bin_to_hex(block_hash);
-    json_doc.AddMember("block_hash", v(hex_block_hash, allocator), allocator);
+    writer.Key("block_hash");
+    json_writer.hex_string(block_hash);
+
+    // report only the block hash if caching and the hash was reported
+    if (optimizing && !hashes->locked_insert(block_hash)) {
+      writer.EndObject();
+      return;
+    }
+
+    // the file hash of each source, in file hash order
+    hashdb::source_sub_counts_t* source_sub_counts =
+                                       new hashdb::source_sub_counts_t;
+    std::map<std::string, uint64_t> source_ids;
+    for (hashdb::source_id_sub_counts_t::const_iterator it =
+         hash_data.source_id_sub_counts.begin();
+         it != hash_data.source_id_sub_counts.end(); ++it) {
+      hashdb::cached_source_t source;
+      find_source(it->source_id, source, false);
+      source_sub_counts->insert(hashdb::source_sub_count_t(
+                                        source.file_hash, it->sub_count));
+      source_ids[source.file_hash] = it->source_id;
+    }
+
+    // hash fields
+    writer.Key("k_entropy");
+    writer.Uint64(hash_data.k_entropy);
+    writer.Key("block_label");
+    json_writer.string(hash_data.block_label);
+    writer.Key("count");
+    writer.Uint64(hash_data.count);
+    writer.Key("source_list_id");
+    writer.Uint(calculate_crc(*source_sub_counts));
+
+    // the sources array, leaving the object open
+    json_text += ",\"sources\":[";
+    bool is_first = true;
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+      if (!optimizing || sources->locked_insert(it->file_hash)) {
+
+        // the complete source information for this source
+        hashdb::cached_source_t source;
+        find_source(source_ids[it->file_hash], source, true);
+        if (!is_first) {
+          json_text += ",";
+        }
+        json_text += source.source_json;
+        is_first = false;
+      }
+    }
+    json_text += "],\"source_sub_counts\":";
 
-    // report hash if not caching or this is the first time for the hash
-    if (!optimizing || hashes->locked_insert(block_hash)) {
+    // source_sub_counts as pairs of file hash, sub_count
+    write_source_sub_counts(json_writer, json_writer.append(json_text),
+                            *source_sub_counts);
+    json_text += "}";
 
-      // add entropy
-      json_doc.AddMember("k_entropy", k_entropy, allocator);
+    delete source_sub_counts;
+  }
+
+  // find hash data, screening with the Bloom filter else the hash store
+  bool scan_manager_t::find_hash_data(const std::string& block_hash,
+                                      hashdb::hash_data_t& hash_data) const {
+
+    hash_data = hashdb::hash_data_t();
+
+    if (block_hash.size() == 0) {
+      std::cerr << "Error: find_hash called with empty block_hash\n";
+      return false;
+    }
 
-      // add block_label
-      json_doc.AddMember("block_label", v(block_label, allocator), allocator);
+    // first check the Bloom filter, else the hash store
+    if (bloom_filter != NULL) {
+      if (!bloom_filter->find(block_hash)) {
+        // hash is not present so return false
+        return false;
+      }
+    } else if (lmdb_hash_manager->find(block_hash) == 0) {
+      // hash is not present so return false
+      return false;
+    }
 
-      // add count
-      json_doc.AddMember("count", count, allocator);
+    // hash may be present so read hash using hash data manager
+    hash_data.is_found = lmdb_hash_data_manager->find(block_hash,
+                          hash_data.k_entropy, hash_data.block_label,
+                          hash_data.count, hash_data.source_id_sub_counts);
+    return hash_data.is_found;
+  }
 
-      // add source_list_id
-      uint32_t crc = calculate_crc(*source_sub_counts);
-      json_doc.AddMember("source_list_id", crc, allocator);
+  // find hash data in ascending hash order, screening like find_hash_data
+  void scan_manager_t::find_hash_data(
+               const std::vector<std::string>& block_hashes,
+               std::vector<hashdb::hash_data_t>& hash_data) const {
 
-      // the sources array
-      rapidjson::Value json_sources(rapidjson::kArrayType);
+    hash_data.clear();
+    hash_data.resize(block_hashes.size());
 
-      // add each source object
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
-        if (!optimizing || sources->locked_insert(it->file_hash)) {
+    // the hashes to look up, in order
+    std::vector<size_t> order;
+    find_present_order(block_hashes, order);
 
-          // create a json_source object for the json_sources array
-          rapidjson::Value json_source(rapidjson::kObjectType);
+    // read the hash data
+    lmdb_hash_data_manager->find_sorted(block_hashes, order, hash_data);
+  }
 
-          // provide the complete source information for this source
-          provide_source_information(*this, it->file_hash, allocator,
-                                     json_source);
-          json_sources.PushBack(json_source, allocator);
+  // indexes of the block hashes that may be present, in ascending hash
+  // order, screened by the Bloom filter else the hash store
+  template <typename T>
+  void scan_manager_t::find_present_order(
+               const std::vector<T>& block_hashes,
+               std::vector<size_t>& order) const {
+
+    sorted_order(block_hashes, bloom_filter, order);
+
+    // without a Bloom filter the hash store screens out absent hashes
+    if (bloom_filter == NULL) {
+      std::vector<size_t> counts(block_hashes.size(), 0);
+      lmdb_hash_manager->find_sorted(block_hashes, order, counts);
+      std::vector<size_t> present;
+      present.reserve(order.size());
+      for (std::vector<size_t>::const_iterator it = order.begin();
+           it != order.end(); ++it) {
+        if (counts[*it] != 0) {
+          present.push_back(*it);
         }
       }
-      json_doc.AddMember("sources", json_sources, allocator);
+      order.swap(present);
+    }
+  }
 
-      // add source_sub_counts as pairs of file hash, sub_count
-      rapidjson::Value json_source_sub_counts(rapidjson::kArrayType);
+  // find source data by source ID through the source cache, rendering
+  // the source JSON if render is set
+  void scan_manager_t::find_source(const uint64_t source_id,
+                                   hashdb::cached_source_t& source,
+                                   const bool render) const {
 
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+    // use the cached source if it has what is needed
+    if (source_cache->find(source_id, source) &&
+                        (!render || source.source_json.size() != 0)) {
+      return;
+    }
 
-        // file hash
-        json_source_sub_counts.PushBack(
-                   v(hashdb::bin_to_hex(it->file_hash), allocator), allocator);
+    // read the source data
+    bool source_data_found = lmdb_source_data_manager->find(source_id,
+                             source.file_hash, source.filesize,
+                             source.file_type, source.zero_count,
+                             source.nonprobative_count);
 
-        // sub_count
-        json_source_sub_counts.PushBack(it->sub_count, allocator);
+    // source_data must have a source_id to match the source_id in
+    // hash_data
+    if (source_data_found == false) {
+      assert(0);
+    }
 
-      }
-      json_doc.AddMember("source_sub_counts", json_source_sub_counts,
-                         allocator);
+    // render the source JSON
+    if (render) {
+      hashdb::source_names_t source_names;
+      lmdb_source_name_manager->find(source_id, source_names);
+      source_json(source.file_hash, source.filesize, source.file_type,
+                  source.zero_count, source.nonprobative_count,
+                  source_names, source.source_json);
     }
 
-    delete source_sub_counts;
+    source_cache->insert(source_id, source);
+  }
 
-    // return JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+  // add the file hash, sub_count pair of each source ID, sub_count pair
+  void scan_manager_t::add_source_sub_counts(
+                 const hashdb::hash_data_t& hash_data,
+                 hashdb::source_sub_counts_t& source_sub_counts) const {
+
+    for (hashdb::source_id_sub_counts_t::const_iterator it =
+         hash_data.source_id_sub_counts.begin();
+         it != hash_data.source_id_sub_counts.end(); ++it) {
+
+      // get file_hash from source_id
+      hashdb::cached_source_t source;
+      find_source(it->source_id, source, false);
+
+      // add the source sub_counts
+      source_sub_counts.insert(hashdb::source_sub_count_t(source.file_hash,
+                                                          it->sub_count));
+    }
   }
 
   // find hash, return associated hash and source data
@@ -755,62 +2299,205 @@ namespace hashdb {
                source_sub_counts_t& source_sub_counts) const {
 
     // clear fields
-    k_entropy = 0;
-    block_label = "";
-    count = 0;
     source_sub_counts.clear();
 
-    if (block_hash.size() == 0) {
-      std::cerr << "Error: find_hash called with empty block_hash\n";
-      return false;
+    hashdb::hash_data_t hash_data;
+    find_hash_data(block_hash, hash_data);
+    k_entropy = hash_data.k_entropy;
+    block_label = hash_data.block_label;
+    count = hash_data.count;
+
+    // build source_sub_count from source_id_sub_count
+    add_source_sub_counts(hash_data, source_sub_counts);
+    const bool is_found = hash_data.is_found;
+    return is_found;
+  }
+
+  // clear a hash record, keeping its buffers
+  static void clear_hash_record(hash_record_t& hash_record) {
+    hash_record.is_found = false;
+    hash_record.k_entropy = 0;
+    hash_record.block_label.clear();
+    hash_record.count = 0;
+    hash_record.sources.clear();
+  }
+
+  // find hashes in ascending order into reused hash records
+  template <typename T>
+  void scan_manager_t::find_hash_records(
+               const std::vector<T>& block_hashes,
+               std::vector<hash_record_t>& hash_records) const {
+
+    // keep the records, and their buffers, of the previous call
+    hash_records.resize(block_hashes.size());
+    for (std::vector<hash_record_t>::iterator it = hash_records.begin();
+         it != hash_records.end(); ++it) {
+      clear_hash_record(*it);
     }
 
-    // first check hash store
-    if (lmdb_hash_manager->find(block_hash) == 0) {
-      // hash is not present so return false
-      return false;
+    // read the hashes that may be present
+    std::vector<size_t> order;
+    find_present_order(block_hashes, order);
+    lmdb_hash_data_manager->find_sorted(block_hashes, order, hash_records);
+  }
+
+  void scan_manager_t::find_hashes(
+               const std::vector<std::string>& block_hashes,
+               std::vector<hash_record_t>& hash_records) const {
+    find_hash_records(block_hashes, hash_records);
+  }
+
+  void scan_manager_t::find_hashes(
+               const std::vector<block_hash_t>& block_hashes,
+               std::vector<hash_record_t>& hash_records) const {
+    find_hash_records(block_hashes, hash_records);
+  }
+
+  // find hashes in ascending order, return JSON text in block_hashes order
+  void scan_manager_t::find_hashes_json(
+               const hashdb::scan_mode_t scan_mode,
+               const std::vector<std::string>& block_hashes,
+               std::vector<std::string>& json_texts) {
+
+    // keep the strings, and their buffers, of the previous call
+    json_texts.resize(block_hashes.size());
+
+    switch(scan_mode) {
+
+      // EXPANDED, EXPANDED_OPTIMIZED
+      case hashdb::scan_mode_t::EXPANDED:
+      case hashdb::scan_mode_t::EXPANDED_OPTIMIZED: {
+        const bool optimizing =
+                   (scan_mode == hashdb::scan_mode_t::EXPANDED_OPTIMIZED);
+        std::vector<hashdb::hash_data_t> hash_data;
+        find_hash_data(block_hashes, hash_data);
+
+        // report in block_hashes order so optimizing reports each hash
+        // and source in full the first time it appears
+        for (size_t i = 0; i < block_hashes.size(); ++i) {
+          find_expanded_hash_json(optimizing, block_hashes[i],
+                                  hash_data[i], json_texts[i]);
+        }
+        return;
+      }
+
+      // COUNT
+      case hashdb::scan_mode_t::COUNT: {
+        std::vector<size_t> counts;
+        find_hash_counts(block_hashes, counts);
+        for (size_t i = 0; i < block_hashes.size(); ++i) {
+          if (counts[i] != 0) {
+            count_json("count", block_hashes[i], counts[i], json_texts[i]);
+          } else {
+            json_texts[i].clear();
+          }
+        }
+        return;
+      }
+
+      // APPROXIMATE_COUNT
+      case hashdb::scan_mode_t::APPROXIMATE_COUNT: {
+        std::vector<size_t> order;
+        sorted_order(block_hashes, bloom_filter, order);
+        std::vector<size_t> counts(block_hashes.size(), 0);
+        lmdb_hash_manager->find_sorted(block_hashes, order, counts);
+        for (size_t i = 0; i < block_hashes.size(); ++i) {
+          if (counts[i] != 0) {
+            count_json("approximate_count", block_hashes[i], counts[i],
+                       json_texts[i]);
+          } else {
+            json_texts[i].clear();
+          }
+        }
+        return;
+      }
+
+      default: assert(0); std::exit(1);
     }
+  }
 
-    // hash may be present so read hash using hash data manager
-    hashdb::source_id_sub_counts_t* source_id_sub_counts =
-                new hashdb::source_id_sub_counts_t;
-    bool has_hash = lmdb_hash_data_manager->find(block_hash, k_entropy,
-                                  block_label, count, *source_id_sub_counts);
-    if (has_hash) {
-      // build source_sub_count from source_id_sub_count
-      for (hashdb::source_id_sub_counts_t::const_iterator it =
-           source_id_sub_counts->begin(); it != source_id_sub_counts->end();
-           ++it) {
-
-        // space for unused returned source variables
-        std::string file_hash;
-        uint64_t filesize;
-        std::string file_type;
-        uint64_t zero_count;
-        uint64_t nonprobative_count;
-
-        // get file_hash from source_id
-        bool source_data_found = lmdb_source_data_manager->find(
-                                it->source_id, file_hash,
-                                filesize, file_type,
-                                zero_count, nonprobative_count);
-
-        // source_data must have a source_id to match the source_id in hash_data
-        if (source_data_found == false) {
-          assert(0);
+  // find hashes in ascending order, return JSON text in block_hashes
+  // order, copying only the hashes found into strings
+  void scan_manager_t::find_hashes_json(
+               const hashdb::scan_mode_t scan_mode,
+               const std::vector<block_hash_t>& block_hashes,
+               std::vector<std::string>& json_texts) {
+
+    // keep the strings, and their buffers, of the previous call
+    json_texts.resize(block_hashes.size());
+
+    switch(scan_mode) {
+
+      // EXPANDED, EXPANDED_OPTIMIZED
+      case hashdb::scan_mode_t::EXPANDED:
+      case hashdb::scan_mode_t::EXPANDED_OPTIMIZED: {
+        const bool optimizing =
+                   (scan_mode == hashdb::scan_mode_t::EXPANDED_OPTIMIZED);
+        std::vector<hash_record_t> hash_records;
+        find_hash_records(block_hashes, hash_records);
+
+        // report in block_hashes order so optimizing reports each hash
+        // and source in full the first time it appears
+        hashdb::hash_data_t hash_data;
+        for (size_t i = 0; i < block_hashes.size(); ++i) {
+          const hash_record_t& hash_record = hash_records[i];
+          if (!hash_record.is_found) {
+            json_texts[i].clear();
+            continue;
+          }
+          hash_data.is_found = true;
+          hash_data.k_entropy = hash_record.k_entropy;
+          hash_data.block_label = hash_record.block_label;
+          hash_data.count = hash_record.count;
+          hash_data.source_id_sub_counts.clear();
+          for (std::vector<hash_source_t>::const_iterator it =
+               hash_record.sources.begin();
+               it != hash_record.sources.end(); ++it) {
+            hash_data.source_id_sub_counts.insert(
+                     source_id_sub_count_t(it->source_id, it->sub_count));
+          }
+          find_expanded_hash_json(optimizing, block_hashes[i].str(),
+                                  hash_data, json_texts[i]);
         }
+        return;
+      }
 
-        // add the source sub_counts
-        source_sub_counts.insert(hashdb::source_sub_count_t(file_hash,
-                                                            it->sub_count));
+      // COUNT
+      case hashdb::scan_mode_t::COUNT: {
+        std::vector<size_t> order;
+        sorted_order(block_hashes, bloom_filter, order);
+        std::vector<size_t> counts(block_hashes.size(), 0);
+        lmdb_hash_data_manager->find_counts_sorted(block_hashes, order,
+                                                   counts);
+        for (size_t i = 0; i < block_hashes.size(); ++i) {
+          if (counts[i] != 0) {
+            count_json("count", block_hashes[i].str(), counts[i],
+                       json_texts[i]);
+          } else {
+            json_texts[i].clear();
+          }
+        }
+        return;
       }
-      delete source_id_sub_counts;
-      return true;
 
-    } else {
-      // no action, lmdb_hash_data_manager.find clears out fields
-      delete source_id_sub_counts;
-      return false;
+      // APPROXIMATE_COUNT
+      case hashdb::scan_mode_t::APPROXIMATE_COUNT: {
+        std::vector<size_t> order;
+        sorted_order(block_hashes, bloom_filter, order);
+        std::vector<size_t> counts(block_hashes.size(), 0);
+        lmdb_hash_manager->find_sorted(block_hashes, order, counts);
+        for (size_t i = 0; i < block_hashes.size(); ++i) {
+          if (counts[i] != 0) {
+            count_json("approximate_count", block_hashes[i].str(),
+                       counts[i], json_texts[i]);
+          } else {
+            json_texts[i].clear();
+          }
+        }
+        return;
+      }
+
+      default: assert(0); std::exit(1);
     }
   }
 
@@ -831,60 +2518,122 @@ namespace hashdb {
 
     std::string json_hash_string;
     if (found_hash) {
+      hash_json(block_hash, k_entropy, block_label, *source_sub_counts,
+                json_hash_string);
+    }
 
-      // prepare JSON
-      rapidjson::Document json_doc;
-      rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-      json_doc.SetObject();
-
-      // put in hash data
-      std::string hex_block_hash = hashdb::bin_to_hex(block_hash);
-      json_doc.AddMember("block_hash", v(hex_block_hash, allocator), allocator);
-      json_doc.AddMember("k_entropy", k_entropy, allocator);
-      json_doc.AddMember("block_label", v(block_label, allocator), allocator);
+    delete source_sub_counts;
+    return json_hash_string;
+  }
 
-      // put in source_sub_counts as pairs of file hash, sub_count
-      rapidjson::Value json_source_sub_counts(rapidjson::kArrayType);
+  // find hash count
+  size_t scan_manager_t::find_hash_count(
+                                    const std::string& block_hash) const {
 
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+    if (block_hash.size() == 0) {
+      std::cerr << "Error: find_hash_count called with empty block_hash\n";
+      return 0;
+    }
 
-        // file hash
-        json_source_sub_counts.PushBack(
-                   v(hashdb::bin_to_hex(it->file_hash), allocator), allocator);
+    // the Bloom filter screens out most absent hashes
+    if (bloom_filter != NULL && !bloom_filter->find(block_hash)) {
+      return 0;
+    }
 
-        // sub_count
-        json_source_sub_counts.PushBack(it->sub_count, allocator);
+    return lmdb_hash_data_manager->find_count(block_hash);
+  }
 
-      }
-      json_doc.AddMember("source_sub_counts", json_source_sub_counts,
-                         allocator);
+  // find hash into a reused hash record, screening like find_hash_data
+  bool scan_manager_t::find_hash(const block_hash_t& block_hash,
+                                 hash_record_t& hash_record) const {
 
-      // write JSON text
-      rapidjson::StringBuffer strbuf;
-      rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-      json_doc.Accept(writer);
-      json_hash_string = strbuf.GetString();
+    if (block_hash.size == 0) {
+      std::cerr << "Error: find_hash called with empty block_hash\n";
+      clear_hash_record(hash_record);
+      return false;
+    }
 
+    // first check the Bloom filter, else the hash store
+    bool may_be_present;
+    if (bloom_filter != NULL) {
+      may_be_present = bloom_filter->find(block_hash.data, block_hash.size);
     } else {
-      // not found
-      json_hash_string = "";
+      may_be_present =
+           (lmdb_hash_manager->find(block_hash.data, block_hash.size) != 0);
+    }
+    if (!may_be_present) {
+      clear_hash_record(hash_record);
+      return false;
     }
 
-    delete source_sub_counts;
-    return json_hash_string;
+    // read hash using hash data manager
+    return lmdb_hash_data_manager->find(block_hash.data, block_hash.size,
+                                        hash_record);
   }
 
-  // find hash count
+  // find hash count without heap allocation
   size_t scan_manager_t::find_hash_count(
-                                    const std::string& block_hash) const {
+                                    const block_hash_t& block_hash) const {
 
-    if (block_hash.size() == 0) {
+    if (block_hash.size == 0) {
       std::cerr << "Error: find_hash_count called with empty block_hash\n";
       return 0;
     }
 
-    return lmdb_hash_data_manager->find_count(block_hash);
+    // the Bloom filter screens out most absent hashes
+    if (bloom_filter != NULL &&
+        !bloom_filter->find(block_hash.data, block_hash.size)) {
+      return 0;
+    }
+
+    return lmdb_hash_data_manager->find_count(block_hash.data,
+                                              block_hash.size);
+  }
+
+  // find approximate hash count without heap allocation
+  size_t scan_manager_t::find_approximate_hash_count(
+                                    const block_hash_t& block_hash) const {
+
+    if (block_hash.size == 0) {
+      std::cerr << "Error: find_approximate_hash_count called with empty block_hash\n";
+      return 0;
+    }
+
+    // the Bloom filter screens out most absent hashes
+    if (bloom_filter != NULL &&
+        !bloom_filter->find(block_hash.data, block_hash.size)) {
+      return 0;
+    }
+
+    return lmdb_hash_manager->find(block_hash.data, block_hash.size);
+  }
+
+  // find source JSON by source ID, return "" if not there
+  std::string scan_manager_t::find_source_json(
+                                    const uint64_t source_id) const {
+
+    // find_source requires the source to be there
+    hashdb::cached_source_t source;
+    if (!source_cache->find(source_id, source) &&
+        !lmdb_source_data_manager->find(source_id, source.file_hash,
+                        source.filesize, source.file_type,
+                        source.zero_count, source.nonprobative_count)) {
+      return "";
+    }
+    find_source(source_id, source, true);
+    return source.source_json;
+  }
+
+  // find hash counts in ascending order, return them in block_hashes order
+  void scan_manager_t::find_hash_counts(
+               const std::vector<std::string>& block_hashes,
+               std::vector<size_t>& counts) const {
+
+    counts.clear();
+    counts.resize(block_hashes.size(), 0);
+    std::vector<size_t> order;
+    sorted_order(block_hashes, bloom_filter, order);
+    lmdb_hash_data_manager->find_counts_sorted(block_hashes, order, counts);
   }
 
   // find hash count JSON
@@ -900,23 +2649,9 @@ namespace hashdb {
     }
 
     // return JSON with count
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
-
-    // block hash
-    std::string hex_block_hash = hashdb::bin_to_hex(block_hash);
-    json_doc.AddMember("block_hash", v(hex_block_hash, allocator), allocator);
-
-    // count
-    json_doc.AddMember("count", (uint64_t)count, allocator);
-
-    // write JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+    std::string json_text;
+    count_json("count", block_hash, count, json_text);
+    return json_text;
   }
 
   size_t scan_manager_t::find_approximate_hash_count(
@@ -926,6 +2661,11 @@ namespace hashdb {
       return 0;
     }
 
+    // the Bloom filter screens out most absent hashes
+    if (bloom_filter != NULL && !bloom_filter->find(block_hash)) {
+      return 0;
+    }
+
     return lmdb_hash_manager->find(block_hash);
   }
 
@@ -943,24 +2683,10 @@ namespace hashdb {
     }
 
     // return JSON with approximate count
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
-
-    // block hash
-    std::string hex_block_hash = hashdb::bin_to_hex(block_hash);
-    json_doc.AddMember("block_hash", v(hex_block_hash, allocator), allocator);
-
-    // approximate count
-    json_doc.AddMember("approximate_count",
-                                  (uint64_t)approximate_count, allocator);
-
-    // write JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+    std::string json_text;
+    count_json("approximate_count", block_hash, approximate_count,
+               json_text);
+    return json_text;
   }
 
   bool scan_manager_t::find_source_data(
@@ -1023,6 +2749,35 @@ namespace hashdb {
     }
   }
 
+  bool scan_manager_t::find_source_hashes(const std::string& file_hash,
+                         std::vector<std::string>& block_hashes) const {
+
+    block_hashes.clear();
+    if (file_hash.size() == 0) {
+      std::cerr << "Error: find_source_hashes called with empty file_hash\n";
+      return false;
+    }
+    if (lmdb_source_hash_manager == NULL) {
+      // no source index
+      return false;
+    }
+
+    // read source_id
+    uint64_t source_id;
+    bool has_id = lmdb_source_id_manager->find(file_hash, source_id);
+    if (has_id == false) {
+      // no source ID for this file_hash
+      return false;
+    } else {
+      // block hashes
+      return lmdb_source_hash_manager->find(source_id, block_hashes);
+    }
+  }
+
+  bool scan_manager_t::has_source_index() const {
+    return (lmdb_source_hash_manager != NULL);
+  }
+
   // export source, return result as JSON string
   std::string scan_manager_t::export_source_json(
                                const std::string& file_hash) const {
@@ -1033,11 +2788,6 @@ namespace hashdb {
     uint64_t zero_count;
     uint64_t nonprobative_count;
 
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
-
     // get source data
     bool has_source_data = find_source_data(file_hash, filesize,
                                  file_type, zero_count, nonprobative_count);
@@ -1047,39 +2797,104 @@ namespace hashdb {
 
     // source found
 
-    // set source data
-    std::string hex_file_hash = hashdb::bin_to_hex(file_hash);
-    json_doc.AddMember("file_hash", v(hex_file_hash, allocator), allocator);
-    json_doc.AddMember("filesize", filesize, allocator);
-    json_doc.AddMember("file_type", v(file_type, allocator), allocator);
-    json_doc.AddMember("zero_count", zero_count, allocator);
-    json_doc.AddMember("nonprobative_count", nonprobative_count, allocator);
-
     // get source names
     hashdb::source_names_t* source_names = new hashdb::source_names_t;
     find_source_names(file_hash, *source_names);
 
-    // name_pairs object
-    rapidjson::Value json_name_pairs(rapidjson::kArrayType);
-
-    // provide names
-    for (hashdb::source_names_t::const_iterator it = source_names->begin();
-         it != source_names->end(); ++it) {
-      // repository name
-      json_name_pairs.PushBack(v(it->first, allocator), allocator);
-      // filename
-      json_name_pairs.PushBack(v(it->second, allocator), allocator);
-    }
-    json_doc.AddMember("name_pairs", json_name_pairs, allocator);
+    // write JSON text
+    std::string json_text;
+    source_json(file_hash, filesize, file_type, zero_count,
+                nonprobative_count, *source_names, json_text);
 
     // done with source names
     delete source_names;
+    return json_text;
+  }
 
-    // write JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+  std::string scan_manager_t::dump(std::ostream& os) const {
+
+    // the hash size is the size of the first hash
+    const std::string first_block_hash = first_hash();
+    binary_dump_writer_t writer(os, first_block_hash.size());
+
+    // the source index of each source ID, plus 1
+    std::vector<uint64_t> source_indexes;
+
+    // sources in file hash order
+    std::string file_hash;
+    uint64_t filesize;
+    std::string file_type;
+    uint64_t zero_count;
+    uint64_t nonprobative_count;
+    hashdb::source_names_t source_names;
+    uint64_t source_count = 0;
+    lmdb_key_iterator_t* source_it =
+                       lmdb_source_id_manager->new_iterator("", "", 0);
+    for (; !source_it->at_end(); source_it->next()) {
+      const uint64_t source_id = lmdb_source_id_manager_t::source_id_at(
+                                               source_it->get_context());
+      lmdb_source_data_manager->find(source_id, file_hash, filesize,
+                               file_type, zero_count, nonprobative_count);
+      lmdb_source_name_manager->find(source_id, source_names);
+      writer.begin_record('S');
+      writer.put_string(source_it->key());
+      writer.put_number(filesize);
+      writer.put_string(file_type);
+      writer.put_number(zero_count);
+      writer.put_number(nonprobative_count);
+      writer.put_number(source_names.size());
+      for (hashdb::source_names_t::const_iterator it = source_names.begin();
+           it != source_names.end(); ++it) {
+        writer.put_string(it->first);
+        writer.put_string(it->second);
+      }
+      if (source_indexes.size() <= source_id) {
+        source_indexes.resize(source_id + 1, 0);
+      }
+      source_indexes[source_id] = ++source_count;
+    }
+    delete source_it;
+
+    // hashes in block hash order
+    std::string error_message = "";
+    hashdb::hash_data_t hash_data;
+    uint64_t hash_count = 0;
+    lmdb_key_iterator_t* hash_it =
+                       lmdb_hash_data_manager->new_iterator("", "", 0);
+    for (; !hash_it->at_end(); hash_it->next()) {
+      const std::string block_hash = hash_it->key();
+      if (block_hash.size() != first_block_hash.size()) {
+        error_message = "The block hashes are not all the same size.";
+        break;
+      }
+      lmdb_hash_data_manager->read_at(hash_it->get_context(), block_hash,
+                         hash_data.k_entropy, hash_data.block_label,
+                         hash_data.count, hash_data.source_id_sub_counts);
+      writer.begin_record('H');
+      writer.put_bytes(block_hash);
+      writer.put_number(hash_data.k_entropy);
+      writer.put_string(hash_data.block_label);
+      writer.put_number(hash_data.source_id_sub_counts.size());
+      for (hashdb::source_id_sub_counts_t::const_iterator it =
+           hash_data.source_id_sub_counts.begin();
+           it != hash_data.source_id_sub_counts.end(); ++it) {
+        if (it->source_id >= source_indexes.size() ||
+            source_indexes[it->source_id] == 0) {
+          std::cerr << "program error: no source for source ID "
+                    << it->source_id << "\n";
+          assert(0);
+        }
+        writer.put_number(source_indexes[it->source_id] - 1);
+        writer.put_number(it->sub_count);
+      }
+      ++hash_count;
+    }
+    delete hash_it;
+
+    if (error_message.size() == 0) {
+      writer.finish(source_count, hash_count);
+    }
+    return error_message;
   }
 
   std::string scan_manager_t::first_hash() const {
@@ -1094,6 +2909,14 @@ namespace hashdb {
     return lmdb_hash_data_manager->next_hash(block_hash);
   }
 
+  void scan_manager_t::hash_ranges(const size_t n,
+                  std::vector<std::pair<std::string, std::string> >& ranges,
+                  const std::string& begin_block_hash,
+                  const std::string& end_block_hash) const {
+    lmdb_hash_data_manager->split(n, ranges, begin_block_hash,
+                                  end_block_hash);
+  }
+
   std::string scan_manager_t::first_source() const {
     return lmdb_source_id_manager->first_source();
   }
@@ -1125,6 +2948,150 @@ namespace hashdb {
     return lmdb_source_id_manager->size();
   }
 
+  // ************************************************************
+  // hash_iterator_t
+  // ************************************************************
+  hash_iterator_t::hash_iterator_t(const scan_manager_t& p_manager,
+                                   const std::string& begin_block_hash,
+                                   const std::string& end_block_hash,
+                                   const size_t refresh_count) :
+          manager(p_manager),
+          iterator(manager.lmdb_hash_data_manager->new_iterator(
+                   begin_block_hash, end_block_hash, refresh_count)),
+          current_block_hash() {
+    set_current();
+  }
+
+  hash_iterator_t::~hash_iterator_t() {
+    delete iterator;
+  }
+
+  void hash_iterator_t::set_current() {
+    current_block_hash = (iterator->at_end()) ? "" : iterator->key();
+  }
+
+  bool hash_iterator_t::at_end() const {
+    return iterator->at_end();
+  }
+
+  void hash_iterator_t::next() {
+    iterator->next();
+    set_current();
+  }
+
+  const std::string& hash_iterator_t::block_hash() const {
+    return current_block_hash;
+  }
+
+  void hash_iterator_t::read(uint64_t& k_entropy,
+                             std::string& block_label,
+                             uint64_t& count,
+                             source_sub_counts_t& source_sub_counts) const {
+
+    source_sub_counts.clear();
+    if (iterator->at_end()) {
+      std::cerr << "Usage error: read called at the end of the hashes.\n";
+      k_entropy = 0;
+      block_label = "";
+      count = 0;
+      return;
+    }
+
+    hashdb::hash_data_t hash_data;
+    manager.lmdb_hash_data_manager->read_at(iterator->get_context(),
+                       current_block_hash, hash_data.k_entropy,
+                       hash_data.block_label, hash_data.count,
+                       hash_data.source_id_sub_counts);
+    k_entropy = hash_data.k_entropy;
+    block_label = hash_data.block_label;
+    count = hash_data.count;
+    manager.add_source_sub_counts(hash_data, source_sub_counts);
+  }
+
+  size_t hash_iterator_t::count() const {
+    if (iterator->at_end()) {
+      return 0;
+    }
+    return lmdb_hash_data_manager_t::count_at(iterator->get_context());
+  }
+
+  size_t hash_iterator_t::source_count() const {
+    if (iterator->at_end()) {
+      return 0;
+    }
+    return manager.lmdb_hash_data_manager->source_count_at(
+                          iterator->get_context(), current_block_hash);
+  }
+
+  std::string hash_iterator_t::export_json() const {
+    hashdb::source_sub_counts_t source_sub_counts;
+    return export_json(source_sub_counts);
+  }
+
+  std::string hash_iterator_t::export_json(
+                         source_sub_counts_t& source_sub_counts) const {
+    if (iterator->at_end()) {
+      source_sub_counts.clear();
+      return "";
+    }
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    read(k_entropy, block_label, count, source_sub_counts);
+    std::string json_text;
+    hash_json(current_block_hash, k_entropy, block_label, source_sub_counts,
+              json_text);
+    return json_text;
+  }
+
+  // ************************************************************
+  // source_iterator_t
+  // ************************************************************
+  source_iterator_t::source_iterator_t(const scan_manager_t& p_manager,
+                                       const std::string& begin_file_hash,
+                                       const std::string& end_file_hash,
+                                       const size_t refresh_count) :
+          manager(p_manager),
+          iterator(manager.lmdb_source_id_manager->new_iterator(
+                   begin_file_hash, end_file_hash, refresh_count)),
+          current_file_hash() {
+    set_current();
+  }
+
+  source_iterator_t::~source_iterator_t() {
+    delete iterator;
+  }
+
+  void source_iterator_t::set_current() {
+    current_file_hash = (iterator->at_end()) ? "" : iterator->key();
+  }
+
+  bool source_iterator_t::at_end() const {
+    return iterator->at_end();
+  }
+
+  void source_iterator_t::next() {
+    iterator->next();
+    set_current();
+  }
+
+  const std::string& source_iterator_t::file_hash() const {
+    return current_file_hash;
+  }
+
+  std::string source_iterator_t::export_json() const {
+    if (iterator->at_end()) {
+      return "";
+    }
+
+    // the source ID is in the record under the cursor
+    const uint64_t source_id = lmdb_source_id_manager_t::source_id_at(
+                                               iterator->get_context());
+    hashdb::cached_source_t source;
+    manager.find_source(source_id, source, true);
+    return source.source_json;
+  }
+
   // ************************************************************
   // timestamp
   // ************************************************************
@@ -63,6 +63,9 @@ class lmdb_changes_t {
   size_t source_name_inserted;
   size_t source_name_already_present;
 
+  // source_hash
+  size_t source_hash_inserted;
+
   lmdb_changes_t() :
             hash_data_inserted(0),
             hash_data_merged(0),
@@ -78,7 +81,8 @@ class lmdb_changes_t {
             source_id_inserted(0),
             source_id_already_present(0),
             source_name_inserted(0),
-            source_name_already_present(0) {
+            source_name_already_present(0),
+            source_hash_inserted(0) {
   }
 
   void report_changes(std::ostream& os) const {
@@ -135,6 +139,9 @@ class lmdb_changes_t {
     if (source_name_already_present) {
       os << "#     source_name_already_present: " << source_name_already_present << "\n";
     }
+    if (source_hash_inserted) {
+      os << "#     source_hash_inserted: " << source_hash_inserted << "\n";
+    }
     if (hash_data_inserted == 0 &&
         hash_data_merged == 0 &&
         hash_data_merged_same == 0 &&
@@ -149,7 +156,8 @@ class lmdb_changes_t {
         source_id_inserted == 0 &&
         source_id_already_present == 0 &&
         source_name_inserted == 0 &&
-        source_name_already_present == 0) {
+        source_name_already_present == 0 &&
+        source_hash_inserted == 0) {
        os << "No changes.\n";
     }
   }
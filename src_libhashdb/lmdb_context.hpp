@@ -22,18 +22,39 @@
  * Provides a working context for accessing a LMDB DB.
  *
  * A context must be opened then closed exactly once.
+ *
+ * The DB handle is opened once by the store's manager, see
+ * lmdb_helper::open_dbi, since stores may share one environment.
+ *
+ * A context that opens its own transaction holds off map changes while
+ * it is open, see lmdb_helper::hold_map.
+ *
+ * A writable context may be given a write transaction that is already
+ * open, see begin_batch in the LMDB managers.  The context then uses that
+ * transaction and leaves it open on close.
+ *
+ * A read-only context may be given a reader, see lmdb_reader_t.  The
+ * context then uses the reader's per-thread transaction and cursor rather
+ * than opening and closing its own.
+ *
+ * A context may also be given an open context.  The context then uses that
+ * context's transaction with its own cursor for another DB in the same
+ * environment, and must be closed first.
  */
 
 #ifndef LMDB_CONTEXT_HPP
 #define LMDB_CONTEXT_HPP
 #include "lmdb.h"
+#include "lmdb_helper.h"
+#include "lmdb_reader.hpp"
 
 namespace hashdb {
   class lmdb_context_t {
     private:
     MDB_env* env;
     unsigned int txn_flags; // example MDB_RDONLY
-    unsigned int dbi_flags; // example MDB_DUPSORT
+    bool is_batch;          // txn is owned by the caller
+    lmdb_reader_t* reader;  // txn and cursor are owned by the reader
     int state;
 
     // do not allow copy or assignment
@@ -47,18 +68,40 @@ namespace hashdb {
     MDB_val key;
     MDB_val data;
 
-    lmdb_context_t(MDB_env* p_env, bool is_writable, bool is_duplicates) :
-           env(p_env), txn_flags(0), dbi_flags(0),
-           state(0), txn(0), dbi(0), cursor(0), key(), data() {
+    lmdb_context_t(MDB_env* p_env, MDB_dbi p_dbi, bool is_writable) :
+           env(p_env), txn_flags(0), is_batch(false), reader(NULL),
+           state(0), txn(0), dbi(p_dbi), cursor(0), key(), data() {
 
       // set flags based on bool inputs
-      if (is_writable) {
-        dbi_flags |= MDB_CREATE;  // DBI
-      } else {
+      if (!is_writable) {
         txn_flags |= MDB_RDONLY;  // TXN
       }
-      if (is_duplicates) {
-        dbi_flags |= MDB_DUPSORT; // DBI
+    }
+
+    // use reader if it is set, otherwise create a read-only context
+    lmdb_context_t(MDB_env* p_env, MDB_dbi p_dbi, lmdb_reader_t* p_reader) :
+           env(p_env), txn_flags(MDB_RDONLY), is_batch(false),
+           reader(p_reader),
+           state(0), txn(0), dbi(p_dbi), cursor(0), key(), data() {
+    }
+
+    // use batch_txn if it is open, otherwise create a writable context
+    lmdb_context_t(MDB_env* p_env, MDB_dbi p_dbi, MDB_txn* batch_txn) :
+           env(p_env), txn_flags(0),
+           is_batch(batch_txn != NULL), reader(NULL),
+           state(0), txn(batch_txn), dbi(p_dbi), cursor(0), key(), data() {
+    }
+
+    // use the txn, or reader, of the open parent_context for p_dbi
+    lmdb_context_t(const lmdb_context_t& parent_context, MDB_dbi p_dbi) :
+           env(parent_context.env), txn_flags(parent_context.txn_flags),
+           is_batch(true), reader(parent_context.reader),
+           state(0), txn(parent_context.txn), dbi(p_dbi), cursor(0),
+           key(), data() {
+      if (parent_context.state != 1) {
+        std::cerr << "Error: LMDB parent context not open: state "
+                  << parent_context.state << "\n";
+        assert(0);
       }
     }
 
@@ -75,18 +118,21 @@ namespace hashdb {
         assert(0);
       }
 
-      // create txn object
-      int rc = mdb_txn_begin(env, NULL, txn_flags, &txn);
-      if (rc != 0) {
-        std::cerr << "LMDB txn error: " << mdb_strerror(rc) << "\n";
-        assert(0);
+      // use the reader's txn and cursor
+      if (reader != NULL) {
+        reader->acquire(env, dbi, txn, cursor);
+        return;
       }
 
-      // create the database handle integer
-      rc = mdb_dbi_open(txn, NULL, dbi_flags, &dbi);
-      if (rc != 0) {
-        std::cerr << "LMDB dbi error: " << mdb_strerror(rc) << "\n";
-        assert(0);
+      // create txn object unless using the open batch txn
+      int rc;
+      if (!is_batch) {
+        lmdb_helper::hold_map(env);
+        rc = mdb_txn_begin(env, NULL, txn_flags, &txn);
+        if (rc != 0) {
+          std::cerr << "LMDB txn error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
       }
 
       // create a cursor object to use with this txn
@@ -102,16 +148,26 @@ namespace hashdb {
         assert(0);
       }
 
+      // return the reader's txn and cursor
+      if (reader != NULL) {
+        reader->release(env);
+        return;
+      }
+
       // free cursor
       mdb_cursor_close(cursor);
 
-      // do not close dbi handle, why not close it?
+      // do not close dbi handle, the manager opened it for all contexts
 
       // free txn object
-      if ((txn_flags & MDB_RDONLY) != MDB_RDONLY) {
+      if (is_batch) {
+        // the batch owner commits the txn
+
+      } else if ((txn_flags & MDB_RDONLY) != MDB_RDONLY) {
 
         // RW
         int rc = mdb_txn_commit(txn);
+        lmdb_helper::release_map(env);
         if (rc != 0) {
           std::cerr << "LMDB txn commit error: " << mdb_strerror(rc) << "\n";
           assert(0);
@@ -120,6 +176,7 @@ namespace hashdb {
       } else {
         // RO
         mdb_txn_abort(txn);
+        lmdb_helper::release_map(env);
       }
     }
   };
@@ -34,6 +34,15 @@
  * Type 3: remaining lines of multi-entry hash:
  *         source_id, 2-byte sub_count up to 65535, clip, do not wrap.
  *
+ * Type 3 records are kept in the fixed-width hash_type3_store, a
+ * MDB_DUPFIXED DB keyed by block hash, with source_id as 8 big-endian
+ * bytes so that records sort by source_id.  Lookups of hashes with many
+ * sources read the records a page at a time, and inserts and merges find
+ * the record for one source_id with MDB_GET_BOTH_RANGE rather than
+ * stepping through the records.  Hashdbs in older layouts
+ * have no hash_type3_store and keep their Type 3 records after their
+ * Type 2 record with source_id as a varint.
+ *
  * NOTES:
  *   * Source ID must be > 0 because this field also distinguishes between
  *     type 1 and Type 2 data.
@@ -52,9 +61,11 @@
 #include "file_modes.h"
 #include "lmdb.h"
 #include "lmdb_helper.h"
+#include "block_hash_bytes.hpp"
 #include "lmdb_context.hpp"
 #include "lmdb_changes.hpp"
 #include "lmdb_hash_data_support.hpp"
+#include "lmdb_key_iterator.hpp"
 #include "source_id_sub_counts.hpp"
 #include "tprint.hpp"
 #include <vector>
@@ -112,12 +123,40 @@ static std::string truncate_block_label(std::string block_label) {
   return block_label;
 }
 
+// the leading 8 bytes of key as a big-endian value, zero-padded
+inline uint64_t leading_uint64(const std::string& key) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    value = (value << 8) |
+            ((i < key.size()) ? static_cast<uint8_t>(key[i]) : 0);
+  }
+  return value;
+}
+
+// hash data read by lmdb_hash_data_manager_t::find_sorted
+struct hash_data_t {
+  bool is_found;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  source_id_sub_counts_t source_id_sub_counts;
+  hash_data_t() : is_found(false), k_entropy(0), block_label(), count(0),
+                  source_id_sub_counts() {
+  }
+};
+
 class lmdb_hash_data_manager_t {
 
   private:
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
+  const bool is_shared_env;                   // env holds all stores
   MDB_env* env;
+  MDB_dbi dbi;
+  MDB_dbi type3_dbi;                          // hash_type3_store, else dbi
+  const bool is_fixed_type3;                  // type3_dbi is DUPFIXED
+  MDB_txn* batch_txn;                         // open during a batch
+  lmdb_reader_t* reader;                      // per-thread read txns, or NULL
 
 #ifdef HAVE_PTHREAD
   mutable pthread_mutex_t M;                  // mutext
@@ -125,29 +164,203 @@ class lmdb_hash_data_manager_t {
   mutable int M;                              // placeholder
 #endif
 
+  // Set the cursor of the open context to the first record of
+  // block_hash, false if the hash is not there.  MDB_SET_RANGE searches
+  // from the current cursor page when the key is on it, so lookups in
+  // ascending order reuse pages.
+  static bool seek(lmdb_context_t& context, const std::string& block_hash) {
+    return seek(context, block_hash.c_str(), block_hash.size());
+  }
+
+  static bool seek(lmdb_context_t& context, const char* const block_hash,
+                   const size_t hash_size) {
+    context.key.mv_size = hash_size;
+    context.key.mv_data = static_cast<void*>(const_cast<char*>(block_hash));
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_RANGE);
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_mdb_val("hash_data_manager seek at key", context.key);
+print_mdb_val("hash_data_manager seek at data", context.data);
+#endif
+
+    if (rc == MDB_NOTFOUND) {
+      // past the last hash
+      return false;
+
+    } else if (rc != 0) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    // the cursor may be at a later hash
+    if (context.key.mv_size != hash_size ||
+        memcmp(context.key.mv_data, block_hash, hash_size) != 0) {
+      return false;
+    }
+
+    // require data to have size
+    if (context.data.mv_size == 0) {
+      std::cerr << "program error in data size\n";
+      assert(0);
+    }
+    return true;
+  }
+
+  // read data for the hash using the open context
+  bool find_at(lmdb_context_t& context,
+               const std::string& block_hash,
+               uint64_t& k_entropy,
+               std::string& block_label,
+               uint64_t& count,
+               source_id_sub_counts_t& source_id_sub_counts) const {
+
+    if (!seek(context, block_hash)) {
+      // no hash
+      k_entropy = 0;
+      block_label = "";
+      count = 0;
+      source_id_sub_counts.clear();
+      return false;
+    }
+
+    read_at(context, block_hash, k_entropy, block_label, count,
+            source_id_sub_counts);
+    return true;
+  }
+
+  // read the source count for the hash using the open context
+  static size_t find_count_at(lmdb_context_t& context,
+                              const std::string& block_hash) {
+    return find_count_at(context, block_hash.c_str(), block_hash.size());
+  }
+
+  static size_t find_count_at(lmdb_context_t& context,
+                              const char* const block_hash,
+                              const size_t hash_size) {
+
+    if (!seek(context, block_hash, hash_size)) {
+      // this hash is not in the DB
+      return 0;
+    }
+
+    return count_at(context);
+  }
+
   // do not allow copy or assignment
   lmdb_hash_data_manager_t(const lmdb_hash_data_manager_t&);
   lmdb_hash_data_manager_t& operator=(const lmdb_hash_data_manager_t&);
 
   public:
+  /**
+   * Open the hash data store.  Keep Type 3 records in hash_type3_store
+   * when has_type3_store, which requires the shared environment.
+   */
   lmdb_hash_data_manager_t(const std::string& p_hashdb_dir,
-                           const hashdb::file_mode_type_t p_file_mode) :
+                           const hashdb::file_mode_type_t p_file_mode,
+                           MDB_env* p_shared_env = NULL,
+                           const bool has_type3_store = false) :
        hashdb_dir(p_hashdb_dir),
        file_mode(p_file_mode),
-       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_hash_data_store",
+       is_shared_env(p_shared_env != NULL),
+       env((is_shared_env) ? p_shared_env :
+                  lmdb_helper::open_env(hashdb_dir + "/lmdb_hash_data_store",
                                                                 file_mode)),
+       dbi(lmdb_helper::open_dbi(env,
+                     (is_shared_env) ? "hash_data_store" : NULL,
+                     true, file_mode, 0, lmdb_helper::compare_hash_keys)),
+       type3_dbi(dbi),
+       is_fixed_type3(has_type3_store),
+       batch_txn(NULL),
+       reader(NULL),
        M() {
 
+    if (has_type3_store) {
+      if (!is_shared_env) {
+        std::cerr << "program error: hash_type3_store requires the shared environment\n";
+        assert(0);
+      }
+      type3_dbi = lmdb_helper::open_dbi(env, "hash_type3_store", true,
+                     file_mode, MDB_DUPFIXED, lmdb_helper::compare_hash_keys);
+    }
+
     MUTEX_INIT(&M);
   }
 
   ~lmdb_hash_data_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
+    // close the DB environment unless it is shared
+    if (!is_shared_env) {
+      lmdb_helper::close_env(env);
+    }
 
     MUTEX_DESTROY(&M);
   }
 
+  /**
+   * Read using the per-thread txns and cursors of p_reader rather than
+   * opening a txn for each read.  Set before reading.
+   */
+  void set_reader(lmdb_reader_t* p_reader) {
+    reader = p_reader;
+  }
+
+  /**
+   * The most pages that writing one record may add to this store.
+   */
+  size_t record_pages() const {
+    return lmdb_helper::record_pages(env);
+  }
+
+  /**
+   * Hold inserts in one open write transaction until commit_batch.
+   * Reserve space for reserve_pages new pages since the DB cannot grow
+   * during the batch.  Call both from the thread that performs the inserts.
+   */
+  void begin_batch(const size_t reserve_pages) {
+    MUTEX_LOCK(&M);
+    batch_txn = lmdb_helper::begin_batch(env, reserve_pages);
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Commit the inserts held since begin_batch.
+   */
+  void commit_batch() {
+    MUTEX_LOCK(&M);
+    lmdb_helper::commit_batch(batch_txn);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Discard the inserts held since begin_batch.
+   */
+  void abort_batch() {
+    MUTEX_LOCK(&M);
+    lmdb_helper::abort_batch(batch_txn);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Hold inserts in txn, a batch txn opened by the owner of the shared
+   * environment, until leave_batch.  The owner commits txn.
+   */
+  void join_batch(MDB_txn* txn) {
+    MUTEX_LOCK(&M);
+    batch_txn = txn;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Stop using the txn given to join_batch.
+   */
+  void leave_batch() {
+    MUTEX_LOCK(&M);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
   // ************************************************************
   // insert
   // ************************************************************
@@ -187,11 +400,13 @@ class lmdb_hash_data_manager_t {
 
     MUTEX_LOCK(&M);
 
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
+    // reserve room in the map, begin_batch reserves room for batches
+    if (batch_txn == NULL) {
+      lmdb_helper::reserve(env);
+    }
 
     // get context
-    hashdb::lmdb_context_t context(env, true, true);
+    hashdb::lmdb_context_t context(env, dbi, batch_txn);
     context.open();
 #ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
 print_whole_mdb("hash_data_manager insert begin", context.cursor);
@@ -257,9 +472,14 @@ print_mdb_val("hash_data_manager insert found data", context.data);
           count = add4(existing_sub_count, 1);
           replace_type2(context, block_hash, existing_k_entropy,
                         existing_block_label, count);
-          new_type3(context, block_hash, existing_source_id,
+          hashdb::lmdb_context_t type3_context(context, type3_dbi);
+          type3_context.open();
+          new_type3(type3_context, is_fixed_type3,
+                    block_hash, existing_source_id,
                     existing_sub_count);
-          new_type3(context, block_hash, source_id, 1);
+          new_type3(type3_context, is_fixed_type3,
+                    block_hash, source_id, 1);
+          type3_context.close();
         }
 
       } else {
@@ -285,15 +505,22 @@ print_mdb_val("hash_data_manager insert found data", context.data);
                       existing_block_label, count);
 
         // look for existing type 3
+        hashdb::lmdb_context_t type3_context(context, type3_dbi);
+        type3_context.open();
         uint64_t existing_sub_count;
-        if (cursor_to_type3(context, source_id, existing_sub_count)) {
+        if (cursor_to_type3(type3_context, is_fixed_type3,
+                            block_hash, source_id,
+                            existing_sub_count)) {
           // increment sub_count at type 3
-          replace_type3(context, block_hash, source_id,
+          replace_type3(type3_context, is_fixed_type3,
+                        block_hash, source_id,
                         add2(existing_sub_count,1));
         } else {
           // new type 3
-          new_type3(context, block_hash, source_id, 1);
+          new_type3(type3_context, is_fixed_type3,
+                    block_hash, source_id, 1);
         }
+        type3_context.close();
       }
 
     } else {
@@ -351,11 +578,13 @@ print_whole_mdb("hash_data_manager insert end", context.cursor);
 
     MUTEX_LOCK(&M);
 
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
+    // reserve room in the map, begin_batch reserves room for batches
+    if (batch_txn == NULL) {
+      lmdb_helper::reserve(env);
+    }
 
     // get context
-    hashdb::lmdb_context_t context(env, true, true);
+    hashdb::lmdb_context_t context(env, dbi, batch_txn);
     context.open();
 #ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
 print_whole_mdb("hash_data_manager merge begin", context.cursor);
@@ -429,9 +658,14 @@ print_mdb_val("hash_data_manager merge found data", context.data);
           count = add4(existing_sub_count,sub_count);
           replace_type2(context, block_hash, existing_k_entropy,
                         existing_block_label, count);
-          new_type3(context, block_hash, existing_source_id,
+          hashdb::lmdb_context_t type3_context(context, type3_dbi);
+          type3_context.open();
+          new_type3(type3_context, is_fixed_type3,
+                    block_hash, existing_source_id,
                     existing_sub_count);
-          new_type3(context, block_hash, source_id, sub_count);
+          new_type3(type3_context, is_fixed_type3,
+                    block_hash, source_id, sub_count);
+          type3_context.close();
 
           ++changes.hash_data_merged;
         }
@@ -454,8 +688,12 @@ print_mdb_val("hash_data_manager merge found data", context.data);
         }
 
         // look for existing type 3
+        hashdb::lmdb_context_t type3_context(context, type3_dbi);
+        type3_context.open();
         uint64_t existing_sub_count;
-        if (cursor_to_type3(context, source_id, existing_sub_count)) {
+        if (cursor_to_type3(type3_context, is_fixed_type3,
+                            block_hash, source_id,
+                            existing_sub_count)) {
 
           // existing type 3 was merged before, no change
 
@@ -476,10 +714,12 @@ print_mdb_val("hash_data_manager merge found data", context.data);
                         existing_block_label, count);
 
           // new type 3 for new souce_id
-          new_type3(context, block_hash, source_id, sub_count);
+          new_type3(type3_context, is_fixed_type3,
+                    block_hash, source_id, sub_count);
 
           ++changes.hash_data_merged;
         }
+        type3_context.close();
       }
 
     } else {
@@ -497,6 +737,66 @@ print_whole_mdb("hash_data_manager merge end", context.cursor);
     return count;
   }
 
+  // ************************************************************
+  // append
+  // ************************************************************
+  /**
+   * Append the aggregated data for a hash that sorts after every hash
+   * already in the store, writing a Type 1 record for one source else
+   * a Type 2 record and its Type 3 records.  Used by the bulk loader to
+   * fill a new store in hash order.
+   */
+  void append(const std::string& block_hash,
+              const uint64_t k_entropy,
+              const std::string& block_label,
+              const uint64_t count,
+              const source_id_sub_counts_t& source_id_sub_counts) {
+
+    // require valid block_hash
+    if (block_hash.size() == 0) {
+      std::cerr << "Usage error: the block_hash value provided to append is empty.\n";
+      return;
+    }
+
+    // program error if there are no sources
+    if (source_id_sub_counts.size() == 0) {
+      std::cerr << "program error in source_id_sub_counts\n";
+      assert(0);
+    }
+
+    MUTEX_LOCK(&M);
+
+    // reserve room in the map, begin_batch reserves room for batches
+    if (batch_txn == NULL) {
+      lmdb_helper::reserve(env);
+    }
+
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, batch_txn);
+    context.open();
+
+    if (source_id_sub_counts.size() == 1) {
+      // Type 1
+      append_type1(context, block_hash, k_entropy, block_label,
+                   source_id_sub_counts.begin()->source_id,
+                   source_id_sub_counts.begin()->sub_count);
+    } else {
+      // Type 2 followed by its Type 3 records
+      append_type2(context, block_hash, k_entropy, block_label, count);
+      hashdb::lmdb_context_t type3_context(context, type3_dbi);
+      type3_context.open();
+      append_type3s(type3_context, is_fixed_type3,
+                    block_hash, source_id_sub_counts);
+      type3_context.close();
+    }
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_whole_mdb("hash_data_manager append end", context.cursor);
+#endif
+
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
   // ************************************************************
   // find
   // ************************************************************
@@ -510,127 +810,110 @@ print_whole_mdb("hash_data_manager merge end", context.cursor);
             uint64_t& count,
             source_id_sub_counts_t& source_id_sub_counts) const {
 
-    // clear any previous values
-    k_entropy = 0;
-    block_label = "";
-    count = 0;
-    source_id_sub_counts.clear();
-
     // require valid block_hash
     if (block_hash.size() == 0) {
       std::cerr << "Usage error: the block_hash value provided to find is empty.\n";
+      k_entropy = 0;
+      block_label = "";
+      count = 0;
+      source_id_sub_counts.clear();
       return false;
     }
 
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    hashdb::lmdb_context_t context(env, dbi, reader);
     context.open();
 #ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
 print_whole_mdb("hash_data_manager find", context.cursor);
 #endif
+    const bool is_found = find_at(context, block_hash, k_entropy,
+                                  block_label, count, source_id_sub_counts);
+    context.close();
+    return is_found;
+  }
 
-    // set key
-    const size_t key_size = block_hash.size();
-    uint8_t* const key_start = static_cast<uint8_t*>(
-                 static_cast<void*>(const_cast<char*>(block_hash.c_str())));
-    context.key.mv_size = key_size;
-    context.key.mv_data = key_start;
+  /**
+   * Read data for the hash given as hash_size bytes at block_hash into
+   * hash_record, reusing its buffers.  If the hash does not exist return
+   * false and empty fields.
+   */
+  bool find(const char* const block_hash, const size_t hash_size,
+            hash_record_t& hash_record) const {
 
-    // set the cursor to this key
-    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                            MDB_SET_KEY);
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find start at key", context.key);
-print_mdb_val("hash_data_manager find start at data", context.data);
-#endif
+    hash_record.k_entropy = 0;
+    hash_record.block_label.clear();
+    hash_record.count = 0;
+    hash_record.sources.clear();
 
-    if (rc == MDB_NOTFOUND) {
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find did not find key", context.key);
-#endif
-      // no hash
-      context.close();
+    // require valid block_hash
+    if (hash_size == 0) {
+      std::cerr << "Usage error: the block_hash value provided to find is empty.\n";
+      hash_record.is_found = false;
       return false;
+    }
 
-    } else if (rc == 0) {
-      // check first byte to see if the entry is Type 1 or Type 2
-      // require data to have size
-      if (context.data.mv_size == 0) {
-        std::cerr << "program error in data size\n";
-        assert(0);
-      }
-
-      // find the existing entry type
-      if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
-
-        // existing entry is Type 1 so read it and be done:
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find Type 1 key", context.key);
-print_mdb_val("hash_data_manager find Type 1 data", context.data);
-#endif
-        uint64_t source_id;
-        uint64_t sub_count;
-        decode_type1(context, k_entropy, block_label, source_id, sub_count);
-        source_id_sub_counts.insert(source_id_sub_count_t(source_id,
-                                                          sub_count));
-        count = sub_count;
-        context.close();
-        return true;
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, reader);
+    context.open();
+    hash_record.is_found = seek(context, block_hash, hash_size);
+    if (hash_record.is_found) {
+      read_at(context, block_hash, hash_size, hash_record);
+    }
+    context.close();
+    return hash_record.is_found;
+  }
 
-      } else {
-        // existing entry is Type 2 so read all entries for this hash
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find Type 2 key", context.key);
-print_mdb_val("hash_data_manager find Type 2 data", context.data);
-#endif
-        // read the existing Type 2 entry into returned fields
-        decode_type2(context, k_entropy, block_label, count);
+  /**
+   * Read data for the hashes in block_hashes at the indexes listed in
+   * order, which must be in ascending hash order, into the same indexes
+   * of hash_data.  One cursor walks forward through the store so
+   * neighboring lookups reuse the pages of the previous lookup.
+   */
+  void find_sorted(const std::vector<std::string>& block_hashes,
+                   const std::vector<size_t>& order,
+                   std::vector<hash_data_t>& hash_data) const {
 
-        // read Type 3 entries while data available and key matches
-        while (true) {
-          rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                              MDB_NEXT);
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find Type 3 key", context.key);
-print_mdb_val("hash_data_manager find Type 3 data", context.data);
-#endif
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, reader);
+    context.open();
 
-          if (rc == MDB_NOTFOUND || context.key.mv_size != key_size ||
-              memcmp(context.key.mv_data, key_start, key_size) != 0) {
-            // EOF or past key so done
-            break;
-          }
+    for (std::vector<size_t>::const_iterator it = order.begin();
+         it != order.end(); ++it) {
+      hash_data_t& data = hash_data[*it];
+      data.is_found = find_at(context, block_hashes[*it], data.k_entropy,
+                    data.block_label, data.count, data.source_id_sub_counts);
+    }
 
-          // make sure rc is valid
-          if (rc != 0) {
-            // invalid rc
-            std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
-            assert(0);
-          }
+    context.close();
+  }
 
-          // read Type 3
-          uint64_t source_id;
-          uint64_t sub_count;
-          decode_type3(context, source_id, sub_count);
+  /**
+   * Read data for the hashes, held in std::string or block_hash_t, at
+   * the indexes listed in order, as above, into the same indexes of
+   * hash_records, whose fields are clear, reusing their buffers.
+   */
+  template <typename T>
+  void find_sorted(const std::vector<T>& block_hashes,
+                   const std::vector<size_t>& order,
+                   std::vector<hash_record_t>& hash_records) const {
 
-          // add the LMDB hash data
-          source_id_sub_counts.insert(source_id_sub_count_t(source_id,
-                                                            sub_count));
-        }
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, reader);
+    context.open();
 
-        context.close();
-        return true;
+    for (std::vector<size_t>::const_iterator it = order.begin();
+         it != order.end(); ++it) {
+      const T& block_hash = block_hashes[*it];
+      hash_record_t& hash_record = hash_records[*it];
+      hash_record.is_found = seek(context, hash_bytes(block_hash),
+                                  hash_size(block_hash));
+      if (hash_record.is_found) {
+        read_at(context, hash_bytes(block_hash), hash_size(block_hash),
+                hash_record);
       }
-
-    } else {
-      // invalid rc
-      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
-      assert(0);
-      return false; // for mingw
     }
-    std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
-    assert(0); // for mingw
-    return false; // for mingw
+
+    context.close();
   }
 
   // ************************************************************
@@ -640,72 +923,199 @@ print_mdb_val("hash_data_manager find Type 3 data", context.data);
    * Return source count for this hash.
    */
   size_t find_count(const std::string& block_hash) const {
+    return find_count(block_hash.c_str(), block_hash.size());
+  }
+
+  /**
+   * Return source count for the hash given as hash_size bytes at
+   * block_hash.
+   */
+  size_t find_count(const char* const block_hash,
+                    const size_t hash_size) const {
 
     // require valid block_hash
-    if (block_hash.size() == 0) {
+    if (hash_size == 0) {
       std::cerr << "Usage error: the block_hash value provided to find_count is empty.\n";
       return 0;
     }
 
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    hashdb::lmdb_context_t context(env, dbi, reader);
     context.open();
+    const size_t count = find_count_at(context, block_hash, hash_size);
+    context.close();
+    return count;
+  }
 
-    // set key
-    context.key.mv_size = block_hash.size();
-    context.key.mv_data =
-                 static_cast<void*>(const_cast<char*>(block_hash.c_str()));
+  /**
+   * Find the source counts of the hashes in block_hashes, held in
+   * std::string or block_hash_t, at the indexes listed in order, which
+   * must be in ascending hash order, into the same indexes of counts.
+   */
+  template <typename T>
+  void find_counts_sorted(const std::vector<T>& block_hashes,
+                          const std::vector<size_t>& order,
+                          std::vector<size_t>& counts) const {
 
-    // set the cursor to this key
-    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                            MDB_SET_KEY);
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, reader);
+    context.open();
 
-    if (rc == MDB_NOTFOUND) {
-      // this hash is not in the DB
-      context.close();
-      return 0;
+    for (std::vector<size_t>::const_iterator it = order.begin();
+         it != order.end(); ++it) {
+      counts[*it] = find_count_at(context, hash_bytes(block_hashes[*it]),
+                                  hash_size(block_hashes[*it]));
+    }
 
-    } else if (rc == 0) {
-      // hash found
-      // require data to have size
-      if (context.data.mv_size == 0) {
-        std::cerr << "program error in data size\n";
-        assert(0);
-      }
+    context.close();
+  }
 
-      // check first byte to see if the entry is Type 1 or Type 2
-      if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
-        // Type 1
+  // ************************************************************
+  // iterate
+  // ************************************************************
+  /**
+   * Return a new iterator over the hashes from begin_block_hash through
+   * end_block_hash, "" for no limit, see lmdb_key_iterator_t.  Read the
+   * hash under it with read_at and count_at.  Delete it when done.
+   */
+  lmdb_key_iterator_t* new_iterator(const std::string& begin_block_hash,
+                                    const std::string& end_block_hash,
+                                    const size_t refresh_count) const {
+    return new lmdb_key_iterator_t(env, dbi, begin_block_hash,
+                                   end_block_hash, refresh_count);
+  }
 
-        // read the existing Type 1 entry into fields:
-        uint64_t k_entropy;
-        std::string block_label;
-        uint64_t source_id;
-        uint64_t sub_count;
-        decode_type1(context, k_entropy, block_label, source_id, sub_count);
+  /**
+   * Read data for block_hash from the first record of the hash, which
+   * context is at.  The Type 3 records of the hash are read with another
+   * cursor so the cursor of context stays at the hash.
+   */
+  void read_at(lmdb_context_t& context,
+               const std::string& block_hash,
+               uint64_t& k_entropy,
+               std::string& block_label,
+               uint64_t& count,
+               source_id_sub_counts_t& source_id_sub_counts) const {
 
-        context.close();
-        return sub_count;
+    // clear any previous values
+    source_id_sub_counts.clear();
 
-      } else {
-        // Type 2
+    // find the existing entry type
+    if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
 
-        // read the existing Type 2 entry into fields:
-        uint64_t k_entropy;
-        std::string block_label;
-        uint64_t count;
-        decode_type2(context, k_entropy, block_label, count);
+      // existing entry is Type 1 so read it and be done:
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_mdb_val("hash_data_manager find Type 1 key", context.key);
+print_mdb_val("hash_data_manager find Type 1 data", context.data);
+#endif
+      uint64_t source_id;
+      uint64_t sub_count;
+      decode_type1(context, k_entropy, block_label, source_id, sub_count);
+      source_id_sub_counts.insert(source_id_sub_count_t(source_id,
+                                                        sub_count));
+      count = sub_count;
 
-        context.close();
-        return count;
-      }
+    } else {
+      // existing entry is Type 2 so read all entries for this hash
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_mdb_val("hash_data_manager find Type 2 key", context.key);
+print_mdb_val("hash_data_manager find Type 2 data", context.data);
+#endif
+      // read the existing Type 2 entry into returned fields
+      decode_type2(context, k_entropy, block_label, count);
+
+      // read the Type 3 entries
+      hashdb::lmdb_context_t type3_context(context, type3_dbi);
+      type3_context.open();
+      read_type3s(type3_context, is_fixed_type3,
+                  block_hash, source_id_sub_counts);
+      type3_context.close();
+    }
+  }
+
+  // read data for the hash whose first record context is at into
+  // hash_record, whose fields are clear
+  void read_at(lmdb_context_t& context,
+               const char* const block_hash,
+               const size_t hash_size,
+               hash_record_t& hash_record) const {
+
+    if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
+      // Type 1
+      uint64_t source_id;
+      uint64_t sub_count;
+      decode_type1(context, hash_record.k_entropy, hash_record.block_label,
+                   source_id, sub_count);
+      hash_record.sources.push_back(hash_source_t(source_id, sub_count));
+      hash_record.count = sub_count;
 
     } else {
-      // invalid rc
+      // Type 2 then the Type 3 entries
+      decode_type2(context, hash_record.k_entropy, hash_record.block_label,
+                   hash_record.count);
+      hashdb::lmdb_context_t type3_context(context, type3_dbi);
+      type3_context.open();
+      read_type3s(type3_context, is_fixed_type3,
+                  block_hash, hash_size, hash_record.sources);
+      type3_context.close();
+    }
+  }
+
+  /**
+   * Return the count of the hash whose first record context is at.
+   */
+  static size_t count_at(lmdb_context_t& context) {
+
+    // check first byte to see if the entry is Type 1 or Type 2
+    uint64_t k_entropy;
+    std::string block_label;
+    if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
+      // Type 1
+      uint64_t source_id;
+      uint64_t sub_count;
+      decode_type1(context, k_entropy, block_label, source_id, sub_count);
+      return sub_count;
+
+    } else {
+      // Type 2
+      uint64_t count;
+      decode_type2(context, k_entropy, block_label, count);
+      return count;
+    }
+  }
+
+  /**
+   * Return the number of sources of block_hash, whose first record
+   * context is at, counting its Type 3 records without reading them.
+   */
+  size_t source_count_at(lmdb_context_t& context,
+                         const std::string& block_hash) const {
+
+    // Type 1
+    if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
+      return 1;
+    }
+
+    // Type 2 so count the Type 3 records
+    hashdb::lmdb_context_t type3_context(context, type3_dbi);
+    type3_context.open();
+    type3_context.key.mv_size = block_hash.size();
+    type3_context.key.mv_data =
+                 static_cast<void*>(const_cast<char*>(block_hash.c_str()));
+    int rc = mdb_cursor_get(type3_context.cursor, &type3_context.key,
+                            &type3_context.data, MDB_SET_KEY);
+    size_t records = 0;
+    if (rc == 0) {
+      rc = mdb_cursor_count(type3_context.cursor, &records);
+    }
+    if (rc != 0) {
       std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
       assert(0);
-      return 0; // for mingw
     }
+    type3_context.close();
+
+    // older layouts keep the Type 2 record among the Type 3 records
+    return (type3_dbi == dbi) ? records - 1 : records;
   }
 
   // ************************************************************
@@ -717,7 +1127,7 @@ print_mdb_val("hash_data_manager find Type 3 data", context.data);
   std::string first_hash() const {
 
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    hashdb::lmdb_context_t context(env, dbi, reader);
     context.open();
 
     int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
@@ -762,7 +1172,7 @@ print_mdb_val("hash_data_manager find_begin data", context.data);
     }
 
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    hashdb::lmdb_context_t context(env, dbi, reader);
     context.open();
 
     // set the cursor to previous hash
@@ -814,9 +1224,170 @@ print_mdb_val("hash_data_manager find_next data", context.data);
     }
   }
 
+  // ************************************************************
+  // split
+  // ************************************************************
+  /**
+   * Split the hashes from begin_key through end_key, or all hashes when
+   * "", into at most n ranges of about the same size, as inclusive first
+   * and last block hash pairs in ascending order.  Empty if there are no
+   * hashes to split.
+   *
+   * LMDB does not expose its branch pages, so split points are spaced
+   * evenly over the leading 8 bytes of the keys between the first and
+   * last hash and moved up to the next hash in the DB.  Block hashes are
+   * digests so this gives ranges of about equal counts.
+   */
+  void split(const size_t n,
+             std::vector<std::pair<std::string, std::string> >& ranges,
+             const std::string& begin_key,
+             const std::string& end_key) const {
+
+    ranges.clear();
+    if (n == 0) {
+      return;
+    }
+
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, reader);
+    context.open();
+
+    // first hash at or after begin_key
+    int rc;
+    if (begin_key.size() == 0) {
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_FIRST);
+    } else {
+      context.key.mv_size = begin_key.size();
+      context.key.mv_data =
+                  static_cast<void*>(const_cast<char*>(begin_key.c_str()));
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_SET_RANGE);
+    }
+    if (rc == MDB_NOTFOUND) {
+      // no hashes
+      context.close();
+      return;
+    }
+    if (rc != 0) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    const std::string first_key(static_cast<char*>(context.key.mv_data),
+                                context.key.mv_size);
+
+    // last hash at or before end_key
+    MDB_val end_val;
+    end_val.mv_size = end_key.size();
+    end_val.mv_data = static_cast<void*>(const_cast<char*>(end_key.c_str()));
+    if (end_key.size() == 0) {
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_LAST);
+    } else {
+      context.key = end_val;
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_SET_RANGE);
+      if (rc == MDB_NOTFOUND) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_LAST);
+      } else if (rc == 0 &&
+                 mdb_cmp(context.txn, context.dbi, &context.key,
+                         &end_val) > 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_PREV_NODUP);
+      }
+    }
+    if (rc == MDB_NOTFOUND) {
+      // no hashes at or before end_key
+      context.close();
+      return;
+    }
+    if (rc != 0) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    const std::string last_key(static_cast<char*>(context.key.mv_data),
+                               context.key.mv_size);
+    MDB_val first_val;
+    first_val.mv_size = first_key.size();
+    first_val.mv_data = static_cast<void*>(const_cast<char*>(
+                                                    first_key.c_str()));
+    if (mdb_cmp(context.txn, context.dbi, &first_val, &context.key) > 0) {
+      // no hashes in range
+      context.close();
+      return;
+    }
+
+    // the leading 8 bytes of the first and last hash
+    const uint64_t low = leading_uint64(first_key);
+    const uint64_t high = leading_uint64(last_key);
+    const uint64_t step = (high - low) / n;
+
+    // the first hash of each range
+    std::vector<std::string> begin_keys;
+    begin_keys.push_back(first_key);
+    for (size_t i = 1; i < n && step != 0; ++i) {
+      // big-endian split point, which sorts before all longer keys
+      // that share its bytes
+      const uint64_t point = low + step * i;
+      uint8_t probe[8];
+      for (size_t j = 0; j < 8; ++j) {
+        probe[j] = static_cast<uint8_t>(point >> (56 - 8 * j));
+      }
+      context.key.mv_size = 8;
+      context.key.mv_data = probe;
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_SET_RANGE);
+      if (rc == MDB_NOTFOUND) {
+        break;
+      }
+      if (rc != 0) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      MDB_val previous_val;
+      previous_val.mv_size = begin_keys.back().size();
+      previous_val.mv_data = static_cast<void*>(const_cast<char*>(
+                                          begin_keys.back().c_str()));
+      if (mdb_cmp(context.txn, context.dbi, &context.key,
+                  &previous_val) > 0) {
+        begin_keys.push_back(std::string(
+                  static_cast<char*>(context.key.mv_data),
+                  context.key.mv_size));
+      }
+    }
+
+    // each range ends at the hash before the first hash of the next range
+    for (size_t i = 0; i + 1 < begin_keys.size(); ++i) {
+      context.key.mv_size = begin_keys[i + 1].size();
+      context.key.mv_data = static_cast<void*>(const_cast<char*>(
+                                          begin_keys[i + 1].c_str()));
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_SET_KEY);
+      if (rc == 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_PREV_NODUP);
+      }
+      if (rc != 0) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      ranges.push_back(std::pair<std::string, std::string>(begin_keys[i],
+                  std::string(static_cast<char*>(context.key.mv_data),
+                              context.key.mv_size)));
+    }
+    ranges.push_back(std::pair<std::string, std::string>(
+                                          begin_keys.back(), last_key));
+
+    context.close();
+  }
+
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
-    return lmdb_helper::size(env);
+    if (type3_dbi == dbi) {
+      return lmdb_helper::size(env, dbi);
+    }
+    return lmdb_helper::size(env, dbi) + lmdb_helper::size(env, type3_dbi);
   }
 };
 
@@ -21,7 +21,9 @@
  * \file
  * Provides low-level support for moving the cursor and for reading and
  * writing Type1, Type2, and Type3 records in lmdb_hash_data_store.
- * See lmdb_hash_data_manager.
+ * Type 3 records are read and written through a context for the Type 3
+ * DB, which is either the hash data DB itself or the fixed-width
+ * hash_type3_store.  See lmdb_hash_data_manager.
  */
 
 // #define DEBUG_LMDB_HASH_DATA_SUPPORT_HPP
@@ -51,6 +53,8 @@
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <cassert>
 
 #ifdef DEBUG_LMDB_HASH_DATA_SUPPORT_HPP
@@ -63,6 +67,7 @@ const size_t max_block_label_size = 10;
 static const size_t type1_max_size = 10+1+max_block_label_size+10+2;
 // not used: static const size_t type2_max_size = 10+1+max_block_label_size+4;
 static const size_t type3_max_size = 10+2;
+static const size_t type3_fixed_size = 8+2;
 
 // put and get fixed-width numbers
 inline uint8_t* put1(uint8_t* p, uint64_t n) {
@@ -106,6 +111,22 @@ inline const uint8_t* get4(const uint8_t* const p, uint64_t &n) {
   return p+4;
 }
 
+// put and get big-endian 8-byte numbers, which sort as their bytes do
+inline uint8_t* put8_big_endian(uint8_t* p, uint64_t n) {
+  for (int i = 7; i >= 0; --i) {
+    p[i] = static_cast<uint8_t>(n & 0xff);
+    n >>= 8;
+  }
+  return p+8;
+}
+inline const uint8_t* get8_big_endian(const uint8_t* const p, uint64_t &n) {
+  n = 0;
+  for (int i = 0; i < 8; ++i) {
+    n = (n << 8) | p[i];
+  }
+  return p+8;
+}
+
 // encode Type 1 record
 static size_t encode_type1(const uint64_t k_entropy,
                            const std::string& block_label,
@@ -192,15 +213,20 @@ static size_t encode_type2(const uint64_t k_entropy,
   return p - p_buf;
 }
 
-// encode Type 3 record
-static size_t encode_type3(uint64_t source_id,
+// encode Type 3 record, fixed width or else varint source_id
+static size_t encode_type3(const bool is_fixed,
+                           uint64_t source_id,
                            uint64_t sub_count,
                            uint8_t* const p_buf) {
 
   uint8_t* p = p_buf;
 
   // add source_id
-  p = lmdb_helper::encode_uint64_t(source_id, p);
+  if (is_fixed) {
+    p = put8_big_endian(p, source_id);
+  } else {
+    p = lmdb_helper::encode_uint64_t(source_id, p);
+  }
 
   // add sub_count
   p = put2(p, sub_count);
@@ -214,15 +240,52 @@ static size_t encode_type3(uint64_t source_id,
   return p - p_buf;
 }
 
+// decode Type 3 record of data_size bytes
+static void decode_type3(const bool is_fixed,
+                         const uint8_t* const p_start,
+                         const size_t data_size,
+                         uint64_t& source_id,
+                         uint64_t& sub_count) {
+
+  const uint8_t* p = p_start;
+
+  // read source ID
+  if (is_fixed) {
+    p = get8_big_endian(p, source_id);
+  } else {
+    p = lmdb_helper::decode_uint64_t(p, source_id);
+  }
+
+  // read sub_count
+  p = get2(p, sub_count);
+
+  // read must align to data record
+  if (p != p_start + data_size) {
+    std::cerr << "data decode error in LMDB hash data store\n";
+    assert(0);
+  }
+}
+
+// set the context key to key
+static void set_key(hashdb::lmdb_context_t& context, const std::string& key) {
+  context.key.mv_size = key.size();
+  context.key.mv_data = static_cast<uint8_t*>(
+             static_cast<void*>(const_cast<char*>(key.c_str())));
+}
+
+static void set_key(hashdb::lmdb_context_t& context, const char* const key,
+                    const size_t key_size) {
+  context.key.mv_size = key_size;
+  context.key.mv_data = static_cast<void*>(const_cast<char*>(key));
+}
+
 // write the record given key and data.
 static void write_record(hashdb::lmdb_context_t& context,
                          const std::string& key,
                          const uint8_t* const data, const size_t data_size) {
 
   // set key and data
-  context.key.mv_size = key.size();
-  context.key.mv_data = static_cast<uint8_t*>(
-             static_cast<void*>(const_cast<char*>(key.c_str())));
+  set_key(context, key);
   context.data.mv_size = data_size;
   context.data.mv_data = const_cast<uint8_t*>(data);
 
@@ -239,6 +302,30 @@ print_mdb_val("hash_data_support write_record data", context.data);
   }
 }
 
+// append the record given key and data.  The key must sort at or after
+// the last key in the store and the data after the last data for the key.
+static void append_record(hashdb::lmdb_context_t& context,
+                          const std::string& key,
+                          const uint8_t* const data, const size_t data_size) {
+
+  // set key and data
+  set_key(context, key);
+  context.data.mv_size = data_size;
+  context.data.mv_data = const_cast<uint8_t*>(data);
+
+#ifdef DEBUG_LMDB_HASH_DATA_SUPPORT_HPP
+print_mdb_val("hash_data_support append_record key", context.key);
+print_mdb_val("hash_data_support append_record data", context.data);
+#endif
+
+  int rc = mdb_cursor_put(context.cursor, &context.key, &context.data,
+                          MDB_APPENDDUP);
+  if (rc != 0) {
+    std::cerr << "LMDB append error: " << mdb_strerror(rc) << "\n";
+    assert(0);
+  }
+}
+
 // replace the record given data.  Types 1 and 3 must match size.
 // New type 2 can be smaller but the record size must stay the same.
 static void replace_record(hashdb::lmdb_context_t& context,
@@ -292,37 +379,156 @@ print_mdb_val("hash_data_support replace_record data", context.data);
     }
   }
 
-  // Move cursor forward from Type 2 to correct Type 3 else false and rewind.
-  // Return sub_count.
+  // Move Type 3 cursor to the Type 3 record for source_id under key else
+  // false.  Return sub_count.
   bool cursor_to_type3(hashdb::lmdb_context_t& context,
+                       const bool is_fixed,
+                       const std::string& key,
                        const uint64_t source_id,
                        uint64_t& sub_count) {
 
-    while (true) {
-      // get next Type 3 record
-      int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                              MDB_NEXT_DUP);
-
+    sub_count = 0;
+    set_key(context, key);
+    int rc;
+
+    if (is_fixed) {
+      // records sort by their big-endian source ID so seek to the first
+      // record at or after source_id with sub_count 0
+      uint8_t p_buf[type3_fixed_size];
+      const size_t size = encode_type3(true, source_id, 0, p_buf);
+      context.data.mv_size = size;
+      context.data.mv_data = p_buf;
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_GET_BOTH_RANGE);
       if (rc == 0) {
         uint64_t existing_source_id;
         uint64_t existing_sub_count;
-        decode_type3(context, existing_source_id, existing_sub_count);
+        decode_type3(true, static_cast<uint8_t*>(context.data.mv_data),
+                     context.data.mv_size, existing_source_id,
+                     existing_sub_count);
         if (existing_source_id == source_id) {
           sub_count = existing_sub_count;
           return true;
         }
-      } else if (rc == MDB_NOTFOUND) {
-        // back up cursor to Type 2
-        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                            MDB_FIRST_DUP);
-        sub_count = 0;
         return false;
-      } else {
-        // invalid rc
-        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
-        assert(0);
+      }
+
+    } else {
+      // varint source IDs do not sort so step past the Type 2 record
+      // through the Type 3 records
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_SET_KEY);
+      while (rc == 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT_DUP);
+        if (rc == 0) {
+          uint64_t existing_source_id;
+          uint64_t existing_sub_count;
+          decode_type3(context, false, existing_source_id,
+                       existing_sub_count);
+          if (existing_source_id == source_id) {
+            sub_count = existing_sub_count;
+            return true;
+          }
+        }
       }
     }
+
+    if (rc == MDB_NOTFOUND) {
+      return false;
+    }
+
+    // invalid rc
+    std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+    assert(0);
+    return false; // for mingw
+  }
+
+  // add a source to a set of source ID, sub_count pairs
+  static void add_source(source_id_sub_counts_t& sources,
+                         const uint64_t source_id, const uint64_t sub_count) {
+    sources.insert(source_id_sub_count_t(source_id, sub_count));
+  }
+
+  // add a source to a vector of sources
+  static void add_source(std::vector<hashdb::hash_source_t>& sources,
+                         const uint64_t source_id, const uint64_t sub_count) {
+    sources.push_back(hashdb::hash_source_t(source_id, sub_count));
+  }
+
+  // read the Type 3 records under the key into sources
+  template<typename T>
+  static void read_type3s_into(hashdb::lmdb_context_t& context,
+                               const bool is_fixed,
+                               const char* const key,
+                               const size_t key_size,
+                               T& sources) {
+
+    // start at the key
+    set_key(context, key, key_size);
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_KEY);
+
+    if (is_fixed) {
+      // read a page of records at a time
+      if (rc == 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_GET_MULTIPLE);
+      }
+      while (rc == 0) {
+#ifdef DEBUG_LMDB_HASH_DATA_SUPPORT_HPP
+print_mdb_val("hash_data_support read_type3s key", context.key);
+print_mdb_val("hash_data_support read_type3s data", context.data);
+#endif
+        const uint8_t* p = static_cast<uint8_t*>(context.data.mv_data);
+        const uint8_t* const p_stop = p + context.data.mv_size;
+        for (; p < p_stop; p += type3_fixed_size) {
+          uint64_t source_id;
+          uint64_t sub_count;
+          decode_type3(true, p, type3_fixed_size, source_id, sub_count);
+          add_source(sources, source_id, sub_count);
+        }
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT_MULTIPLE);
+      }
+
+    } else {
+      // step past the Type 2 record through the Type 3 records
+      while (rc == 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT_DUP);
+        if (rc == 0) {
+          uint64_t source_id;
+          uint64_t sub_count;
+          decode_type3(context, false, source_id, sub_count);
+          add_source(sources, source_id, sub_count);
+        }
+      }
+    }
+
+    // the read must end at the last record for the key
+    if (rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+  }
+
+  // read the Type 3 records under key into source_id_sub_counts
+  void read_type3s(hashdb::lmdb_context_t& context,
+                   const bool is_fixed,
+                   const std::string& key,
+                   source_id_sub_counts_t& source_id_sub_counts) {
+    read_type3s_into(context, is_fixed, key.c_str(), key.size(),
+                     source_id_sub_counts);
+  }
+
+  // read the Type 3 records under key into sources
+  void read_type3s(hashdb::lmdb_context_t& context,
+                   const bool is_fixed,
+                   const char* const key,
+                   const size_t key_size,
+                   std::vector<hashdb::hash_source_t>& sources) {
+    read_type3s_into(context, is_fixed, key, key_size, sources);
   }
 
   // parse Type 1 context.data into these parameters
@@ -355,8 +561,7 @@ print_mdb_val("hash_data_support decode_type1 data", context.data);
     p = lmdb_helper::decode_uint64_t(p, block_label_size);
 
     // read the hash data block_label
-    block_label =
-       std::string(reinterpret_cast<const char*>(p), block_label_size);
+    block_label.assign(reinterpret_cast<const char*>(p), block_label_size);
     p += block_label_size;
 
     // compensate for padding
@@ -412,8 +617,7 @@ print_mdb_val("hash_data_support decode_type2 data", context.data);
     p = lmdb_helper::decode_uint64_t(p, block_label_size);
 
     // read the hash data block_label
-    block_label =
-       std::string(reinterpret_cast<const char*>(p), block_label_size);
+    block_label.assign(reinterpret_cast<const char*>(p), block_label_size);
     p += block_label_size;
 
     // read count
@@ -428,6 +632,7 @@ print_mdb_val("hash_data_support decode_type2 data", context.data);
 
   // parse Type 3 context.data into these parameters
   void decode_type3(hashdb::lmdb_context_t& context,
+                    const bool is_fixed,
                     uint64_t& source_id,
                     uint64_t& sub_count) {
 
@@ -436,21 +641,9 @@ print_mdb_val("hash_data_support decode_type3 key", context.key);
 print_mdb_val("hash_data_support decode_type3 data", context.data);
 #endif
 
-    // prepare to read Type 1 entry:
-    const uint8_t* const p_start = static_cast<uint8_t*>(context.data.mv_data);
-    const uint8_t* p = p_start;
-
-    // read source ID
-    p = lmdb_helper::decode_uint64_t(p, source_id);
-
-    // read sub_count
-    p = get2(p, sub_count);
-
-    // read must align to data record
-    if (p != p_start + context.data.mv_size) {
-      std::cerr << "data decode error in LMDB hash data store\n";
-      assert(0);
-    }
+    decode_type3(is_fixed,
+                 static_cast<uint8_t*>(context.data.mv_data),
+                 context.data.mv_size, source_id, sub_count);
   }
 
   // write new Type 1 record, key must be valid
@@ -474,6 +667,7 @@ print_mdb_val("hash_data_support decode_type3 data", context.data);
 
   // write new Type 3 record, key must be valid
   void new_type3(hashdb::lmdb_context_t& context,
+                 const bool is_fixed,
                  const std::string& key,
                  const uint64_t source_id,
                  const uint64_t sub_count) {
@@ -482,7 +676,7 @@ print_mdb_val("hash_data_support decode_type3 data", context.data);
     uint8_t p_buf[type3_max_size];
 
     // encode type3
-    const size_t size = encode_type3(source_id, sub_count, p_buf);
+    const size_t size = encode_type3(is_fixed, source_id, sub_count, p_buf);
 
     // write
     write_record(context, key, p_buf, size);
@@ -526,6 +720,7 @@ print_mdb_val("hash_data_support decode_type3 data", context.data);
 
   // replace Type 3 record at cursor
   void replace_type3(hashdb::lmdb_context_t& context,
+                     const bool is_fixed,
                      const std::string& key,
                      const uint64_t& source_id,
                      const uint64_t& sub_count) {
@@ -534,11 +729,191 @@ print_mdb_val("hash_data_support decode_type3 data", context.data);
     uint8_t p_buf[type3_max_size];
 
     // encode type3
-    const size_t size = encode_type3(source_id, sub_count, p_buf);
+    const size_t size = encode_type3(is_fixed, source_id, sub_count, p_buf);
 
     // write
     replace_record(context, key, p_buf, size, true);
   }
 
+  // append new Type 1 record after the last record in the store
+  void append_type1(hashdb::lmdb_context_t& context,
+                    const std::string& key,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const uint64_t source_id,
+                    const uint64_t sub_count) {
+
+    // space for encoding
+    uint8_t p_buf[type1_max_size];
+
+    // encode type1
+    const size_t size = encode_type1(k_entropy, block_label,
+                                     source_id, sub_count, p_buf);
+
+    // write
+    append_record(context, key, p_buf, size);
+  }
+
+  // append new Type 2 record after the last record in the store
+  void append_type2(hashdb::lmdb_context_t& context,
+                    const std::string& key,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const uint64_t count) {
+
+    // space for encoding
+    uint8_t p_buf[type1_max_size];
+
+    // encode type2
+    const size_t size = encode_type2(k_entropy, block_label, count, p_buf);
+
+    // write
+    append_record(context, key, p_buf, size);
+  }
+
+  // append the Type 3 records for the Type 2 record just appended
+  void append_type3s(hashdb::lmdb_context_t& context,
+                     const bool is_fixed,
+                     const std::string& key,
+                     const source_id_sub_counts_t& source_id_sub_counts) {
+
+    // LMDB orders duplicates by their encoded bytes, which for varint
+    // source IDs is not source ID order, so encode them all and sort the
+    // encodings
+    std::vector<std::string> records;
+    records.reserve(source_id_sub_counts.size());
+    uint8_t p_buf[type3_max_size];
+    for (source_id_sub_counts_t::const_iterator it =
+         source_id_sub_counts.begin(); it != source_id_sub_counts.end();
+         ++it) {
+      const size_t size = encode_type3(is_fixed, it->source_id,
+                                       it->sub_count, p_buf);
+      records.push_back(std::string(reinterpret_cast<char*>(p_buf), size));
+    }
+    std::sort(records.begin(), records.end());
+
+    // write
+    for (std::vector<std::string>::const_iterator it = records.begin();
+         it != records.end(); ++it) {
+      append_record(context, key,
+                    reinterpret_cast<const uint8_t*>(it->c_str()),
+                    it->size());
+    }
+  }
+
+  // Move the Type 3 records that follow their Type 2 records in
+  // hash_data_dbi into the fixed-width type3_dbi, committing every so
+  // often so the map can grow.
+  void move_type3s(MDB_env* env, MDB_dbi hash_data_dbi, MDB_dbi type3_dbi) {
+
+    // records moved per commit, allowing two pages per record as copy_dbi
+    // does
+    const size_t records_per_commit = 10000;
+
+    // the last hash moved, to resume at after each commit
+    std::string last_key = "";
+    int rc = 0;
+    while (rc == 0) {
+      MDB_txn* txn = lmdb_helper::begin_batch(env,
+                                          records_per_commit * 2 + 10);
+      MDB_cursor* cursor;
+      rc = mdb_cursor_open(txn, hash_data_dbi, &cursor);
+      if (rc != 0) {
+        std::cerr << "LMDB cursor error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+
+      // go to the first hash not moved yet
+      MDB_val key;
+      MDB_val data;
+      if (last_key.size() == 0) {
+        rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST);
+      } else {
+        key.mv_size = last_key.size();
+        key.mv_data = const_cast<char*>(last_key.c_str());
+        rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_KEY);
+        if (rc == 0) {
+          rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_NODUP);
+        }
+      }
+
+      size_t moved = 0;
+      while (rc == 0 && moved < records_per_commit) {
+        const std::string block_hash(static_cast<char*>(key.mv_data),
+                                     key.mv_size);
+
+        // a Type 2 record starts with 0x00 and is followed by its Type 3
+        // records
+        if (data.mv_size > 0 && static_cast<uint8_t*>(data.mv_data)[0] == 0) {
+          std::vector<std::string> records;
+          while ((rc = mdb_cursor_get(cursor, &key, &data,
+                                      MDB_NEXT_DUP)) == 0) {
+            records.push_back(std::string(
+                       static_cast<char*>(data.mv_data), data.mv_size));
+          }
+          if (rc != MDB_NOTFOUND) {
+            std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+            assert(0);
+          }
+
+          for (std::vector<std::string>::const_iterator it = records.begin();
+               it != records.end(); ++it) {
+            MDB_val record_key;
+            record_key.mv_size = block_hash.size();
+            record_key.mv_data = const_cast<char*>(block_hash.c_str());
+
+            // add the fixed-width record
+            const uint8_t* const p = reinterpret_cast<const uint8_t*>(
+                                                          it->c_str());
+            uint64_t source_id;
+            uint64_t sub_count;
+            decode_type3(false, p, it->size(), source_id, sub_count);
+            uint8_t p_buf[type3_max_size];
+            MDB_val record_data;
+            record_data.mv_size = encode_type3(true, source_id, sub_count,
+                                               p_buf);
+            record_data.mv_data = p_buf;
+            rc = mdb_put(txn, type3_dbi, &record_key, &record_data,
+                         MDB_NODUPDATA);
+            if (rc != 0) {
+              std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+              assert(0);
+            }
+
+            // remove the varint record
+            record_data.mv_size = it->size();
+            record_data.mv_data = const_cast<char*>(it->c_str());
+            rc = mdb_del(txn, hash_data_dbi, &record_key, &record_data);
+            if (rc != 0) {
+              std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+              assert(0);
+            }
+          }
+          moved += records.size();
+
+          // return to the Type 2 record
+          key.mv_size = block_hash.size();
+          key.mv_data = const_cast<char*>(block_hash.c_str());
+          rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_KEY);
+          if (rc != 0) {
+            std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+            assert(0);
+          }
+        }
+
+        last_key = block_hash;
+        rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_NODUP);
+      }
+
+      // the walk must end at the last hash else pause to commit
+      if (rc != 0 && rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      mdb_cursor_close(cursor);
+      lmdb_helper::commit_batch(txn);
+    }
+  }
+
 } // end namespace hashdb
 
@@ -21,7 +21,9 @@
  * \file
  * Provides low-level support for moving the cursor and for reading and
  * writing Type1, Type2, and Type3 records in lmdb_hash_data_store.
- * See lmdb_hash_data_manager.
+ * Type 3 records are read and written through a context for the Type 3
+ * DB, which is either the hash data DB itself or the fixed-width
+ * hash_type3_store.  See lmdb_hash_data_manager.
  */
 
 #ifndef LMDB_HASH_DATA_SUPPORT_HPP
@@ -29,7 +31,10 @@
 
 #include <unistd.h>
 #include <string>
+#include <vector>
+#include "hashdb.hpp"
 #include "lmdb_context.hpp"
+#include "source_id_sub_counts.hpp"
 
 namespace hashdb {
 
@@ -39,12 +44,32 @@ namespace hashdb {
   // move cursor to first entry of current key
   void cursor_to_first_current(hashdb::lmdb_context_t& context);
 
-  // Move cursor forward from Type 2 to correct Type 3 else false and rewind.
-  // Return sub_count.
+  // The Type 3 functions take is_fixed, true when the Type 3 DB of
+  // context is the fixed-width hash_type3_store rather than the hash data
+  // DB with the Type 3 records following their Type 2 record.
+
+  // Move Type 3 cursor to the Type 3 record for source_id under key else
+  // false.  Return sub_count.  Fixed-width records are found by seeking,
+  // varint records by stepping through them.
   bool cursor_to_type3(hashdb::lmdb_context_t& context,
+                       const bool is_fixed,
+                       const std::string& key,
                        const uint64_t source_id,
                        uint64_t& sub_count);
 
+  // read the Type 3 records under key into source_id_sub_counts
+  void read_type3s(hashdb::lmdb_context_t& context,
+                   const bool is_fixed,
+                   const std::string& key,
+                   source_id_sub_counts_t& source_id_sub_counts);
+
+  // read the Type 3 records under the key_size bytes at key into sources
+  void read_type3s(hashdb::lmdb_context_t& context,
+                   const bool is_fixed,
+                   const char* const key,
+                   const size_t key_size,
+                   std::vector<hashdb::hash_source_t>& sources);
+
   // parse Type 1 context.data into these parameters
   void decode_type1(hashdb::lmdb_context_t& context,
                     uint64_t& k_entropy,
@@ -60,6 +85,7 @@ namespace hashdb {
 
   // parse Type 3 context.data into these parameters
   void decode_type3(hashdb::lmdb_context_t& context,
+                    const bool is_fixed,
                     uint64_t& source_id,
                     uint64_t& sub_count);
 
@@ -73,6 +99,7 @@ namespace hashdb {
 
   // write new Type 3 record, key must be valid
   void new_type3(hashdb::lmdb_context_t& context,
+                 const bool is_fixed,
                  const std::string& key,
                  const uint64_t source_id,
                  const uint64_t sub_count);
@@ -94,10 +121,37 @@ namespace hashdb {
 
   // replace Type 3 record at cursor
   void replace_type3(hashdb::lmdb_context_t& context,
+                     const bool is_fixed,
                      const std::string& key,
                      const uint64_t& source_id,
                      const uint64_t& sub_count);
 
+  // append new Type 1 record after the last record in the store
+  void append_type1(hashdb::lmdb_context_t& context,
+                    const std::string& key,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const uint64_t source_id,
+                    const uint64_t sub_count);
+
+  // append new Type 2 record after the last record in the store
+  void append_type2(hashdb::lmdb_context_t& context,
+                    const std::string& key,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const uint64_t count);
+
+  // append the Type 3 records for the Type 2 record just appended
+  void append_type3s(hashdb::lmdb_context_t& context,
+                     const bool is_fixed,
+                     const std::string& key,
+                     const source_id_sub_counts_t& source_id_sub_counts);
+
+  // Move the Type 3 records that follow their Type 2 records in
+  // hash_data_dbi into the fixed-width type3_dbi, committing every so
+  // often so the map can grow.
+  void move_type3s(MDB_env* env, MDB_dbi hash_data_dbi, MDB_dbi type3_dbi);
+
 } // end namespace hashdb
 
 #endif
@@ -19,7 +19,11 @@
 
 /**
  * \file
- * Manage the LMDB hash store.  Threadsafe.
+ * Manage the LMDB hash store of key=hash prefix, data=approximate count.
+ * The prefix width and the count width come from the hashdb settings.
+ * A count of 1 byte is the logarithmic encoding below, of 2 or 4 bytes is
+ * the count clipped to fit, big-endian, and of 0 bytes is presence only.
+ * Threadsafe.
  */
 
 /** The following Python program generates example count encodings:
@@ -60,11 +64,14 @@ for i in range(1500):
 #include "lmdb_helper.h"
 #include "lmdb_context.hpp"
 #include "lmdb_changes.hpp"
+#include "hashdb.hpp" // for settings_t
+#include "block_hash_bytes.hpp"
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
 #include <string>
 #include <set>
+#include <vector>
 #include <cassert>
 #ifdef DEBUG_LMDB_HASH_MANAGER_HPP
 #include "lmdb_print_val.hpp"
@@ -80,14 +87,18 @@ namespace hashdb {
 
 static const uint8_t masks[8] = {0xff,0x80,0xc0,0xe0,0xf0,0xf8,0xfc,0xfe};
 
-static const size_t num_prefix_bytes = 7;
-
 class lmdb_hash_manager_t {
 
   private:
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
+  const size_t num_prefix_bytes;              // key width
+  const size_t num_count_bytes;               // data width
+  const bool is_shared_env;                   // env holds all stores
   MDB_env* env;
+  MDB_dbi dbi;
+  MDB_txn* batch_txn;                         // open during a batch
+  lmdb_reader_t* reader;                      // per-thread read txns, or NULL
 #ifdef HAVE_PTHREAD
   mutable pthread_mutex_t M;                  // mutext
 #else
@@ -122,24 +133,163 @@ class lmdb_hash_manager_t {
     return (m + 4) * lookup[x] - 5;
   }
 
+  // encode count into num_count_bytes bytes.  Larger encodings are larger
+  // counts when compared with memcmp.
+  inline void encode_count(const size_t count, uint8_t* const data) const {
+    switch(num_count_bytes) {
+      case 0:
+        break;
+      case 1:
+        data[0] = count_to_byte(count);
+        break;
+      default: {
+        const uint64_t max_count =
+                     (num_count_bytes == 2) ? 0xffff : 0xffffffff;
+        uint64_t clipped = (count > max_count) ? max_count : count;
+        for (size_t i = num_count_bytes; i > 0; --i) {
+          data[i - 1] = static_cast<uint8_t>(clipped);
+          clipped >>= 8;
+        }
+      }
+    }
+  }
+
+  inline size_t decode_count(const uint8_t* const data) const {
+    switch(num_count_bytes) {
+      case 0:
+        // present
+        return 1;
+      case 1:
+        return byte_to_count(data[0]);
+      default: {
+        size_t count = 0;
+        for (size_t i = 0; i < num_count_bytes; ++i) {
+          count = (count << 8) | data[i];
+        }
+        return count;
+      }
+    }
+  }
+
+  // the key for binary_hash, return the key size
+  inline size_t make_key(const std::string& binary_hash,
+                         uint8_t* const key) const {
+    return make_key(binary_hash.c_str(), binary_hash.size(), key);
+  }
+
+  inline size_t make_key(const char* const binary_hash,
+                         const size_t hash_size,
+                         uint8_t* const key) const {
+    const size_t prefix_size =
+              (hash_size > num_prefix_bytes) ? num_prefix_bytes : hash_size;
+    memcpy(key, binary_hash, prefix_size);
+    return prefix_size;
+  }
+
   public:
   lmdb_hash_manager_t(const std::string& p_hashdb_dir,
-                      const hashdb::file_mode_type_t p_file_mode) :
-          hashdb_dir(p_hashdb_dir),
-          file_mode(p_file_mode),
-          env(lmdb_helper::open_env(
-                           hashdb_dir + "/lmdb_hash_store", file_mode)),
+                      const hashdb::file_mode_type_t p_file_mode,
+                      MDB_env* p_shared_env = NULL,
+                      const size_t p_num_prefix_bytes =
+                             hashdb::settings_t::DEFAULT_HASH_PREFIX_BYTES,
+                      const size_t p_num_count_bytes =
+                             hashdb::settings_t::DEFAULT_HASH_COUNT_BYTES) :
+       hashdb_dir(p_hashdb_dir),
+       file_mode(p_file_mode),
+       num_prefix_bytes(p_num_prefix_bytes),
+       num_count_bytes(p_num_count_bytes),
+       is_shared_env(p_shared_env != NULL),
+       env((is_shared_env) ? p_shared_env :
+                  lmdb_helper::open_env(hashdb_dir + "/lmdb_hash_store",
+                                                                file_mode)),
+       dbi(lmdb_helper::open_dbi(env,
+                     (is_shared_env) ? "hash_store" : NULL,
+                     false, file_mode)),
+       batch_txn(NULL),
+       reader(NULL),
           M() {
+    if (!hashdb::settings_t::valid_hash_prefix_bytes(num_prefix_bytes) ||
+        !hashdb::settings_t::valid_hash_count_bytes(num_count_bytes)) {
+      std::cerr << "Invalid hash store prefix or count width\n";
+      assert(0);
+    }
     MUTEX_INIT(&M);
   }
 
   ~lmdb_hash_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
+    // close the DB environment unless it is shared
+    if (!is_shared_env) {
+      lmdb_helper::close_env(env);
+    }
 
     MUTEX_DESTROY(&M);
   }
 
+  /**
+   * Read using the per-thread txns and cursors of p_reader rather than
+   * opening a txn for each read.  Set before reading.
+   */
+  void set_reader(lmdb_reader_t* p_reader) {
+    reader = p_reader;
+  }
+
+  /**
+   * The most pages that writing one record may add to this store.
+   */
+  size_t record_pages() const {
+    return lmdb_helper::record_pages(env);
+  }
+
+  /**
+   * Hold inserts in one open write transaction until commit_batch.
+   * Reserve space for reserve_pages new pages since the DB cannot grow
+   * during the batch.  Call both from the thread that performs the inserts.
+   */
+  void begin_batch(const size_t reserve_pages) {
+    MUTEX_LOCK(&M);
+    batch_txn = lmdb_helper::begin_batch(env, reserve_pages);
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Commit the inserts held since begin_batch.
+   */
+  void commit_batch() {
+    MUTEX_LOCK(&M);
+    lmdb_helper::commit_batch(batch_txn);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Discard the inserts held since begin_batch.
+   */
+  void abort_batch() {
+    MUTEX_LOCK(&M);
+    lmdb_helper::abort_batch(batch_txn);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Hold inserts in txn, a batch txn opened by the owner of the shared
+   * environment, until leave_batch.  The owner commits txn.
+   */
+  void join_batch(MDB_txn* txn) {
+    MUTEX_LOCK(&M);
+    batch_txn = txn;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Stop using the txn given to join_batch.
+   */
+  void leave_batch() {
+    MUTEX_LOCK(&M);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
   void insert(const std::string& binary_hash, const size_t count,
               hashdb::lmdb_changes_t& changes) {
 
@@ -152,29 +302,27 @@ class lmdb_hash_manager_t {
     // ************************************************************
     // make key and data from binary_hash and count
     // ************************************************************
-    uint8_t key[num_prefix_bytes];
-    uint8_t data[1];  // 1 byte for count_encoding
-
-    size_t hash_size = binary_hash.size();
+    uint8_t key[hashdb::settings_t::MAX_HASH_PREFIX_BYTES];
+    uint8_t data[4];  // up to 4 bytes for count encoding
 
     // set key
-    size_t prefix_size =
-              (hash_size > num_prefix_bytes) ? num_prefix_bytes : hash_size;
-    memcpy(key, binary_hash.c_str(), prefix_size);
+    const size_t prefix_size = make_key(binary_hash, key);
 
     // set data
-    data[0] = count_to_byte(count);
+    encode_count(count, data);
 
     // ************************************************************
     // insert
     // ************************************************************
     MUTEX_LOCK(&M);
 
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
+    // reserve room in the map, begin_batch reserves room for batches
+    if (batch_txn == NULL) {
+      lmdb_helper::reserve(env);
+    }
 
     // get context
-    hashdb::lmdb_context_t context(env, true, false);
+    hashdb::lmdb_context_t context(env, dbi, batch_txn);
     context.open();
 
     // see if key is already there
@@ -190,7 +338,7 @@ class lmdb_hash_manager_t {
     if (rc == MDB_NOTFOUND) {
 
       // set context data
-      context.data.mv_size = 1;
+      context.data.mv_size = num_count_bytes;
       context.data.mv_data = data;
 #ifdef DEBUG_LMDB_HASH_MANAGER_HPP
 print_mdb_val("hash_manager insert not found key", context.key);
@@ -217,19 +365,23 @@ print_mdb_val("hash_manager insert not found data", context.data);
     } else if (rc == 0) {
 
       // validate data size
-      if (context.data.mv_size != 1) {
+      if (context.data.mv_size != num_count_bytes) {
         std::cerr << "corrupted DB\n";
         assert(0);
       }
 
       // maybe update count
-      uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
-      if (*data == *p) {
+      const uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
+      if (memcmp(data, p, num_count_bytes) == 0) {
         // same
         ++changes.hash_count_not_changed;
       } else {
-        // write back just to update count
-        *p = *data;
+        // write back just to update count.  Point key and data at our
+        // buffers rather than into the page that mdb_put will change.
+        context.key.mv_size = prefix_size;
+        context.key.mv_data = key;
+        context.data.mv_size = num_count_bytes;
+        context.data.mv_data = data;
 #ifdef DEBUG_LMDB_HASH_MANAGER_HPP
 print_mdb_val("hash_manager insert update count key", context.key);
 print_mdb_val("hash_manager insert update count data", context.data);
@@ -258,13 +410,110 @@ print_mdb_val("hash_manager insert update count data", context.data);
     }
   }
 
+  /**
+   * Append hash with count where hash sorts at or after every hash
+   * already in the store.  Hashes sharing a prefix keep the largest count.
+   * Used by the bulk loader to fill a new store in hash order.
+   */
+  void append(const std::string& binary_hash, const size_t count,
+              hashdb::lmdb_changes_t& changes) {
+
+    // require valid binary_hash
+    if (binary_hash.size() == 0) {
+      std::cerr << "Usage error: the binary_hash value provided to append is empty.\n";
+      return;
+    }
+
+    // make key and data from binary_hash and count
+    uint8_t key[hashdb::settings_t::MAX_HASH_PREFIX_BYTES];
+    uint8_t data[4];  // up to 4 bytes for count encoding
+    const size_t prefix_size = make_key(binary_hash, key);
+    encode_count(count, data);
+
+    MUTEX_LOCK(&M);
+
+    // reserve room in the map, begin_batch reserves room for batches
+    if (batch_txn == NULL) {
+      lmdb_helper::reserve(env);
+    }
+
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, batch_txn);
+    context.open();
+
+    // the previous hash may have had the same prefix
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_LAST);
+    if (rc == 0 && context.key.mv_size == prefix_size &&
+        memcmp(context.key.mv_data, key, prefix_size) == 0) {
+
+      // validate data size
+      if (context.data.mv_size != num_count_bytes) {
+        std::cerr << "corrupted DB\n";
+        assert(0);
+      }
+
+      // keep the larger count
+      const uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
+      if (memcmp(data, p, num_count_bytes) <= 0) {
+        ++changes.hash_count_not_changed;
+      } else {
+        context.key.mv_size = prefix_size;
+        context.key.mv_data = key;
+        context.data.mv_size = num_count_bytes;
+        context.data.mv_data = data;
+        rc = mdb_cursor_put(context.cursor, &context.key, &context.data,
+                            MDB_CURRENT);
+        if (rc != 0) {
+          std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+        ++changes.hash_count_changed;
+      }
+
+    } else if (rc == 0 || rc == MDB_NOTFOUND) {
+
+      // append the new prefix
+      context.key.mv_size = prefix_size;
+      context.key.mv_data = key;
+      context.data.mv_size = num_count_bytes;
+      context.data.mv_data = data;
+#ifdef DEBUG_LMDB_HASH_MANAGER_HPP
+print_mdb_val("hash_manager append key", context.key);
+print_mdb_val("hash_manager append data", context.data);
+#endif
+      rc = mdb_cursor_put(context.cursor, &context.key, &context.data,
+                          MDB_APPEND);
+      if (rc != 0) {
+        std::cerr << "LMDB append error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      ++changes.hash_inserted;
+
+    } else {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
   /**
    * Find if hash is present, return approximate count.
    */
   size_t find(const std::string& binary_hash) const {
+    return find(binary_hash.c_str(), binary_hash.size());
+  }
+
+  /**
+   * Find, given the hash as hash_size bytes at binary_hash.
+   */
+  size_t find(const char* const binary_hash, const size_t hash_size) const {
 
     // require valid binary_hash
-    if (binary_hash.size() == 0) {
+    if (hash_size == 0) {
       std::cerr << "empty key\n";
       assert(0);
     }
@@ -272,19 +521,16 @@ print_mdb_val("hash_manager insert update count data", context.data);
     // ************************************************************
     // make key and data from binary_hash
     // ************************************************************
-    size_t hash_size = binary_hash.size();
-    uint8_t key[num_prefix_bytes];
+    uint8_t key[hashdb::settings_t::MAX_HASH_PREFIX_BYTES];
 
     // set key
-    size_t prefix_size =
-              (hash_size > num_prefix_bytes) ? num_prefix_bytes : hash_size;
-    memcpy(key, binary_hash.c_str(), prefix_size);
+    const size_t prefix_size = make_key(binary_hash, hash_size, key);
 
     // ************************************************************
     // find
     // ************************************************************
     // get context
-    hashdb::lmdb_context_t context(env, false, false);
+    hashdb::lmdb_context_t context(env, dbi, reader);
     context.open();
 
     // see if prefix is already there
@@ -313,14 +559,14 @@ print_mdb_val("hash_manager find data", context.data);
 #endif
 
       // validate data size
-      if (context.data.mv_size != 1) {
+      if (context.data.mv_size != num_count_bytes) {
         std::cerr << "corrupted DB\n";
         assert(0);
       }
 
       // extract approximate count
-      uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
-      size_t approximate_count = byte_to_count(p[0]);
+      const uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
+      size_t approximate_count = decode_count(p);
       context.close();
       return approximate_count;
 
@@ -332,9 +578,62 @@ print_mdb_val("hash_manager find data", context.data);
     }
   }
 
+  /**
+   * Find the approximate counts of the hashes in block_hashes, held in
+   * std::string or block_hash_t, at the indexes listed in order, which
+   * must be in ascending hash order, into the same indexes of counts.
+   * One cursor walks forward through the store so neighboring lookups
+   * reuse the pages of the previous lookup.
+   */
+  template <typename T>
+  void find_sorted(const std::vector<T>& block_hashes,
+                   const std::vector<size_t>& order,
+                   std::vector<size_t>& counts) const {
+
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, reader);
+    context.open();
+
+    uint8_t key[hashdb::settings_t::MAX_HASH_PREFIX_BYTES];
+    for (std::vector<size_t>::const_iterator it = order.begin();
+         it != order.end(); ++it) {
+
+      // set the cursor at or after the prefix
+      const T& block_hash = block_hashes[*it];
+      const size_t prefix_size = make_key(hash_bytes(block_hash),
+                                          hash_size(block_hash), key);
+      context.key.mv_size = prefix_size;
+      context.key.mv_data = key;
+      int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                              MDB_SET_RANGE);
+
+      if (rc == 0 && context.key.mv_size == prefix_size &&
+          memcmp(context.key.mv_data, key, prefix_size) == 0) {
+        // prefix present
+        if (context.data.mv_size != num_count_bytes) {
+          std::cerr << "corrupted DB\n";
+          assert(0);
+        }
+        counts[*it] = decode_count(
+                          static_cast<uint8_t*>(context.data.mv_data));
+
+      } else if (rc == 0 || rc == MDB_NOTFOUND) {
+        // prefix not present
+        counts[*it] = 0;
+
+      } else {
+        // invalid rc
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+
+    context.close();
+  }
+
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
-    return lmdb_helper::size(env);
+    return lmdb_helper::size(env, dbi);
   }
 };
 
@@ -44,6 +44,8 @@
 #include "sys/stat.h"
 #include "lmdb.h"
 #include "file_modes.h"
+#include "num_cpus.hpp"
+#include "lmdb_map_manager.hpp"
 #include <stdexcept>
 #include <cassert>
 #include <stdint.h>
@@ -58,35 +60,6 @@
 
 namespace lmdb_helper {
 
-  // thread support to sync to prevent long delays
-  static bool sync_busy = false;
-  static void *perform_mdb_env_sync(void* env) {
-    if (sync_busy) {
-      // busy, so drop this sync request
-#ifdef DEBUG
-      std::cout << "sync busy\n";
-#endif
-    } else {
-      sync_busy=true;
-#ifdef DEBUG
-      std::cout << "sync start\n";
-#endif
-      int rc = mdb_env_sync(static_cast<MDB_env*>(env), 1);
-      if (rc != 0) {
-        // silently let the error go.  sync is a convenience and also sync is
-        // expected to fail when the program closes env and exits.
-#ifdef DEBUG
-        std::cout << "Note in sync DB: " <<  mdb_strerror(rc) << "\n";
-#endif
-      }
-#ifdef DEBUG
-      std::cout << "sync done\n";
-#endif
-      sync_busy = false;
-    }
-    return NULL;
-  }
-
   // write value into encoding, return pointer past value written.
   // each write will add no more than 10 bytes.
   // note: code adapted directly from:
@@ -196,7 +169,8 @@ namespace lmdb_helper {
   }
 
   MDB_env* open_env(const std::string& store_dir,
-                           const hashdb::file_mode_type_t file_mode) {
+                           const hashdb::file_mode_type_t file_mode,
+                           const unsigned int max_dbs) {
 
     // create the DB environment
     MDB_env* env;
@@ -206,11 +180,31 @@ namespace lmdb_helper {
       assert(0);
     }
 
+    // size the reader table for the scan threads, which each may hold a
+    // persistent reader txn, see lmdb_reader_t, and a transient read txn,
+    // beyond the LMDB default of 126 slots
+    rc = mdb_env_set_maxreaders(env, 126 + 2 * hashdb::numCPU());
+    if (rc != 0) {
+      std::cerr << "LMDB maxreaders error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    // make room for named DBs
+    if (max_dbs > 0) {
+      rc = mdb_env_set_maxdbs(env, max_dbs);
+      if (rc != 0) {
+        std::cerr << "LMDB maxdbs error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+
     // set flags for open
     unsigned int env_flags;
     switch(file_mode) {
       case hashdb::READ_ONLY:
-        env_flags = MDB_RDONLY;
+        // tie reader slots to txns so that threads may keep reader txns
+        // open while opening other read txns, see lmdb_reader_t
+        env_flags = MDB_RDONLY | MDB_NOTLS;
         break;
       case hashdb::RW_NEW:
         // store directory must not exist yet
@@ -257,83 +251,353 @@ namespace lmdb_helper {
       exit(1);
     }
 
+    // writable environments grow and sync through their map manager
+    if (file_mode != hashdb::READ_ONLY) {
+      rc = mdb_env_set_userctx(env, new hashdb::lmdb_map_manager_t(env));
+      if (rc != 0) {
+        std::cerr << "LMDB userctx error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+
     return env;
   }
 
-  void maybe_grow(MDB_env* env) {
-    // http://comments.gmane.org/gmane.network.openldap.technical/11699
-    // also see mdb_env_set_mapsize
+  static hashdb::lmdb_map_manager_t* map_manager(MDB_env* env) {
+    hashdb::lmdb_map_manager_t* manager =
+           static_cast<hashdb::lmdb_map_manager_t*>(mdb_env_get_userctx(env));
+    if (manager == NULL) {
+      std::cerr << "program error: the LMDB environment is not writable\n";
+      assert(0);
+    }
+    return manager;
+  }
+
+  void hold_map(MDB_env* env) {
+    hashdb::lmdb_map_manager_t* manager =
+           static_cast<hashdb::lmdb_map_manager_t*>(mdb_env_get_userctx(env));
+    if (manager != NULL) {
+      manager->hold();
+    }
+  }
+
+  void release_map(MDB_env* env) {
+    hashdb::lmdb_map_manager_t* manager =
+           static_cast<hashdb::lmdb_map_manager_t*>(mdb_env_get_userctx(env));
+    if (manager != NULL) {
+      manager->release();
+    }
+  }
+
+  bool is_resizable(MDB_env* env) {
+    return mdb_env_get_userctx(env) != NULL;
+  }
+
+  void close_env(MDB_env* env) {
+    // stop the flusher before the environment goes away
+    delete static_cast<hashdb::lmdb_map_manager_t*>(mdb_env_get_userctx(env));
+    mdb_env_close(env);
+  }
+
+  MDB_dbi open_dbi(MDB_env* env, const char* name, const bool is_duplicates,
+                   const hashdb::file_mode_type_t file_mode,
+                   const unsigned int dbi_flags,
+                   MDB_cmp_func* key_compare) {
+
+    // set flags
+    const bool is_writable = (file_mode != hashdb::READ_ONLY);
+    unsigned int flags = dbi_flags;
+    if (is_duplicates) {
+      flags |= MDB_DUPSORT;
+    }
+    if (is_writable) {
+      flags |= MDB_CREATE;
+    }
 
-    // read environment info
-    MDB_envinfo env_info;
-    int rc = mdb_env_info(env, &env_info);
+    // open the handle in its own txn.  Commit even when read-only so the
+    // handle stays open in the environment.
+    MDB_txn* txn;
+    hold_map(env);
+    int rc = mdb_txn_begin(env, NULL, (is_writable) ? 0 : MDB_RDONLY, &txn);
     if (rc != 0) {
+      std::cerr << "LMDB txn error: " << mdb_strerror(rc) << "\n";
       assert(0);
     }
+    MDB_dbi dbi;
+    rc = mdb_dbi_open(txn, name, flags, &dbi);
+    if (rc != 0) {
+      std::cerr << "Error opening LMDB DB '" << ((name) ? name : "")
+                << "': " << mdb_strerror(rc) << "\nAborting.\n";
+      exit(1);
+    }
 
-    // get page size
-    MDB_stat ms;
-    rc = mdb_env_stat(env, &ms);
+    // the key compare must be set before any data access
+    if (key_compare != NULL) {
+      rc = mdb_set_compare(txn, dbi, key_compare);
+      if (rc != 0) {
+        std::cerr << "LMDB compare error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+    // writes reserve pages by the depth of the DBs in the environment
+    if (is_writable) {
+      map_manager(env)->add_dbi(txn, dbi);
+    }
+    rc = mdb_txn_commit(txn);
+    release_map(env);
     if (rc != 0) {
+      std::cerr << "LMDB txn commit error: " << mdb_strerror(rc) << "\n";
       assert(0);
     }
+    return dbi;
+  }
 
-    // occasionally sync to prevent long flush delays
-    if (ms.ms_entries % 10000000 == 10000000 - 1) {
-      pthread_t thread;
-      int result_code = pthread_create(&thread, NULL, perform_mdb_env_sync,
-                            static_cast<void*>(env));
-      if (result_code != 0) {
-        assert(0);
+  // read 8 bytes as a big-endian number so that numbers compare as
+  // the bytes do
+  static inline uint64_t get_big_endian_8(const uint8_t* const p) {
+    return (static_cast<uint64_t>(p[0]) << 56) |
+           (static_cast<uint64_t>(p[1]) << 48) |
+           (static_cast<uint64_t>(p[2]) << 40) |
+           (static_cast<uint64_t>(p[3]) << 32) |
+           (static_cast<uint64_t>(p[4]) << 24) |
+           (static_cast<uint64_t>(p[5]) << 16) |
+           (static_cast<uint64_t>(p[6]) << 8) |
+           (static_cast<uint64_t>(p[7]));
+  }
+
+  int compare_hash_keys(const MDB_val* a, const MDB_val* b) {
+
+    // 16-byte keys as two words
+    if (a->mv_size == 16 && b->mv_size == 16) {
+      const uint8_t* const pa = static_cast<const uint8_t*>(a->mv_data);
+      const uint8_t* const pb = static_cast<const uint8_t*>(b->mv_data);
+      uint64_t wa = get_big_endian_8(pa);
+      uint64_t wb = get_big_endian_8(pb);
+      if (wa == wb) {
+        wa = get_big_endian_8(pa + 8);
+        wb = get_big_endian_8(pb + 8);
       }
+      return (wa < wb) ? -1 : (wa > wb) ? 1 : 0;
+    }
+
+    // other keys as LMDB does: by bytes then shorter first
+    const size_t size = (a->mv_size < b->mv_size) ? a->mv_size : b->mv_size;
+    const int diff = std::memcmp(a->mv_data, b->mv_data, size);
+    if (diff != 0) {
+      return diff;
     }
+    return (a->mv_size < b->mv_size) ? -1 :
+           (a->mv_size > b->mv_size) ? 1 : 0;
+  }
 
-    // maybe grow the DB
-    if (env_info.me_mapsize / ms.ms_psize <= env_info.me_last_pgno + 10) {
+  void reserve(MDB_env* env, const size_t reserve_pages) {
+    map_manager(env)->reserve(reserve_pages);
+  }
 
-      // could call mdb_env_sync(env, 1) here but it does not help
-      // rc = mdb_env_sync(env, 1);
-      // if (rc != 0) {
-      //   std::cerr << "Error growing DB: " <<  mdb_strerror(rc)
-      //             << "\nAborting.\n";
-      //   exit(1);
-      // }
+  void preallocate(MDB_env* env, const uint64_t expected_bytes) {
+    map_manager(env)->preallocate(expected_bytes);
+  }
 
-      // grow the DB
-      size_t size = env_info.me_mapsize;
-      if (size > (1<<30)) { // 1<<30 = 1,073,741,824
-        // add 1GiB
-        size += (1<<30);
-      } else {
-        // double
-        size *= 2;
+  void set_flush_policy(MDB_env* env, const uint64_t flush_bytes,
+                        const uint64_t flush_milliseconds) {
+    map_manager(env)->set_flush_policy(flush_bytes, flush_milliseconds);
+  }
+
+  size_t record_pages(MDB_env* env) {
+    return map_manager(env)->record_pages();
+  }
+
+  MDB_txn* begin_batch(MDB_env* env, const size_t reserve_pages) {
+
+    // the map cannot grow while the txn is open so grow it now
+    reserve(env, reserve_pages);
+
+    // open the write txn
+    MDB_txn* txn;
+    hold_map(env);
+    int rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc != 0) {
+      std::cerr << "LMDB batch txn error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    return txn;
+  }
+
+  void commit_batch(MDB_txn* txn) {
+    if (txn == NULL) {
+      std::cerr << "program error: no batch txn to commit\n";
+      assert(0);
+    }
+    MDB_env* env = mdb_txn_env(txn);
+    map_manager(env)->measure_depth(txn);
+    int rc = mdb_txn_commit(txn);
+    release_map(env);
+    if (rc != 0) {
+      std::cerr << "LMDB batch commit error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+  }
+
+  void abort_batch(MDB_txn* txn) {
+    if (txn == NULL) {
+      std::cerr << "program error: no batch txn to abort\n";
+      assert(0);
+    }
+    MDB_env* env = mdb_txn_env(txn);
+    mdb_txn_abort(txn);
+    release_map(env);
+  }
+
+  void copy_dbi(MDB_env* from_env, MDB_dbi from_dbi,
+                MDB_env* to_env, MDB_dbi to_dbi) {
+
+    // records arrive in order so append them.  Key compare still runs
+    // for sorted duplicates so that a key may take several data values.
+    const size_t records_per_commit = 10000;
+
+    // read from one txn
+    MDB_txn* from_txn;
+    hold_map(from_env);
+    int rc = mdb_txn_begin(from_env, NULL, MDB_RDONLY, &from_txn);
+    if (rc != 0) {
+      std::cerr << "LMDB txn error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    MDB_cursor* from_cursor;
+    rc = mdb_cursor_open(from_txn, from_dbi, &from_cursor);
+    if (rc != 0) {
+      std::cerr << "LMDB cursor error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    MDB_val key;
+    MDB_val data;
+    rc = mdb_cursor_get(from_cursor, &key, &data, MDB_FIRST);
+    while (rc == 0) {
+
+      // write up to records_per_commit records per txn, allowing two pages
+      // per record for records that overflow their page
+      MDB_txn* to_txn = begin_batch(to_env, records_per_commit * 2 + 10);
+      unsigned int to_flags;
+      int rc2 = mdb_dbi_flags(to_txn, to_dbi, &to_flags);
+      if (rc2 != 0) {
+        std::cerr << "LMDB dbi error: " << mdb_strerror(rc2) << "\n";
+        assert(0);
       }
-#ifdef DEBUG
-      std::cout << "Growing DB " << env << " from " << env_info.me_mapsize
-                << " to " << size << "\n";
-#endif
+      const unsigned int put_flags =
+                 (to_flags & MDB_DUPSORT) ? MDB_APPENDDUP : MDB_APPEND;
+
+      for (size_t i = 0; rc == 0 && i < records_per_commit; ++i) {
+        rc2 = mdb_put(to_txn, to_dbi, &key, &data, put_flags);
+        if (rc2 != 0) {
+          std::cerr << "LMDB copy error: " << mdb_strerror(rc2) << "\n";
+          assert(0);
+        }
+        rc = mdb_cursor_get(from_cursor, &key, &data, MDB_NEXT);
+      }
+      commit_batch(to_txn);
+    }
 
-      rc = mdb_env_set_mapsize(env, size);
-      if (rc != 0) {
-        // grow failed
-        std::cerr << "Error growing DB: " <<  mdb_strerror(rc)
-                  << "\nAborting.\n";
-        exit(1);
+    // the read must end at the last record
+    if (rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    mdb_cursor_close(from_cursor);
+    mdb_txn_abort(from_txn);
+    release_map(from_env);
+  }
+
+  void replace_dbi(MDB_env* from_env, MDB_dbi from_dbi,
+                   MDB_env* to_env, MDB_dbi to_dbi) {
+
+    // read from one txn
+    MDB_txn* from_txn;
+    hold_map(from_env);
+    int rc = mdb_txn_begin(from_env, NULL, MDB_RDONLY, &from_txn);
+    if (rc != 0) {
+      std::cerr << "LMDB txn error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    MDB_stat from_stat;
+    rc = mdb_stat(from_txn, from_dbi, &from_stat);
+    if (rc != 0) {
+      std::cerr << "LMDB stat error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    MDB_cursor* from_cursor;
+    rc = mdb_cursor_open(from_txn, from_dbi, &from_cursor);
+    if (rc != 0) {
+      std::cerr << "LMDB cursor error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    // the old pages are freed only when the txn commits so reserve room
+    // for a second copy of the new records, appended about as densely
+    const size_t from_pages = from_stat.ms_branch_pages +
+                              from_stat.ms_leaf_pages +
+                              from_stat.ms_overflow_pages;
+    MDB_txn* to_txn = begin_batch(to_env, 2 * from_pages + 10);
+    unsigned int to_flags;
+    rc = mdb_dbi_flags(to_txn, to_dbi, &to_flags);
+    if (rc != 0) {
+      std::cerr << "LMDB dbi error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    const unsigned int put_flags =
+               (to_flags & MDB_DUPSORT) ? MDB_APPENDDUP : MDB_APPEND;
+
+    // empty to_dbi then append the records of from_dbi
+    rc = mdb_drop(to_txn, to_dbi, 0);
+    if (rc != 0) {
+      std::cerr << "LMDB drop error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    MDB_val key;
+    MDB_val data;
+    rc = mdb_cursor_get(from_cursor, &key, &data, MDB_FIRST);
+    while (rc == 0) {
+      int rc2 = mdb_put(to_txn, to_dbi, &key, &data, put_flags);
+      if (rc2 != 0) {
+        std::cerr << "LMDB copy error: " << mdb_strerror(rc2) << "\n";
+        assert(0);
       }
+      rc = mdb_cursor_get(from_cursor, &key, &data, MDB_NEXT);
     }
+
+    // the read must end at the last record
+    if (rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    commit_batch(to_txn);
+
+    mdb_cursor_close(from_cursor);
+    mdb_txn_abort(from_txn);
+    release_map(from_env);
   }
 
   // size
-  size_t size(MDB_env* env) {
+  size_t size(MDB_env* env, MDB_dbi dbi) {
 
-    // obtain statistics
+    // obtain statistics from a read txn since named DBs share the env
+    MDB_txn* txn;
+    hold_map(env);
+    int rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc != 0) {
+      std::cerr << "size txn failure: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
     MDB_stat stat;
-    int rc = mdb_env_stat(env, &stat);
+    rc = mdb_stat(txn, dbi, &stat);
     if (rc != 0) {
       // program error
       std::cerr << "size failure: " << mdb_strerror(rc) << "\n";
       assert(0);
     }
+    mdb_txn_abort(txn);
+    release_map(env);
     return stat.ms_entries;
   }
 }
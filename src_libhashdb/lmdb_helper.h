@@ -57,13 +57,79 @@ namespace lmdb_helper {
   // https://code.google.com/p/protobuf/source/browse/trunk/src/google/protobuf/io/coded_stream.cc?r=417
   const uint8_t* decode_uint64_t(const uint8_t* p_ptr, uint64_t& value);
 
+  // open the environment at store_dir.  Set max_dbs to hold named DBs.
+  // Writable environments get a map manager and its flusher thread.
   MDB_env* open_env(const std::string& store_dir,
-                           const hashdb::file_mode_type_t file_mode);
+                           const hashdb::file_mode_type_t file_mode,
+                           const unsigned int max_dbs = 0);
 
-  void maybe_grow(MDB_env* env);
+  // stop the flusher of a writable environment then close env
+  void close_env(MDB_env* env);
+
+  // open the DB handle for name, or the unnamed DB when name is NULL.
+  // Add dbi_flags such as MDB_DUPFIXED and set key_compare if not NULL.
+  // Open each handle once, before contexts use it.
+  MDB_dbi open_dbi(MDB_env* env, const char* name, const bool is_duplicates,
+                   const hashdb::file_mode_type_t file_mode,
+                   const unsigned int dbi_flags = 0,
+                   MDB_cmp_func* key_compare = NULL);
+
+  // compare keys in the same order as the LMDB default key compare,
+  // comparing 16-byte keys such as MD5 block hashes as two 64-bit words
+  int compare_hash_keys(const MDB_val* a, const MDB_val* b);
+
+  // Hold off map changes of env in this process while a txn of env is
+  // open: call hold_map before a txn begins or renews and release_map
+  // after it commits, aborts or resets.  Holds nest.  These do nothing
+  // for read-only environments, whose maps this process never changes.
+  void hold_map(MDB_env* env);
+  void release_map(MDB_env* env);
+
+  // true if env is writable so its map may change, see hold_map
+  bool is_resizable(MDB_env* env);
+
+  // make room in the map for a write txn that adds up to reserve_pages
+  // pages.  This only consults the environment when the reservations
+  // since the last check could fill the map.
+  void reserve(MDB_env* env, const size_t reserve_pages = 10);
+
+  // grow the map now to hold about expected_bytes more bytes
+  void preallocate(MDB_env* env, const uint64_t expected_bytes);
+
+  // sync env in the background after flush_bytes bytes of changes or
+  // after flush_milliseconds, whichever comes first
+  void set_flush_policy(MDB_env* env, const uint64_t flush_bytes,
+                        const uint64_t flush_milliseconds);
+
+  // the most pages that writing one record may add to a DB of env, for
+  // sizing reservations
+  size_t record_pages(MDB_env* env);
+
+  // reserve reserve_pages more pages then open a write txn
+  // for batching many writes into one commit.  Call with no txn of env
+  // open on this thread.
+  MDB_txn* begin_batch(MDB_env* env, const size_t reserve_pages);
+
+  // commit a write txn opened by begin_batch, noting the depth of the
+  // DBs for later reservations, then release its hold on the map
+  void commit_batch(MDB_txn* txn);
+
+  // abort a write txn opened by begin_batch then release its hold on the
+  // map
+  void abort_batch(MDB_txn* txn);
+
+  // copy all records of from_dbi into the empty to_dbi, committing every
+  // so often so the map can grow
+  void copy_dbi(MDB_env* from_env, MDB_dbi from_dbi,
+                MDB_env* to_env, MDB_dbi to_dbi);
+
+  // replace all records of to_dbi with the records of from_dbi in one
+  // write txn, so readers and crashes see either the old or the new records
+  void replace_dbi(MDB_env* from_env, MDB_dbi from_dbi,
+                   MDB_env* to_env, MDB_dbi to_dbi);
 
   // size
-  size_t size(MDB_env* env);
+  size_t size(MDB_env* env, MDB_dbi dbi);
 }
 
 #endif
@@ -0,0 +1,198 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Walk the distinct keys of a LMDB DB in order with one read txn and
+ * cursor, so each step is a cursor move rather than a new txn and a seek
+ * back to the previous key.  The record under the cursor is read in place
+ * through get_context().
+ *
+ * The walk may be limited to the keys from begin_key through end_key.
+ * Every refresh_count keys the txn is reset and renewed and the cursor is
+ * put back at the key it was on, so a long walk does not keep one old
+ * snapshot, and the pages it holds, for its whole run.  With
+ * refresh_count 0 the walk reads from one snapshot.
+ *
+ * Not threadsafe.  Use one iterator per thread.
+ */
+
+#ifndef LMDB_KEY_ITERATOR_HPP
+#define LMDB_KEY_ITERATOR_HPP
+
+#include "lmdb.h"
+#include "lmdb_context.hpp"
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <cassert>
+
+namespace hashdb {
+
+class lmdb_key_iterator_t {
+
+  private:
+  lmdb_context_t context;
+  const std::string end_key;                  // "" for no end
+  const size_t refresh_count;                 // 0 for no refresh
+  size_t keys_since_refresh;
+  bool is_at_end;
+
+  // do not allow copy or assignment
+  lmdb_key_iterator_t(const lmdb_key_iterator_t&);
+  lmdb_key_iterator_t& operator=(const lmdb_key_iterator_t&);
+
+  // note the end when rc is MDB_NOTFOUND or the key is past end_key
+  void check(const int rc) {
+    if (rc == MDB_NOTFOUND) {
+      is_at_end = true;
+      return;
+    }
+    if (rc != 0) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    if (end_key.size() != 0) {
+      MDB_val end_val;
+      end_val.mv_size = end_key.size();
+      end_val.mv_data = static_cast<void*>(const_cast<char*>(end_key.c_str()));
+      is_at_end = (mdb_cmp(context.txn, context.dbi, &context.key,
+                           &end_val) > 0);
+    }
+  }
+
+  // renew the snapshot and put the cursor back at the current key or,
+  // if that key is gone, at the key after it.  Return false if the
+  // cursor was already moved past the current key.
+  bool refresh() {
+    const std::string current_key(static_cast<char*>(context.key.mv_data),
+                                  context.key.mv_size);
+    mdb_txn_reset(context.txn);
+    int rc = mdb_txn_renew(context.txn);
+    if (rc != 0) {
+      std::cerr << "LMDB txn renew error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    rc = mdb_cursor_renew(context.txn, context.cursor);
+    if (rc != 0) {
+      std::cerr << "LMDB cursor renew error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    keys_since_refresh = 0;
+
+    context.key.mv_size = current_key.size();
+    context.key.mv_data =
+                 static_cast<void*>(const_cast<char*>(current_key.c_str()));
+    rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                        MDB_SET_RANGE);
+    if (rc == 0 && (context.key.mv_size != current_key.size() ||
+                    memcmp(context.key.mv_data, current_key.c_str(),
+                           current_key.size()) != 0)) {
+      // the current key is gone so the cursor is at the next key
+      check(rc);
+      return false;
+    }
+    check(rc);
+    return true;
+  }
+
+  public:
+  /**
+   * Open a read txn on env and a cursor on dbi positioned at the first
+   * key at or after begin_key, or at the first key when begin_key is "".
+   */
+  lmdb_key_iterator_t(MDB_env* env, MDB_dbi dbi,
+                      const std::string& begin_key,
+                      const std::string& p_end_key,
+                      const size_t p_refresh_count) :
+            context(env, dbi, false),
+            end_key(p_end_key),
+            refresh_count(p_refresh_count),
+            keys_since_refresh(0),
+            is_at_end(false) {
+
+    context.open();
+
+    int rc;
+    if (begin_key.size() == 0) {
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_FIRST);
+    } else {
+      context.key.mv_size = begin_key.size();
+      context.key.mv_data =
+                 static_cast<void*>(const_cast<char*>(begin_key.c_str()));
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_SET_RANGE);
+    }
+    check(rc);
+  }
+
+  ~lmdb_key_iterator_t() {
+    context.close();
+  }
+
+  /**
+   * True when there are no more keys in range.
+   */
+  bool at_end() const {
+    return is_at_end;
+  }
+
+  /**
+   * Move to the next distinct key.
+   */
+  void next() {
+    if (is_at_end) {
+      std::cerr << "Usage error: next called at the end of the keys.\n";
+      return;
+    }
+
+    // maybe renew the snapshot first
+    if (refresh_count != 0 && ++keys_since_refresh >= refresh_count) {
+      if (!refresh() || is_at_end) {
+        return;
+      }
+    }
+
+    check(mdb_cursor_get(context.cursor, &context.key, &context.data,
+                         MDB_NEXT_NODUP));
+  }
+
+  /**
+   * The context, whose key and data are the first record of the current
+   * key.  Move the cursor of the context only to read the records of the
+   * current key.
+   */
+  lmdb_context_t& get_context() {
+    return context;
+  }
+
+  /**
+   * The current key.
+   */
+  std::string key() const {
+    return std::string(static_cast<char*>(context.key.mv_data),
+                       context.key.mv_size);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
@@ -0,0 +1,494 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Size the LMDB map and flush committed changes to disk for one writable
+ * environment.  Threadsafe.
+ *
+ * The map grows geometrically.  Writers reserve the pages they may add
+ * before opening a write txn, and the reservations are counted against
+ * the pages in use at the last check, so the environment is only
+ * consulted when the reservations could reach the end of the map.  The
+ * map cannot grow while a write txn is open, and a txn that fails with
+ * MDB_MAP_FULL must be aborted, so space is reserved up front rather
+ * than recovered after the failure.
+ *
+ * LMDB unmaps and remaps the map when it changes size, so no txn of the
+ * environment may be active in this process while it does.  Every txn
+ * of the environment is counted from hold to release, and the map only
+ * changes once the count is zero.  While a change waits, new txns wait
+ * for it, so a steady stream of reads cannot put it off, except on a
+ * thread that already holds a txn, which may open another so that it
+ * can finish and release both.  The map grows only in reserve and
+ * preallocate, which are called with no txn of the environment open on
+ * the calling thread.
+ *
+ * The pages a write may add depend on the depth of the tree it writes
+ * to, so the map manager tracks the depth of the DBs opened in its
+ * environment, measured when they are opened and again as each batch
+ * commits, and writers reserve record_pages() pages per record.
+ *
+ * The environment is opened with MDB_NOSYNC, so one flusher thread
+ * syncs it in the background after flush_bytes bytes of new pages or
+ * flush_milliseconds, whichever comes first, so that the operating
+ * system does not stall writers flushing a large backlog at once.
+ */
+
+#ifndef LMDB_MAP_MANAGER_HPP
+#define LMDB_MAP_MANAGER_HPP
+
+//#define DEBUG_LMDB_MAP_MANAGER_HPP
+
+#include "lmdb.h"
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>   // gettimeofday
+#include <time.h>       // timespec
+
+namespace hashdb {
+
+class lmdb_map_manager_t {
+
+  public:
+  // suggested flush policy
+  static const uint64_t DEFAULT_FLUSH_BYTES = 1ULL<<28; // 256 MiB
+  static const uint64_t DEFAULT_FLUSH_MILLISECONDS = 10000;
+
+  private:
+  // how often the flusher looks for committed changes
+  static const uint64_t POLL_MILLISECONDS = 100;
+
+  MDB_env* env;
+  size_t page_size;
+  size_t map_pages;           // pages in the map
+  size_t checked_pages;       // pages in use at the last check
+  size_t reserved_pages;      // pages reserved since the last check
+  std::vector<MDB_dbi> dbis;  // the DBs opened in the environment
+  size_t depth;               // the deepest of them when last measured
+  size_t txns;                // txns held open in this process
+  size_t resizes_waiting;     // changes waiting for txns to end
+  pthread_key_t thread_txns;  // txns held open by each thread
+
+  // flush policy
+  uint64_t flush_bytes;
+  uint64_t flush_milliseconds;
+
+  // flusher state, used by the flusher thread only
+  size_t synced_pages;
+  size_t synced_txnid;
+  timeval synced_time;
+
+  bool is_done;
+  pthread_t flusher;
+  mutable pthread_mutex_t M;  // guards the sizes, txns, resizes_waiting,
+                              // the policy and is_done
+  pthread_cond_t no_txns;     // txns reached zero
+  pthread_cond_t no_resizes;  // resizes_waiting reached zero
+  pthread_cond_t wake;        // done or a new policy
+
+  // do not allow copy or assignment
+  lmdb_map_manager_t(const lmdb_map_manager_t&);
+  lmdb_map_manager_t& operator=(const lmdb_map_manager_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  MDB_envinfo env_info() const {
+    MDB_envinfo info;
+    int rc = mdb_env_info(env, &info);
+    if (rc != 0) {
+      std::cerr << "LMDB env info error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    return info;
+  }
+
+  // wait until no txn of the environment is open, call from lock.  New
+  // txns wait meanwhile, see hold.  The lock is held from then until the
+  // caller unlocks, so no txn opens.
+  void wait_no_txns() {
+    ++resizes_waiting;
+    while (txns > 0) {
+      pthread_cond_wait(&no_txns, &M);
+    }
+    if (--resizes_waiting == 0) {
+      pthread_cond_broadcast(&no_resizes);
+    }
+  }
+
+  // the txns held open by this thread
+  size_t held_by_thread() const {
+    return reinterpret_cast<uintptr_t>(pthread_getspecific(thread_txns));
+  }
+
+  void set_held_by_thread(const size_t count) {
+    pthread_setspecific(thread_txns,
+                        reinterpret_cast<void*>(static_cast<uintptr_t>(count)));
+  }
+
+  // read the map size and the pages in use, call from lock
+  void read_sizes() {
+    const MDB_envinfo info = env_info();
+    map_pages = info.me_mapsize / page_size;
+    checked_pages = info.me_last_pgno + 1;
+  }
+
+  // set the map to size bytes once no txn is open, call from lock
+  void set_map_size(const size_t size) {
+    wait_no_txns();
+    int rc = mdb_env_set_mapsize(env, size);
+    if (rc != 0) {
+      // grow failed
+      std::cerr << "Error growing DB: " <<  mdb_strerror(rc)
+                << "\nAborting.\n";
+      exit(1);
+    }
+#ifdef DEBUG_LMDB_MAP_MANAGER_HPP
+    std::cout << "Growing DB " << env << " from " << map_pages * page_size
+              << " to " << size << "\n";
+#endif
+    map_pages = size / page_size;
+  }
+
+  // read the pages in use and grow the map geometrically until it holds
+  // pages more, call from lock
+  void check(const size_t pages) {
+    read_sizes();
+    reserved_pages = 0;
+    if (checked_pages + pages >= map_pages) {
+      // txns may commit pages while the change waits for them to end
+      wait_no_txns();
+      read_sizes();
+      size_t new_pages = map_pages;
+      while (checked_pages + pages >= new_pages) {
+        new_pages += new_pages / 2 + 1;
+      }
+      set_map_size(new_pages * page_size);
+    }
+  }
+
+  // the depth of the deepest DB as seen by txn, call from lock
+  size_t deepest(MDB_txn* txn) const {
+    size_t max_depth = 0;
+    for (std::vector<MDB_dbi>::const_iterator it = dbis.begin();
+         it != dbis.end(); ++it) {
+      MDB_stat ms;
+      int rc = mdb_stat(txn, *it, &ms);
+      if (rc != 0) {
+        std::cerr << "LMDB stat error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      if (ms.ms_depth > max_depth) {
+        max_depth = ms.ms_depth;
+      }
+    }
+    return max_depth;
+  }
+
+  static uint64_t milliseconds_since(const timeval& then) {
+    timeval now;
+    gettimeofday(&now, 0);
+    return (static_cast<uint64_t>(now.tv_sec) - then.tv_sec) * 1000 +
+           (now.tv_usec - then.tv_usec) / 1000;
+  }
+
+  // sync when enough has changed or enough time has passed.  Count at
+  // least one page for each committed txn since pages freed by earlier
+  // txns are reused.
+  void maybe_sync() {
+    const MDB_envinfo info = env_info();
+    if (info.me_last_txnid == synced_txnid) {
+      // nothing committed
+      gettimeofday(&synced_time, 0);
+      return;
+    }
+    const size_t new_pages = (info.me_last_pgno > synced_pages) ?
+                             info.me_last_pgno - synced_pages : 0;
+    const size_t unsynced_txns = info.me_last_txnid - synced_txnid;
+    const uint64_t dirty_bytes = static_cast<uint64_t>(
+           (new_pages > unsynced_txns) ? new_pages : unsynced_txns) *
+           page_size;
+
+    lock();
+    const bool is_due = dirty_bytes >= flush_bytes ||
+                        milliseconds_since(synced_time) >= flush_milliseconds;
+    unlock();
+    if (!is_due) {
+      return;
+    }
+
+    // the map must not change during the sync
+    hold();
+    int rc = mdb_env_sync(env, 1);
+    release();
+    if (rc != 0) {
+      // sync is a convenience so let the error go, the next sync retries
+#ifdef DEBUG_LMDB_MAP_MANAGER_HPP
+      std::cout << "Note in sync DB: " <<  mdb_strerror(rc) << "\n";
+#endif
+      return;
+    }
+    synced_pages = info.me_last_pgno;
+    synced_txnid = info.me_last_txnid;
+    gettimeofday(&synced_time, 0);
+  }
+
+  static void* run_flusher(void* const arg) {
+    lmdb_map_manager_t& manager = *static_cast<lmdb_map_manager_t*>(arg);
+    manager.lock();
+    while (!manager.is_done) {
+
+      // wait for the next poll
+      uint64_t wait_milliseconds = POLL_MILLISECONDS;
+      if (manager.flush_milliseconds < wait_milliseconds) {
+        wait_milliseconds = manager.flush_milliseconds + 1;
+      }
+      timeval now;
+      gettimeofday(&now, 0);
+      const uint64_t usec = now.tv_usec + (wait_milliseconds % 1000) * 1000;
+      timespec deadline;
+      deadline.tv_sec = now.tv_sec + wait_milliseconds / 1000 +
+                        usec / 1000000;
+      deadline.tv_nsec = (usec % 1000000) * 1000;
+      pthread_cond_timedwait(&manager.wake, &manager.M, &deadline);
+      if (manager.is_done) {
+        break;
+      }
+
+      manager.unlock();
+      manager.maybe_sync();
+      manager.lock();
+    }
+    manager.unlock();
+    return NULL;
+  }
+
+  public:
+  lmdb_map_manager_t(MDB_env* p_env) :
+                env(p_env), page_size(0), map_pages(0), checked_pages(0),
+                reserved_pages(0), dbis(), depth(0), txns(0),
+                resizes_waiting(0), thread_txns(),
+                flush_bytes(DEFAULT_FLUSH_BYTES),
+                flush_milliseconds(DEFAULT_FLUSH_MILLISECONDS),
+                synced_pages(0), synced_txnid(0), synced_time(),
+                is_done(false), flusher(), M(), no_txns(), no_resizes(),
+                wake() {
+    if(pthread_mutex_init(&M,NULL) ||
+       pthread_cond_init(&no_txns,NULL) ||
+       pthread_cond_init(&no_resizes,NULL) ||
+       pthread_cond_init(&wake,NULL) ||
+       pthread_key_create(&thread_txns, NULL)) {
+      std::cerr << "Error obtaining LMDB map manager mutex.\n";
+      assert(0);
+    }
+
+    // page size
+    MDB_stat ms;
+    int rc = mdb_env_stat(env, &ms);
+    if (rc != 0) {
+      std::cerr << "LMDB env stat error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    page_size = ms.ms_psize;
+
+    // pages in use
+    const MDB_envinfo info = env_info();
+    map_pages = info.me_mapsize / page_size;
+    checked_pages = info.me_last_pgno + 1;
+    synced_pages = info.me_last_pgno;
+    synced_txnid = info.me_last_txnid;
+    gettimeofday(&synced_time, 0);
+
+    // start the flusher
+    rc = pthread_create(&flusher, NULL, lmdb_map_manager_t::run_flusher,
+                        static_cast<void*>(this));
+    if (rc != 0) {
+      std::cerr << "Unable to start LMDB flusher thread.\n";
+      assert(0);
+    }
+  }
+
+  /**
+   * Stop the flusher.  Close the environment after this.
+   */
+  ~lmdb_map_manager_t() {
+    lock();
+    is_done = true;
+    pthread_cond_signal(&wake);
+    unlock();
+    int status = pthread_join(flusher, NULL);
+    if (status != 0) {
+      std::cerr << "error in LMDB flusher join " << status << "\n";
+    }
+    pthread_key_delete(thread_txns);
+    pthread_cond_destroy(&wake);
+    pthread_cond_destroy(&no_resizes);
+    pthread_cond_destroy(&no_txns);
+    pthread_mutex_destroy(&M);
+  }
+
+  /**
+   * Make room for pages more pages before opening a write txn that may
+   * add up to that many.  Call with no txn of the environment open on
+   * this thread, since growing waits for every txn to end.
+   */
+  void reserve(const size_t pages) {
+    lock();
+    if (checked_pages + reserved_pages + pages < map_pages) {
+      // room without looking
+      reserved_pages += pages;
+    } else {
+      check(pages);
+      reserved_pages = pages;
+    }
+    unlock();
+  }
+
+  /**
+   * Note a txn of the environment about to open in this process, keeping
+   * the map from changing until release.  Call before the txn begins or
+   * renews.  Waits for a pending change unless this thread already holds
+   * a txn.
+   */
+  void hold() {
+    const size_t held = held_by_thread();
+    lock();
+    if (held == 0) {
+      while (resizes_waiting > 0) {
+        pthread_cond_wait(&no_resizes, &M);
+      }
+    }
+    ++txns;
+    unlock();
+    set_held_by_thread(held + 1);
+  }
+
+  /**
+   * Note a txn from hold ended, by commit, abort or reset.
+   */
+  void release() {
+    lock();
+    if (txns == 0) {
+      std::cerr << "program error: LMDB txn released too often\n";
+      assert(0);
+    }
+    if (--txns == 0) {
+      pthread_cond_broadcast(&no_txns);
+    }
+    unlock();
+
+    // a txn may be closed by a thread other than the one that opened it
+    const size_t held = held_by_thread();
+    if (held > 0) {
+      set_held_by_thread(held - 1);
+    }
+  }
+
+  /**
+   * Track the depth of dbi, first measured in txn.
+   */
+  void add_dbi(MDB_txn* txn, const MDB_dbi dbi) {
+    lock();
+    if (std::find(dbis.begin(), dbis.end(), dbi) == dbis.end()) {
+      dbis.push_back(dbi);
+    }
+    depth = deepest(txn);
+    unlock();
+  }
+
+  /**
+   * Measure the depth of the DBs as seen by txn.  Call before committing
+   * a batch so that later reservations count the levels it added.
+   */
+  void measure_depth(MDB_txn* txn) {
+    lock();
+    depth = deepest(txn);
+    unlock();
+  }
+
+  /**
+   * The most pages that writing or deleting one record may add.  The
+   * write copies each page on the path from the root to its leaf and may
+   * split each of them and add a new root, and a key with duplicates has
+   * a second tree under it.  One more level is counted for growth since
+   * the depth was measured.
+   */
+  size_t record_pages() const {
+    lock();
+    const size_t pages = 2 * (2 * (depth + 1) + 1);
+    unlock();
+    return pages;
+  }
+
+  /**
+   * Grow the map now to hold about expected_bytes more bytes.  Call with
+   * no txn of the environment open on this thread.
+   */
+  void preallocate(const uint64_t expected_bytes) {
+    lock();
+    check(0);
+    const size_t expected_pages = expected_bytes / page_size + 1;
+    if (checked_pages + expected_pages > map_pages) {
+      // txns may commit pages while the change waits for them to end
+      wait_no_txns();
+      read_sizes();
+      set_map_size(std::max(checked_pages + expected_pages, map_pages) *
+                   page_size);
+    }
+    unlock();
+  }
+
+  /**
+   * Sync after flush_bytes bytes of changes or after flush_milliseconds,
+   * whichever comes first.
+   */
+  void set_flush_policy(const uint64_t p_flush_bytes,
+                        const uint64_t p_flush_milliseconds) {
+    lock();
+    flush_bytes = p_flush_bytes;
+    flush_milliseconds = p_flush_milliseconds;
+    pthread_cond_signal(&wake);
+    unlock();
+  }
+
+  size_t map_size() const {
+    lock();
+    const size_t size = map_pages * page_size;
+    unlock();
+    return size;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
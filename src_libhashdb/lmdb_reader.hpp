@@ -0,0 +1,305 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides per-thread read transactions and cursors that are kept open
+ * across lookups rather than opened and closed for each lookup.
+ *
+ * Each thread gets one read txn per environment and one cursor per DB.
+ * Between lookups the txn keeps its snapshot for up to
+ * refresh_milliseconds, then it is reset and renewed to see newer
+ * commits.  With refresh_milliseconds 0 the txn is reset after every
+ * lookup, so lookups see the latest commit, as with lmdb_context_t.
+ *
+ * An active txn holds off map changes, see lmdb_helper::hold_map.  In a
+ * writable environment, whose map this process may grow, the txn is
+ * reset after every lookup whatever refresh_milliseconds is, so an idle
+ * thread never keeps the map from growing.
+ *
+ * Environments read this way must be opened with MDB_NOTLS so that a
+ * thread holding a reader txn may also open other read txns.
+ *
+ * See lmdb_context_t, which uses this when given a reader.
+ */
+
+#ifndef LMDB_READER_HPP
+#define LMDB_READER_HPP
+
+#include "lmdb.h"
+#include "lmdb_helper.h"
+#include <vector>
+#include <iostream>
+#include <cassert>
+#include <sys/time.h>
+
+// threadsafe registry of thread states
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+class lmdb_reader_t {
+
+  private:
+  // a cursor and the txn generation it was renewed for
+  struct cursor_t {
+    MDB_dbi dbi;
+    MDB_cursor* cursor;
+    uint64_t generation;
+    cursor_t(MDB_dbi p_dbi, MDB_cursor* p_cursor, uint64_t p_generation) :
+              dbi(p_dbi), cursor(p_cursor), generation(p_generation) {
+    }
+  };
+
+  // one read txn and its cursors in one environment
+  struct env_reader_t {
+    MDB_env* env;
+    MDB_txn* txn;
+    const bool is_resizable;     // the map of env may change
+    uint64_t generation;         // increments each renew
+    bool is_reset;
+    size_t in_use;               // contexts using the txn
+    timeval renewed;
+    std::vector<cursor_t> cursors;
+    env_reader_t(MDB_env* p_env, MDB_txn* p_txn) :
+              env(p_env), txn(p_txn),
+              is_resizable(lmdb_helper::is_resizable(p_env)),
+              generation(0), is_reset(false),
+              in_use(0), renewed(), cursors() {
+      gettimeofday(&renewed, 0);
+    }
+    private:
+    env_reader_t(const env_reader_t&);
+    env_reader_t& operator=(const env_reader_t&);
+  };
+
+  // the readers of one thread
+  struct thread_reader_t {
+    lmdb_reader_t* owner;
+    std::vector<env_reader_t*> env_readers;
+    thread_reader_t(lmdb_reader_t* p_owner) :
+              owner(p_owner), env_readers() {
+    }
+    private:
+    thread_reader_t(const thread_reader_t&);
+    thread_reader_t& operator=(const thread_reader_t&);
+  };
+
+  const uint64_t refresh_milliseconds;
+  pthread_key_t key;
+  std::vector<thread_reader_t*> thread_readers;
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  lmdb_reader_t(const lmdb_reader_t&);
+  lmdb_reader_t& operator=(const lmdb_reader_t&);
+
+  // close cursors and txns
+  static void close_thread_reader(thread_reader_t* thread_reader) {
+    std::vector<env_reader_t*>::iterator it;
+    for (it = thread_reader->env_readers.begin();
+         it != thread_reader->env_readers.end(); ++it) {
+      std::vector<cursor_t>::iterator cursor_it;
+      for (cursor_it = (*it)->cursors.begin();
+           cursor_it != (*it)->cursors.end(); ++cursor_it) {
+        mdb_cursor_close(cursor_it->cursor);
+      }
+      mdb_txn_abort((*it)->txn);
+      if (!(*it)->is_reset) {
+        lmdb_helper::release_map((*it)->env);
+      }
+      delete *it;
+    }
+    delete thread_reader;
+  }
+
+  // release the snapshot of a thread that exits
+  static void thread_exit(void* arg) {
+    thread_reader_t* thread_reader = static_cast<thread_reader_t*>(arg);
+    lmdb_reader_t* owner = thread_reader->owner;
+    MUTEX_LOCK(&owner->M);
+    std::vector<thread_reader_t*>::iterator it;
+    for (it = owner->thread_readers.begin();
+         it != owner->thread_readers.end(); ++it) {
+      if (*it == thread_reader) {
+        owner->thread_readers.erase(it);
+        break;
+      }
+    }
+    MUTEX_UNLOCK(&owner->M);
+    close_thread_reader(thread_reader);
+  }
+
+  // the env reader of this thread for env
+  env_reader_t& env_reader(MDB_env* env) {
+
+    // get this thread's readers
+    thread_reader_t* thread_reader =
+                 static_cast<thread_reader_t*>(pthread_getspecific(key));
+    if (thread_reader == NULL) {
+      thread_reader = new thread_reader_t(this);
+      pthread_setspecific(key, thread_reader);
+      MUTEX_LOCK(&M);
+      thread_readers.push_back(thread_reader);
+      MUTEX_UNLOCK(&M);
+    }
+
+    // find the reader for env
+    std::vector<env_reader_t*>::iterator it;
+    for (it = thread_reader->env_readers.begin();
+         it != thread_reader->env_readers.end(); ++it) {
+      if ((*it)->env == env) {
+        return **it;
+      }
+    }
+
+    // open a read txn for env
+    MDB_txn* txn;
+    lmdb_helper::hold_map(env);
+    int rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc != 0) {
+      std::cerr << "LMDB reader txn error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    env_reader_t* reader = new env_reader_t(env, txn);
+    thread_reader->env_readers.push_back(reader);
+    return *reader;
+  }
+
+  public:
+  lmdb_reader_t(const uint64_t p_refresh_milliseconds) :
+          refresh_milliseconds(p_refresh_milliseconds),
+          key(), thread_readers(), M() {
+    MUTEX_INIT(&M);
+    int rc = pthread_key_create(&key, thread_exit);
+    if (rc != 0) {
+      std::cerr << "LMDB reader key error " << rc << "\n";
+      assert(0);
+    }
+  }
+
+  // call after threads using the reader are done
+  ~lmdb_reader_t() {
+    pthread_key_delete(key);
+    std::vector<thread_reader_t*>::iterator it;
+    for (it = thread_readers.begin(); it != thread_readers.end(); ++it) {
+      close_thread_reader(*it);
+    }
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Provide this thread's txn and its cursor for dbi in env, renewing
+   * the txn if it is reset or older than refresh_milliseconds.  Call
+   * release when done.
+   */
+  void acquire(MDB_env* env, MDB_dbi dbi, MDB_txn*& txn,
+               MDB_cursor*& cursor) {
+
+    env_reader_t& reader = env_reader(env);
+
+    // maybe renew the snapshot, but not while another context uses it
+    if (reader.in_use == 0) {
+      if (!reader.is_reset && refresh_milliseconds > 0) {
+        timeval now;
+        gettimeofday(&now, 0);
+        const uint64_t age =
+                 (now.tv_sec - reader.renewed.tv_sec) * 1000 +
+                 (now.tv_usec - reader.renewed.tv_usec) / 1000;
+        if (age >= refresh_milliseconds) {
+          mdb_txn_reset(reader.txn);
+          lmdb_helper::release_map(env);
+          reader.is_reset = true;
+        }
+      }
+      if (reader.is_reset) {
+        lmdb_helper::hold_map(env);
+        int rc = mdb_txn_renew(reader.txn);
+        if (rc != 0) {
+          std::cerr << "LMDB reader renew error: " << mdb_strerror(rc)
+                    << "\n";
+          assert(0);
+        }
+        reader.is_reset = false;
+        ++reader.generation;
+        gettimeofday(&reader.renewed, 0);
+      }
+    }
+    ++reader.in_use;
+    txn = reader.txn;
+
+    // find the cursor, renewing it for the current txn
+    std::vector<cursor_t>::iterator it;
+    for (it = reader.cursors.begin(); it != reader.cursors.end(); ++it) {
+      if (it->dbi == dbi) {
+        if (it->generation != reader.generation) {
+          int rc = mdb_cursor_renew(reader.txn, it->cursor);
+          if (rc != 0) {
+            std::cerr << "LMDB cursor renew error: " << mdb_strerror(rc)
+                      << "\n";
+            assert(0);
+          }
+          it->generation = reader.generation;
+        }
+        cursor = it->cursor;
+        return;
+      }
+    }
+
+    // open a new cursor
+    int rc = mdb_cursor_open(reader.txn, dbi, &cursor);
+    if (rc != 0) {
+      std::cerr << "LMDB cursor error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    reader.cursors.push_back(cursor_t(dbi, cursor, reader.generation));
+  }
+
+  /**
+   * Done with the txn from acquire.
+   */
+  void release(MDB_env* env) {
+    env_reader_t& reader = env_reader(env);
+    if (reader.in_use == 0) {
+      std::cerr << "program error: LMDB reader released too often\n";
+      assert(0);
+    }
+    --reader.in_use;
+
+    // release the snapshot now when not keeping it, and never keep one
+    // that would keep the map from growing
+    if (reader.in_use == 0 &&
+        (refresh_milliseconds == 0 || reader.is_resizable)) {
+      mdb_txn_reset(reader.txn);
+      lmdb_helper::release_map(env);
+      reader.is_reset = true;
+    }
+  }
+};
+
+} // end namespace hashdb
+
+#endif
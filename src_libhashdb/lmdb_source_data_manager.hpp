@@ -58,7 +58,11 @@ class lmdb_source_data_manager_t {
   private:
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
+  const bool is_shared_env;                   // env holds all stores
   MDB_env* env;
+  MDB_dbi dbi;
+  MDB_txn* batch_txn;                         // open during a batch
+  lmdb_reader_t* reader;                      // per-thread read txns, or NULL
 #ifdef HAVE_PTHREAD
   mutable pthread_mutex_t M;                  // mutext
 #else
@@ -72,22 +76,97 @@ class lmdb_source_data_manager_t {
 
   public:
   lmdb_source_data_manager_t(const std::string& p_hashdb_dir,
-                            const hashdb::file_mode_type_t p_file_mode) :
+                             const hashdb::file_mode_type_t p_file_mode,
+                             MDB_env* p_shared_env = NULL) :
        hashdb_dir(p_hashdb_dir),
        file_mode(p_file_mode),
-       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_data_store",
-                                                            file_mode)),
+       is_shared_env(p_shared_env != NULL),
+       env((is_shared_env) ? p_shared_env :
+                  lmdb_helper::open_env(hashdb_dir + "/lmdb_source_data_store",
+                                                                file_mode)),
+       dbi(lmdb_helper::open_dbi(env,
+                     (is_shared_env) ? "source_data_store" : NULL,
+                     false, file_mode)),
+       batch_txn(NULL),
+       reader(NULL),
        M() {
     MUTEX_INIT(&M);
   }
 
   ~lmdb_source_data_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
+    // close the DB environment unless it is shared
+    if (!is_shared_env) {
+      lmdb_helper::close_env(env);
+    }
 
     MUTEX_DESTROY(&M);
   }
 
+  /**
+   * Read using the per-thread txns and cursors of p_reader rather than
+   * opening a txn for each read.  Set before reading.
+   */
+  void set_reader(lmdb_reader_t* p_reader) {
+    reader = p_reader;
+  }
+
+  /**
+   * The most pages that writing one record may add to this store.
+   */
+  size_t record_pages() const {
+    return lmdb_helper::record_pages(env);
+  }
+
+  /**
+   * Hold inserts in one open write transaction until commit_batch.
+   * Reserve space for reserve_pages new pages since the DB cannot grow
+   * during the batch.  Call both from the thread that performs the inserts.
+   */
+  void begin_batch(const size_t reserve_pages) {
+    MUTEX_LOCK(&M);
+    batch_txn = lmdb_helper::begin_batch(env, reserve_pages);
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Commit the inserts held since begin_batch.
+   */
+  void commit_batch() {
+    MUTEX_LOCK(&M);
+    lmdb_helper::commit_batch(batch_txn);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Discard the inserts held since begin_batch.
+   */
+  void abort_batch() {
+    MUTEX_LOCK(&M);
+    lmdb_helper::abort_batch(batch_txn);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Hold inserts in txn, a batch txn opened by the owner of the shared
+   * environment, until leave_batch.  The owner commits txn.
+   */
+  void join_batch(MDB_txn* txn) {
+    MUTEX_LOCK(&M);
+    batch_txn = txn;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Stop using the txn given to join_batch.
+   */
+  void leave_batch() {
+    MUTEX_LOCK(&M);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
   /**
    * Insert unless there and same.
    */
@@ -101,11 +180,13 @@ class lmdb_source_data_manager_t {
 
     MUTEX_LOCK(&M);
 
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
+    // reserve room in the map, begin_batch reserves room for batches
+    if (batch_txn == NULL) {
+      lmdb_helper::reserve(env);
+    }
 
     // get context
-    hashdb::lmdb_context_t context(env, true, false); // writable, no duplicates
+    hashdb::lmdb_context_t context(env, dbi, batch_txn); // writable, no duplicates
     context.open();
 
     // set key
@@ -171,7 +252,10 @@ print_mdb_val("source_data_manager insert change from data", context.data);
         ++changes.source_data_same;
       } else {
 
-        // different so overwrite
+        // different so overwrite.  Point key at our buffer rather than
+        // into the page that mdb_put will change.
+        context.key.mv_size = key_p - key_start;
+        context.key.mv_data = key_start;
         context.data.mv_size = new_data_size;
         context.data.mv_data = data;
 #ifdef DEBUG_LMDB_SOURCE_DATA_MANAGER_HPP
@@ -212,7 +296,7 @@ print_mdb_val("source_data_manager insert change to data", context.data);
             uint64_t& nonprobative_count) const {
 
     // get context
-    hashdb::lmdb_context_t context(env, false, false); // not writable, no duplicates
+    hashdb::lmdb_context_t context(env, dbi, reader); // not writable, no duplicates
     context.open();
 
     // set key
@@ -290,7 +374,7 @@ print_mdb_val("source_data_manager no find key", context.key);
 
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
-    return lmdb_helper::size(env);
+    return lmdb_helper::size(env, dbi);
   }
 };
 
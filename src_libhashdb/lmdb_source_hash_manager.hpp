@@ -0,0 +1,208 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Manage the optional LMDB source hash store, the reverse index of the
+ * hash data store: key=source_id, duplicate data=block_hash.  It lets
+ * per-source queries read the block hashes of one source rather than
+ * scan every hash.  The store is a named DB in the shared environment.
+ * Threadsafe.
+ */
+
+#ifndef LMDB_SOURCE_HASH_MANAGER_HPP
+#define LMDB_SOURCE_HASH_MANAGER_HPP
+
+#include "file_modes.h"
+#include "lmdb.h"
+#include "lmdb_helper.h"
+#include "lmdb_context.hpp"
+#include "lmdb_changes.hpp"
+#include <vector>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cassert>
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+class lmdb_source_hash_manager_t {
+
+  private:
+  MDB_env* env;
+  MDB_dbi dbi;
+  MDB_txn* batch_txn;                         // open during a batch
+  lmdb_reader_t* reader;                      // per-thread read txns, or NULL
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  lmdb_source_hash_manager_t(const lmdb_source_hash_manager_t&);
+  lmdb_source_hash_manager_t& operator=(const lmdb_source_hash_manager_t&);
+
+  public:
+  // the store is kept in p_shared_env, which the caller closes
+  lmdb_source_hash_manager_t(const hashdb::file_mode_type_t file_mode,
+                             MDB_env* p_shared_env) :
+       env(p_shared_env),
+       dbi(lmdb_helper::open_dbi(env, "source_hash_store", true,
+                                 file_mode)),
+       batch_txn(NULL),
+       reader(NULL),
+       M() {
+
+    MUTEX_INIT(&M);
+  }
+
+  ~lmdb_source_hash_manager_t() {
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Read using the per-thread txns and cursors of p_reader rather than
+   * opening a txn for each read.  Set before reading.
+   */
+  void set_reader(lmdb_reader_t* p_reader) {
+    reader = p_reader;
+  }
+
+  /**
+   * Hold inserts in txn, a batch txn opened by the owner of the shared
+   * environment, until leave_batch.  The owner commits txn.
+   */
+  void join_batch(MDB_txn* txn) {
+    MUTEX_LOCK(&M);
+    batch_txn = txn;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Stop using the txn given to join_batch.
+   */
+  void leave_batch() {
+    MUTEX_LOCK(&M);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Insert the source_id, block_hash pair unless it is already there.
+   */
+  void insert(const uint64_t source_id,
+              const std::string& block_hash,
+              hashdb::lmdb_changes_t& changes) {
+
+    MUTEX_LOCK(&M);
+
+    // reserve room in the map, begin_batch reserves room for batches
+    if (batch_txn == NULL) {
+      lmdb_helper::reserve(env);
+    }
+
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, batch_txn);
+    context.open();
+
+    // set key=source_id
+    uint8_t key[10];
+    uint8_t* key_p = key;
+    key_p = lmdb_helper::encode_uint64_t(source_id, key_p);
+    context.key.mv_size = key_p - key;
+    context.key.mv_data = key;
+
+    // set data=block_hash
+    context.data.mv_size = block_hash.size();
+    context.data.mv_data =
+                   static_cast<void*>(const_cast<char*>(block_hash.c_str()));
+
+    int rc = mdb_put(context.txn, context.dbi,
+                     &context.key, &context.data, MDB_NODUPDATA);
+
+    if (rc == 0) {
+      // the new pair went in
+      ++changes.source_hash_inserted;
+    } else if (rc != MDB_KEYEXIST) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Find the block hashes of a source in ascending order, false on no
+   * source ID.
+   */
+  bool find(const uint64_t source_id,
+            std::vector<std::string>& block_hashes) const {
+
+    block_hashes.clear();
+
+    // get context
+    hashdb::lmdb_context_t context(env, dbi, reader);
+    context.open();
+
+    // set key
+    uint8_t key_start[10];
+    uint8_t* key_p = key_start;
+    key_p = lmdb_helper::encode_uint64_t(source_id, key_p);
+    context.key.mv_size = key_p - key_start;
+    context.key.mv_data = key_start;
+
+    // read each block hash of the key
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_KEY);
+    const bool source_id_found = (rc == 0);
+    while (rc == 0) {
+      block_hashes.push_back(std::string(
+                 static_cast<const char*>(context.data.mv_data),
+                 context.data.mv_size));
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT_DUP);
+    }
+
+    // make sure rc is valid
+    if (rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+    return source_id_found;
+  }
+
+  // call this from a lock to prevent getting an unstable answer.
+  size_t size() const {
+    return lmdb_helper::size(env, dbi);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
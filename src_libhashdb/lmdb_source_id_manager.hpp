@@ -33,6 +33,7 @@
 #include "lmdb_helper.h"
 #include "lmdb_context.hpp"
 #include "lmdb_changes.hpp"
+#include "lmdb_key_iterator.hpp"
 #include <vector>
 #include <unistd.h>
 #include <sstream>
@@ -56,7 +57,11 @@ class lmdb_source_id_manager_t {
   private:
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
+  const bool is_shared_env;                   // env holds all stores
   MDB_env* env;
+  MDB_dbi dbi;
+  MDB_txn* batch_txn;                         // open during a batch
+  lmdb_reader_t* reader;                      // per-thread read txns, or NULL
 #ifdef HAVE_PTHREAD
   mutable pthread_mutex_t M;                  // mutext
 #else
@@ -69,22 +74,97 @@ class lmdb_source_id_manager_t {
 
   public:
   lmdb_source_id_manager_t(const std::string& p_hashdb_dir,
-                           const hashdb::file_mode_type_t p_file_mode) :
+                           const hashdb::file_mode_type_t p_file_mode,
+                           MDB_env* p_shared_env = NULL) :
        hashdb_dir(p_hashdb_dir),
        file_mode(p_file_mode),
-       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_id_store",
-                                                            file_mode)),
+       is_shared_env(p_shared_env != NULL),
+       env((is_shared_env) ? p_shared_env :
+                  lmdb_helper::open_env(hashdb_dir + "/lmdb_source_id_store",
+                                                                file_mode)),
+       dbi(lmdb_helper::open_dbi(env,
+                     (is_shared_env) ? "source_id_store" : NULL,
+                     false, file_mode)),
+       batch_txn(NULL),
+       reader(NULL),
        M() {
     MUTEX_INIT(&M);
   }
 
   ~lmdb_source_id_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
+    // close the DB environment unless it is shared
+    if (!is_shared_env) {
+      lmdb_helper::close_env(env);
+    }
 
     MUTEX_DESTROY(&M);
   }
 
+  /**
+   * Read using the per-thread txns and cursors of p_reader rather than
+   * opening a txn for each read.  Set before reading.
+   */
+  void set_reader(lmdb_reader_t* p_reader) {
+    reader = p_reader;
+  }
+
+  /**
+   * The most pages that writing one record may add to this store.
+   */
+  size_t record_pages() const {
+    return lmdb_helper::record_pages(env);
+  }
+
+  /**
+   * Hold inserts in one open write transaction until commit_batch.
+   * Reserve space for reserve_pages new pages since the DB cannot grow
+   * during the batch.  Call both from the thread that performs the inserts.
+   */
+  void begin_batch(const size_t reserve_pages) {
+    MUTEX_LOCK(&M);
+    batch_txn = lmdb_helper::begin_batch(env, reserve_pages);
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Commit the inserts held since begin_batch.
+   */
+  void commit_batch() {
+    MUTEX_LOCK(&M);
+    lmdb_helper::commit_batch(batch_txn);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Discard the inserts held since begin_batch.
+   */
+  void abort_batch() {
+    MUTEX_LOCK(&M);
+    lmdb_helper::abort_batch(batch_txn);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Hold inserts in txn, a batch txn opened by the owner of the shared
+   * environment, until leave_batch.  The owner commits txn.
+   */
+  void join_batch(MDB_txn* txn) {
+    MUTEX_LOCK(&M);
+    batch_txn = txn;
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Stop using the txn given to join_batch.
+   */
+  void leave_batch() {
+    MUTEX_LOCK(&M);
+    batch_txn = NULL;
+    MUTEX_UNLOCK(&M);
+  }
+
   /**
    * Insert key=file_binary_hash, value=source_id.  Return bool, source_id.
    * True if new.
@@ -100,11 +180,13 @@ class lmdb_source_id_manager_t {
 
     MUTEX_LOCK(&M);
 
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
+    // reserve room in the map, begin_batch reserves room for batches
+    if (batch_txn == NULL) {
+      lmdb_helper::reserve(env);
+    }
 
     // get context
-    hashdb::lmdb_context_t context(env, true, false); // writable, no duplicates
+    hashdb::lmdb_context_t context(env, dbi, batch_txn); // writable, no duplicates
     context.open();
 
     // set key
@@ -138,8 +220,15 @@ print_mdb_val("source_id_manager insert has data", context.data);
       return false;
 
     } else if (rc == MDB_NOTFOUND) {
-      // generate new source ID as DB size + 1
-      source_id = size() + 1;
+      // generate new source ID as DB size + 1, reading the size from this
+      // txn since a batch txn may hold source IDs that are not committed yet
+      MDB_stat stat;
+      rc = mdb_stat(context.txn, context.dbi, &stat);
+      if (rc != 0) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      source_id = stat.ms_entries + 1;
       uint8_t data[10];
       uint8_t* p = data;
       p = lmdb_helper::encode_uint64_t(source_id, p);
@@ -186,7 +275,7 @@ print_mdb_val("source_id_manager insert new data", context.data);
     }
 
     // get context
-    hashdb::lmdb_context_t context(env, false, false);
+    hashdb::lmdb_context_t context(env, dbi, reader);
     context.open();
 
     // set key
@@ -234,13 +323,43 @@ print_mdb_val("source_id_manager find not found key", context.key);
     }
   }
 
+  /**
+   * Return a new iterator over the sources from begin_file_binary_hash
+   * through end_file_binary_hash, "" for no limit, see
+   * lmdb_key_iterator_t.  Read the source ID under it with source_id_at.
+   * Delete it when done.
+   */
+  lmdb_key_iterator_t* new_iterator(const std::string& begin_file_binary_hash,
+                                    const std::string& end_file_binary_hash,
+                                    const size_t refresh_count) const {
+    return new lmdb_key_iterator_t(env, dbi, begin_file_binary_hash,
+                                   end_file_binary_hash, refresh_count);
+  }
+
+  /**
+   * Return the source ID of the record context is at.
+   */
+  static uint64_t source_id_at(const lmdb_context_t& context) {
+    uint64_t source_id;
+    const uint8_t* p = static_cast<uint8_t*>(context.data.mv_data);
+    p = lmdb_helper::decode_uint64_t(p, source_id);
+
+    // read must align to data record
+    if (p != static_cast<uint8_t*>(context.data.mv_data) +
+                                              context.data.mv_size) {
+      std::cerr << "data decode error in LMDB source ID store\n";
+      assert(0);
+    }
+    return source_id;
+  }
+
   /**
    * Return first file_binary_hash else false and "".
    */
   std::string first_source() const {
 
     // get context
-    hashdb::lmdb_context_t context(env, false, false);
+    hashdb::lmdb_context_t context(env, dbi, reader);
     context.open();
 
     int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
@@ -282,7 +401,7 @@ print_mdb_val("source_id_manager find_begin data", context.data);
     }
 
     // get context
-    hashdb::lmdb_context_t context(env, false, false);
+    hashdb::lmdb_context_t context(env, dbi, reader);
     context.open();
 
     // set the cursor to last file binary hash
@@ -336,7 +455,7 @@ print_mdb_val("source_id_manager find_next data", context.data);
 
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
-    return lmdb_helper::size(env);
+    return lmdb_helper::size(env, dbi);
   }
 };
 
@@ -20,13 +20,26 @@
 /**
  * \file
  * Provide a threadsafe interface for checking membership.
+ *
+ * Items are spread over shards by a 64-bit hash of the item, and each
+ * shard has its own lock, so threads rarely wait on each other.  A shard
+ * is an open-addressing table of slots holding the item hash and the
+ * offset of the item in one string of length-prefixed items, so an
+ * insert allocates only when the table or the string grows.
+ *
+ * With a memory limit, a shard that reaches its share of the limit keeps
+ * its items but puts new items into a Bloom filter instead.  A new item
+ * may then be taken as already there, so membership becomes approximate
+ * but memory stays bounded.
  */
 
 #ifndef LOCKED_MEMBER_HPP
 #define LOCKED_MEMBER_HPP
 
 #include <string>
-#include <set>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
 
 // no concurrent writes
 #ifdef HAVE_PTHREAD
@@ -39,39 +52,224 @@ namespace hashdb {
 class locked_member_t {
 
   private:
-  typedef std::set<std::string> set_t;
-  set_t member;
+  static const size_t shard_bits = 6;
+  static const size_t num_shards = 1 << shard_bits;
+  static const size_t initial_slots = 64;       // power of 2
+  static const uint32_t filter_k = 4;
 
+  // an item hash and 1 + the offset of its item, 0 when empty
+  struct slot_t {
+    uint64_t hash;
+    uint64_t offset;
+  };
+
+  struct shard_t {
 #ifdef HAVE_PTHREAD
-  mutable pthread_mutex_t M;                  // mutext
+    pthread_mutex_t M;                          // mutext
 #else
-  mutable int M;                              // placeholder
+    int M;                                      // placeholder
 #endif
+    std::vector<slot_t> slots;
+    size_t count;
+    std::string items;                          // uint32_t size, item
+    std::vector<uint64_t> filter;               // used once full
+    size_t memory_limit;                        // 0 for none
+
+    shard_t() : M(), slots(), count(0), items(), filter(),
+                memory_limit(0) {
+      MUTEX_INIT(&M);
+    }
+
+    ~shard_t() {
+      MUTEX_DESTROY(&M);
+    }
+
+    private:
+    shard_t(const shard_t&);
+    shard_t& operator=(const shard_t&);
+  };
+
+  std::vector<shard_t*> shards;
 
   // do not allow copy or assignment
   locked_member_t(const locked_member_t&);
   locked_member_t& operator=(const locked_member_t&);
 
+  static uint64_t mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+  }
+
+  // hash eight bytes at a time, items are usually digests already
+  static uint64_t hash64(const std::string& item) {
+    const char* const p = item.c_str();
+    const size_t size = item.size();
+    uint64_t h = 14695981039346656037ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+      uint64_t word;
+      memcpy(&word, p + i, 8);
+      h = mix(h ^ word);
+    }
+    if (i < size) {
+      uint64_t word = 0;
+      memcpy(&word, p + i, size - i);
+      h = mix(h ^ word);
+    }
+    return mix(h);
+  }
+
+  // true if item is at offset in the items of shard
+  static bool is_item(const shard_t& shard, const uint64_t offset,
+                      const std::string& item) {
+    uint32_t size;
+    memcpy(&size, shard.items.c_str() + offset, sizeof(uint32_t));
+    return size == item.size() &&
+           memcmp(shard.items.c_str() + offset + sizeof(uint32_t),
+                  item.c_str(), size) == 0;
+  }
+
+  // the slot for the hash, either holding item or empty
+  static slot_t& find_slot(shard_t& shard, const uint64_t hash,
+                           const std::string& item) {
+    const size_t mask = shard.slots.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+      slot_t& slot = shard.slots[i];
+      if (slot.offset == 0 ||
+          (slot.hash == hash && is_item(shard, slot.offset - 1, item))) {
+        return slot;
+      }
+    }
+  }
+
+  // double the slots
+  static void grow(shard_t& shard) {
+    std::vector<slot_t> old_slots(shard.slots.size() * 2, slot_t());
+    old_slots.swap(shard.slots);
+    const size_t mask = shard.slots.size() - 1;
+    for (std::vector<slot_t>::const_iterator it = old_slots.begin();
+         it != old_slots.end(); ++it) {
+      if (it->offset != 0) {
+        size_t i = it->hash & mask;
+        while (shard.slots[i].offset != 0) {
+          i = (i + 1) & mask;
+        }
+        shard.slots[i] = *it;
+      }
+    }
+  }
+
+  // the memory a shard would use after adding an item of size
+  static size_t memory_after_add(const shard_t& shard, const size_t size) {
+    size_t slots = (shard.slots.size() == 0) ?
+                                   initial_slots : shard.slots.size();
+    if ((shard.count + 1) * 2 > slots) {
+      slots *= 2;
+    }
+    size_t items = shard.items.capacity();
+    if (shard.items.size() + sizeof(uint32_t) + size > items) {
+      items = 2 * (shard.items.size() + sizeof(uint32_t) + size);
+    }
+    return slots * sizeof(slot_t) + items;
+  }
+
+  // add to the filter, return true if any bit was not set
+  static bool filter_insert(shard_t& shard, const uint64_t hash) {
+    const uint64_t num_bits = shard.filter.size() * 64;
+    const uint64_t step = mix(hash) | 1;
+    bool is_new = false;
+    for (uint32_t i = 0; i < filter_k; ++i) {
+      const uint64_t bit = (hash + i * step) % num_bits;
+      const uint64_t mask = 1ULL << (bit & 63);
+      if ((shard.filter[bit >> 6] & mask) == 0) {
+        shard.filter[bit >> 6] |= mask;
+        is_new = true;
+      }
+    }
+    return is_new;
+  }
+
+  // true if new else false, with the shard locked
+  static bool insert(shard_t& shard, const uint64_t hash,
+                     const std::string& item) {
+
+    // an item kept exactly
+    if (shard.count != 0) {
+      slot_t& slot = find_slot(shard, hash, item);
+      if (slot.offset != 0) {
+        return false;
+      }
+    }
+
+    // full, so use the filter, with a quarter of the limit for its bits
+    if (shard.filter.size() == 0 && shard.memory_limit != 0 &&
+        memory_after_add(shard, item.size()) > shard.memory_limit * 3 / 4) {
+      shard.filter.resize(shard.memory_limit / 4 / sizeof(uint64_t) + 1, 0);
+    }
+    if (shard.filter.size() != 0) {
+      return filter_insert(shard, hash);
+    }
+
+    // keep the item
+    if (shard.slots.size() == 0) {
+      shard.slots.resize(initial_slots, slot_t());
+    } else if ((shard.count + 1) * 2 > shard.slots.size()) {
+      grow(shard);
+    }
+    slot_t& slot = find_slot(shard, hash, item);
+    const uint32_t size = static_cast<uint32_t>(item.size());
+    slot.hash = hash;
+    slot.offset = shard.items.size() + 1;
+    shard.items.append(reinterpret_cast<const char*>(&size),
+                       sizeof(uint32_t));
+    shard.items.append(item);
+    ++shard.count;
+    return true;
+  }
+
   public:
-  locked_member_t() : member(), M() {
-    MUTEX_INIT(&M);
+  locked_member_t() : shards(num_shards) {
+    for (size_t i = 0; i < num_shards; ++i) {
+      shards[i] = new shard_t;
+    }
   }
 
   ~locked_member_t() {
-    MUTEX_DESTROY(&M);
+    for (size_t i = 0; i < num_shards; ++i) {
+      delete shards[i];
+    }
   }
 
   // return true if new else false
   bool locked_insert(const std::string& item) {
-    MUTEX_LOCK(&M);
-    std::pair<set_t::const_iterator, bool> pair = member.insert(item);
-    bool did_insert = pair.second;
-    MUTEX_UNLOCK(&M);
+    const uint64_t hash = hash64(item);
+    shard_t& shard = *shards[hash >> (64 - shard_bits)];
+    MUTEX_LOCK(&shard.M);
+    const bool did_insert = insert(shard, hash, item);
+    MUTEX_UNLOCK(&shard.M);
     return did_insert;
   }
+
+  // forget all items and set the memory limit in bytes, 0 for none
+  void clear(const size_t memory_limit) {
+    for (size_t i = 0; i < num_shards; ++i) {
+      shard_t& shard = *shards[i];
+      MUTEX_LOCK(&shard.M);
+      std::vector<slot_t>().swap(shard.slots);
+      shard.count = 0;
+      std::string().swap(shard.items);
+      std::vector<uint64_t>().swap(shard.filter);
+      shard.memory_limit = (memory_limit == 0) ? 0 :
+                                    memory_limit / num_shards + 1;
+      MUTEX_UNLOCK(&shard.M);
+    }
+  }
 };
 
 } // end namespace hashdb
 
 #endif
-
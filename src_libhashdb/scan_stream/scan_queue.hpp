@@ -19,142 +19,237 @@
 
 /**
  * \file
- * A simple non-blocking threadsafe scan queue.
+ * A bounded blocking threadsafe scan queue.
  *
- * Warns to stderr
+ * Unscanned requests and scanned results are held in rings of string
+ * slots that keep their capacity, so a request is copied in once and
+ * strings are swapped, not copied, after that.
  *
- * To correctly detect busy threads, every non-empty put_unscanned call
- * must be matched with a put_scanned call.
+ * put_unscanned waits while the unscanned ring is full or while as many
+ * requests are in flight as the scanned ring has slots.  A request is in
+ * flight from put_unscanned until its result is taken by get_scanned, or
+ * until put_scanned if it has no result.  The scanned ring therefore
+ * always has room, so scanner threads never wait in put_scanned.  They
+ * wait in get_unscanned while there is nothing to scan.  Nothing spins.
+ *
+ * To correctly detect busy threads, every get_unscanned call that
+ * returns true must be matched with a put_scanned call.
  */
 
 #ifndef SCAN_QUEUE_HPP
 #define SCAN_QUEUE_HPP
 
 #include <string>
-#include <queue>
+#include <vector>
+#include <iostream>
+#include <cassert>
 #include <pthread.h>
 
-// diagnostic
-//#define TEST_SCAN_QUEUE_HPP
+namespace scan_stream {
 
-#ifdef TEST_SCAN_QUEUE_HPP
-#include "hashdb.hpp" // for bin_to_hex
-#endif
+// a fixed number of string slots used first in, first out
+class string_ring_t {
 
-namespace scan_stream {
+  private:
+  std::vector<std::string> slots;
+  size_t head;
+  size_t count;
+
+  public:
+  string_ring_t(const size_t capacity) :
+                slots(capacity), head(0), count(0) {
+  }
+
+  bool is_empty() const {
+    return count == 0;
+  }
+
+  bool is_full() const {
+    return count == slots.size();
+  }
+
+  size_t capacity() const {
+    return slots.size();
+  }
+
+  // copy data into the back slot, reusing its capacity
+  void push_copy(const std::string& data) {
+    slots[(head + count) % slots.size()].assign(data);
+    ++count;
+  }
+
+  // swap data into the back slot
+  void push_swap(std::string& data) {
+    slots[(head + count) % slots.size()].swap(data);
+    ++count;
+  }
+
+  // swap the front slot into data
+  void pop_swap(std::string& data) {
+    data.swap(slots[head]);
+    head = (head + 1) % slots.size();
+    --count;
+  }
+};
 
 class scan_queue_t {
 
   private:
-  std::queue<std::string> unscanned;
-  std::queue<std::string> scanned;
+  string_ring_t unscanned;
+  string_ring_t scanned;
   size_t unscanned_submitted;
   size_t scanned_submitted;
-  mutable pthread_mutex_t M;   // mutex
+  size_t in_flight;                 // requests whose results are not taken
+  bool is_closed;
+  mutable pthread_mutex_t M;        // mutex
+  pthread_cond_t unscanned_ready;   // unscanned data or closed
+  pthread_cond_t unscanned_room;    // room for a request in flight
+  pthread_cond_t scanned_changed;   // scanned data or a request done
 
   // do not allow copy or assignment
   scan_queue_t(const scan_queue_t&);
   scan_queue_t& operator=(const scan_queue_t&);
 
-  void lock() {
+  void lock() const {
     if(pthread_mutex_lock(&M)) {
       assert(0);
     }
   }
 
-  void unlock() {
+  void unlock() const {
     pthread_mutex_unlock(&M);
   }
 
+  bool is_empty() const {
+    // Empty when both queues are empty and processing is not active.
+    return unscanned.is_empty() && scanned.is_empty() &&
+           unscanned_submitted == scanned_submitted;
+  }
+
   public:
-  scan_queue_t() : unscanned(), scanned(),
+  scan_queue_t(const size_t unscanned_capacity,
+               const size_t scanned_capacity) :
+                   unscanned(unscanned_capacity), scanned(scanned_capacity),
                    unscanned_submitted(0), scanned_submitted(0),
-                   M() {
-    if(pthread_mutex_init(&M,NULL)) {
+                   in_flight(0), is_closed(false), M(),
+                   unscanned_ready(), unscanned_room(),
+                   scanned_changed() {
+    if(pthread_mutex_init(&M,NULL) ||
+       pthread_cond_init(&unscanned_ready,NULL) ||
+       pthread_cond_init(&unscanned_room,NULL) ||
+       pthread_cond_init(&scanned_changed,NULL)) {
       std::cerr << "Error obtaining mutex.\n";
       assert(0);
     }
   }
 
   ~scan_queue_t() {
-    if (!empty()) {
+    lock();
+    const bool was_empty = is_empty();
+    unlock();
+    if (!was_empty) {
       // warn
       std::cerr << "Processing error: The scan_stream queue was closed but it was not empty.\n";
     }
+    pthread_cond_destroy(&scanned_changed);
+    pthread_cond_destroy(&unscanned_room);
+    pthread_cond_destroy(&unscanned_ready);
     pthread_mutex_destroy(&M);
   }
 
-  std::string get_unscanned() {
+  // wait for unscanned data and swap it into unscanned_data, return
+  // false when closed
+  bool get_unscanned(std::string& unscanned_data) {
     lock();
-    if (unscanned.empty()) {
+    while (unscanned.is_empty() && !is_closed) {
+      pthread_cond_wait(&unscanned_ready, &M);
+    }
+    if (is_closed) {
       unlock();
-      return "";
+      return false;
     }
-    std::string unscanned_data = unscanned.front();
-#ifdef TEST_SCAN_QUEUE_HPP
-    std::cerr << "get_unscanned: '" << unscanned_data
-              << "', " << hashdb::bin_to_hex(unscanned_data) << "\n";
-#endif
-    unscanned.pop();
+    unscanned.pop_swap(unscanned_data);
+    pthread_cond_signal(&unscanned_room);
     unlock();
-    return unscanned_data;
+    return true;
   }
 
-  void put_unscanned(const std::string unscanned_data) {
+  // wait for room in the unscanned ring and for a scanned slot for the
+  // result, then copy in unscanned_data
+  void put_unscanned(const std::string& unscanned_data) {
     if (unscanned_data.size() == 0) {
       // drop the request
       return;
     }
     lock();
-#ifdef TEST_SCAN_QUEUE_HPP
-    std::cerr << "put_unscanned: '" << unscanned_data
-              << "', " << hashdb::bin_to_hex(unscanned_data) << "\n";
-#endif
+    while (unscanned.is_full() || in_flight >= scanned.capacity()) {
+      pthread_cond_wait(&unscanned_room, &M);
+    }
     ++unscanned_submitted;
-    unscanned.push(unscanned_data);
+    ++in_flight;
+    unscanned.push_copy(unscanned_data);
+    pthread_cond_signal(&unscanned_ready);
     unlock();
   }
 
+  // scanned data or "" if none is available
   std::string get_scanned() {
+    std::string scanned_data;
     lock();
-    if (scanned.empty()) {
-      unlock();
-      return "";
+    if (!scanned.is_empty()) {
+      scanned.pop_swap(scanned_data);
+      --in_flight;
+      pthread_cond_signal(&unscanned_room);
     }
-    std::string scanned_data = scanned.front();
-#ifdef TEST_SCAN_QUEUE_HPP
-    std::cerr << "get_scanned: '" << scanned_data
-              << "', " << hashdb::bin_to_hex(scanned_data) << "\n";
-#endif
-    scanned.pop();
     unlock();
     return scanned_data;
   }
 
-  void put_scanned(const std::string scanned_data) {
+  // swap in scanned_data, which may be empty, without waiting since
+  // put_unscanned keeps a scanned slot for every request in flight
+  void put_scanned(std::string& scanned_data) {
     lock();
+    if (scanned_data.size() != 0) {
+      if (scanned.is_full()) {
+        std::cerr << "program error: no scanned slot for the result\n";
+        assert(0);
+      }
+      scanned.push_swap(scanned_data);
+    } else {
+      // the request leaves the stream without a result
+      --in_flight;
+      pthread_cond_signal(&unscanned_room);
+    }
     ++scanned_submitted;
-#ifdef TEST_SCAN_QUEUE_HPP
-    std::cerr << "put_scanned: '" << scanned_data
-              << "', " << hashdb::bin_to_hex(scanned_data) << "\n";
-#endif
-    if (scanned_data.size() == 0) {
-      // drop the result
-      unlock();
-      return;
+    pthread_cond_broadcast(&scanned_changed);
+    unlock();
+  }
+
+  bool empty() const {
+    lock();
+    const bool was_empty = is_empty();
+    unlock();
+    return was_empty;
+  }
+
+  // wait until there is scanned data or the queue is empty, return true
+  // if empty
+  bool wait_empty() {
+    lock();
+    while (scanned.is_empty() && !is_empty()) {
+      pthread_cond_wait(&scanned_changed, &M);
     }
-    scanned.push(scanned_data);
+    const bool was_empty = is_empty();
     unlock();
+    return was_empty;
   }
 
-  bool empty() {
+  // wake the scanner threads so they can stop
+  void close() {
     lock();
-    // Empty when both queues are empty and processing is not active.
-    const bool is_empty = unscanned.size() == 0 &&
-                          scanned.size() == 0 &&
-                          unscanned_submitted == scanned_submitted;
+    is_closed = true;
+    pthread_cond_broadcast(&unscanned_ready);
     unlock();
-    return is_empty;
   }
 };
 
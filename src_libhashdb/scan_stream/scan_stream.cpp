@@ -38,131 +38,176 @@
 #endif
 #include <cstring>
 #include <sstream>
+#include <vector>
 #include <cstdlib>
 #include <stdint.h>
 #include <assert.h>
-#include <fcntl.h>
-#include <sys/types.h>
-#include <sys/stat.h>
 #include <iostream>
-#include <unistd.h>
-#include <sched.h>  // sched_yield
 #include <pthread.h>
 #include "scan_thread_data.hpp"
 #include "num_cpus.hpp"
 #include "tprint.hpp"
 
+// The stream holds up to this many unscanned requests per thread.
+static const size_t SCAN_STREAM_REQUESTS_PER_THREAD = 4;
+
+// append a native-Endian integer
+template<typename T>
+static void append_int(std::string& out, const T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// the queue capacities for num_threads threads
+static size_t unscanned_capacity(const size_t num_threads) {
+  return num_threads * SCAN_STREAM_REQUESTS_PER_THREAD;
+}
+static size_t scanned_capacity(const size_t num_threads) {
+  // the requests in flight, more than the unscanned ring and the threads
+  // hold so a caller that takes every ready result before each put only
+  // ever waits in put on the threads
+  return (SCAN_STREAM_REQUESTS_PER_THREAD + 1) * num_threads + 1;
+}
+
+// report a request that ends inside a record
+static void report_truncated(const size_t size, const size_t index,
+                             const char* const reading) {
+  std::stringstream ss;
+  ss << "Unexpected end of data error in unscanned data size "
+     << size << " index " << index << " while reading " << reading
+     << ".\n";
+  hashdb::tprint(std::cerr, ss.str());
+}
+
 static void* run(void* const arg) {
   // get pointer to scan thread data job
   scan_stream::scan_thread_data_t* const job =
                     static_cast<scan_stream::scan_thread_data_t* const>(arg);
-
-  // make space for the hash and label
-  char* char_hash = new char[job->hash_size]();
-  char* char_label = new char[65536](); // fits uint16_t
-
-  // get and process input arrays until signaled to close
+  const size_t hash_size = job->hash_size;
+
+  // buffers kept across requests, the hashes of a request are copied
+  // into reused fixed-width block_hash_t values
+  std::string unscanned_array;
+  std::string scanned_array;
+  std::vector<hashdb::block_hash_t> block_hashes;
+  std::vector<size_t> label_offsets;
+  std::vector<uint16_t> label_lengths;
+  std::vector<std::string> json_responses;
+  std::vector<hashdb::hash_record_t> hash_records;
+  const bool binary_results =
+             (job->result_format == hashdb::scan_stream_t::BINARY_RESULTS);
+
+  // get and process input arrays until the queue is closed
   // print warnings to stderr
-  while (!job->done) {
-
-    // read unscanned array from scan_queue
-    const std::string unscanned_array = job->scan_queue.get_unscanned();
+  while (job->scan_queue.get_unscanned(unscanned_array)) {
+
+    // find the scan input elements in place
+    block_hashes.clear();
+    label_offsets.clear();
+    label_lengths.clear();
+    const char* const data = unscanned_array.data();
+    const size_t size = unscanned_array.size();
+    size_t index = 0;
+    while (index < size) {
+
+      // hash
+      if (size - index < hash_size) {
+        report_truncated(size, index, "hash");
+        break;
+      }
+      const size_t hash_offset = index;
+      index += hash_size;
 
-    // empty so pause and retry
-    if (unscanned_array.size() == 0) {
-      sched_yield();
-      continue;
+      // label length, size uint16_t
+      if (size - index < sizeof(uint16_t)) {
+        report_truncated(size, index, "label length");
+        break;
+      }
+      uint16_t char_label_length;
+      memcpy(&char_label_length, data + index, sizeof(uint16_t));
+      index += sizeof(uint16_t);
+
+      // label
+      if (size - index < char_label_length) {
+        report_truncated(size, index, "label");
+        break;
+      }
+      block_hashes.push_back(hashdb::block_hash_t(data + hash_offset,
+                                                  hash_size));
+      label_offsets.push_back(index);
+      label_lengths.push_back(char_label_length);
+      index += char_label_length;
     }
 
-    // set up input stream from unscanned_array
-    std::istringstream unscanned_stream(unscanned_array);
-
-    // set up empty scanned output stream
-    std::ostringstream scanned_stream;
-
-    // read and process the scan input elements
-    size_t next_index = 0;
-    while (unscanned_stream.peek() != EOF) {
-
-      // read char_hash
-      unscanned_stream.read(char_hash, job->hash_size);
+    // scan the whole array at once, in hash order
+    if (binary_results) {
+      job->scan_manager->find_hashes(block_hashes, hash_records);
+    } else {
+      job->scan_manager->find_hashes_json(job->scan_mode, block_hashes,
+                                          json_responses);
+    }
 
-      // check for EOF
-      if (unscanned_stream.rdstate() & std::ios::eofbit) {
-        std::stringstream ss;
-        ss << "Unexpected end of data error in unscanned data size "
-           << unscanned_array.size() << " index " << next_index
-           << " while reading hash.\n";
-        hashdb::tprint(std::cerr, ss.str());
+    // write the matches in input order
+    scanned_array.clear();
+    for (size_t i = 0; i < block_hashes.size(); ++i) {
+
+      if (binary_results) {
+        const hashdb::hash_record_t& hash_record = hash_records[i];
+        if (!hash_record.is_found) {
+          continue;
+        }
+
+        // write char_hash, char_label length and char_label
+        scanned_array.append(block_hashes[i].data, block_hashes[i].size);
+        append_int(scanned_array, label_lengths[i]);
+        scanned_array.append(data + label_offsets[i], label_lengths[i]);
+
+        // write count, k_entropy and block_label
+        append_int(scanned_array, hash_record.count);
+        append_int(scanned_array, hash_record.k_entropy);
+        append_int(scanned_array,
+                   static_cast<uint16_t>(hash_record.block_label.size()));
+        scanned_array.append(hash_record.block_label);
+
+        // write the source ID, sub_count pairs
+        append_int(scanned_array, static_cast<uint32_t>(
+                                  hash_record.sources.size()));
+        for (std::vector<hashdb::hash_source_t>::const_iterator it =
+             hash_record.sources.begin();
+             it != hash_record.sources.end(); ++it) {
+          append_int(scanned_array, it->source_id);
+          append_int(scanned_array, it->sub_count);
+        }
         continue;
       }
-      next_index += job->hash_size;
-
-      // read char_label length, size uint16_t
-      uint16_t char_label_length = 0;
-      unscanned_stream.read(reinterpret_cast<char*>(&char_label_length),
-                            sizeof(uint16_t));
-
-      // check for EOF
-      if (unscanned_stream.rdstate() & std::ios::eofbit) {
-        std::stringstream ss;
-        ss << "Unexpected end of data error in unscanned data size "
-           << unscanned_array.size() << " index " << next_index
-           << " while reading label length.\n";
-        hashdb::tprint(std::cerr, ss.str());
-        continue;
-      }
-      next_index += sizeof(uint16_t);
-
-      // read char_label
-      unscanned_stream.read(char_label, char_label_length);
-
-      // check for EOF
-      if (unscanned_stream.rdstate() & std::ios::eofbit) {
-        std::stringstream ss;
-        ss << "Unexpected end of data error in unscanned data size "
-           << unscanned_array.size() << " index " << next_index
-           << " while reading label.\n";
-        hashdb::tprint(std::cerr, ss.str());
-        continue;
-      }
-      next_index += char_label_length;
-
-      // scan
-      const std::string json_response = job->scan_manager->find_hash_json(
-                     job->scan_mode, std::string(char_hash, job->hash_size));
 
+      const std::string& json_response = json_responses[i];
       if (json_response.size() > 0) {
 
         // write char_hash
-        scanned_stream.write(char_hash, job->hash_size);
+        scanned_array.append(block_hashes[i].data, block_hashes[i].size);
 
-        // write char_label length
-        scanned_stream.write(
+        // write char_label length and char_label
+        const uint16_t char_label_length = label_lengths[i];
+        scanned_array.append(
                         reinterpret_cast<const char*>(&char_label_length),
                         sizeof(uint16_t));
-
-        // write char_label
-        scanned_stream.write(char_label, char_label_length);
+        scanned_array.append(data + label_offsets[i], char_label_length);
 
         // write json_response length
         const uint32_t json_response_length = json_response.size();
-        scanned_stream.write(
+        scanned_array.append(
                         reinterpret_cast<const char*>(&json_response_length),
                         sizeof(uint32_t));
 
         // write json_response
-        scanned_stream << json_response;
+        scanned_array.append(json_response);
       }
     }
 
     // push result back, even if empty
-    job->scan_queue.put_scanned(scanned_stream.str());
+    job->scan_queue.put_scanned(scanned_array);
   }
 
-  // clean up
-  delete[] char_hash;
-  delete[] char_label;
   return 0;
 }
 
@@ -175,11 +220,53 @@ namespace hashdb {
          num_threads(hashdb::numCPU()),
          threads(new ::pthread_t[num_threads]),
          scan_thread_data(new scan_stream::scan_thread_data_t(
-                          scan_manager, hash_size, scan_mode)),
+                          scan_manager, hash_size, scan_mode, JSON_RESULTS,
+                          unscanned_capacity(num_threads),
+                          scanned_capacity(num_threads))),
          done(false) {
 
     // open one scan thread per CPU
-    for (int i=0; i<num_threads; i++) {
+    start_threads(std::vector<int>());
+  }
+
+  scan_stream_t::scan_stream_t(
+              hashdb::scan_manager_t* const scan_manager,
+              const size_t hash_size,
+              const hashdb::scan_mode_t scan_mode,
+              const size_t p_num_threads,
+              const std::vector<int>& cpus,
+              const result_format_t result_format) :
+         num_threads(p_num_threads == 0 ? hashdb::numCPU() : p_num_threads),
+         threads(new ::pthread_t[num_threads]),
+         scan_thread_data(new scan_stream::scan_thread_data_t(
+                          scan_manager, hash_size, scan_mode, result_format,
+                          unscanned_capacity(num_threads),
+                          scanned_capacity(num_threads))),
+         done(false) {
+
+    start_threads(cpus);
+  }
+
+  // start the scan threads, placing thread i on cpus[i % cpus.size()]
+  void scan_stream_t::start_threads(const std::vector<int>& cpus) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    // an empty list means no placement, and CPU_SET is undefined outside
+    // the set so an invalid CPU is a program error
+    bool is_placed = (cpus.size() > 0);
+    for (size_t i=0; i<cpus.size(); i++) {
+      if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+        std::cerr << "Invalid scan_stream CPU " << cpus[i] << ".\n";
+        assert(0);
+        is_placed = false;
+      }
+    }
+#else
+    if (cpus.size() > 0) {
+      hashdb::tprint(std::cerr,
+             "Note: scan_stream CPU selection is not available, ignoring.\n");
+    }
+#endif
+    for (size_t i=0; i<num_threads; i++) {
       int rc = ::pthread_create(&threads[i], NULL, run,
                                 (void*)scan_thread_data);
       if (rc != 0) {
@@ -187,10 +274,26 @@ namespace hashdb {
                   << strerror(rc) << ".\n";
         assert(0);
       }
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+      if (is_placed) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpus[i % cpus.size()], &cpu_set);
+        rc = ::pthread_setaffinity_np(threads[i], sizeof(cpu_set_t),
+                                      &cpu_set);
+        if (rc != 0) {
+          // the thread still runs, just not where asked
+          std::stringstream ss;
+          ss << "Unable to place scan_stream thread on CPU "
+             << cpus[i % cpus.size()] << ": " << strerror(rc) << ".\n";
+          hashdb::tprint(std::cerr, ss.str());
+        }
+      }
+#endif
     }
   }
 
-  // put in data to scan
+  // put in data to scan, waiting while the stream is full
   void scan_stream_t::put(const std::string& unscanned_data) {
     scan_thread_data->scan_queue.put_unscanned(unscanned_data);
   }
@@ -200,22 +303,16 @@ namespace hashdb {
     return scan_thread_data->scan_queue.get_scanned();
   }
 
-  // return true if scan_stream is empty, may yield
+  // return true if scan_stream is empty, else wait for scanned data
   bool scan_stream_t::empty() {
-    bool is_empty = scan_thread_data->scan_queue.empty();
-    if (!is_empty) {
-      // yield so caller can busy-wait with less waste
-      sched_yield();
-    }
-
-    return is_empty;
+    return scan_thread_data->scan_queue.wait_empty();
   }
 
   scan_stream_t::~scan_stream_t() {
 
     // join each thread
-    scan_thread_data->done = true;
-    for (int i=0; i<num_threads; i++) {
+    scan_thread_data->scan_queue.close();
+    for (size_t i=0; i<num_threads; i++) {
       int status = pthread_join(threads[i], NULL);
       if (status != 0) {
         std::cerr << "Error in threadpool join: " << strerror(status) << ".\n";
@@ -227,4 +324,3 @@ namespace hashdb {
   }
 
 } // end namespace hashdb
-
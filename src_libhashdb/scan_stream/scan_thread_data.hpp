@@ -38,8 +38,8 @@ class scan_thread_data_t {
   hashdb::scan_manager_t* const scan_manager;
   const size_t hash_size;
   const ::hashdb::scan_mode_t scan_mode;
+  const ::hashdb::scan_stream_t::result_format_t result_format;
   scan_queue_t scan_queue;
-  volatile bool done;
 
   // do not allow copy or assignment
   scan_thread_data_t(const scan_thread_data_t&);
@@ -48,12 +48,16 @@ class scan_thread_data_t {
   public:
   scan_thread_data_t(hashdb::scan_manager_t* const p_scan_manager,
                      const size_t p_hash_size,
-                     const hashdb::scan_mode_t p_scan_mode) :
+                     const hashdb::scan_mode_t p_scan_mode,
+                     const hashdb::scan_stream_t::result_format_t
+                                                       p_result_format,
+                     const size_t unscanned_capacity,
+                     const size_t scanned_capacity) :
             scan_manager(p_scan_manager),
             hash_size(p_hash_size),
             scan_mode(p_scan_mode),
-            scan_queue(),
-            done(false) {
+            result_format(p_result_format),
+            scan_queue(unscanned_capacity, scanned_capacity) {
   }
 };
 
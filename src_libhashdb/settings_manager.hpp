@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <string.h> // for strerror
 #include <cerrno>
+#include <cstdio>
 #include <fstream>
 #include "hashdb.hpp" // for settings
 #include "rapidjson.h"
@@ -102,10 +103,86 @@ namespace hashdb {
 
     // settings version must be compatible
     if (settings.settings_version <
-                             hashdb::settings_t::CURRENT_SETTINGS_VERSION) {
+                         hashdb::settings_t::SEPARATE_ENV_SETTINGS_VERSION ||
+        settings.settings_version >
+                         hashdb::settings_t::CURRENT_SETTINGS_VERSION) {
       return "The hashdb at path '" + hashdb_dir + "' is not compatible.";
     }
 
+    // the layout is absent for hashdbs made with one environment per store
+    settings.layout_version = hashdb::settings_t::SEPARATE_ENV_LAYOUT;
+    if (document.HasMember("layout_version")) {
+      if (!document["layout_version"].IsUint64()) {
+        return "Invalid layout_version in settings file at path '"
+               + filename + "'.";
+      }
+      settings.layout_version = document["layout_version"].GetUint64();
+      if (settings.layout_version < hashdb::settings_t::SEPARATE_ENV_LAYOUT
+          || settings.layout_version >
+                           hashdb::settings_t::CURRENT_LAYOUT_VERSION) {
+        return "The hashdb at path '" + hashdb_dir + "' is not compatible.";
+      }
+    }
+
+    // the hash store widths are absent for hashdbs made with the defaults
+    settings.hash_prefix_bytes = hashdb::settings_t::DEFAULT_HASH_PREFIX_BYTES;
+    if (document.HasMember("hash_prefix_bytes")) {
+      if (!document["hash_prefix_bytes"].IsUint64() ||
+          !hashdb::settings_t::valid_hash_prefix_bytes(
+                               document["hash_prefix_bytes"].GetUint64())) {
+        return "Invalid hash_prefix_bytes in settings file at path '"
+               + filename + "'.";
+      }
+      settings.hash_prefix_bytes = document["hash_prefix_bytes"].GetUint64();
+    }
+    settings.hash_count_bytes = hashdb::settings_t::DEFAULT_HASH_COUNT_BYTES;
+    if (document.HasMember("hash_count_bytes")) {
+      if (!document["hash_count_bytes"].IsUint64() ||
+          !hashdb::settings_t::valid_hash_count_bytes(
+                               document["hash_count_bytes"].GetUint64())) {
+        return "Invalid hash_count_bytes in settings file at path '"
+               + filename + "'.";
+      }
+      settings.hash_count_bytes = document["hash_count_bytes"].GetUint64();
+    }
+
+    // the Bloom filter rate is absent for hashdbs made without one
+    settings.bloom_false_positive_rate = 0.0;
+    if (document.HasMember("bloom_false_positive_rate")) {
+      if (!document["bloom_false_positive_rate"].IsNumber()) {
+        return "Invalid bloom_false_positive_rate in settings file at path '"
+               + filename + "'.";
+      }
+      settings.bloom_false_positive_rate =
+                          document["bloom_false_positive_rate"].GetDouble();
+      if (settings.bloom_false_positive_rate < 0.0 ||
+          settings.bloom_false_positive_rate >= 1.0) {
+        return "Invalid bloom_false_positive_rate in settings file at path '"
+               + filename + "'.";
+      }
+    }
+
+    // the Bloom filter capacity is absent for hashdbs made with the default
+    settings.bloom_capacity = hashdb::settings_t::DEFAULT_BLOOM_CAPACITY;
+    if (document.HasMember("bloom_capacity")) {
+      if (!document["bloom_capacity"].IsUint64() ||
+          document["bloom_capacity"].GetUint64() == 0) {
+        return "Invalid bloom_capacity in settings file at path '"
+               + filename + "'.";
+      }
+      settings.bloom_capacity = document["bloom_capacity"].GetUint64();
+    }
+
+    // the source index is absent for hashdbs made without one
+    settings.source_index = false;
+    if (document.HasMember("source_index")) {
+      if (!document["source_index"].IsBool()) {
+        return "Invalid source_index in settings file at path '"
+               + filename + "'.";
+      }
+      settings.source_index = document["source_index"].GetBool();
+    }
+
     // accept the read
     return "";
   }
@@ -116,27 +193,47 @@ namespace hashdb {
     // calculate the settings filename
     std::string filename = hashdb_dir + "/settings.json";
     std::string filename_old = hashdb_dir + "/_old_settings.json";
+    std::string filename_new = hashdb_dir + "/_new_settings.json";
 
-    // if present, try to move existing settings to old
+    // if present, back up existing settings to old
     if (access(filename.c_str(), F_OK) == 0) {
-      std::remove(filename_old.c_str());
-      int status = std::rename(filename.c_str(), filename_old.c_str());
-      if (status != 0) {
+      std::ifstream in(filename.c_str());
+      std::ofstream out_old(filename_old.c_str());
+      out_old << in.rdbuf();
+      out_old.close();
+      if (!out_old) {
         std::cerr << "Warning: unable to back up '" << filename
-                  << "' to '" << filename_old << "': "
-                  << strerror(status) << "\n";
+                  << "' to '" << filename_old << "'.\n";
       }
     }
 
-    // write the settings
+    // write the settings beside the existing settings
     std::ofstream out;
-    out.open(filename.c_str());
+    out.open(filename_new.c_str());
     if (!out.is_open()) {
       return std::string(strerror(errno));
     }
 
-    out << settings.settings_string() << "\n";
+    // the settings version follows the layout
+    hashdb::settings_t written_settings = settings;
+    written_settings.settings_version =
+          (settings.layout_version == hashdb::settings_t::SEPARATE_ENV_LAYOUT)
+                       ? hashdb::settings_t::SEPARATE_ENV_SETTINGS_VERSION
+                       : hashdb::settings_t::CURRENT_SETTINGS_VERSION;
+    out << written_settings.settings_string() << "\n";
     out.close();
+    if (!out) {
+      std::remove(filename_new.c_str());
+      return "Unable to write settings file '" + filename_new + "'.";
+    }
+
+    // replace the existing settings whole
+    if (std::rename(filename_new.c_str(), filename.c_str()) != 0) {
+      const std::string error_message = "Unable to replace settings file '"
+                                 + filename + "': " + strerror(errno);
+      std::remove(filename_new.c_str());
+      return error_message;
+    }
 
     return "";
   }
@@ -0,0 +1,232 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provide a bounded, threadsafe LRU cache of source information by
+ * source ID for scan_manager_t.
+ *
+ * Matches tend to come from a few sources, so an expanded scan looks up
+ * the same sources over and over.  The cache keeps the file hash, the
+ * source data and the rendered source JSON of recently used sources.
+ * Entries are split across shards by source ID, each with its own lock
+ * and LRU list, so scan threads rarely wait on each other.
+ *
+ * Source data and names may change while a hashdb is scanned, so entries
+ * are dropped after max_age_milliseconds, the longest a scan reader may
+ * keep its snapshot.  A cache with max age 0 keeps nothing.
+ */
+
+#ifndef SOURCE_CACHE_HPP
+#define SOURCE_CACHE_HPP
+
+#include <string>
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <sys/time.h>
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+// source information cached by source ID
+struct cached_source_t {
+  std::string file_hash;
+  uint64_t filesize;
+  std::string file_type;
+  uint64_t zero_count;
+  uint64_t nonprobative_count;
+  std::string source_json;     // rendered source object, or "" if not yet
+  cached_source_t() : file_hash(), filesize(0), file_type(), zero_count(0),
+                      nonprobative_count(0), source_json() {
+  }
+};
+
+class source_cache_t {
+
+  public:
+  // suggested capacity
+  static const size_t DEFAULT_CAPACITY = 65536;
+
+  private:
+  static const size_t num_shards = 16;
+
+  struct entry_t {
+    uint64_t source_id;
+    cached_source_t source;
+    timeval cached;
+    entry_t(const uint64_t p_source_id, const cached_source_t& p_source) :
+            source_id(p_source_id), source(p_source), cached() {
+      gettimeofday(&cached, 0);
+    }
+  };
+  typedef std::list<entry_t> lru_t;          // most recently used first
+  typedef std::map<uint64_t, lru_t::iterator> index_t;
+
+  struct shard_t {
+    lru_t lru;
+    index_t index;
+    uint64_t hits;
+    uint64_t misses;
+#ifdef HAVE_PTHREAD
+    mutable pthread_mutex_t M;                // mutext
+#else
+    mutable int M;                            // placeholder
+#endif
+    shard_t() : lru(), index(), hits(0), misses(0), M() {
+      MUTEX_INIT(&M);
+    }
+    ~shard_t() {
+      MUTEX_DESTROY(&M);
+    }
+    private:
+    shard_t(const shard_t&);
+    shard_t& operator=(const shard_t&);
+  };
+
+  const size_t shard_capacity;
+  const uint64_t max_age_milliseconds;
+  shard_t* shards;
+
+  // do not allow copy or assignment
+  source_cache_t(const source_cache_t&);
+  source_cache_t& operator=(const source_cache_t&);
+
+  shard_t& shard(const uint64_t source_id) const {
+    return shards[source_id % num_shards];
+  }
+
+  bool is_expired(const timeval& cached) const {
+    timeval now;
+    gettimeofday(&now, 0);
+    const uint64_t age = (static_cast<uint64_t>(now.tv_sec) -
+                          cached.tv_sec) * 1000 +
+                         (now.tv_usec - cached.tv_usec) / 1000;
+    return age >= max_age_milliseconds;
+  }
+
+  public:
+  source_cache_t(const size_t capacity,
+                 const uint64_t p_max_age_milliseconds) :
+            shard_capacity((capacity + num_shards - 1) / num_shards),
+            max_age_milliseconds(p_max_age_milliseconds),
+            shards(new shard_t[num_shards]) {
+  }
+
+  ~source_cache_t() {
+    delete[] shards;
+  }
+
+  /**
+   * Copy the cached source into source, false if it is not cached.
+   */
+  bool find(const uint64_t source_id, cached_source_t& source) const {
+    if (max_age_milliseconds == 0) {
+      return false;
+    }
+    shard_t& s = shard(source_id);
+    MUTEX_LOCK(&s.M);
+    index_t::iterator it = s.index.find(source_id);
+    if (it == s.index.end()) {
+      ++s.misses;
+      MUTEX_UNLOCK(&s.M);
+      return false;
+    }
+    if (is_expired(it->second->cached)) {
+      s.lru.erase(it->second);
+      s.index.erase(it);
+      ++s.misses;
+      MUTEX_UNLOCK(&s.M);
+      return false;
+    }
+
+    // most recently used
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    source = it->second->source;
+    ++s.hits;
+    MUTEX_UNLOCK(&s.M);
+    return true;
+  }
+
+  /**
+   * Cache source, replacing any source cached for source_id and dropping
+   * the least recently used source when the shard is full.
+   */
+  void insert(const uint64_t source_id, const cached_source_t& source) {
+    if (max_age_milliseconds == 0 || shard_capacity == 0) {
+      return;
+    }
+    shard_t& s = shard(source_id);
+    MUTEX_LOCK(&s.M);
+    index_t::iterator it = s.index.find(source_id);
+    if (it != s.index.end()) {
+      s.lru.erase(it->second);
+      s.index.erase(it);
+    } else if (s.index.size() >= shard_capacity) {
+      s.index.erase(s.lru.back().source_id);
+      s.lru.pop_back();
+    }
+    s.lru.push_front(entry_t(source_id, source));
+    s.index[source_id] = s.lru.begin();
+    MUTEX_UNLOCK(&s.M);
+  }
+
+  // lookups that found a source
+  uint64_t hits() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < num_shards; ++i) {
+      MUTEX_LOCK(&shards[i].M);
+      total += shards[i].hits;
+      MUTEX_UNLOCK(&shards[i].M);
+    }
+    return total;
+  }
+
+  // lookups that did not
+  uint64_t misses() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < num_shards; ++i) {
+      MUTEX_LOCK(&shards[i].M);
+      total += shards[i].misses;
+      MUTEX_UNLOCK(&shards[i].M);
+    }
+    return total;
+  }
+
+  // sources cached
+  size_t size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < num_shards; ++i) {
+      MUTEX_LOCK(&shards[i].M);
+      total += shards[i].index.size();
+      MUTEX_UNLOCK(&shards[i].M);
+    }
+    return total;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
@@ -81,6 +81,17 @@ void rm_hashdb_dir(const std::string& hashdb_dir) {
   remove((hashdb_dir + "/lmdb_source_name_store/lock.mdb").c_str());
   rmdir((hashdb_dir + "/lmdb_source_name_store").c_str());
 
+  remove((hashdb_dir + "/lmdb_store/data.mdb").c_str());
+  remove((hashdb_dir + "/lmdb_store/lock.mdb").c_str());
+  rmdir((hashdb_dir + "/lmdb_store").c_str());
+
+  remove((hashdb_dir + "/lmdb_hash_store.new/data.mdb").c_str());
+  remove((hashdb_dir + "/lmdb_hash_store.new/lock.mdb").c_str());
+  rmdir((hashdb_dir + "/lmdb_hash_store.new").c_str());
+
+  remove((hashdb_dir + "/bloom_filter").c_str());
+  remove((hashdb_dir + "/bloom_filter.new").c_str());
+
   remove((hashdb_dir + "/log.txt").c_str());
   remove((hashdb_dir + "/settings.json").c_str());
   remove((hashdb_dir + "/_old_settings.json").c_str());
@@ -486,6 +486,79 @@ void test_other_manager_functions() {
   TEST_EQ(manager.size(), 4);
 }
 
+// many sources per hash, with Type 3 records in hash_type3_store else
+// after their Type 2 record
+void check_many_sources(hashdb::lmdb_hash_data_manager_t& manager) {
+
+  // variables
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  hashdb::lmdb_changes_t changes;
+
+  // insert source IDs 1 through 2000, odd then even so that new source IDs
+  // land between existing ones, then large source IDs
+  for (uint64_t source_id = 1; source_id <= 2000; source_id += 2) {
+    manager.insert(binary_0, 1000, "bl", source_id, changes);
+  }
+  for (uint64_t source_id = 2000; source_id > 0; source_id -= 2) {
+    manager.insert(binary_0, 1000, "bl", source_id, changes);
+  }
+  manager.merge(binary_0, 1000, "bl", 0x4000, 3, changes);
+  manager.merge(binary_0, 1000, "bl", 0x10000000000, 4, changes);
+
+  // add to existing Type 3 records
+  TEST_EQ(manager.insert(binary_0, 1000, "bl", 1000, changes), 2008);
+  TEST_EQ(manager.merge(binary_0, 1000, "bl", 0x4000, 5, changes), 2008);
+  check_changes(changes,2001,2,1,0,1);
+
+  // find them all
+  TEST_EQ(manager.find(binary_0, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(k_entropy, 1000);
+  TEST_EQ(block_label, "bl");
+  TEST_EQ(count, 2008);
+  TEST_EQ(source_id_sub_counts.size(), 2002);
+  hashdb::source_id_sub_counts_t::const_iterator it =
+                                             source_id_sub_counts.begin();
+  TEST_EQ(it->source_id, 1);
+  TEST_EQ(it->sub_count, 1);
+  it = source_id_sub_counts.lower_bound(
+                      hashdb::source_id_sub_count_t(1000, 0));
+  TEST_EQ(it->sub_count, 2);
+  it = source_id_sub_counts.lower_bound(
+                      hashdb::source_id_sub_count_t(0x4000, 0));
+  TEST_EQ(it->sub_count, 3);
+  it = source_id_sub_counts.lower_bound(
+                      hashdb::source_id_sub_count_t(0x10000000000, 0));
+  TEST_EQ(it->sub_count, 4);
+
+  // one Type 2 record and its Type 3 records
+  TEST_EQ(manager.size(), 2003);
+}
+
+void test_type3_store() {
+
+  // Type 3 records after their Type 2 record
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+    check_many_sources(manager);
+  }
+
+  // Type 3 records in hash_type3_store
+  make_new_hashdb_dir(hashdb_dir);
+  MDB_env* env = lmdb_helper::open_env(hashdb_dir + "/lmdb_store",
+                                       hashdb::RW_NEW, 16);
+  {
+    hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                             env, true);
+    check_many_sources(manager);
+  }
+  lmdb_helper::close_env(env);
+}
+
 // ************************************************************
 // main
 // ************************************************************
@@ -498,6 +571,7 @@ test_merge();
 test_maximums();
 test_block_label();
 test_other_manager_functions();
+test_type3_store();
 
   // done
   std::cout << "lmdb_hash_data_manager_test Done.\n";
@@ -25,7 +25,13 @@
 #include <config.h>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <fstream>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>     // for usleep
 #include "unit_test.h"
 #include "lmdb_hash_data_manager.hpp"
 #include "lmdb_hash_manager.hpp"
@@ -35,6 +41,12 @@
 #include "lmdb_helper.h"
 #include "lmdb_changes.hpp"
 #include "source_id_sub_counts.hpp"
+#include "bloom_filter.hpp"
+#include "binary_dump.hpp"
+#include "source_cache.hpp"
+#include "locked_member.hpp"
+#include "hasher/hash_calculator.hpp"
+#include "hasher/md5_multi.hpp"
 #include "../src_libhashdb/hashdb.hpp"
 #include "directory_helper.hpp"
 
@@ -148,6 +160,36 @@ void lmdb_hash_manager_count() {
   TEST_EQ(manager.find(binary_00), 1495);
 }
 
+// test configured prefix and count widths
+void lmdb_hash_manager_widths() {
+  hashdb::lmdb_changes_t changes;
+
+  // full prefix, 2-byte count
+  {
+    make_new_hashdb_dir(hashdb_dir);
+    hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::RW_NEW, NULL,
+                                        16, 2);
+    manager.insert(binary_00, 1494, changes);
+    TEST_EQ(manager.find(binary_00), 1494);
+    TEST_EQ(manager.find(binary_01), 0);
+    manager.insert(binary_01, 70000, changes);
+    TEST_EQ(manager.find(binary_01), 65535);
+    TEST_EQ(manager.size(), 2);
+  }
+
+  // 1-byte prefix, presence only
+  {
+    make_new_hashdb_dir(hashdb_dir);
+    hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::RW_NEW, NULL,
+                                        1, 0);
+    manager.insert(binary_00, 1494, changes);
+    TEST_EQ(manager.find(binary_00), 1);
+    TEST_EQ(manager.find(binary_2), 1);
+    TEST_EQ(manager.find(binary_10), 0);
+    TEST_EQ(manager.size(), 1);
+  }
+}
+
 // ************************************************************
 // lmdb_source_id_manager
 // ************************************************************
@@ -213,6 +255,1798 @@ void lmdb_source_id_manager() {
 
 }
 
+// ************************************************************
+// batched writes
+// ************************************************************
+void lmdb_batch() {
+  hashdb::lmdb_changes_t changes;
+  uint64_t source_id;
+  std::string file_binary_hash;
+  uint64_t filesize;
+  std::string file_type;
+  uint64_t zero_count;
+  uint64_t nonprobative_count;
+
+  // source IDs are numbered within an open batch
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_source_id_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+    manager.begin_batch(100);
+    manager.insert(binary_00, changes, source_id);
+    TEST_EQ(source_id, 1);
+    manager.insert(binary_01, changes, source_id);
+    TEST_EQ(source_id, 2);
+    manager.insert(binary_00, changes, source_id);
+    TEST_EQ(source_id, 1);
+    manager.commit_batch();
+    TEST_EQ(manager.size(), 2);
+    TEST_EQ(manager.find(binary_01, source_id), true);
+    TEST_EQ(source_id, 2);
+  }
+
+  // source data changed within an open batch keeps its key
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_source_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+    manager.begin_batch(100);
+    manager.insert(1, "fbh1", 0, "", 0, 0, changes);
+    manager.insert(2, "fbh2", 0, "", 0, 0, changes);
+    manager.insert(1, "fbh1", 10, "ft1", 11, 12, changes);
+    manager.insert(2, "fbh2", 20, "ft2", 21, 22, changes);
+    manager.commit_batch();
+    TEST_EQ(manager.size(), 2);
+    manager.find(1, file_binary_hash, filesize, file_type, zero_count,
+                 nonprobative_count);
+    TEST_EQ(file_binary_hash, "fbh1");
+    TEST_EQ(filesize, 10);
+    manager.find(2, file_binary_hash, filesize, file_type, zero_count,
+                 nonprobative_count);
+    TEST_EQ(file_binary_hash, "fbh2");
+    TEST_EQ(nonprobative_count, 22);
+  }
+
+  // hash counts changed within an open batch
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+    manager.begin_batch(100);
+    manager.insert(binary_00, 1, changes);
+    manager.insert(binary_26, 1, changes);
+    manager.insert(binary_00, 2, changes);
+    manager.commit_batch();
+    TEST_EQ(manager.find(binary_00), 2);
+    TEST_EQ(manager.find(binary_26), 1);
+    TEST_EQ(manager.size(), 2);
+  }
+
+  // hashes of a preexisting source are skipped and a new source is added
+  // once, decided as the queued changes are applied
+  rm_hashdb_dir(hashdb_dir);
+  hashdb::settings_t settings;
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test", 1000, 100000);
+    manager.insert_source_name(binary_10, "rn", "fn");
+    manager.insert_new_source_hash(binary_00, 0, "", binary_10, "rn", "fn2");
+    manager.insert_new_source_hash(binary_00, 0, "", binary_11, "rn", "fn2");
+    manager.insert_new_source_hash(binary_26, 0, "w", binary_11, "rn", "fn2");
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.size_hashes(), 2);
+    TEST_EQ(manager.size_sources(), 2);
+    TEST_EQ(manager.find_hash_count(binary_00), 1);
+    TEST_EQ(manager.find_hash_count(binary_26), 1);
+    hashdb::source_names_t source_names;
+    manager.find_source_names(binary_10, source_names);
+    TEST_EQ(source_names.size(), 1);
+    manager.find_source_names(binary_11, source_names);
+    TEST_EQ(source_names.size(), 1);
+    TEST_EQ(source_names.begin()->second, "fn2");
+  }
+
+  // the decision for a source holds across batch commits
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test", 1, 100000);
+    manager.insert_source_name(binary_10, "rn", "fn");
+    for (size_t i = 0; i < 4; ++i) {
+      manager.insert_new_source_hash(std::string(16, static_cast<char>(i + 1)),
+                                     0, "", binary_11, "rn", "fn2");
+      manager.insert_new_source_hash(std::string(16, static_cast<char>(i + 65)),
+                                     0, "", binary_10, "rn", "fn2");
+      manager.flush();
+    }
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.size_hashes(), 4);
+    TEST_EQ(manager.size_sources(), 2);
+    TEST_EQ(manager.find_hash_count(std::string(16, 4)), 1);
+    TEST_EQ(manager.find_hash_count(std::string(16, 68)), 0);
+  }
+
+  // a batch of hashes over batch_size is queued as one change
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test", 3, 100000);
+    std::vector<hashdb::block_hash_t> block_hashes;
+    std::vector<uint64_t> k_entropies;
+    std::vector<std::string> block_labels;
+    for (size_t i = 0; i < 10; ++i) {
+      block_hashes.push_back(hashdb::block_hash_t(
+                              std::string(16, static_cast<char>(i + 1))));
+      k_entropies.push_back(i);
+      block_labels.push_back((i % 2 == 0) ? "L" : "");
+    }
+    manager.insert_hashes(block_hashes, k_entropies, block_labels,
+                          binary_10);
+
+    // not one block label per hash
+    block_labels.pop_back();
+    manager.insert_hashes(block_hashes, k_entropies, block_labels,
+                          binary_11);
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.size_hashes(), 10);
+    TEST_EQ(manager.size_sources(), 1);
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    TEST_EQ(manager.find_hash(std::string(16, 5), k_entropy, block_label,
+                              count, source_sub_counts), true);
+    TEST_EQ(k_entropy, 4);
+    TEST_EQ(block_label, "L");
+    TEST_EQ(count, 1);
+  }
+}
+
+// ************************************************************
+// store layouts
+// ************************************************************
+void lmdb_layout() {
+  hashdb::settings_t settings;
+  std::string file_binary_hash;
+
+  // new hashdbs hold all stores in one environment
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  TEST_EQ(access((hashdb_dir + "/lmdb_store").c_str(), F_OK), 0);
+  bool is_migrated = (hashdb::migrate_hashdb(hashdb_dir, "test") == "");
+  TEST_EQ(is_migrated, false);
+
+  // settings versions newer than this reader are rejected
+  {
+    std::ofstream out((hashdb_dir + "/settings.json").c_str());
+    out << "{\"settings_version\":6, \"block_size\":512}\n";
+  }
+  bool is_read = (hashdb::read_settings(hashdb_dir, settings) == "");
+  TEST_EQ(is_read, false);
+
+  // hashdbs with one environment per store
+  rm_hashdb_dir(hashdb_dir);
+  settings.layout_version = hashdb::settings_t::SEPARATE_ENV_LAYOUT;
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  TEST_EQ(access((hashdb_dir + "/lmdb_hash_store").c_str(), F_OK), 0);
+  TEST_EQ(hashdb::read_settings(hashdb_dir, settings), "");
+  TEST_EQ(settings.settings_version,
+          hashdb::settings_t::SEPARATE_ENV_SETTINGS_VERSION);
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    manager.insert_hash(binary_00, 0, "", binary_10);
+    manager.insert_hash(binary_01, 0, "", binary_10);
+    manager.insert_source_name(binary_10, "rn", "fn");
+  }
+
+  // migrate keeps the data
+  TEST_EQ(hashdb::migrate_hashdb(hashdb_dir, "test"), "");
+  TEST_EQ(hashdb::read_settings(hashdb_dir, settings), "");
+  TEST_EQ(settings.layout_version,
+          hashdb::settings_t::CURRENT_LAYOUT_VERSION);
+  TEST_EQ(settings.settings_version,
+          hashdb::settings_t::CURRENT_SETTINGS_VERSION);
+  bool has_old_store =
+                (access((hashdb_dir + "/lmdb_hash_store").c_str(), F_OK) == 0);
+  TEST_EQ(has_old_store, false);
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    manager.insert_hash(binary_2, 0, "", binary_11);
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.size_hashes(), 3);
+    TEST_EQ(manager.size_sources(), 2);
+    TEST_EQ(manager.find_approximate_hash_count(binary_00), 1);
+    TEST_EQ(manager.first_source(), binary_10);
+    TEST_EQ(manager.next_source(binary_10), binary_11);
+  }
+
+  // hashdbs with Type 3 hash data records after their Type 2 record
+  rm_hashdb_dir(hashdb_dir);
+  settings.layout_version = hashdb::settings_t::SINGLE_ENV_LAYOUT;
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    manager.insert_hash(binary_00, 0, "", binary_10);
+    manager.insert_hash(binary_00, 0, "", binary_11);
+    manager.insert_hash(binary_00, 0, "", binary_11);
+    manager.insert_hash(binary_01, 0, "", binary_12);
+  }
+
+  // migrate moves the Type 3 records
+  TEST_EQ(hashdb::migrate_hashdb(hashdb_dir, "test"), "");
+  TEST_EQ(hashdb::read_settings(hashdb_dir, settings), "");
+  TEST_EQ(settings.layout_version,
+          hashdb::settings_t::CURRENT_LAYOUT_VERSION);
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    manager.insert_hash(binary_00, 0, "", binary_12);
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    TEST_EQ(manager.find_hash(binary_00, k_entropy, block_label, count,
+                              source_sub_counts), true);
+    TEST_EQ(count, 4);
+    TEST_EQ(source_sub_counts.size(), 3);
+    hashdb::source_sub_counts_t::const_iterator it =
+               source_sub_counts.find(hashdb::source_sub_count_t(binary_11, 0));
+    TEST_EQ(it->sub_count, 2);
+    TEST_EQ(manager.find_hash_count(binary_01), 1);
+    TEST_EQ(manager.size_hashes(), 5);
+  }
+}
+
+// ************************************************************
+// per-thread readers
+// ************************************************************
+static void* find_in_thread(void* arg) {
+  hashdb::scan_manager_t* manager = static_cast<hashdb::scan_manager_t*>(arg);
+  size_t count = manager->find_approximate_hash_count(binary_00) +
+                 manager->find_approximate_hash_count(binary_26);
+  return reinterpret_cast<void*>(count);
+}
+
+void lmdb_reader() {
+  hashdb::settings_t settings;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    manager.insert_hash(binary_00, 0, "", binary_10);
+    manager.insert_hash(binary_01, 0, "", binary_10);
+  }
+
+  hashdb::scan_manager_t manager(hashdb_dir, 1000);
+
+  // reuse the reader txn
+  for (int i = 0; i < 10; ++i) {
+    TEST_EQ(manager.find_approximate_hash_count(binary_00), 1);
+    TEST_EQ(manager.find_approximate_hash_count(binary_26), 0);
+    TEST_EQ(manager.size_hashes(), 2);
+  }
+
+  // more threads than reader slots, so threads must release their slots
+  for (int i = 0; i < 300; ++i) {
+    pthread_t thread;
+    TEST_EQ(pthread_create(&thread, NULL, find_in_thread, &manager), 0);
+    void* count;
+    pthread_join(thread, &count);
+    TEST_EQ(reinterpret_cast<size_t>(count), 1);
+  }
+}
+
+// ************************************************************
+// bulk load
+// ************************************************************
+static std::string bulk_hash(const size_t n) {
+  // spread the hashes out of input order
+  std::string hash(16, 0);
+  hash[0] = static_cast<char>(n * 37);
+  hash[1] = static_cast<char>(n >> 8);
+  hash[2] = static_cast<char>(n);
+  return hash;
+}
+
+static void bulk_import(hashdb::import_manager_t& manager) {
+  // 200 sources so that some source IDs take two encoded bytes
+  for (size_t i = 0; i < 1000; ++i) {
+    const std::string block_hash = bulk_hash((i * 7919) % 150);
+    const std::string file_hash = bulk_hash(1000 + (i * 31) % 200);
+    const uint64_t k_entropy = (i % 97 == 0) ? 1 : 0;
+    if (i % 3 == 0) {
+      manager.merge_hash(block_hash, k_entropy, "", file_hash, 1 + i % 2);
+    } else {
+      manager.insert_hash(block_hash, k_entropy, (i % 89 == 0) ? "L" : "",
+                          file_hash);
+    }
+  }
+  manager.insert_source_name(bulk_hash(1000), "rn", "fn");
+}
+
+void lmdb_bulk_load() {
+  hashdb::settings_t settings;
+  const std::string bulk_dir = "temp_dir_lmdb_bulk_test.hdb";
+
+  // import the same hashes normally and bulk loaded
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+  rm_hashdb_dir(bulk_dir);
+  TEST_EQ(hashdb::create_hashdb(bulk_dir, settings, "test"), "");
+  {
+    // small runs so that runs are merged in more than one pass
+    hashdb::import_manager_t manager(bulk_dir, "test");
+    TEST_EQ(manager.enable_bulk_load(2), "");
+    bulk_import(manager);
+  }
+  bool has_bulk_load_dir =
+               (access((bulk_dir + "/bulk_load_tmp").c_str(), F_OK) == 0);
+  TEST_EQ(has_bulk_load_dir, false);
+
+  // the hashdbs match
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    hashdb::scan_manager_t bulk_manager(bulk_dir);
+    TEST_EQ(bulk_manager.size_hashes(), manager.size_hashes());
+    TEST_EQ(bulk_manager.size_sources(), manager.size_sources());
+    std::string block_hash = manager.first_hash();
+    std::string bulk_block_hash = bulk_manager.first_hash();
+    size_t hash_count = 0;
+    while (block_hash != "") {
+      TEST_EQ(bulk_block_hash, block_hash);
+      TEST_EQ(bulk_manager.export_hash_json(block_hash),
+              manager.export_hash_json(block_hash));
+      TEST_EQ(bulk_manager.find_approximate_hash_count(block_hash),
+              manager.find_approximate_hash_count(block_hash));
+      block_hash = manager.next_hash(block_hash);
+      bulk_block_hash = bulk_manager.next_hash(bulk_block_hash);
+      ++hash_count;
+    }
+    TEST_EQ(bulk_block_hash, "");
+    TEST_EQ(hash_count, 150);
+  }
+
+  // hashes sharing a prefix keep the larger count
+  rm_hashdb_dir(bulk_dir);
+  TEST_EQ(hashdb::create_hashdb(bulk_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(bulk_dir, "test");
+    TEST_EQ(manager.enable_bulk_load(10), "");
+    manager.insert_hash(binary_00, 0, "", binary_10);
+    manager.insert_hash(binary_01, 0, "", binary_10);
+    manager.insert_hash(binary_01, 0, "", binary_11);
+  }
+  {
+    hashdb::scan_manager_t manager(bulk_dir);
+    TEST_EQ(manager.first_hash(), binary_00);
+    TEST_EQ(manager.next_hash(binary_00), binary_01);
+    TEST_EQ(manager.find_approximate_hash_count(binary_00), 2);
+  }
+
+  // bulk loading requires a hashdb with no hashes
+  {
+    hashdb::import_manager_t manager(bulk_dir, "test");
+    bool is_enabled = (manager.enable_bulk_load(10) == "");
+    TEST_EQ(is_enabled, false);
+  }
+  rm_hashdb_dir(bulk_dir);
+}
+
+// ************************************************************
+// iterators
+// ************************************************************
+void lmdb_iterators() {
+  hashdb::settings_t settings;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    uint64_t it_k_entropy;
+    std::string it_block_label;
+    uint64_t it_count;
+    hashdb::source_sub_counts_t it_source_sub_counts;
+
+    // the hash iterator visits the hashes first_hash and next_hash visit
+    std::vector<std::string> block_hashes;
+    std::string block_hash = manager.first_hash();
+    for (hashdb::hash_iterator_t it(manager); !it.at_end(); it.next()) {
+      TEST_EQ(it.block_hash(), block_hash);
+      manager.find_hash(block_hash, k_entropy, block_label, count,
+                        source_sub_counts);
+      it.read(it_k_entropy, it_block_label, it_count, it_source_sub_counts);
+      TEST_EQ(it_k_entropy, k_entropy);
+      TEST_EQ(it_block_label, block_label);
+      TEST_EQ(it_count, count);
+      TEST_EQ(it_source_sub_counts.size(), source_sub_counts.size());
+      for (hashdb::source_sub_counts_t::const_iterator it2 =
+           source_sub_counts.begin(); it2 != source_sub_counts.end(); ++it2) {
+        hashdb::source_sub_counts_t::const_iterator it3 =
+                                     it_source_sub_counts.find(*it2);
+        bool has_source = (it3 != it_source_sub_counts.end());
+        TEST_EQ(has_source, true);
+        TEST_EQ(it3->sub_count, it2->sub_count);
+      }
+      TEST_EQ(it.count(), count);
+      TEST_EQ(it.source_count(), source_sub_counts.size());
+      TEST_EQ(it.export_json(), manager.export_hash_json(block_hash));
+      block_hashes.push_back(block_hash);
+      block_hash = manager.next_hash(block_hash);
+    }
+    TEST_EQ(block_hash, "");
+    TEST_EQ(block_hashes.size(), 150);
+
+    // the source iterator visits the sources first_source and next_source
+    // visit
+    std::string file_hash = manager.first_source();
+    size_t source_count = 0;
+    for (hashdb::source_iterator_t it(manager); !it.at_end(); it.next()) {
+      TEST_EQ(it.file_hash(), file_hash);
+      TEST_EQ(it.export_json(), manager.export_source_json(file_hash));
+      file_hash = manager.next_source(file_hash);
+      ++source_count;
+    }
+    TEST_EQ(file_hash, "");
+    TEST_EQ(source_count, 200);
+
+    // key range
+    size_t i = 3;
+    for (hashdb::hash_iterator_t it(manager, block_hashes[3],
+                                   block_hashes[10]); !it.at_end();
+                                   it.next()) {
+      TEST_EQ(it.block_hash(), block_hashes[i]);
+      ++i;
+    }
+    TEST_EQ(i, 11);
+
+    // a range may begin between hashes
+    std::string between = block_hashes[3] + std::string(1, '\0');
+    hashdb::hash_iterator_t between_it(manager, between, block_hashes[5]);
+    TEST_EQ(between_it.block_hash(), block_hashes[4]);
+    between_it.next();
+    TEST_EQ(between_it.block_hash(), block_hashes[5]);
+    between_it.next();
+    TEST_EQ(between_it.at_end(), true);
+    TEST_EQ(between_it.block_hash(), "");
+
+    // a range past the last hash is empty
+    std::string past(17, '\xff');
+    hashdb::hash_iterator_t past_it(manager, past);
+    TEST_EQ(past_it.at_end(), true);
+
+    // renewing the snapshot keeps the place
+    i = 0;
+    for (hashdb::hash_iterator_t it(manager, "", "", 7); !it.at_end();
+         it.next()) {
+      TEST_EQ(it.block_hash(), block_hashes[i]);
+      ++i;
+    }
+    TEST_EQ(i, 150);
+    i = 0;
+    for (hashdb::hash_iterator_t it(manager, "", "", 1); !it.at_end();
+         it.next()) {
+      TEST_EQ(it.block_hash(), block_hashes[i]);
+      ++i;
+    }
+    TEST_EQ(i, 150);
+
+    // hash ranges cover every hash once, in order
+    std::vector<std::pair<std::string, std::string> > ranges;
+    manager.hash_ranges(4, ranges);
+    TEST_EQ(ranges.size(), 4);
+    i = 0;
+    for (size_t j = 0; j < ranges.size(); ++j) {
+      TEST_EQ(ranges[j].first, block_hashes[i]);
+      for (hashdb::hash_iterator_t it(manager, ranges[j].first,
+                                     ranges[j].second); !it.at_end();
+                                     it.next()) {
+        TEST_EQ(it.block_hash(), block_hashes[i]);
+        ++i;
+      }
+      TEST_EQ(ranges[j].second, block_hashes[i - 1]);
+    }
+    TEST_EQ(i, 150);
+
+    // no more ranges than hashes
+    manager.hash_ranges(1000, ranges);
+    const bool at_most_hashes = (ranges.size() <= 150);
+    TEST_EQ(at_most_hashes, true);
+    TEST_EQ(ranges.front().first, block_hashes.front());
+    TEST_EQ(ranges.back().second, block_hashes.back());
+    manager.hash_ranges(1, ranges);
+    TEST_EQ(ranges.size(), 1);
+    TEST_EQ(ranges[0].first, block_hashes.front());
+    TEST_EQ(ranges[0].second, block_hashes.back());
+
+    // hash ranges within bounds that fall between hashes
+    manager.hash_ranges(3, ranges, between,
+                        block_hashes[100] + std::string(1, '\0'));
+    i = 4;
+    for (size_t j = 0; j < ranges.size(); ++j) {
+      TEST_EQ(ranges[j].first, block_hashes[i]);
+      for (hashdb::hash_iterator_t it(manager, ranges[j].first,
+                                     ranges[j].second); !it.at_end();
+                                     it.next()) {
+        TEST_EQ(it.block_hash(), block_hashes[i]);
+        ++i;
+      }
+    }
+    TEST_EQ(i, 101);
+    manager.hash_ranges(3, ranges, block_hashes[7], block_hashes[7]);
+    TEST_EQ(ranges.size(), 1);
+    TEST_EQ(ranges[0].first, block_hashes[7]);
+    TEST_EQ(ranges[0].second, block_hashes[7]);
+    manager.hash_ranges(3, ranges, between, between);
+    TEST_EQ(ranges.size(), 0);
+    manager.hash_ranges(3, ranges, past);
+    TEST_EQ(ranges.size(), 0);
+
+    // the hash iterator exports the source sub counts it read
+    hashdb::hash_iterator_t export_it(manager);
+    TEST_EQ(export_it.export_json(it_source_sub_counts),
+            manager.export_hash_json(block_hashes[0]));
+    TEST_EQ(it_source_sub_counts.size(), export_it.source_count());
+  }
+
+  // an empty DB has no hash ranges
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    std::vector<std::pair<std::string, std::string> > ranges;
+    manager.hash_ranges(4, ranges);
+    TEST_EQ(ranges.size(), 0);
+  }
+
+  // hashdbs with Type 3 hash data records after their Type 2 record
+  rm_hashdb_dir(hashdb_dir);
+  settings.layout_version = hashdb::settings_t::SINGLE_ENV_LAYOUT;
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    manager.insert_hash(binary_00, 0, "", binary_10);
+    manager.insert_hash(binary_00, 0, "", binary_11);
+    manager.insert_hash(binary_00, 0, "", binary_12);
+    manager.insert_hash(binary_01, 0, "", binary_12);
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    hashdb::hash_iterator_t it(manager);
+    TEST_EQ(it.block_hash(), binary_00);
+    TEST_EQ(it.count(), 3);
+    TEST_EQ(it.source_count(), 3);
+    it.next();
+    TEST_EQ(it.block_hash(), binary_01);
+    TEST_EQ(it.source_count(), 1);
+    it.next();
+    TEST_EQ(it.at_end(), true);
+  }
+}
+
+// ************************************************************
+// binary dump and load
+// ************************************************************
+// the hashes and sources of two hashdbs are the same
+static void test_same_hashdb(const std::string& dir1,
+                             const std::string& dir2) {
+  hashdb::scan_manager_t manager1(dir1);
+  hashdb::scan_manager_t manager2(dir2);
+  TEST_EQ(manager2.size_hashes(), manager1.size_hashes());
+  TEST_EQ(manager2.size_sources(), manager1.size_sources());
+  hashdb::hash_iterator_t it2(manager2);
+  for (hashdb::hash_iterator_t it1(manager1); !it1.at_end(); it1.next()) {
+    TEST_EQ(it2.block_hash(), it1.block_hash());
+    TEST_EQ(it2.export_json(), it1.export_json());
+    TEST_EQ(manager2.find_approximate_hash_count(it1.block_hash()),
+            manager1.find_approximate_hash_count(it1.block_hash()));
+    it2.next();
+  }
+  TEST_EQ(it2.at_end(), true);
+  hashdb::source_iterator_t source_it2(manager2);
+  for (hashdb::source_iterator_t source_it1(manager1); !source_it1.at_end();
+       source_it1.next()) {
+    TEST_EQ(source_it2.export_json(), source_it1.export_json());
+    source_it2.next();
+  }
+  TEST_EQ(source_it2.at_end(), true);
+}
+
+void lmdb_dump_load() {
+  hashdb::settings_t settings;
+  const std::string load_dir = "temp_dir_lmdb_load_test.hdb";
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+    manager.insert_source_data(bulk_hash(1001), 8000, "exe", 1, 4);
+    manager.insert_source_name(bulk_hash(1001), "rn2", "fn2");
+  }
+
+  // dump
+  std::stringstream ss;
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.dump(ss), "");
+  }
+  const std::string dump_text = ss.str();
+
+  // load into an empty hashdb by appending
+  rm_hashdb_dir(load_dir);
+  TEST_EQ(hashdb::create_hashdb(load_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(load_dir, "test");
+    std::stringstream in(dump_text);
+    TEST_EQ(manager.load(in), "");
+  }
+  test_same_hashdb(hashdb_dir, load_dir);
+
+  // load again, merging, changes nothing
+  {
+    hashdb::import_manager_t manager(load_dir, "test", 100, 100);
+    std::stringstream in(dump_text);
+    TEST_EQ(manager.load(in), "");
+  }
+  test_same_hashdb(hashdb_dir, load_dir);
+
+  // a damaged chunk is rejected
+  std::string damaged_text = dump_text;
+  damaged_text[damaged_text.size() / 2] ^= 0x01;
+  rm_hashdb_dir(load_dir);
+  TEST_EQ(hashdb::create_hashdb(load_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(load_dir, "test");
+    std::stringstream in(damaged_text);
+    TEST_EQ(manager.load(in), "Checksum error in hashdb binary dump chunk.");
+  }
+
+  // a truncated dump is rejected
+  {
+    hashdb::import_manager_t manager(load_dir, "test");
+    std::stringstream in(dump_text.substr(0, dump_text.size() - 5));
+    TEST_EQ(manager.load(in), "The hashdb binary dump ends inside a chunk.");
+    std::stringstream in2("not a dump");
+    TEST_EQ(manager.load(in2), "The input is not a hashdb binary dump.");
+  }
+
+  // a source with fewer names than it claims is not committed
+  rm_hashdb_dir(load_dir);
+  TEST_EQ(hashdb::create_hashdb(load_dir, settings, "test"), "");
+  {
+    std::stringstream short_ss;
+    hashdb::binary_dump_writer_t writer(short_ss, 16);
+    writer.begin_record('S');
+    writer.put_string(binary_10);
+    writer.put_number(100);
+    writer.put_string("txt");
+    writer.put_number(0);
+    writer.put_number(0);
+    writer.put_number(2);
+    writer.put_string("rn");
+    writer.put_string("fn");
+    writer.finish(1, 0);
+    hashdb::import_manager_t manager(load_dir, "test");
+    bool is_loaded = (manager.load(short_ss) == "");
+    TEST_EQ(is_loaded, false);
+    TEST_EQ(manager.has_source(binary_10), false);
+  }
+
+  // an empty hashdb dumps and loads
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  std::stringstream empty_ss;
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.dump(empty_ss), "");
+  }
+  rm_hashdb_dir(load_dir);
+  TEST_EQ(hashdb::create_hashdb(load_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(load_dir, "test");
+    TEST_EQ(manager.load(empty_ss), "");
+  }
+  test_same_hashdb(hashdb_dir, load_dir);
+  rm_hashdb_dir(load_dir);
+}
+
+// ************************************************************
+// JSON import
+// ************************************************************
+void lmdb_import_json() {
+  hashdb::json_record_t record;
+
+  // a hash, with an odd trailing source_sub_counts element ignored
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"block_hash\":\"0011\",\"k_entropy\":8,\"block_label\":\"W\","
+          "\"source_sub_counts\":[\"22\",2,\"33\",3,\"44\"],"
+          "\"other\":{\"block_hash\":\"55\"}}", record), "");
+  TEST_EQ(record.is_source, false);
+  TEST_EQ(record.block_hash, hashdb::hex_to_bin("0011"));
+  TEST_EQ(record.k_entropy, 8);
+  TEST_EQ(record.block_label, "W");
+  TEST_EQ(record.source_sub_counts.size(), 2);
+  TEST_EQ(record.source_sub_counts[1].first, hashdb::hex_to_bin("33"));
+  TEST_EQ(record.source_sub_counts[1].second, 3);
+
+  // a source
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"file_hash\":\"22\",\"filesize\":800,\"file_type\":\"exe\","
+          "\"zero_count\":1,\"nonprobative_count\":2,"
+          "\"name_pairs\":[\"rn1\",\"fn1\",\"rn2\",\"fn2\"]}", record), "");
+  TEST_EQ(record.is_source, true);
+  TEST_EQ(record.file_hash, hashdb::hex_to_bin("22"));
+  TEST_EQ(record.filesize, 800);
+  TEST_EQ(record.file_type, "exe");
+  TEST_EQ(record.zero_count, 1);
+  TEST_EQ(record.nonprobative_count, 2);
+  TEST_EQ(record.names.size(), 2);
+
+  // errors
+  TEST_EQ(hashdb::import_manager_t::parse_json("{", record),
+          "Invalid JSON syntax");
+  TEST_EQ(hashdb::import_manager_t::parse_json("[1]", record),
+          "Invalid JSON syntax");
+  TEST_EQ(hashdb::import_manager_t::parse_json("{}", record),
+          "A block_hash or file_hash field is required");
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"block_hash\":1}", record), "Invalid block_hash field");
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"block_hash\":\"00\",\"k_entropy\":-1}", record),
+          "Invalid k_entropy field");
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"block_hash\":\"00\"}", record),
+          "Invalid source_sub_counts field");
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"block_hash\":\"00\",\"source_sub_counts\":[[\"22\"],1]}",
+          record), "Invalid source hash in source_sub_counts");
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"block_hash\":\"00\",\"source_sub_counts\":[\"22\",1.5]}",
+          record), "Invalid sub_count in source_sub_counts");
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"file_hash\":\"22\",\"name_pairs\":[]}", record),
+          "Invalid filesize field");
+  TEST_EQ(hashdb::import_manager_t::parse_json(
+          "{\"file_hash\":\"22\",\"filesize\":1,\"name_pairs\":[\"rn1\"]}",
+          record), "Invalid filename in name_pairs field");
+
+  // import_json imports what parse_json decodes
+  hashdb::settings_t settings;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    TEST_EQ(manager.import_json(
+          "{\"block_hash\":\"0011\",\"k_entropy\":8,\"block_label\":\"W\","
+          "\"source_sub_counts\":[\"22\",2,\"33\",3]}"), "");
+    TEST_EQ(manager.import_json(
+          "{\"file_hash\":\"22\",\"filesize\":800,"
+          "\"name_pairs\":[\"rn1\",\"fn1\"]}"), "");
+    TEST_EQ(manager.import_json(
+          "{\"block_hash\":\"0022\",\"source_sub_counts\":[\"22\",x]}"),
+          "Invalid JSON syntax");
+  }
+  hashdb::scan_manager_t manager(hashdb_dir);
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_sub_counts_t source_sub_counts;
+  TEST_EQ(manager.find_hash(hashdb::hex_to_bin("0011"), k_entropy,
+                            block_label, count, source_sub_counts), true);
+  TEST_EQ(k_entropy, 8);
+  TEST_EQ(block_label, "W");
+  TEST_EQ(count, 5);
+  TEST_EQ(source_sub_counts.size(), 2);
+  TEST_EQ(manager.find_hash(hashdb::hex_to_bin("0022"), k_entropy,
+                            block_label, count, source_sub_counts), false);
+  hashdb::source_names_t source_names;
+  TEST_EQ(manager.find_source_names(hashdb::hex_to_bin("22"), source_names),
+          true);
+  TEST_EQ(source_names.size(), 1);
+}
+
+// ************************************************************
+// batch lookup
+// ************************************************************
+void lmdb_find_hashes() {
+  hashdb::settings_t settings;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+
+  // probes out of order, with repeats, absent hashes and an empty hash
+  std::vector<std::string> block_hashes;
+  for (size_t i = 0; i < 400; ++i) {
+    block_hashes.push_back(bulk_hash((i * 13) % 200));
+  }
+  block_hashes.push_back("");
+  std::vector<hashdb::block_hash_t> fixed_hashes;
+  for (size_t i = 0; i < block_hashes.size(); ++i) {
+    fixed_hashes.push_back(hashdb::block_hash_t(block_hashes[i]));
+  }
+
+  const hashdb::scan_mode_t modes[] = {
+                     hashdb::scan_mode_t::EXPANDED,
+                     hashdb::scan_mode_t::EXPANDED_OPTIMIZED,
+                     hashdb::scan_mode_t::COUNT,
+                     hashdb::scan_mode_t::APPROXIMATE_COUNT};
+  for (size_t m = 0; m < 4; ++m) {
+
+    // each lookup alone
+    std::vector<std::string> expected;
+    {
+      hashdb::scan_manager_t manager(hashdb_dir);
+      for (size_t i = 0; i + 1 < block_hashes.size(); ++i) {
+        expected.push_back(manager.find_hash_json(modes[m],
+                                                  block_hashes[i]));
+      }
+      expected.push_back("");
+    }
+
+    // all lookups at once, with sources cached
+    hashdb::scan_manager_t manager(hashdb_dir, 1000);
+    std::vector<std::string> json_texts;
+    manager.find_hashes_json(modes[m], block_hashes, json_texts);
+    TEST_EQ(json_texts.size(), block_hashes.size());
+    bool is_same = (json_texts == expected);
+    TEST_EQ(is_same, true);
+
+    // the same given as block_hash_t values
+    hashdb::scan_manager_t fixed_manager(hashdb_dir, 1000);
+    fixed_manager.find_hashes_json(modes[m], fixed_hashes, json_texts);
+    is_same = (json_texts == expected);
+    TEST_EQ(is_same, true);
+  }
+
+  // structured results
+  hashdb::scan_manager_t manager(hashdb_dir);
+  std::vector<hashdb::hash_record_t> hash_records;
+  manager.find_hashes(block_hashes, hash_records);
+  TEST_EQ(hash_records.size(), block_hashes.size());
+  size_t found = 0;
+  for (size_t i = 0; i + 1 < block_hashes.size(); ++i) {
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    const bool is_found = manager.find_hash(block_hashes[i], k_entropy,
+                               block_label, count, source_sub_counts);
+    TEST_EQ(hash_records[i].is_found, is_found);
+    TEST_EQ(hash_records[i].k_entropy, k_entropy);
+    TEST_EQ(hash_records[i].block_label, block_label);
+    TEST_EQ(hash_records[i].count, count);
+    TEST_EQ(hash_records[i].sources.size(), source_sub_counts.size());
+    found += (is_found) ? 1 : 0;
+  }
+  TEST_EQ(found, 300);
+  TEST_EQ(hash_records.back().is_found, false);
+  std::vector<hashdb::hash_record_t> fixed_records;
+  manager.find_hashes(fixed_hashes, fixed_records);
+  TEST_EQ(fixed_records.size(), hash_records.size());
+  for (size_t i = 0; i < block_hashes.size(); ++i) {
+    TEST_EQ(fixed_records[i].is_found, hash_records[i].is_found);
+    TEST_EQ(fixed_records[i].count, hash_records[i].count);
+    TEST_EQ(fixed_records[i].sources.size(), hash_records[i].sources.size());
+  }
+
+  // counts
+  std::vector<size_t> counts;
+  manager.find_hash_counts(block_hashes, counts);
+  TEST_EQ(counts.size(), block_hashes.size());
+  for (size_t i = 0; i < block_hashes.size(); ++i) {
+    TEST_EQ(counts[i], hash_records[i].count);
+  }
+
+  // reused records keep nothing of the previous lookup
+  std::vector<std::string> absent_hashes(block_hashes.begin() + 1,
+                                         block_hashes.begin() + 3);
+  absent_hashes[0] = bulk_hash(250);
+  manager.find_hashes(absent_hashes, hash_records);
+  TEST_EQ(hash_records.size(), 2);
+  TEST_EQ(hash_records[0].is_found, false);
+  TEST_EQ(hash_records[0].count, 0);
+  TEST_EQ(hash_records[0].sources.size(), 0);
+  TEST_EQ(hash_records[1].count, counts[2]);
+}
+
+// lookups with block_hash_t and a reused hash_record_t
+static bool less_source_id(const hashdb::hash_source_t& a,
+                           const hashdb::hash_source_t& b) {
+  return a.source_id < b.source_id;
+}
+
+void lmdb_find_hash_record() {
+  for (size_t with_filter = 0; with_filter < 2; ++with_filter) {
+    hashdb::settings_t settings;
+    if (with_filter == 1) {
+      settings.bloom_false_positive_rate = 0.01;
+    }
+    rm_hashdb_dir(hashdb_dir);
+    TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+    {
+      hashdb::import_manager_t manager(hashdb_dir, "test");
+      bulk_import(manager);
+    }
+    hashdb::scan_manager_t manager(hashdb_dir);
+
+    // the same as the string lookups
+    std::vector<std::string> block_hashes;
+    for (size_t i = 0; i < 200; ++i) {
+      block_hashes.push_back(bulk_hash(i));
+    }
+    std::vector<hashdb::hash_record_t> hash_records;
+    manager.find_hashes(block_hashes, hash_records);
+    hashdb::hash_record_t hash_record;
+    size_t found = 0;
+    for (size_t i = 0; i < block_hashes.size(); ++i) {
+      const hashdb::block_hash_t block_hash(block_hashes[i]);
+      TEST_EQ(block_hash.str(), block_hashes[i]);
+      hashdb::hash_record_t& expected = hash_records[i];
+      TEST_EQ(manager.find_hash(block_hash, hash_record), expected.is_found);
+      TEST_EQ(hash_record.is_found, expected.is_found);
+      TEST_EQ(hash_record.k_entropy, expected.k_entropy);
+      TEST_EQ(hash_record.block_label, expected.block_label);
+      TEST_EQ(hash_record.count, expected.count);
+      std::sort(hash_record.sources.begin(), hash_record.sources.end(),
+                less_source_id);
+      std::sort(expected.sources.begin(), expected.sources.end(),
+                less_source_id);
+      TEST_EQ(hash_record.sources.size(), expected.sources.size());
+      bool same_sources = true;
+      for (size_t j = 0; j < hash_record.sources.size(); ++j) {
+        if (hash_record.sources[j].source_id !=
+                             expected.sources[j].source_id ||
+            hash_record.sources[j].sub_count !=
+                             expected.sources[j].sub_count) {
+          same_sources = false;
+        }
+      }
+      TEST_EQ(same_sources, true);
+      TEST_EQ(manager.find_hash_count(block_hash),
+              manager.find_hash_count(block_hashes[i]));
+      TEST_EQ(manager.find_approximate_hash_count(block_hash),
+              manager.find_approximate_hash_count(block_hashes[i]));
+      found += (hash_record.is_found) ? 1 : 0;
+    }
+    TEST_EQ(found, 150);
+  }
+
+  // too long
+  const hashdb::block_hash_t too_long(std::string(65, 'a'));
+  TEST_EQ(too_long.size, 0);
+}
+
+// ************************************************************
+// scan stream
+// ************************************************************
+// one scan_stream record
+static std::string scan_record(const std::string& block_hash,
+                               const std::string& label) {
+  const uint16_t label_length = label.size();
+  return block_hash +
+         std::string(reinterpret_cast<const char*>(&label_length),
+                     sizeof(uint16_t)) + label;
+}
+
+// put requests without getting, as a thread of its own
+struct scan_stream_putter_t {
+  hashdb::scan_stream_t* scan_stream;
+  std::string request;
+  size_t count;
+};
+
+static void* put_in_thread(void* arg) {
+  scan_stream_putter_t* putter = static_cast<scan_stream_putter_t*>(arg);
+  for (size_t i = 0; i < putter->count; ++i) {
+    putter->scan_stream->put(putter->request);
+  }
+  return NULL;
+}
+
+void lmdb_scan_stream() {
+  hashdb::settings_t settings;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+  hashdb::scan_manager_t manager(hashdb_dir);
+
+  // an absent hash, then two present hashes
+  std::string request = scan_record(bulk_hash(500), "absent") +
+                        scan_record(bulk_hash(1), "label1") +
+                        scan_record(bulk_hash(2), "");
+  const std::string json1 = manager.find_hash_json(
+                             hashdb::scan_mode_t::COUNT, bulk_hash(1));
+  const std::string json2 = manager.find_hash_json(
+                             hashdb::scan_mode_t::COUNT, bulk_hash(2));
+  const uint32_t json1_length = json1.size();
+  const uint32_t json2_length = json2.size();
+  const std::string expected = scan_record(bulk_hash(1), "label1") +
+         std::string(reinterpret_cast<const char*>(&json1_length), 4) +
+         json1 + scan_record(bulk_hash(2), "") +
+         std::string(reinterpret_cast<const char*>(&json2_length), 4) +
+         json2;
+
+  {
+    hashdb::scan_stream_t scan_stream(&manager, 16,
+                                      hashdb::scan_mode_t::COUNT);
+
+    // more requests than the stream holds, put by one thread that does
+    // not get while this thread gets
+    scan_stream_putter_t putter;
+    putter.scan_stream = &scan_stream;
+    putter.request = request;
+    putter.count = 200;
+    pthread_t thread;
+    TEST_EQ(pthread_create(&thread, NULL, put_in_thread, &putter), 0);
+    size_t matched = 0;
+    while (matched < 200) {
+      scan_stream.empty();
+      const std::string scanned = scan_stream.get();
+      if (scanned.size() != 0) {
+        TEST_EQ(scanned, expected);
+        ++matched;
+      }
+    }
+    pthread_join(thread, NULL);
+    TEST_EQ(scan_stream.empty(), true);
+
+    // a request cut short inside a record keeps its whole records
+    scan_stream.put(request.substr(0, request.size() - 1));
+    TEST_EQ(scan_stream.empty(), false);
+    const std::string scanned = scan_stream.get();
+    TEST_EQ(scanned, expected.substr(0, expected.size() -
+                                     json2.size() - 4 - 18));
+    TEST_EQ(scan_stream.empty(), true);
+  }
+
+  {
+    hashdb::scan_stream_t scan_stream(&manager, 16,
+                                      hashdb::scan_mode_t::COUNT);
+
+    // requests that match nothing leave the stream without get
+    const std::string absent_request = scan_record(bulk_hash(500), "");
+    for (size_t i = 0; i < 200; ++i) {
+      scan_stream.put(absent_request);
+    }
+
+    // more matches than the stream holds, taking the ready ones before
+    // each put so put only waits on the scan threads
+    size_t matched = 0;
+    for (size_t i = 0; i < 200; ++i) {
+      while (scan_stream.get().size() != 0) {
+        ++matched;
+      }
+      scan_stream.put(request);
+    }
+    while (!scan_stream.empty()) {
+      if (scan_stream.get().size() != 0) {
+        ++matched;
+      }
+    }
+    TEST_EQ(matched, 200);
+  }
+}
+
+template<typename T>
+static T read_scanned(const std::string& scanned, size_t& index) {
+  T value;
+  memcpy(&value, scanned.data() + index, sizeof(T));
+  index += sizeof(T);
+  return value;
+}
+
+void lmdb_scan_stream_binary() {
+  hashdb::settings_t settings;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+  hashdb::scan_manager_t manager(hashdb_dir);
+
+  // every hash, present or not, with its number as its label
+  std::string request;
+  for (size_t i = 0; i < 160; ++i) {
+    std::stringstream ss;
+    ss << i;
+    request += scan_record(bulk_hash(i), ss.str());
+  }
+
+  // two threads, placed on CPU 0
+  std::string scanned;
+  {
+    hashdb::scan_stream_t scan_stream(&manager, 16,
+                                      hashdb::scan_mode_t::EXPANDED, 2,
+                                      std::vector<int>(1, 0),
+                                      hashdb::scan_stream_t::BINARY_RESULTS);
+    scan_stream.put(request);
+    TEST_EQ(scan_stream.empty(), false);
+    scanned = scan_stream.get();
+    TEST_EQ(scan_stream.empty(), true);
+  }
+
+  // each record matches find_hash, in input order
+  size_t index = 0;
+  size_t found = 0;
+  for (size_t i = 0; i < 160; ++i) {
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t* source_sub_counts =
+                                          new hashdb::source_sub_counts_t;
+    if (!manager.find_hash(bulk_hash(i), k_entropy, block_label, count,
+                           *source_sub_counts)) {
+      delete source_sub_counts;
+      continue;
+    }
+    ++found;
+
+    std::stringstream ss;
+    ss << i;
+    TEST_EQ(scanned.substr(index, 16 + 2 + ss.str().size()),
+            scan_record(bulk_hash(i), ss.str()));
+    index += 16 + 2 + ss.str().size();
+    TEST_EQ(read_scanned<uint64_t>(scanned, index), count);
+    TEST_EQ(read_scanned<uint64_t>(scanned, index), k_entropy);
+    const uint16_t block_label_length =
+                                read_scanned<uint16_t>(scanned, index);
+    TEST_EQ(scanned.substr(index, block_label_length), block_label);
+    index += block_label_length;
+    const uint32_t num_sources = read_scanned<uint32_t>(scanned, index);
+    TEST_EQ(num_sources, source_sub_counts->size());
+
+    // each source ID gives the source of a file hash with its sub_count
+    for (uint32_t j = 0; j < num_sources; ++j) {
+      const uint64_t source_id = read_scanned<uint64_t>(scanned, index);
+      const uint64_t sub_count = read_scanned<uint64_t>(scanned, index);
+      const std::string source_json = manager.find_source_json(source_id);
+      bool source_matches = false;
+      for (hashdb::source_sub_counts_t::const_iterator it =
+           source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+        if (it->sub_count == sub_count && source_json.find(
+                 "\"" + hashdb::bin_to_hex(it->file_hash) + "\"") !=
+                 std::string::npos) {
+          source_matches = true;
+        }
+      }
+      TEST_EQ(source_matches, true);
+    }
+    delete source_sub_counts;
+  }
+  TEST_EQ(found, 150);
+  TEST_EQ(index, scanned.size());
+
+  // no such source
+  TEST_EQ(manager.find_source_json(100000), "");
+}
+
+// ************************************************************
+// hex conversion
+// ************************************************************
+void hex_conversion() {
+
+  // every byte value, at every length and offset within a word
+  std::string bin;
+  for (size_t i = 0; i < 256 + 7; ++i) {
+    bin.push_back(static_cast<char>(i * 7));
+  }
+  for (size_t size = 0; size < 20; ++size) {
+    for (size_t offset = 0; offset + size < bin.size(); offset += 13) {
+      const std::string part = bin.substr(offset, size);
+      const std::string hex = hashdb::bin_to_hex(part);
+      TEST_EQ(hashdb::hex_to_bin(hex), part);
+    }
+  }
+
+  // lower case digits for every byte value
+  for (size_t i = 0; i < 256; ++i) {
+    char expected[3];
+    snprintf(expected, sizeof(expected), "%02x", static_cast<unsigned>(i));
+    TEST_EQ(hashdb::bin_to_hex(std::string(1, static_cast<char>(i))),
+            std::string(expected));
+  }
+
+  // upper case
+  TEST_EQ(hashdb::hex_to_bin("09AFaf0123456789ABCDEF"),
+          hashdb::hex_to_bin("09afaf0123456789abcdef"));
+
+  // invalid digits at each position, and odd sizes
+  const char invalid[] = {'/', ':', '@', 'G', '`', 'g', ' ', '\xb0'};
+  for (size_t i = 0; i < sizeof(invalid); ++i) {
+    for (size_t j = 0; j < 18; ++j) {
+      std::string hex(18, 'a');
+      hex[j] = invalid[i];
+      char out[9];
+      TEST_EQ(hashdb::hex_to_bin(hex.c_str(), hex.size(), out), false);
+    }
+  }
+  char out[9];
+  TEST_EQ(hashdb::hex_to_bin("abc", 3, out), false);
+  TEST_EQ(hashdb::hex_to_bin("abc"), "");
+}
+
+// ************************************************************
+// source cache
+// ************************************************************
+static hashdb::cached_source_t cached_source(const uint64_t source_id) {
+  hashdb::cached_source_t source;
+  source.file_hash = std::string(16, static_cast<char>(source_id));
+  source.filesize = source_id * 100;
+  return source;
+}
+
+void source_cache() {
+  hashdb::cached_source_t source;
+
+  // 16 shards of 2
+  hashdb::source_cache_t cache(32, 60000);
+  TEST_EQ(cache.find(1, source), false);
+  cache.insert(1, cached_source(1));
+  TEST_EQ(cache.find(1, source), true);
+  TEST_EQ(source.file_hash, cached_source(1).file_hash);
+  TEST_EQ(source.filesize, 100);
+  TEST_EQ(cache.hits(), 1);
+  TEST_EQ(cache.misses(), 1);
+
+  // replace
+  source = cached_source(1);
+  source.source_json = "{}";
+  cache.insert(1, source);
+  TEST_EQ(cache.size(), 1);
+  TEST_EQ(cache.find(1, source), true);
+  TEST_EQ(source.source_json, "{}");
+
+  // source IDs 1, 17 and 33 share a shard, so 17 is least recently used
+  cache.insert(17, cached_source(17));
+  TEST_EQ(cache.find(1, source), true);
+  cache.insert(33, cached_source(33));
+  TEST_EQ(cache.size(), 2);
+  TEST_EQ(cache.find(17, source), false);
+  TEST_EQ(cache.find(1, source), true);
+  TEST_EQ(cache.find(33, source), true);
+  TEST_EQ(cache.find(2, source), false);
+
+  // entries expire
+  hashdb::source_cache_t short_cache(32, 1);
+  short_cache.insert(1, cached_source(1));
+  usleep(5000);
+  TEST_EQ(short_cache.find(1, source), false);
+  TEST_EQ(short_cache.size(), 0);
+
+  // max age 0 keeps nothing
+  hashdb::source_cache_t no_cache(32, 0);
+  no_cache.insert(1, cached_source(1));
+  TEST_EQ(no_cache.find(1, source), false);
+  TEST_EQ(no_cache.size(), 0);
+}
+
+// ************************************************************
+// reported hashes and sources
+// ************************************************************
+void locked_member() {
+  hashdb::locked_member_t member;
+
+  // items of many sizes, each new once
+  for (size_t i = 0; i < 20000; ++i) {
+    TEST_EQ(member.locked_insert(bulk_hash(i).substr(0, i % 20)
+                                 + bulk_hash(i)), true);
+  }
+  TEST_EQ(member.locked_insert(""), true);
+  bool all_kept = true;
+  for (size_t i = 0; i < 20000; ++i) {
+    if (member.locked_insert(bulk_hash(i).substr(0, i % 20) +
+                             bulk_hash(i))) {
+      all_kept = false;
+    }
+  }
+  TEST_EQ(all_kept, true);
+  TEST_EQ(member.locked_insert(""), false);
+
+  // clear
+  member.clear(0);
+  TEST_EQ(member.locked_insert(bulk_hash(1)), true);
+  TEST_EQ(member.locked_insert(bulk_hash(1)), false);
+
+  // past the limit items go in the filter, which is never wrong about
+  // items it has
+  member.clear(256 * 1024);
+  size_t num_new = 0;
+  for (size_t i = 0; i < 20000; ++i) {
+    if (member.locked_insert(bulk_hash(i))) {
+      ++num_new;
+    }
+  }
+  const bool mostly_new = (num_new > 19900);
+  TEST_EQ(mostly_new, true);
+  all_kept = true;
+  for (size_t i = 0; i < 20000; ++i) {
+    if (member.locked_insert(bulk_hash(i))) {
+      all_kept = false;
+    }
+  }
+  TEST_EQ(all_kept, true);
+}
+
+void lmdb_reset_reported() {
+  hashdb::settings_t settings;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+  hashdb::scan_manager_t manager(hashdb_dir);
+
+  // reported in full once, then again after reset
+  const std::string expanded = manager.find_hash_json(
+                           hashdb::scan_mode_t::EXPANDED, bulk_hash(1));
+  const std::string brief = "{\"block_hash\":\"" +
+                            hashdb::bin_to_hex(bulk_hash(1)) + "\"}";
+  TEST_EQ(manager.find_hash_json(hashdb::scan_mode_t::EXPANDED_OPTIMIZED,
+                                 bulk_hash(1)), expanded);
+  TEST_EQ(manager.find_hash_json(hashdb::scan_mode_t::EXPANDED_OPTIMIZED,
+                                 bulk_hash(1)), brief);
+  manager.reset_reported(1000000);
+  TEST_EQ(manager.find_hash_json(hashdb::scan_mode_t::EXPANDED_OPTIMIZED,
+                                 bulk_hash(1)), expanded);
+  TEST_EQ(manager.find_hash_json(hashdb::scan_mode_t::EXPANDED_OPTIMIZED,
+                                 bulk_hash(1)), brief);
+}
+
+// ************************************************************
+// source index
+// ************************************************************
+// the source index lists the same hashes as a scan of every hash
+static void check_source_index(const std::string& dir) {
+  hashdb::scan_manager_t manager(dir);
+  TEST_EQ(manager.has_source_index(), true);
+  size_t num_sources = 0;
+  for (std::string file_hash = manager.first_source(); file_hash != "";
+       file_hash = manager.next_source(file_hash)) {
+    std::vector<std::string> expected;
+    for (std::string block_hash = manager.first_hash(); block_hash != "";
+         block_hash = manager.next_hash(block_hash)) {
+      uint64_t k_entropy;
+      std::string block_label;
+      uint64_t count;
+      hashdb::source_sub_counts_t source_sub_counts;
+      manager.find_hash(block_hash, k_entropy, block_label, count,
+                        source_sub_counts);
+      if (source_sub_counts.find(hashdb::source_sub_count_t(file_hash, 0))
+                                         != source_sub_counts.end()) {
+        expected.push_back(block_hash);
+      }
+    }
+    std::vector<std::string> block_hashes;
+    const bool has_hashes = (expected.size() != 0);
+    TEST_EQ(manager.find_source_hashes(file_hash, block_hashes), has_hashes);
+    bool is_same = (block_hashes == expected);
+    TEST_EQ(is_same, true);
+    ++num_sources;
+  }
+  TEST_EQ(num_sources, 200);
+}
+
+void lmdb_source_index() {
+  hashdb::settings_t settings;
+  const std::string bulk_dir = "temp_dir_lmdb_bulk_test.hdb";
+
+  // kept on import
+  settings.source_index = true;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+  check_source_index(hashdb_dir);
+
+  // kept on bulk load
+  rm_hashdb_dir(bulk_dir);
+  TEST_EQ(hashdb::create_hashdb(bulk_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(bulk_dir, "test");
+    TEST_EQ(manager.enable_bulk_load(2), "");
+    bulk_import(manager);
+  }
+  check_source_index(bulk_dir);
+
+  // built for an existing hashdb
+  settings.source_index = false;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.has_source_index(), false);
+    std::vector<std::string> block_hashes;
+    TEST_EQ(manager.find_source_hashes(bulk_hash(1000), block_hashes),
+            false);
+  }
+  TEST_EQ(hashdb::rebuild_source_index(hashdb_dir, "test"), "");
+  hashdb::settings_t read_settings;
+  TEST_EQ(hashdb::read_settings(hashdb_dir, read_settings), "");
+  TEST_EQ(read_settings.source_index, true);
+  check_source_index(hashdb_dir);
+
+  // rebuilding replaces the index whole and leaves no scratch store
+  TEST_EQ(hashdb::rebuild_source_index(hashdb_dir, "test"), "");
+  TEST_EQ(access((hashdb_dir + "/lmdb_source_hash_store.new").c_str(),
+                 F_OK), -1);
+  check_source_index(hashdb_dir);
+
+  // the separate environment layout has no room for it
+  settings.source_index = true;
+  settings.layout_version = hashdb::settings_t::SEPARATE_ENV_LAYOUT;
+  rm_hashdb_dir(hashdb_dir);
+  bool has_error =
+           hashdb::create_hashdb(hashdb_dir, settings, "test").size() != 0;
+  TEST_EQ(has_error, true);
+}
+
+// ************************************************************
+// map size and flusher
+// ************************************************************
+static size_t map_size(MDB_env* env) {
+  MDB_envinfo env_info;
+  TEST_EQ(mdb_env_info(env, &env_info), 0);
+  return env_info.me_mapsize;
+}
+
+// grow the map of env to more than twice its size
+static void* preallocate_in_thread(void* arg) {
+  MDB_env* env = static_cast<MDB_env*>(arg);
+  lmdb_helper::preallocate(env, map_size(env) * 2);
+  return NULL;
+}
+
+// the map size seen by a txn opened while the map was to grow
+static size_t held_map_size = 0;
+static void* hold_in_thread(void* arg) {
+  MDB_env* env = static_cast<MDB_env*>(arg);
+  lmdb_helper::hold_map(env);
+  held_map_size = map_size(env);
+  lmdb_helper::release_map(env);
+  return NULL;
+}
+
+void lmdb_map() {
+  hashdb::settings_t settings;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+
+  // unbatched inserts grow the map while the flusher syncs often
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    manager.set_flush_policy(4096, 1);
+    for (size_t i = 0; i < 20000; ++i) {
+      manager.insert_hash(bulk_hash(i), 0, "", binary_10);
+    }
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir, 1000);
+    TEST_EQ(manager.size_hashes(), 20000);
+    TEST_EQ(manager.find_approximate_hash_count(bulk_hash(19999)), 1);
+  }
+
+  // reserve grows the map only when the reservation does not fit
+  MDB_env* env = lmdb_helper::open_env(hashdb_dir + "/lmdb_store",
+                                       hashdb::RW_MODIFY, 16);
+  const size_t size = map_size(env);
+  lmdb_helper::reserve(env, 10);
+  TEST_EQ(map_size(env), size);
+  lmdb_helper::reserve(env, size / 4096 * 2);
+  bool is_grown = map_size(env) > size * 2;
+  TEST_EQ(is_grown, true);
+
+  // preallocate grows the map to the expected size
+  lmdb_helper::preallocate(env, size * 8);
+  is_grown = map_size(env) > size * 8;
+  TEST_EQ(is_grown, true);
+
+  // the map does not change while a txn is open
+  const size_t held_size = map_size(env);
+  lmdb_helper::hold_map(env);
+  MDB_txn* txn;
+  TEST_EQ(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn), 0);
+  pthread_t thread;
+  TEST_EQ(pthread_create(&thread, NULL, preallocate_in_thread, env), 0);
+  usleep(100000);
+  TEST_EQ(map_size(env), held_size);
+
+  // a thread holding a txn may hold another while the change waits, and
+  // other threads wait for the change
+  lmdb_helper::hold_map(env);
+  lmdb_helper::release_map(env);
+  pthread_t hold_thread;
+  TEST_EQ(pthread_create(&hold_thread, NULL, hold_in_thread, env), 0);
+  usleep(100000);
+  TEST_EQ(map_size(env), held_size);
+  mdb_txn_abort(txn);
+  lmdb_helper::release_map(env);
+  pthread_join(thread, NULL);
+  pthread_join(hold_thread, NULL);
+  is_grown = map_size(env) > held_size * 2;
+  TEST_EQ(is_grown, true);
+  is_grown = held_map_size > held_size * 2;
+  TEST_EQ(is_grown, true);
+  lmdb_helper::close_env(env);
+}
+
+// ************************************************************
+// Bloom filter
+// ************************************************************
+static std::string bloom_hash(const size_t n) {
+  std::string hash(16, 0);
+  for (size_t i = 0; i < 8; ++i) {
+    hash[i] = static_cast<char>(n >> (8 * i));
+  }
+  return hash;
+}
+
+void bloom_filter() {
+  const std::string filename = "temp_bloom_filter_test";
+  std::remove(filename.c_str());
+  TEST_EQ(hashdb::bloom_filter_t::create(filename, 10000, 0.01), "");
+  bool is_created = (hashdb::bloom_filter_t::create(filename, 10000, 0.01)
+                                                                   == "");
+  TEST_EQ(is_created, false);
+  {
+    hashdb::bloom_filter_t* filter =
+                 hashdb::bloom_filter_t::open(filename, hashdb::RW_MODIFY);
+    TEST_EQ(filter->size_capacity(), 10000);
+    for (size_t i = 0; i < 10000; ++i) {
+      filter->add(bloom_hash(i));
+    }
+    delete filter;
+  }
+
+  // no false negatives and about 1% false positives
+  hashdb::bloom_filter_t* filter =
+                 hashdb::bloom_filter_t::open(filename, hashdb::READ_ONLY);
+  size_t found = 0;
+  for (size_t i = 0; i < 10000; ++i) {
+    if (filter->find(bloom_hash(i))) {
+      ++found;
+    }
+  }
+  TEST_EQ(found, 10000);
+
+  // about every hash counts
+  bool is_near_count = (filter->size_hashes() > 9800 &&
+                        filter->size_hashes() <= 10000);
+  TEST_EQ(is_near_count, true);
+  size_t false_positives = 0;
+  for (size_t i = 10000; i < 110000; ++i) {
+    if (filter->find(bloom_hash(i))) {
+      ++false_positives;
+    }
+  }
+  bool is_near_rate = (false_positives < 1500);
+  TEST_EQ(is_near_rate, true);
+  delete filter;
+
+  // exactly one add reports going past capacity
+  std::remove(filename.c_str());
+  TEST_EQ(hashdb::bloom_filter_t::create(filename, 100, 0.01), "");
+  filter = hashdb::bloom_filter_t::open(filename, hashdb::RW_MODIFY);
+  size_t num_past_capacity = 0;
+  for (size_t i = 0; i < 300; ++i) {
+    if (filter->add(bloom_hash(i))) {
+      ++num_past_capacity;
+    }
+    filter->add(bloom_hash(i));
+  }
+  TEST_EQ(num_past_capacity, 1);
+  bool is_past_capacity = (filter->size_hashes() > filter->size_capacity());
+  TEST_EQ(is_past_capacity, true);
+  delete filter;
+
+  // no filter file
+  std::remove(filename.c_str());
+  bool is_open = (hashdb::bloom_filter_t::open(filename, hashdb::READ_ONLY)
+                                                                   != NULL);
+  TEST_EQ(is_open, false);
+}
+
+void lmdb_bloom_filter() {
+  hashdb::settings_t settings;
+  settings.bloom_false_positive_rate = 0.01;
+  settings.bloom_capacity = 200;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  bool has_filter = (access((hashdb_dir + "/bloom_filter").c_str(), F_OK) == 0);
+  TEST_EQ(has_filter, true);
+  hashdb::settings_t read_back;
+  TEST_EQ(hashdb::read_settings(hashdb_dir, read_back), "");
+  TEST_EQ(read_back.settings_string(), settings.settings_string());
+
+  // the filter is sized for the capacity in the settings
+  hashdb::bloom_filter_t* filter = hashdb::bloom_filter_t::open(
+                         hashdb_dir + "/bloom_filter", hashdb::READ_ONLY);
+  TEST_EQ(filter->size_capacity(), 200);
+  delete filter;
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+
+  // imported hashes are found
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    size_t hash_count = 0;
+    for (std::string block_hash = manager.first_hash(); block_hash != "";
+         block_hash = manager.next_hash(block_hash)) {
+      bool is_found = (manager.find_hash_count(block_hash) > 0);
+      TEST_EQ(is_found, true);
+      ++hash_count;
+    }
+    TEST_EQ(hash_count, 150);
+
+    // absent hashes sharing the hash store prefix of an imported hash are
+    // screened out by the Bloom filter
+    size_t positives = 0;
+    for (size_t i = 0; i < 150; ++i) {
+      std::string block_hash = bulk_hash(i);
+      block_hash[15] = 1;
+      if (manager.find_approximate_hash_count(block_hash) > 0) {
+        ++positives;
+      }
+    }
+    bool is_rare = (positives < 10);
+    TEST_EQ(is_rare, true);
+    TEST_EQ(manager.find_hash_count(binary_26), 0);
+  }
+
+  // rebuild
+  TEST_EQ(hashdb::rebuild_bloom(hashdb_dir, 0.001, "test"), "");
+  TEST_EQ(hashdb::read_settings(hashdb_dir, read_back), "");
+  settings.bloom_false_positive_rate = 0.001;
+  settings.bloom_capacity = read_back.bloom_capacity;
+  TEST_EQ(read_back.settings_string(), settings.settings_string());
+
+  // the rebuilt filter is sized for the hashes present with room to grow
+  bool has_room = (read_back.bloom_capacity >= 225);
+  TEST_EQ(has_room, true);
+  filter = hashdb::bloom_filter_t::open(hashdb_dir + "/bloom_filter",
+                                        hashdb::READ_ONLY);
+  TEST_EQ(filter->size_capacity(), read_back.bloom_capacity);
+  delete filter;
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    for (std::string block_hash = manager.first_hash(); block_hash != "";
+         block_hash = manager.next_hash(block_hash)) {
+      bool is_found = (manager.find_approximate_hash_count(block_hash) > 0);
+      TEST_EQ(is_found, true);
+    }
+  }
+
+  // remove
+  TEST_EQ(hashdb::rebuild_bloom(hashdb_dir, 0, "test"), "");
+  has_filter = (access((hashdb_dir + "/bloom_filter").c_str(), F_OK) == 0);
+  TEST_EQ(has_filter, false);
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    bool is_found = (manager.find_hash_count(manager.first_hash()) > 0);
+    TEST_EQ(is_found, true);
+  }
+  rm_hashdb_dir(hashdb_dir);
+}
+
+// ************************************************************
+// rebuild hash store
+// ************************************************************
+void lmdb_rebuild_hash_store() {
+  hashdb::settings_t settings;
+  uint64_t hash_count;
+  uint64_t prefix_count;
+  rm_hashdb_dir(hashdb_dir);
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+
+  // one prefix per distinct first byte
+  TEST_EQ(hashdb::rebuild_hash_store(hashdb_dir, 1, 1, "test",
+                                     hash_count, prefix_count), "");
+  TEST_EQ(hash_count, 150);
+  std::set<char> first_bytes;
+  for (size_t i = 0; i < 150; ++i) {
+    first_bytes.insert(bulk_hash(i)[0]);
+  }
+  TEST_EQ(prefix_count, first_bytes.size());
+
+  // no collisions with full width prefixes, and exact counts
+  TEST_EQ(hashdb::rebuild_hash_store(hashdb_dir, 16, 4, "test",
+                                     hash_count, prefix_count), "");
+  TEST_EQ(hash_count, 150);
+  TEST_EQ(prefix_count, 150);
+  hashdb::settings_t read_back;
+  TEST_EQ(hashdb::read_settings(hashdb_dir, read_back), "");
+  TEST_EQ(read_back.hash_prefix_bytes, 16);
+  TEST_EQ(read_back.hash_count_bytes, 4);
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    for (std::string block_hash = manager.first_hash(); block_hash != "";
+         block_hash = manager.next_hash(block_hash)) {
+      TEST_EQ(manager.find_approximate_hash_count(block_hash),
+              manager.find_hash_count(block_hash));
+    }
+    std::string absent = bulk_hash(0);
+    absent[15] = 1;
+    TEST_EQ(manager.find_approximate_hash_count(absent), 0);
+  }
+
+  // imports use the new widths
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    manager.insert_hash(binary_26, 0, "", binary_10);
+  }
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.find_approximate_hash_count(binary_26), 1);
+  }
+
+  // the rebuild leaves no scratch store or settings behind
+  TEST_EQ(access((hashdb_dir + "/lmdb_hash_store.new").c_str(), F_OK), -1);
+  TEST_EQ(access((hashdb_dir + "/_new_settings.json").c_str(), F_OK), -1);
+
+  // invalid widths
+  bool is_rebuilt = (hashdb::rebuild_hash_store(hashdb_dir, 0, 1, "test",
+                                     hash_count, prefix_count) == "");
+  TEST_EQ(is_rebuilt, false);
+  is_rebuilt = (hashdb::rebuild_hash_store(hashdb_dir, 7, 3, "test",
+                                     hash_count, prefix_count) == "");
+  TEST_EQ(is_rebuilt, false);
+
+  // hash stores with their own environment
+  rm_hashdb_dir(hashdb_dir);
+  settings.layout_version = hashdb::settings_t::SEPARATE_ENV_LAYOUT;
+  TEST_EQ(hashdb::create_hashdb(hashdb_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(hashdb_dir, "test");
+    bulk_import(manager);
+  }
+  TEST_EQ(hashdb::rebuild_hash_store(hashdb_dir, 16, 4, "test",
+                                     hash_count, prefix_count), "");
+  TEST_EQ(prefix_count, 150);
+  {
+    hashdb::scan_manager_t manager(hashdb_dir);
+    TEST_EQ(manager.find_approximate_hash_count(bulk_hash(0)),
+            manager.find_hash_count(bulk_hash(0)));
+  }
+  rm_hashdb_dir(hashdb_dir);
+}
+
 // ************************************************************
 // lmdb_source_data_manager
 // ************************************************************
@@ -360,6 +2194,66 @@ void lmdb_source_name_manager() {
   TEST_EQ(manager.size(), 4);
 }
 
+// ************************************************************
+// multi-buffer MD5
+// ************************************************************
+void md5_multi() {
+  // data that ends part way into the last blocks
+  const size_t buffer_size = 100000;
+  uint8_t* const buffer = new uint8_t[buffer_size];
+  for (size_t i = 0; i < buffer_size; ++i) {
+    buffer[i] = static_cast<uint8_t>((i * 2654435761u) >> 13);
+  }
+
+  // block sizes around the MD5 chunk and padding boundaries
+  const size_t block_sizes[] = {0, 1, 55, 56, 63, 64, 65, 512, 4096};
+  std::vector<size_t> offsets;
+  for (size_t i = 0; i < buffer_size; i += 777) {
+    offsets.push_back(i);
+  }
+  offsets.push_back(buffer_size - 1);
+  offsets.push_back(buffer_size);
+
+  // every kernel this CPU runs agrees with OpenSSL, including partly
+  // filled groups of lanes
+  hasher::hash_calculator_t hash_calculator;
+  const hasher::md5_kernel_t kernels[] = {hasher::MD5_SCALAR,
+           hasher::MD5_SSE2, hasher::MD5_AVX2, hasher::MD5_AVX512};
+  for (size_t k = 0; k < 4; ++k) {
+    if (!hasher::md5_kernel_supported(kernels[k])) {
+      continue;
+    }
+    for (size_t b = 0; b < 9; ++b) {
+      for (size_t count = offsets.size() - 17; count <= offsets.size();
+           ++count) {
+        std::vector<hasher::md5_digest_t> digests(count);
+        hasher::md5_blocks(buffer, buffer_size, &offsets[0], count,
+                           block_sizes[b], &digests[0], kernels[k]);
+        for (size_t j = 0; j < count; ++j) {
+          TEST_EQ(hashdb::bin_to_hex(digests[j].str()),
+                  hashdb::bin_to_hex(hash_calculator.calculate(buffer,
+                               buffer_size, offsets[j], block_sizes[b])));
+        }
+      }
+    }
+  }
+
+  // the scalar kernel is always there and the best kernel runs
+  TEST_EQ(hasher::md5_kernel_supported(hasher::MD5_SCALAR), true);
+  TEST_EQ(hasher::md5_kernel_supported(hasher::md5_best_kernel()), true);
+
+  // known digest
+  const std::string abc("abc");
+  const size_t zero_offset = 0;
+  hasher::md5_digest_t digest;
+  hasher::md5_blocks(reinterpret_cast<const uint8_t*>(abc.c_str()),
+                     abc.size(), &zero_offset, 1, abc.size(), &digest);
+  TEST_EQ(hashdb::bin_to_hex(digest.str()),
+          "900150983cd24fb0d6963f7d28e17f72");
+
+  delete[] buffer;
+}
+
 // ************************************************************
 // main
 // ************************************************************
@@ -370,6 +2264,7 @@ int main(int argc, char* argv[]) {
   lmdb_hash_manager_write();
   lmdb_hash_manager_read();
   lmdb_hash_manager_count();
+  lmdb_hash_manager_widths();
 
   // source ID manager
   lmdb_source_id_manager();
@@ -380,6 +2275,61 @@ int main(int argc, char* argv[]) {
   // source name manager
   lmdb_source_name_manager();
 
+  // batched writes
+  lmdb_batch();
+
+  // store layouts
+  lmdb_layout();
+
+  // per-thread readers
+  lmdb_reader();
+
+  // iterators
+  lmdb_iterators();
+
+  // binary dump and load
+  lmdb_dump_load();
+
+  // JSON import
+  lmdb_import_json();
+
+  // batch lookup
+  lmdb_find_hashes();
+  lmdb_find_hash_record();
+
+  // hex conversion
+  hex_conversion();
+
+  // scan stream
+  lmdb_scan_stream();
+  lmdb_scan_stream_binary();
+
+  // source cache
+  source_cache();
+
+  // reported hashes and sources
+  locked_member();
+  lmdb_reset_reported();
+
+  // source index
+  lmdb_source_index();
+
+  // map size and flusher
+  lmdb_map();
+
+  // bulk load
+  lmdb_bulk_load();
+
+  // rebuild hash store
+  lmdb_rebuild_hash_store();
+
+  // Bloom filter
+  bloom_filter();
+  lmdb_bloom_filter();
+
+  // multi-buffer MD5
+  md5_multi();
+
   // done
   std::cout << "lmdb_other_managers_test Done.\n";
   return 0;
@@ -91,9 +91,9 @@ def test_add_multiple():
     json_in3 = H.read_file("temp_3.json")
     H.lines_equals(json_in3, json3_db3)
 
-def test_add_repository():
+def test_add_repository(create_options=[]):
     # create new hashdb
-    H.make_hashdb("temp_1.hdb", json_out1)
+    H.make_hashdb("temp_1.hdb", json_out1, create_options)
     H.rm_tempdir("temp_2.hdb")
 
     # add to new temp_2.hdb
@@ -301,9 +301,9 @@ def test_subtract_hash():
 '{"file_hash":"33","filesize":3,"file_type":"C","zero_count":13,"nonprobative_count":3,"name_pairs":["r2","f2"]}'
 ])
 
-def test_subtract_repository():
+def test_subtract_repository(create_options=[]):
     # create new hashdb
-    H.make_hashdb("temp_1.hdb", json_out1)
+    H.make_hashdb("temp_1.hdb", json_out1, create_options)
     H.rm_tempdir("temp_2.hdb")
 
     # add to new temp_2.hdb
@@ -341,11 +341,13 @@ if __name__=="__main__":
     test_add()
     test_add_multiple()
     test_add_repository()
+    test_add_repository(["-i"])
     test_add_range()
     test_intersect()
     test_intersect_hash()
     test_subtract()
     test_subtract_hash()
     test_subtract_repository()
+    test_subtract_repository(["-i"])
     print("Test Done.")
 
@@ -112,10 +112,10 @@ def make_tempfile(filename, lines):
         f.write("%s\n" % line)
 
 # create new tempdir containing json_data
-def make_hashdb(tempdir, json_data):
+def make_hashdb(tempdir, json_data, create_options=[]):
     rm_tempdir(tempdir)
     rm_tempfile("temp_0.json")
-    hashdb(["create", tempdir])
+    hashdb(["create"] + create_options + [tempdir])
     make_tempfile("temp_0.json", json_data)
     hashdb(["import", tempdir, "temp_0.json"])
 
@@ -19,11 +19,27 @@ def test_basic_settings():
     # validate settings parameters
     lines = h.read_file(settings1)
     h.lines_equals(lines, [
-'{"settings_version":4, "block_size":4}'
+'{"settings_version":5, "block_size":4, "layout_version":3, "hash_prefix_bytes":7, "hash_count_bytes":1, "bloom_false_positive_rate":0, "bloom_capacity":100000000, "source_index":false}'
+
+])
+
+# check the source index setting
+def test_source_index_settings():
+    # remove existing DB
+    h.rm_tempdir("temp_1.hdb")
+
+    # create new DB with a source index
+    h.hashdb(["create", "-i", "temp_1.hdb"])
+
+    # validate settings parameters
+    lines = h.read_file(settings1)
+    h.lines_equals(lines, [
+'{"settings_version":5, "block_size":512, "layout_version":3, "hash_prefix_bytes":7, "hash_count_bytes":1, "bloom_false_positive_rate":0, "bloom_capacity":100000000, "source_index":true}'
 
 ])
 
 if __name__=="__main__":
     test_basic_settings()
+    test_source_index_settings()
     print("Test Done.")
 
@@ -2,6 +2,8 @@
 #
 # Test the Scan command group
 
+import json
+import struct
 import helpers as H
 
 json_data = ["# command: ","# hashdb-Version: ", \
@@ -54,6 +56,65 @@ def test_scan_list():
 
     H.lines_equals(returned_answer, expected_answer)
 
+# the output of a serial EXPANDED_OPTIMIZED scan, made from EXPANDED output
+# by suppressing hashes and sources after they are first reported
+def optimized_lines(expanded_lines):
+    hashes = set()
+    sources = set()
+    lines = []
+    for line in expanded_lines:
+        if line == "" or line[0] == "#":
+            lines.append(line)
+            continue
+        label, block_hash, text = line.split("\t", 2)
+        if block_hash in hashes:
+            text = '{"block_hash":"%s"}' % block_hash
+        else:
+            hashes.add(block_hash)
+            record = json.loads(text)
+            record["sources"] = [source for source in record["sources"]
+                                 if source["file_hash"] not in sources]
+            for source in record["sources"]:
+                sources.add(source["file_hash"])
+            text = json.dumps(record, separators=(",", ":"))
+        lines.append("%s\t%s\t%s" % (label, block_hash, text))
+    return lines
+
+def test_scan_list_order():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.make_tempfile("temp_1.json", json_data)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+
+    # a list of many chunks, mostly of hashes that are not present, with
+    # present hashes repeated throughout
+    present = ["2222222222222222", "8899aabbccddeeff", "ffffffffffffffff"]
+    hash_file = []
+    binary_records = []
+    for i in range(200000):
+        if i % 997 == 0:
+            block_hash = present[(i // 997) % 3]
+        else:
+            block_hash = "%016x" % (i * 7919 + 1)
+        hash_file.append("%d\t%s" % (i, block_hash))
+        binary_records.append(struct.pack(">Q", i) +
+                              bytes.fromhex(block_hash))
+    H.make_tempfile("temp_1.txt", hash_file)
+    with open("temp_1.bin", "wb") as f:
+        f.write(b"".join(binary_records))
+
+    # parallel EXPANDED_OPTIMIZED output matches the serial scan, for hex
+    # and for binary input
+    expanded = H.hashdb(["scan_list", "-j", "e", "temp_1.hdb", "temp_1.txt"])
+    expected_answer = optimized_lines(expanded)
+    returned_answer = H.hashdb(["scan_list", "-j", "o", "temp_1.hdb",
+                                "temp_1.txt"])
+    H.lines_equals(returned_answer, expected_answer)
+    returned_answer = H.hashdb(["scan_list", "-j", "o", "-l", "8",
+                                "temp_1.hdb", "temp_1.bin"])
+    H.lines_equals(returned_answer, expected_answer)
+
 def test_scan_hash():
     H.rm_tempdir("temp_1.hdb")
     H.rm_tempfile("temp_1.json")
@@ -74,6 +135,7 @@ def test_scan_hash():
 
 if __name__=="__main__":
     test_scan_list()
+    test_scan_list_order()
     test_scan_hash()
     print("Test Done.")
 
@@ -127,14 +127,24 @@ def test_hash_table():
 'There is no source with this file hash',
 ''])
 
-    # two matches
-    returned_answer = H.hashdb(["hash_table", "temp_1.hdb", "0000000000000000"])
-    H.lines_equals(returned_answer, [
+    # two matches, with and without the source index
+    two_matches = [
 '# command: ',
 '# hashdb-Version: ',
 '1111111111111111	{"block_hash":"1111111111111111","k_entropy":0,"block_label":"","count":1,"source_list_id":1696784233,"sources":[{"file_hash":"0000000000000000","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":[]}],"source_sub_counts":["0000000000000000",1]}',
 '2222222222222222	{"block_hash":"2222222222222222","k_entropy":0,"block_label":"","count":2,"source_list_id":1696784233,"sources":[],"source_sub_counts":["0000000000000000",2]}',
 '# Processing 2 of 2 completed.',
+'']
+    returned_answer = H.hashdb(["hash_table", "temp_1.hdb", "0000000000000000"])
+    H.lines_equals(returned_answer, two_matches)
+    H.hashdb(["rebuild_source_index", "temp_1.hdb"])
+    returned_answer = H.hashdb(["hash_table", "temp_1.hdb", "0000000000000000"])
+    H.lines_equals(returned_answer, two_matches)
+
+    # no match with the source index
+    returned_answer = H.hashdb(["hash_table", "temp_1.hdb", "0011223344556677"])
+    H.lines_equals(returned_answer, [
+'There is no source with this file hash',
 ''])
 
 def test_media():